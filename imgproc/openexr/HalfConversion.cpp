@@ -0,0 +1,176 @@
+/*============================================================================
+
+ OpenEXR for Matlab
+
+ Distributed under the MIT License (the "License");
+ see accompanying file LICENSE for details
+ or copy at http://opensource.org/licenses/MIT
+
+ Originated from HDRITools - High Dynamic Range Image Tools
+ Copyright 2011 Program of Computer Graphics, Cornell University
+
+ This software is distributed WITHOUT ANY WARRANTY; without even the
+ implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ See the License for more information.
+ -----------------------------------------------------------------------------
+ Authors:
+ Jinwei Gu <jwgu AT cs DOT cornell DOT edu>
+ Edgar Velazquez-Armendariz <eva5 AT cs DOT cornell DOT edu>
+ Manuel Leonhardt <leom AT hs-furtwangen DOT de>
+
+ ============================================================================*/
+
+
+#include "HalfConversion.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+  #define EXR_X86 1
+  #include <immintrin.h>
+  #if defined(_MSC_VER)
+    #include <intrin.h>
+  #else
+    #include <cpuid.h>
+  #endif
+#endif
+
+// GCC and Clang compile the F16C kernels for that target only, so that the
+// MEX files still load on CPUs without it
+#if defined(EXR_X86) && (defined(__GNUC__) || defined(__clang__))
+  #define F16C_TARGET __attribute__((target("avx,f16c")))
+#else
+  #define F16C_TARGET
+#endif
+
+
+namespace
+{
+
+// Number of elements converted at a time by the vector kernels
+const size_t VECTOR_SIZE = 8;
+
+
+template <typename T>
+inline void convertScalar(half * dest, const T * src, size_t len)
+{
+    for (size_t i = 0; i != len; ++i) {
+        dest[i] = half(static_cast<float>(src[i]));
+    }
+}
+
+
+#if defined(EXR_X86)
+
+bool detectF16C()
+{
+    unsigned int regs[4] = {0, 0, 0, 0};
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    for (int i = 0; i != 4; ++i) {
+        regs[i] = static_cast<unsigned int>(info[i]);
+    }
+#else
+    if (__get_cpuid(1, &regs[0], &regs[1], &regs[2], &regs[3]) == 0) {
+        return false;
+    }
+#endif
+    const unsigned int ecx = regs[2];
+    const bool osxsave = (ecx & (1u << 27)) != 0;
+    const bool avx     = (ecx & (1u << 28)) != 0;
+    const bool f16c    = (ecx & (1u << 29)) != 0;
+    if (!(osxsave && avx && f16c)) {
+        return false;
+    }
+
+    // The OS also has to preserve the YMM registers
+#if defined(_MSC_VER)
+    const unsigned long long xcr0 = _xgetbv(0);
+#else
+    unsigned int eax = 0, edx = 0;
+    __asm__ volatile ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+    const unsigned long long xcr0 =
+        (static_cast<unsigned long long>(edx) << 32) | eax;
+#endif
+    return (xcr0 & 0x6) == 0x6;
+}
+
+
+// NaNs take the scalar path so that their payload matches the scalar
+// conversion exactly; every other value is rounded to nearest even by both
+F16C_TARGET inline void storeHalf(half * dest, __m256 v)
+{
+    if (_mm256_movemask_ps(_mm256_cmp_ps(v, v, _CMP_UNORD_Q)) != 0) {
+        float tmp[VECTOR_SIZE];
+        _mm256_storeu_ps(tmp, v);
+        convertScalar(dest, tmp, VECTOR_SIZE);
+    } else {
+        const __m128i h = _mm256_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dest), h);
+    }
+}
+
+
+F16C_TARGET void convertF16C(half * dest, const float * src, size_t len)
+{
+    size_t i = 0;
+    for (; i + VECTOR_SIZE <= len; i += VECTOR_SIZE) {
+        storeHalf(dest + i, _mm256_loadu_ps(src + i));
+    }
+    convertScalar(dest + i, src + i, len - i);
+}
+
+
+// The doubles are first rounded to single precision, exactly like the
+// static_cast in the scalar path
+F16C_TARGET void convertF16C(half * dest, const double * src, size_t len)
+{
+    size_t i = 0;
+    for (; i + VECTOR_SIZE <= len; i += VECTOR_SIZE) {
+        const __m128 lo = _mm256_cvtpd_ps(_mm256_loadu_pd(src + i));
+        const __m128 hi = _mm256_cvtpd_ps(_mm256_loadu_pd(src + i + 4));
+        storeHalf(dest + i,
+            _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1));
+    }
+    convertScalar(dest + i, src + i, len - i);
+}
+
+#endif // EXR_X86
+
+
+template <typename T>
+inline void convertToHalfImp(half * dest, const T * src, size_t len)
+{
+#if defined(EXR_X86)
+    if (OpenEXRforMatlab::hasF16C()) {
+        convertF16C(dest, src, len);
+        return;
+    }
+#endif
+    convertScalar(dest, src, len);
+}
+
+} // namespace
+
+
+
+bool OpenEXRforMatlab::hasF16C()
+{
+#if defined(EXR_X86)
+    static const bool supported = detectF16C();
+    return supported;
+#else
+    return false;
+#endif
+}
+
+
+void OpenEXRforMatlab::convertToHalf(half * dest, const float * src, size_t len)
+{
+    convertToHalfImp(dest, src, len);
+}
+
+
+void OpenEXRforMatlab::convertToHalf(half * dest, const double * src, size_t len)
+{
+    convertToHalfImp(dest, src, len);
+}
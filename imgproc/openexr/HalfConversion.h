@@ -0,0 +1,44 @@
+/*============================================================================
+
+ OpenEXR for Matlab
+
+ Distributed under the MIT License (the "License");
+ see accompanying file LICENSE for details
+ or copy at http://opensource.org/licenses/MIT
+
+ Originated from HDRITools - High Dynamic Range Image Tools
+ Copyright 2011 Program of Computer Graphics, Cornell University
+
+ This software is distributed WITHOUT ANY WARRANTY; without even the
+ implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ See the License for more information.
+ -----------------------------------------------------------------------------
+ Authors:
+ Jinwei Gu <jwgu AT cs DOT cornell DOT edu>
+ Edgar Velazquez-Armendariz <eva5 AT cs DOT cornell DOT edu>
+ Manuel Leonhardt <leom AT hs-furtwangen DOT de>
+
+ ============================================================================*/
+
+
+#pragma once
+
+#include <half.h>
+
+#include <cstddef>
+
+// Vectorized conversion of floating point arrays into half
+
+namespace OpenEXRforMatlab
+{
+
+// Convert an array into half. The result is bit-identical to converting
+// each element with half(static_cast<float>(x)): the hardware instructions
+// are used when the CPU supports F16C, otherwise the conversion is scalar.
+void convertToHalf(half * dest, const float * src, size_t len);
+void convertToHalf(half * dest, const double * src, size_t len);
+
+// Whether the CPU running Matlab supports the F16C instructions
+bool hasF16C();
+
+} // namespace OpenEXRforMatlab
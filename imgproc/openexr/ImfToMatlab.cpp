@@ -109,6 +109,10 @@ inline const char* getCompressionName(Compression c)
 		return "b44";
 	case B44A_COMPRESSION:
 		return "b44a";
+	case DWAA_COMPRESSION:
+		return "dwaa";
+	case DWAB_COMPRESSION:
+		return "dwab";
 	default:
 		return "unknown";
 	}
@@ -130,6 +134,34 @@ inline const char * getLineOrderName(LineOrder ord)
 }
 
 
+inline const char * getLevelModeName(LevelMode mode)
+{
+	switch(mode) {
+	case ONE_LEVEL:
+		return "one";
+	case MIPMAP_LEVELS:
+		return "mipmap";
+	case RIPMAP_LEVELS:
+		return "ripmap";
+	default:
+		return "unknown";
+	}
+}
+
+
+inline const char * getLevelRoundingModeName(LevelRoundingMode mode)
+{
+	switch(mode) {
+	case ROUND_DOWN:
+		return "down";
+	case ROUND_UP:
+		return "up";
+	default:
+		return "unknown";
+	}
+}
+
+
 inline const char * getPixelTypeName(PixelType p)
 {
 	switch(p) {
@@ -218,6 +250,24 @@ inline mxArray * fromStringVector(const StringVector & vec)
 }
 
 
+// Represent tile descriptions with the same names as the exrwritechannels options
+inline mxArray * fromTileDescription(const TileDescription & tiles)
+{
+	const char* fields[] = {"tilesize", "levels", "rounding"};
+	const size_t nFields = sizeof(fields)/sizeof(const char *);
+	mxArray *tStruct = mxCreateStructMatrix(1, 1, nFields, &fields[0]);
+
+	const double size[] = {static_cast<double>(tiles.xSize),
+	                       static_cast<double>(tiles.ySize)};
+	mxSetField(tStruct, 0, "tilesize", fromArray(size));
+	mxSetField(tStruct, 0, "levels",
+		mxCreateString(getLevelModeName(tiles.mode)));
+	mxSetField(tStruct, 0, "rounding",
+		mxCreateString(getLevelRoundingModeName(tiles.roundingMode)));
+	return tStruct;
+}
+
+
 // Represent channels as structs with each member
 inline mxArray * fromChannelList(const ChannelList & channelList)
 {
@@ -340,7 +390,7 @@ mxArray* OpenEXRforMatlab::toMatlab(const OPENEXR_IMF_INTERNAL_NAMESPACE::Attrib
 	}
 	// Tile description
 	else if (canCastTo<TileDescriptionAttribute>(attr)) {
-		// TODO Support TileDescriptionAttribute
+		return fromTileDescription(getValue<TileDescription>(attr));
 	}
 	// Time code
 	else if (canCastTo<TimeCodeAttribute>(attr)) {
@@ -22,6 +22,8 @@
 
 
 #include <string>
+#include <vector>
+#include <cassert>
 
 #include <mex.h>
 
@@ -39,6 +41,8 @@
 #include <ImfFloatAttribute.h>
 #include <ImfDoubleAttribute.h>
 #include <ImfStringVectorAttribute.h>
+#include <ImfVecAttribute.h>
+#include <IlmThreadPool.h>
 
 #ifdef __clang__
   #pragma clang diagnostic pop
@@ -116,6 +120,30 @@ DoubleAttribute* toAttributeImp(const mxArray * pa)
 }
 
 
+// Vectors of 2 or 3 elements, such as pixel sizes or offsets
+template <typename VecType>
+Attribute* toVecAttributeImp(const mxArray * pa)
+{
+    typedef typename VecType::BaseType BaseType;
+    BaseType values[3];
+    OpenEXRforMatlab::convertData(values, pa, mxGetClassID(pa),
+        VecType::dimensions());
+    VecType value;
+    for (unsigned int i = 0; i != VecType::dimensions(); ++i) {
+        value[i] = values[i];
+    }
+    return new TypedAttribute<VecType>(value);
+}
+
+
+template <typename Vec2Type, typename Vec3Type>
+Attribute* toVecAttribute(const mxArray * pa, size_t numel)
+{
+    return numel == 2 ? toVecAttributeImp<Vec2Type>(pa) :
+                        toVecAttributeImp<Vec3Type>(pa);
+}
+
+
 }
 
 
@@ -164,6 +192,152 @@ Attribute* OpenEXRforMatlab::toAttribute(const mxArray * pa)
                 return NULL;
             }
         }
+        else if ((M == 1 || N == 1) && (M * N == 2 || M * N == 3)) {
+            const size_t numel = M * N;
+            switch(mxGetClassID(pa)) {
+            case mxSINGLE_CLASS:
+                return toVecAttribute<Imath::V2f, Imath::V3f> (pa, numel);
+            case mxINT8_CLASS:
+            case mxUINT8_CLASS:
+            case mxINT16_CLASS:
+            case mxUINT16_CLASS:
+            case mxINT32_CLASS:
+                return toVecAttribute<Imath::V2i, Imath::V3i> (pa, numel);
+            default:
+                return toVecAttribute<Imath::V2d, Imath::V3d> (pa, numel);
+            }
+        }
     }
     return NULL;
 }
+
+
+
+template <>
+bool OpenEXRforMatlab::toNative(const mxArray * pa, AttributeVector &outAttributes)
+{
+    if (!mxIsClass(pa, "containers.Map")) {
+        mexErrMsgIdAndTxt("OpenEXR:argument", "Not a containers.Map object.");
+    }
+
+    // Extract the cell arrays with the names and values for the attributes
+    mxArray * map = const_cast<mxArray *>(pa);
+    mxArray * isempty    = NULL;
+    mxArray * namesCell  = NULL;
+    mxArray * valuesCell = NULL;
+    if (mexCallMATLAB(1, &isempty, 1, &map, "isempty") != 0) {
+        mexErrMsgIdAndTxt("OpenEXR:argument", "Could not query the map.");
+    }
+    else if (mxIsLogicalScalarTrue(isempty)) {
+        mxDestroyArray (isempty);
+        return true;
+    }
+
+    if (mexCallMATLAB(1, &namesCell, 1, &map, "keys") != 0) {
+        mexErrMsgIdAndTxt("OpenEXR:argument", "Could not get the map keys.");
+    }
+
+    std::vector<std::string> names;
+    if (!toNative(namesCell, names)) {
+        mexWarnMsgIdAndTxt("OpenEXR:unsupported",
+            "The attribute map contains non-string keys.");
+        mxDestroyArray(namesCell);
+        return false;
+    } else {
+        mxDestroyArray(namesCell);
+        namesCell = NULL;
+    }
+
+    if (mexCallMATLAB(1, &valuesCell, 1, &map, "values") != 0) {
+        mxDestroyArray(namesCell);
+        mexErrMsgIdAndTxt("OpenEXR:argument", "Could not get the map values.");
+    }
+
+    assert(names.size() == mxGetNumberOfElements(valuesCell));
+    for (size_t i = 0; i != names.size(); ++i) {
+        OPENEXR_IMF_INTERNAL_NAMESPACE::Attribute* attr = OpenEXRforMatlab::toAttribute(mxGetCell(valuesCell, i));
+        if (attr != NULL) {
+            AttributePair pair(names[i], attr);
+            outAttributes.push_back(pair);
+        }
+    }
+
+    mxDestroyArray(valuesCell);
+    return true;
+}
+
+
+
+namespace
+{
+
+// Task to convert a block of rows of a single source
+template <typename TargetType>
+class ConvertRowsTask : public IlmThread::Task
+{
+public:
+    ConvertRowsTask(IlmThread::TaskGroup * group, TargetType * dest,
+        const OpenEXRforMatlab::RowSource & source,
+        size_t firstRow, size_t numRows) :
+    IlmThread::Task(group), m_dest(dest), m_source(source),
+    m_firstRow(firstRow), m_numRows(numRows)
+    {}
+
+    void execute() {
+        OpenEXRforMatlab::convertRows(m_dest, m_source, m_firstRow, m_numRows);
+    }
+
+private:
+    TargetType * m_dest;
+    const OpenEXRforMatlab::RowSource m_source;
+    const size_t m_firstRow;
+    const size_t m_numRows;
+};
+
+} // namespace
+
+
+template <typename TargetType>
+void OpenEXRforMatlab::convertRowsParallel(
+    const std::vector<TargetType *> & dests,
+    const std::vector<RowSource> & sources,
+    size_t firstRow, size_t numRows, int numThreads)
+{
+    assert(dests.size() == sources.size());
+    if (numThreads <= 0 || numRows == 0) {
+        for (size_t i = 0; i != sources.size(); ++i) {
+            convertRows(dests[i], sources[i], firstRow, numRows);
+        }
+        return;
+    }
+
+    // A few tasks per thread for load balancing, each one covering whole
+    // transpose tiles. With many channels each task is a whole channel.
+    const size_t numTasks = 4 * static_cast<size_t>(numThreads);
+    const size_t chunksPerSource = std::max(static_cast<size_t>(1),
+        (numTasks + sources.size() - 1) / sources.size());
+    size_t chunkRows = (numRows + chunksPerSource - 1) / chunksPerSource;
+    chunkRows = std::max(TRANSPOSE_TILE_SIZE,
+        (chunkRows + TRANSPOSE_TILE_SIZE - 1) / TRANSPOSE_TILE_SIZE *
+        TRANSPOSE_TILE_SIZE);
+
+    IlmThread::TaskGroup taskGroup;
+    IlmThread::ThreadPool & pool = IlmThread::ThreadPool::globalThreadPool();
+    for (size_t i = 0; i != sources.size(); ++i) {
+        for (size_t y = 0; y < numRows; y += chunkRows) {
+            const size_t rows = std::min(chunkRows, numRows - y);
+            pool.addTask(new ConvertRowsTask<TargetType>(&taskGroup,
+                dests[i] + y * sources[i].width, sources[i],
+                firstRow + y, rows));
+        }
+    }
+}
+
+
+// The pixel types which may be written
+template void OpenEXRforMatlab::convertRowsParallel<float>(
+    const std::vector<float *> &, const std::vector<RowSource> &,
+    size_t, size_t, int);
+template void OpenEXRforMatlab::convertRowsParallel<half>(
+    const std::vector<half *> &, const std::vector<RowSource> &,
+    size_t, size_t, int);
@@ -24,16 +24,19 @@
 #pragma once
 
 #include "ImfToMatlab.h"
+#include "HalfConversion.h"
 
 #include <half.h>
 #include <ImfPixelType.h>
 #include <ImfCompression.h>
+#include <ImfTileDescription.h>
 
 #include <mex.h>
 
 #include <string>
 #include <vector>
 #include <utility>
+#include <algorithm>
 #include <cstring>
 #include <cassert>
 
@@ -168,6 +171,10 @@ inline bool toNative(const mxArray * pa,
             mexWarnMsgIdAndTxt("OpenEXR:IllegalConversion",
                 "Complex data is not supported.");
             return false;
+        } else if (mxIsSparse(pa)) {
+            mexWarnMsgIdAndTxt("OpenEXR:IllegalConversion",
+                "Sparse data is not supported.");
+            return false;
         }
         pair.first  = pa;
         pair.second = mxGetClassID(pa);
@@ -241,6 +248,12 @@ inline bool toNative(const mxArray * pa, OPENEXR_IMF_INTERNAL_NAMESPACE::Compres
     else if (strcmp(data, "b44a") == 0) {
         outCompression = OPENEXR_IMF_INTERNAL_NAMESPACE::B44A_COMPRESSION;
     }
+    else if (strcmp(data, "dwaa") == 0) {
+        outCompression = OPENEXR_IMF_INTERNAL_NAMESPACE::DWAA_COMPRESSION;
+    }
+    else if (strcmp(data, "dwab") == 0) {
+        outCompression = OPENEXR_IMF_INTERNAL_NAMESPACE::DWAB_COMPRESSION;
+    }
     else {
         mexWarnMsgIdAndTxt("OpenEXR:argument",
             "Unrecognized compression: %s", data);
@@ -252,6 +265,61 @@ inline bool toNative(const mxArray * pa, OPENEXR_IMF_INTERNAL_NAMESPACE::Compres
 }
 
 
+template <>
+inline bool toNative(const mxArray * pa, OPENEXR_IMF_INTERNAL_NAMESPACE::LevelMode & outMode)
+{
+    char * data = mxArrayToString(pa);
+    if (data == NULL) {
+        return false;
+    }
+
+    bool result = true;
+    if (strcmp(data, "one") == 0) {
+        outMode = OPENEXR_IMF_INTERNAL_NAMESPACE::ONE_LEVEL;
+    }
+    else if (strcmp(data, "mipmap") == 0) {
+        outMode = OPENEXR_IMF_INTERNAL_NAMESPACE::MIPMAP_LEVELS;
+    }
+    else if (strcmp(data, "ripmap") == 0) {
+        outMode = OPENEXR_IMF_INTERNAL_NAMESPACE::RIPMAP_LEVELS;
+    }
+    else {
+        mexWarnMsgIdAndTxt("OpenEXR:argument",
+            "Unrecognized level mode: %s", data);
+        result = false;
+    }
+
+    mxFree(data);
+    return result;
+}
+
+
+template <>
+inline bool toNative(const mxArray * pa, OPENEXR_IMF_INTERNAL_NAMESPACE::LevelRoundingMode & outMode)
+{
+    char * data = mxArrayToString(pa);
+    if (data == NULL) {
+        return false;
+    }
+
+    bool result = true;
+    if (strcmp(data, "down") == 0) {
+        outMode = OPENEXR_IMF_INTERNAL_NAMESPACE::ROUND_DOWN;
+    }
+    else if (strcmp(data, "up") == 0) {
+        outMode = OPENEXR_IMF_INTERNAL_NAMESPACE::ROUND_UP;
+    }
+    else {
+        mexWarnMsgIdAndTxt("OpenEXR:argument",
+            "Unrecognized level rounding mode: %s", data);
+        result = false;
+    }
+
+    mxFree(data);
+    return result;
+}
+
+
 
 ///////////////////////////////////////////////////////////////////////////////
 // Bulk array conversion
@@ -282,6 +350,27 @@ struct type_traits<half>
     }
 };
 
+
+// Convert a contiguous span of elements
+template <typename SourceType, typename TargetType>
+inline void convertSpan(TargetType * dest, const SourceType * src, size_t len)
+{
+    for (size_t i = 0; i != len; ++i) {
+        dest[i] = type_traits<TargetType>::cast (src[i]);
+    }
+}
+
+// Floating point to half uses the vectorized kernels
+inline void convertSpan(half * dest, const real32_T * src, size_t len)
+{
+    convertToHalf(dest, src, len);
+}
+
+inline void convertSpan(half * dest, const real64_T * src, size_t len)
+{
+    convertToHalf(dest, src, len);
+}
+
 } // namespace convert_detail
 
 
@@ -291,9 +380,7 @@ inline void convertData(TargetType * dest, const mxArray * pa, const size_t len)
 {
     assert(mxGetClassID(pa) == mex_traits<SourceType>::classID);
     const SourceType * src = static_cast<const SourceType *>(mxGetData(pa));
-    for (size_t i = 0; i != len; ++i) {
-        dest[i] = convert_detail::type_traits<TargetType>::cast (src[i]);
-    }
+    convert_detail::convertSpan(dest, src, len);
 }
 
 
@@ -345,9 +432,265 @@ inline void convertData(TargetType * dest,
 
 
 
+// Size of the square tiles used when transposing matrices
+const size_t TRANSPOSE_TILE_SIZE = 32;
+
+
+// Rows of a plane of a Matlab numeric array. The Matlab API may only be used
+// from the main thread, so the conversions running in other threads take
+// these instead of the mxArray. A source may also be a subsampled view of
+// the plane, such as the pixels of one site of a color filter array.
+struct RowSource
+{
+    const void * data;
+    mxClassID classID;
+    size_t elementSize;
+    size_t height;       // rows in the view
+    size_t width;        // columns in the view
+    size_t columnStride; // elements between consecutive columns of the view
+    size_t rowStride;    // elements between consecutive rows of the view
+
+    explicit RowSource(const mxArray * pa, const size_t plane = 0) :
+    classID(mxGetClassID(pa)), elementSize(mxGetElementSize(pa)),
+    height(mxGetM(pa)), width(mxGetDimensions(pa)[1]),
+    columnStride(height), rowStride(1)
+    {
+        assert((plane + 1) * height * width <= mxGetNumberOfElements(pa));
+        data = static_cast<const char *>(mxGetData(pa)) +
+            plane * height * width * elementSize;
+    }
+
+    // Restrict the view to every ySampling-th row and xSampling-th column,
+    // starting at the given offsets
+    RowSource sample(size_t xOffset, size_t yOffset,
+                     size_t xSampling, size_t ySampling) const
+    {
+        assert(xOffset < width && yOffset < height);
+        RowSource view(*this);
+        view.data = static_cast<const char *>(data) +
+            (xOffset * columnStride + yOffset * rowStride) * elementSize;
+        view.width  = (width  - xOffset + xSampling - 1) / xSampling;
+        view.height = (height - yOffset + ySampling - 1) / ySampling;
+        view.columnStride = columnStride * xSampling;
+        view.rowStride = rowStride * ySampling;
+        return view;
+    }
+};
+
+
+// Convert a block of rows of a column-major Matlab matrix into a row-major
+// array, as the OpenEXR scanlines expect. The matrix is traversed in small
+// square tiles so that both the reads and the strided writes stay in cache;
+// each column of a tile is converted at once into a scratch tile which is
+// then transposed.
+template <typename SourceType, typename TargetType>
+inline void convertRowsFrom(TargetType * dest, const RowSource & source,
+                        const size_t firstRow, const size_t numRows)
+{
+    assert(source.classID == mex_traits<SourceType>::classID);
+    const size_t width = source.width;
+    const size_t rowStride = source.rowStride;
+    const SourceType * src = static_cast<const SourceType *>(source.data);
+    assert(firstRow + numRows <= source.height);
+
+    TargetType tile[TRANSPOSE_TILE_SIZE * TRANSPOSE_TILE_SIZE];
+    SourceType column[TRANSPOSE_TILE_SIZE];
+    for (size_t x0 = 0; x0 < width; x0 += TRANSPOSE_TILE_SIZE) {
+        const size_t x1 = std::min(x0 + TRANSPOSE_TILE_SIZE, width);
+        for (size_t y0 = 0; y0 < numRows; y0 += TRANSPOSE_TILE_SIZE) {
+            const size_t y1 = std::min(y0 + TRANSPOSE_TILE_SIZE, numRows);
+            for (size_t x = x0; x != x1; ++x) {
+                const SourceType * srcCol = src + x * source.columnStride +
+                    (firstRow + y0) * rowStride;
+                TargetType * tileCol = tile + (x - x0) * TRANSPOSE_TILE_SIZE;
+                if (rowStride == 1) {
+                    convert_detail::convertSpan(tileCol, srcCol, y1 - y0);
+                } else {
+                    // Gather the rows of a subsampled view first
+                    for (size_t y = 0; y != y1 - y0; ++y) {
+                        column[y] = srcCol[y * rowStride];
+                    }
+                    convert_detail::convertSpan(tileCol, column, y1 - y0);
+                }
+            }
+            for (size_t y = y0; y != y1; ++y) {
+                TargetType * destRow = dest + y * width;
+                for (size_t x = x0; x != x1; ++x) {
+                    destRow[x] = tile[(x - x0) * TRANSPOSE_TILE_SIZE + (y - y0)];
+                }
+            }
+        }
+    }
+}
+
+
+// Convert a block of rows from a Matlab numeric matrix into the given data
+// format, in row-major order. Safe to call from any thread.
+template <typename TargetType>
+inline void convertRows(TargetType * dest, const RowSource & source,
+                        const size_t firstRow, const size_t numRows)
+{
+    switch(source.classID) {
+    case mxDOUBLE_CLASS:
+        convertRowsFrom<real64_T>(dest, source, firstRow, numRows);
+        break;
+    case mxSINGLE_CLASS:
+        convertRowsFrom<real32_T>(dest, source, firstRow, numRows);
+        break;
+    case mxINT8_CLASS:
+        convertRowsFrom<int8_T>(dest, source, firstRow, numRows);
+        break;
+    case mxUINT8_CLASS:
+        convertRowsFrom<uint8_T>(dest, source, firstRow, numRows);
+        break;
+    case mxINT16_CLASS:
+        convertRowsFrom<int16_T>(dest, source, firstRow, numRows);
+        break;
+    case mxUINT16_CLASS:
+        convertRowsFrom<uint16_T>(dest, source, firstRow, numRows);
+        break;
+    case mxINT32_CLASS:
+        convertRowsFrom<int32_T>(dest, source, firstRow, numRows);
+        break;
+    case mxUINT32_CLASS:
+        convertRowsFrom<uint32_T>(dest, source, firstRow, numRows);
+        break;
+    case mxINT64_CLASS:
+        convertRowsFrom<int64_T>(dest, source, firstRow, numRows);
+        break;
+    case mxUINT64_CLASS:
+        convertRowsFrom<uint64_T>(dest, source, firstRow, numRows);
+        break;
+
+    default:
+        assert("Unsupported mxClassID" == 0);
+    }
+}
+
+
+// Convert a block of rows from a Matlab numeric matrix into the given data
+// format, in row-major order. For HxWxN arrays the rows are taken from the
+// given plane.
+template <typename TargetType>
+inline void convertRows(TargetType * dest, const mxArray * pa, mxClassID srcType,
+                        const size_t firstRow, const size_t numRows,
+                        const size_t plane = 0)
+{
+    assert(srcType == mxGetClassID(pa));
+    if (!mxIsNumeric(pa) || mxIsSparse(pa) || mxIsComplex(pa)) {
+        assert("Unsupported mxClassID" == 0);
+        mexErrMsgIdAndTxt("OpenEXR:unsupported",
+            "Unsupported mxClassID: %s", mxGetClassName(pa));
+    }
+    convertRows(dest, RowSource(pa, plane), firstRow, numRows);
+}
+
+
+// Convert the same block of rows of several sources at once, splitting the
+// work by source and by blocks of rows across the global OpenEXR thread
+// pool. With numThreads == 0 everything runs in the calling thread.
+template <typename TargetType>
+void convertRowsParallel(const std::vector<TargetType *> & dests,
+                         const std::vector<RowSource> & sources,
+                         size_t firstRow, size_t numRows, int numThreads);
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Options structs
+///////////////////////////////////////////////////////////////////////////////
+
+// Check that the options are a scalar struct, warning about unknown fields
+inline void checkOptionFields(const mxArray * opts,
+    const char * const * knownFields, int numKnown)
+{
+    if (!mxIsStruct(opts) || mxGetNumberOfElements(opts) != 1) {
+        mexErrMsgIdAndTxt("OpenEXR:argument",
+            "The options argument must be a scalar struct.");
+    }
+    for (int i = 0; i != mxGetNumberOfFields(opts); ++i) {
+        const char * name = mxGetFieldNameByNumber(opts, i);
+        bool known = false;
+        for (int j = 0; j != numKnown && !known; ++j) {
+            known = strcmp(name, knownFields[j]) == 0;
+        }
+        if (!known) {
+            mexWarnMsgIdAndTxt("OpenEXR:argument", "Unknown option: %s", name);
+        }
+    }
+}
+
+
+// Get the numeric value of an option as doubles. Returns false if the field
+// is not present or it is empty.
+inline bool getNumericOption(const mxArray * opts, const char * name,
+    size_t minCount, size_t maxCount, double * outValues, size_t & outCount)
+{
+    const mxArray * field = mxGetField(opts, 0, name);
+    if (field == NULL || mxIsEmpty(field)) {
+        return false;
+    }
+    const size_t numel = mxGetNumberOfElements(field);
+    if (!mxIsNumeric(field) || mxIsComplex(field) ||
+        numel < minCount || numel > maxCount)
+    {
+        mexErrMsgIdAndTxt("OpenEXR:argument",
+            "Invalid value for the '%s' option.", name);
+    }
+    convertData(outValues, field, mxGetClassID(field), numel);
+    outCount = numel;
+    return true;
+}
+
+
+// Get a logical scalar option. Returns false if the field is not present.
+inline bool getLogicalOption(const mxArray * opts, const char * name, bool & outValue)
+{
+    const mxArray * field = mxGetField(opts, 0, name);
+    if (field == NULL || mxIsEmpty(field)) {
+        return false;
+    }
+    if (!(mxIsLogical(field) || mxIsNumeric(field)) ||
+        mxGetNumberOfElements(field) != 1)
+    {
+        mexErrMsgIdAndTxt("OpenEXR:argument",
+            "The '%s' option must be a logical scalar.", name);
+    }
+    outValue = mxGetScalar(field) != 0.0;
+    return true;
+}
+
+
+// Get an option through toNative. Returns false if the field is not present.
+template <typename T>
+inline bool getOption(const mxArray * opts, const char * name, T & outValue)
+{
+    const mxArray * field = mxGetField(opts, 0, name);
+    if (field == NULL || mxIsEmpty(field)) {
+        return false;
+    }
+    if (!toNative(field, outValue)) {
+        mexErrMsgIdAndTxt("OpenEXR:argument",
+            "Invalid value for the '%s' option.", name);
+    }
+    return true;
+}
+
+
+
 // Convert the Matlab type to a known Imf::Attribute. Returns NULL if
 // the conversion fails, most likely because the conversion is not
 // implemented yet.
 Attribute* toAttribute(const mxArray* pa);
 
+
+// To hold a vector of attributes
+typedef std::pair<std::string, OPENEXR_IMF_INTERNAL_NAMESPACE::Attribute *> AttributePair;
+typedef std::vector<AttributePair> AttributeVector;
+
+// Convert from a containters.Map object into a set of attributes. The caller
+// is responsible to delete the attribute pointers returned.
+template <>
+bool toNative(const mxArray * pa, AttributeVector &outAttributes);
+
 } // namespace OpenEXRforMatlab
\ No newline at end of file
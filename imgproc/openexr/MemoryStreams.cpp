@@ -0,0 +1,207 @@
+/*============================================================================
+ 
+ OpenEXR for Matlab
+ 
+ Distributed under the MIT License (the "License");
+ see accompanying file LICENSE for details
+ or copy at http://opensource.org/licenses/MIT
+ 
+ Originated from HDRITools - High Dynamic Range Image Tools
+ Copyright 2011 Program of Computer Graphics, Cornell University
+ 
+ This software is distributed WITHOUT ANY WARRANTY; without even the
+ implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ See the License for more information.
+ -----------------------------------------------------------------------------
+ Authors:
+ Jinwei Gu <jwgu AT cs DOT cornell DOT edu>
+ Edgar Velazquez-Armendariz <eva5 AT cs DOT cornell DOT edu>
+ Manuel Leonhardt <leom AT hs-furtwangen DOT de>
+ 
+ ============================================================================*/
+
+
+#if defined(_WIN32)
+  #define WINDOWS_LEAN_AND_MEAN
+  #include <windows.h>
+#else
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <errno.h>
+#endif
+
+#include <cstring>
+
+#ifdef __clang__
+  #pragma clang diagnostic push
+  #pragma clang diagnostic ignored "-Wlong-long"
+  #pragma clang diagnostic ignored "-Wdeprecated-register"
+  #pragma clang diagnostic ignored "-Wextra"
+#endif
+
+#include <Iex.h>
+
+#ifdef __clang__
+  #pragma clang diagnostic pop
+#endif
+
+#include "MemoryStreams.h"
+
+
+using OpenEXRforMatlab::MemoryIStream;
+using OpenEXRforMatlab::MappedFileIStream;
+
+
+MemoryIStream::MemoryIStream(const char * data, size_t size, const char * name) :
+OPENEXR_IMF_INTERNAL_NAMESPACE::IStream(name),
+m_data(data), m_size(size), m_pos(0)
+{}
+
+
+MemoryIStream::MemoryIStream(const char * name) :
+OPENEXR_IMF_INTERNAL_NAMESPACE::IStream(name),
+m_data(NULL), m_size(0), m_pos(0)
+{}
+
+
+bool MemoryIStream::isMemoryMapped() const
+{
+    return true;
+}
+
+
+const char * MemoryIStream::advance(int n)
+{
+    if (n < 0 || static_cast<size_t>(n) > m_size - m_pos) {
+        throw Iex::InputExc("Unexpected end of file.");
+    }
+    const char * ptr = m_data + m_pos;
+    m_pos += n;
+    return ptr;
+}
+
+
+char * MemoryIStream::readMemoryMapped(int n)
+{
+    // OpenEXR only reads through the returned pointer
+    return const_cast<char *>(advance(n));
+}
+
+
+bool MemoryIStream::read(char c[], int n)
+{
+    memcpy(c, advance(n), n);
+    return m_pos < m_size;
+}
+
+
+uint64_t MemoryIStream::tellg()
+{
+    return m_pos;
+}
+
+
+void MemoryIStream::seekg(uint64_t pos)
+{
+    if (pos > m_size) {
+        throw Iex::InputExc("Seek past the end of file.");
+    }
+    m_pos = static_cast<size_t>(pos);
+}
+
+
+
+#if defined(_WIN32)
+
+MappedFileIStream::MappedFileIStream(const char * filename) :
+MemoryIStream(filename), m_mapping(NULL), m_mappingSize(0),
+m_file(INVALID_HANDLE_VALUE), m_mappingHandle(NULL)
+{
+    m_file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (m_file == INVALID_HANDLE_VALUE) {
+        throw Iex::IoExc(std::string("Cannot open file ") + filename);
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(m_file, &size)) {
+        CloseHandle(m_file);
+        throw Iex::IoExc(std::string("Cannot get the size of ") + filename);
+    }
+    m_mappingSize = static_cast<size_t>(size.QuadPart);
+
+    // Empty files cannot be mapped; they fail later as truncated files
+    if (m_mappingSize != 0) {
+        m_mappingHandle = CreateFileMappingA(m_file, NULL, PAGE_READONLY,
+            0, 0, NULL);
+        if (m_mappingHandle != NULL) {
+            m_mapping = MapViewOfFile(m_mappingHandle, FILE_MAP_READ, 0, 0, 0);
+        }
+        if (m_mapping == NULL) {
+            if (m_mappingHandle != NULL) {
+                CloseHandle(m_mappingHandle);
+            }
+            CloseHandle(m_file);
+            throw Iex::IoExc(std::string("Cannot map file ") + filename);
+        }
+    }
+    setBuffer(static_cast<const char *>(m_mapping), m_mappingSize);
+}
+
+
+MappedFileIStream::~MappedFileIStream()
+{
+    if (m_mapping != NULL) {
+        UnmapViewOfFile(m_mapping);
+        CloseHandle(m_mappingHandle);
+    }
+    CloseHandle(m_file);
+}
+
+#else
+
+MappedFileIStream::MappedFileIStream(const char * filename) :
+MemoryIStream(filename), m_mapping(NULL), m_mappingSize(0)
+{
+    const int fd = ::open(filename, O_RDONLY);
+    if (fd < 0) {
+        Iex::throwErrnoExc(std::string("Cannot open file ") + filename + " (%T).");
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        const int err = errno;
+        ::close(fd);
+        Iex::throwErrnoExc(std::string("Cannot get the size of ") + filename +
+            " (%T).", err);
+    }
+    m_mappingSize = static_cast<size_t>(st.st_size);
+
+    // Empty files cannot be mapped; they fail later as truncated files
+    if (m_mappingSize != 0) {
+        void * mapping = mmap(NULL, m_mappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+            const int err = errno;
+            ::close(fd);
+            Iex::throwErrnoExc(std::string("Cannot map file ") + filename +
+                " (%T).", err);
+        }
+        m_mapping = mapping;
+    }
+
+    // The mapping stays valid after closing the descriptor
+    ::close(fd);
+    setBuffer(static_cast<const char *>(m_mapping), m_mappingSize);
+}
+
+
+MappedFileIStream::~MappedFileIStream()
+{
+    if (m_mapping != NULL) {
+        munmap(m_mapping, m_mappingSize);
+    }
+}
+
+#endif
@@ -0,0 +1,101 @@
+/*============================================================================
+ 
+ OpenEXR for Matlab
+ 
+ Distributed under the MIT License (the "License");
+ see accompanying file LICENSE for details
+ or copy at http://opensource.org/licenses/MIT
+ 
+ Originated from HDRITools - High Dynamic Range Image Tools
+ Copyright 2011 Program of Computer Graphics, Cornell University
+ 
+ This software is distributed WITHOUT ANY WARRANTY; without even the
+ implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ See the License for more information.
+ -----------------------------------------------------------------------------
+ Authors:
+ Jinwei Gu <jwgu AT cs DOT cornell DOT edu>
+ Edgar Velazquez-Armendariz <eva5 AT cs DOT cornell DOT edu>
+ Manuel Leonhardt <leom AT hs-furtwangen DOT de>
+ 
+ ============================================================================*/
+
+
+#pragma once
+
+#include <string>
+#include <stdint.h>
+
+#ifdef __clang__
+  #pragma clang diagnostic push
+  #pragma clang diagnostic ignored "-Wlong-long"
+  #pragma clang diagnostic ignored "-Wdeprecated-register"
+  #pragma clang diagnostic ignored "-Wextra"
+#endif
+
+#include <ImfIO.h>
+#include <ImfNamespace.h>
+
+#ifdef __clang__
+  #pragma clang diagnostic pop
+#endif
+
+
+// Input streams which hand OpenEXR pointers into memory instead of copying
+// the file contents through buffered reads
+
+namespace OpenEXRforMatlab
+{
+
+// Stream over a buffer owned by someone else, such as a Matlab uint8 array.
+// The buffer must outlive the stream.
+class MemoryIStream : public OPENEXR_IMF_INTERNAL_NAMESPACE::IStream
+{
+public:
+    MemoryIStream(const char * data, size_t size, const char * name);
+
+    virtual bool isMemoryMapped() const;
+    virtual char * readMemoryMapped(int n);
+    virtual bool read(char c[], int n);
+    virtual uint64_t tellg();
+    virtual void seekg(uint64_t pos);
+
+protected:
+    // For subclasses which set the buffer once they have it
+    explicit MemoryIStream(const char * name);
+
+    inline void setBuffer(const char * data, size_t size) {
+        m_data = data;
+        m_size = size;
+    }
+
+private:
+    // Check that there are n more bytes, returning the current position
+    const char * advance(int n);
+
+    const char * m_data;
+    size_t m_size;
+    size_t m_pos;
+};
+
+
+// Stream over a read-only memory mapping of a whole file
+class MappedFileIStream : public MemoryIStream
+{
+public:
+    explicit MappedFileIStream(const char * filename);
+    virtual ~MappedFileIStream();
+
+private:
+    MappedFileIStream(const MappedFileIStream &);
+    MappedFileIStream & operator=(const MappedFileIStream &);
+
+    void * m_mapping;
+    size_t m_mappingSize;
+#if defined(_WIN32)
+    void * m_file;
+    void * m_mappingHandle;
+#endif
+};
+
+} // namespace OpenEXRforMatlab
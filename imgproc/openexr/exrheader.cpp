@@ -0,0 +1,317 @@
+/*============================================================================
+
+ OpenEXR for Matlab
+
+ Distributed under the MIT License (the "License");
+ see accompanying file LICENSE for details
+ or copy at http://opensource.org/licenses/MIT
+
+ Originated from HDRITools - High Dynamic Range Image Tools
+ Copyright 2011 Program of Computer Graphics, Cornell University
+
+ This software is distributed WITHOUT ANY WARRANTY; without even the
+ implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ See the License for more information.
+ -----------------------------------------------------------------------------
+ Authors:
+ Jinwei Gu <jwgu AT cs DOT cornell DOT edu>
+ Edgar Velazquez-Armendariz <eva5 AT cs DOT cornell DOT edu>
+ Manuel Leonhardt <leom AT hs-furtwangen DOT de>
+
+ ============================================================================*/
+
+
+#include <string>
+#include <vector>
+#include <cassert>
+
+#include <mex.h>
+
+#ifdef __clang__
+  #pragma clang diagnostic push
+  #pragma clang diagnostic ignored "-Wlong-long"
+  #pragma clang diagnostic ignored "-Wdeprecated-register"
+  #pragma clang diagnostic ignored "-Wextra"
+#endif
+
+#include <ImfHeader.h>
+#include <ImfChannelList.h>
+#include <ImfStdIO.h>
+#include <ImfXdr.h>
+#include <ImfVersion.h>
+#include <ImfNamespace.h>
+#include <Iex.h>
+#include <IlmThreadPool.h>
+
+#ifdef __clang__
+  #pragma clang diagnostic pop
+#endif
+
+#include "utilities.h"
+#include "ImfToMatlab.h"
+#include "MatlabToImf.h"
+
+
+using namespace OPENEXR_IMF_INTERNAL_NAMESPACE;
+
+
+namespace
+{
+
+// Reads the headers of all the parts of a file. Only the header bytes are
+// read: neither the offset tables nor any pixels are touched.
+class HeaderJob
+{
+public:
+    explicit HeaderJob(const std::string & filename) :
+    m_filename(filename), m_version(0)
+    {}
+
+    // Read the headers. May be called from any thread.
+    void read();
+
+    // Convert the headers into a struct array, one element per part
+    mxArray * result() const;
+
+    inline bool failed() const {
+        return !m_error.empty();
+    }
+
+    inline const std::string & error() const {
+        return m_error;
+    }
+
+    inline const std::string & filename() const {
+        return m_filename;
+    }
+
+private:
+    mxArray * attributesMap(const Header & header) const;
+
+    const std::string m_filename;
+    int m_version;
+    std::vector<Header> m_headers;
+    std::string m_error;
+};
+
+
+void HeaderJob::read()
+{
+    try {
+        StdIFStream is(m_filename.c_str());
+
+        int magic = 0;
+        Xdr::read<StreamIO>(is, magic);
+        if (magic != MAGIC) {
+            throw Iex::InputExc("File is not an OpenEXR file.");
+        }
+        Xdr::read<StreamIO>(is, m_version);
+        if (!supportsFlags(getFlags(m_version))) {
+            throw Iex::InputExc("File uses unsupported OpenEXR features.");
+        }
+
+        m_headers.push_back(Header());
+        m_headers.back().readFrom(is, m_version);
+
+        // Multi-part headers are terminated by an empty header
+        if (isMultiPart(m_version)) {
+            for (;;) {
+                char c = 0;
+                Xdr::read<StreamIO>(is, c);
+                if (c == 0) {
+                    break;
+                }
+                is.seekg(is.tellg() - 1);
+                m_headers.push_back(Header());
+                m_headers.back().readFrom(is, m_version);
+            }
+        }
+    }
+    catch (std::exception & e) {
+        m_error = e.what();
+    }
+}
+
+
+// Attributes which cannot be converted yet are left out
+mxArray * HeaderJob::attributesMap(const Header & header) const
+{
+    std::vector<mxArray *> names;
+    std::vector<mxArray *> values;
+    for (Header::ConstIterator it = header.begin(); it != header.end(); ++it) {
+        mxArray * value = OpenEXRforMatlab::toMatlab(it.attribute());
+        if (value != NULL) {
+            names.push_back(mxCreateString(it.name()));
+            values.push_back(value);
+        }
+    }
+
+    mxArray * args[4];
+    args[0] = mxCreateCellMatrix(1, names.size());
+    args[1] = mxCreateCellMatrix(1, values.size());
+    for (size_t i = 0; i != names.size(); ++i) {
+        mxSetCell(args[0], i, names[i]);
+        mxSetCell(args[1], i, values[i]);
+    }
+    args[2] = mxCreateString("UniformValues");
+    args[3] = mxCreateLogicalScalar(false);
+
+    mxArray * map = NULL;
+    if (names.empty()) {
+        mexCallMATLAB(1, &map, 0, NULL, "containers.Map");
+    } else {
+        mexCallMATLAB(1, &map, 4, args, "containers.Map");
+    }
+    for (int i = 0; i != 4; ++i) {
+        mxDestroyArray(args[i]);
+    }
+    return map;
+}
+
+
+mxArray * HeaderJob::result() const
+{
+    assert(!failed());
+
+    const char * fields[] =
+        {"filename", "type", "size", "channels", "attributes"};
+    const int nFields = sizeof(fields) / sizeof(const char *);
+    mxArray * info = mxCreateStructMatrix(1, m_headers.size(), nFields, fields);
+
+    for (size_t i = 0; i != m_headers.size(); ++i) {
+        const Header & header = m_headers[i];
+
+        std::string type;
+        if (header.hasType()) {
+            type = header.type();
+        } else {
+            type = isTiled(m_version) ? TILEDIMAGE : SCANLINEIMAGE;
+        }
+
+        // Size of the data window, as [height width]
+        const Imath::Box2i & dw = header.dataWindow();
+        mxArray * size = mxCreateDoubleMatrix(1, 2, mxREAL);
+        mxGetPr(size)[0] = dw.max.y - dw.min.y + 1;
+        mxGetPr(size)[1] = dw.max.x - dw.min.x + 1;
+
+        const ChannelList & channels = header.channels();
+        size_t numChannels = 0;
+        for (ChannelList::ConstIterator it = channels.begin();
+             it != channels.end(); ++it) {
+            ++numChannels;
+        }
+        mxArray * names = mxCreateCellMatrix(1, numChannels);
+        size_t idx = 0;
+        for (ChannelList::ConstIterator it = channels.begin();
+             it != channels.end(); ++it) {
+            mxSetCell(names, idx++, mxCreateString(it.name()));
+        }
+
+        mxSetField(info, i, "filename",   mxCreateString(m_filename.c_str()));
+        mxSetField(info, i, "type",       mxCreateString(type.c_str()));
+        mxSetField(info, i, "size",       size);
+        mxSetField(info, i, "channels",   names);
+        mxSetField(info, i, "attributes", attributesMap(header));
+    }
+    return info;
+}
+
+
+// Task to read the headers of a file in a batch
+class HeaderTask : public IlmThread::Task
+{
+public:
+    HeaderTask(IlmThread::TaskGroup * group, HeaderJob * job) :
+    IlmThread::Task(group), m_job(job) {}
+
+    void execute() {
+        m_job->read();
+    }
+
+private:
+    HeaderJob * m_job;
+};
+
+
+// Read the headers of all the files, returning the first failed job or NULL
+const HeaderJob * readBatch(const std::vector<HeaderJob *> & jobs)
+{
+    {
+        IlmThread::ThreadPool & pool = OpenEXRforMatlab::getFileThreadPool();
+        IlmThread::TaskGroup taskGroup;
+        for (size_t i = 0; i != jobs.size(); ++i) {
+            pool.addTask(new HeaderTask(&taskGroup, jobs[i]));
+        }
+    }
+
+    for (size_t i = 0; i != jobs.size(); ++i) {
+        if (jobs[i]->failed()) {
+            return jobs[i];
+        }
+    }
+    return NULL;
+}
+
+} // namespace
+
+
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+    OpenEXRforMatlab::mexEXRInit();
+
+    if (nrhs != 1) {
+        mexErrMsgIdAndTxt("OpenEXR:argument", "Invalid number of arguments.");
+    } else if (nlhs > 1) {
+        mexErrMsgIdAndTxt("OpenEXR:argument", "Too many output arguments.");
+    }
+
+    if (mxIsCell(prhs[0])) {
+        // Batch mode: a cell array of filenames returns a cell of results
+        std::vector<std::string> filenames;
+        OpenEXRforMatlab::toNativeCheck(prhs[0], filenames);
+
+        std::vector<HeaderJob *> jobs(filenames.size());
+        for (size_t i = 0; i != filenames.size(); ++i) {
+            jobs[i] = new HeaderJob(filenames[i]);
+        }
+
+        const HeaderJob * failedJob = readBatch(jobs);
+        if (failedJob != NULL) {
+            const std::string msg = failedJob->filename() + ": " + failedJob->error();
+            for (size_t i = 0; i != jobs.size(); ++i) {
+                delete jobs[i];
+            }
+            mexErrMsgIdAndTxt("OpenEXR:exception", "%s", msg.c_str());
+        }
+
+        mxArray * results = mxCreateCellArray(mxGetNumberOfDimensions(prhs[0]),
+            mxGetDimensions(prhs[0]));
+        for (size_t i = 0; i != jobs.size(); ++i) {
+            mxSetCell(results, i, jobs[i]->result());
+            delete jobs[i];
+        }
+        plhs[0] = results;
+        return;
+    }
+
+    std::string filename;
+    if (!mxIsChar(prhs[0])) {
+        mexErrMsgIdAndTxt("OpenEXR:argument", "Invalid filename argument.");
+    }
+    OpenEXRforMatlab::toNativeCheck(prhs[0], filename);
+
+    std::string errorMsg;
+    {
+        HeaderJob job(filename);
+        job.read();
+        if (job.failed()) {
+            errorMsg = job.error();
+        } else {
+            plhs[0] = job.result();
+        }
+    }
+    if (!errorMsg.empty()) {
+        mexErrMsgIdAndTxt("OpenEXR:exception", "%s", errorMsg.c_str());
+    }
+}
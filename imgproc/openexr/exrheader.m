@@ -0,0 +1,27 @@
+function exrheader( filename )
+%EXRHEADER    Read the header of an OpenEXR image without its pixels.
+%   INFO = EXRHEADER(FILENAME) reads only the header of the OpenEXR file
+%   and returns a struct with the following fields:
+%     filename   - the name of the file.
+%     type       - 'scanlineimage', 'tiledimage', 'deepscanline' or
+%                  'deeptile'.
+%     size       - [height width] of the data window.
+%     channels   - cell vector with the names of the channels.
+%     attributes - containers.Map object whose keys are the attribute
+%                  names and the values are the attribute values. This
+%                  includes the full channel list with the pixel types and
+%                  sampling rates, the data and display windows, the
+%                  compression and the tile description of tiled files.
+%                  Attributes of unsupported types are left out.
+%
+%   For multi-part files INFO is a struct vector with one element per part.
+%
+%   INFOS = EXRHEADER(FILENAMES) reads the headers of all the files in the
+%   cell array FILENAMES in parallel, and returns a cell array of the same
+%   size with the INFO struct of each file. An error is raised if any of
+%   the files cannot be read.
+%
+%   See also EXRREADCHANNELS,EXRWRITECHANNELS,CONTAINERS.MAP
+
+% (The help system uses this file, but actually doing something with it
+% will employ the mex file).
@@ -24,6 +24,8 @@
 #include <string>
 #include <cassert>
 #include <vector>
+#include <algorithm>
+#include <sstream>
 
 #include <mex.h>
 
@@ -34,7 +36,15 @@
   #pragma clang diagnostic ignored "-Wextra"
 #endif
 
-#include <ImfInputFile.h>
+#include <ImfMultiPartInputFile.h>
+#include <ImfInputPart.h>
+#include <ImfTiledInputPart.h>
+#include <ImfDeepScanLineInputPart.h>
+#include <ImfDeepTiledInputPart.h>
+#include <ImfDeepFrameBuffer.h>
+#include <ImfPartType.h>
+#include <ImfVersion.h>
+#include <ImfThreading.h>
 #include <ImfChannelList.h>
 #include <ImfNamespace.h>
 #include <ImfExport.h>
@@ -42,20 +52,240 @@
 #include <ImathMath.h>
 #include <ImfHeader.h>
 #include <ImfFrameBuffer.h>
+#include <IlmThreadPool.h>
+#include <IlmThreadSemaphore.h>
 
 #ifdef __clang__
   #pragma clang diagnostic pop
 #endif
 
 #include "utilities.h"
+#include "MatlabToImf.h"
+#include "MemoryStreams.h"
 
 
 using namespace OPENEXR_IMF_INTERNAL_NAMESPACE;
+using namespace OpenEXRforMatlab;
 using Imath::Box2i;
 
 
 namespace {
 
+// Number of scanlines decoded at a time when reading a region of interest
+const int REGION_BLOCK_ROWS = 64;
+
+
+// Optional arguments given as a trailing struct. The region of interest is
+// kept as 0-based, inclusive pixel offsets relative to the data window; a
+// negative maximum means the whole extent of the data window. The part is
+// selected either by name or by its 0-based index; by default the first
+// part is read. A negative thread count means the global OpenEXR count.
+struct ReadOptions
+{
+    bool native;
+    bool cube;
+    bool hasRoi;
+    int rowMin, rowMax;
+    int colMin, colMax;
+    int rowStride, colStride;
+    std::string partName;
+    int partIndex;
+    bool mmap;
+    int numThreads;
+    bool hasLevel;
+    int levelX, levelY;
+    int reduceX, reduceY;
+
+    ReadOptions() : native(false), cube(false), hasRoi(false), rowMin(0), rowMax(-1), colMin(0), colMax(-1),
+        rowStride(1), colStride(1), partIndex(0), mmap(false), numThreads(-1),
+        hasLevel(false), levelX(0), levelY(0), reduceX(1), reduceY(1) {}
+
+    // Reduced reads average blocks of reduceY x reduceX pixels, the last
+    // ones partial when the region is not a multiple of the block size
+    inline bool isReduced() const {
+        return reduceX > 1 || reduceY > 1;
+    }
+
+    inline int outHeight() const {
+        return (rowMax - rowMin) / std::max(rowStride, reduceY) + 1;
+    }
+
+    inline int outWidth() const {
+        return (colMax - colMin) / std::max(colStride, reduceX) + 1;
+    }
+};
+
+
+// Get a 1-based [first last] range option as 0-based offsets
+bool getRangeOption(const mxArray * opts, const char * name,
+    int & outMin, int & outMax)
+{
+    double values[2];
+    size_t count = 0;
+    if (!getNumericOption(opts, name, 2, 2, values, count)) {
+        return false;
+    }
+    if (values[0] < 1 || values[1] < values[0]) {
+        mexErrMsgIdAndTxt("OpenEXR:argument",
+            "Invalid '%s' range: [%g %g].", name, values[0], values[1]);
+    }
+    outMin = static_cast<int>(values[0]) - 1;
+    outMax = static_cast<int>(values[1]) - 1;
+    return true;
+}
+
+
+// Parse the options struct
+void getReadOptions(const mxArray * pa, ReadOptions & options)
+{
+    static const char * knownFields[] =
+        {"rows", "cols", "stride", "native", "cube", "part", "mmap", "threads",
+         "level", "reduce"};
+    const int numKnown = sizeof(knownFields) / sizeof(const char *);
+
+    checkOptionFields(pa, knownFields, numKnown);
+
+    if (getRangeOption(pa, "rows", options.rowMin, options.rowMax)) {
+        options.hasRoi = true;
+    }
+    if (getRangeOption(pa, "cols", options.colMin, options.colMax)) {
+        options.hasRoi = true;
+    }
+
+    getLogicalOption(pa, "native", options.native);
+    getLogicalOption(pa, "cube", options.cube);
+    getLogicalOption(pa, "mmap", options.mmap);
+
+    double values[2];
+    size_t count = 0;
+    if (getNumericOption(pa, "stride", 1, 2, values, count)) {
+        if (values[0] < 1 || values[count-1] < 1) {
+            mexErrMsgIdAndTxt("OpenEXR:argument",
+                "The stride must be a positive integer.");
+        }
+        options.rowStride = static_cast<int>(values[0]);
+        options.colStride = static_cast<int>(values[count-1]);
+        options.hasRoi = true;
+    }
+
+    if (getNumericOption(pa, "threads", 1, 1, values, count)) {
+        if (values[0] < 0) {
+            mexErrMsgIdAndTxt("OpenEXR:argument",
+                "The number of threads must be non-negative.");
+        }
+        options.numThreads = static_cast<int>(values[0]);
+    }
+
+    // Levels are given as [ylevel xlevel], in the same order as the strides
+    if (getNumericOption(pa, "level", 1, 2, values, count)) {
+        if (values[0] < 0 || values[count-1] < 0 ||
+            values[0] > 30 || values[count-1] > 30)
+        {
+            mexErrMsgIdAndTxt("OpenEXR:argument",
+                "The level must be a non-negative integer.");
+        }
+        options.levelY = static_cast<int>(values[0]);
+        options.levelX = static_cast<int>(values[count-1]);
+        options.hasLevel = true;
+    }
+
+    if (getNumericOption(pa, "reduce", 1, 2, values, count)) {
+        if (values[0] < 1 || values[count-1] < 1) {
+            mexErrMsgIdAndTxt("OpenEXR:argument",
+                "The reduction factor must be a positive integer.");
+        }
+        options.reduceY = static_cast<int>(values[0]);
+        options.reduceX = static_cast<int>(values[count-1]);
+        options.hasRoi = true;
+    }
+
+    if (options.isReduced()) {
+        if (options.hasLevel) {
+            mexErrMsgIdAndTxt("OpenEXR:argument",
+                "The 'level' and 'reduce' options are exclusive.");
+        }
+        if (options.rowStride != 1 || options.colStride != 1) {
+            mexErrMsgIdAndTxt("OpenEXR:argument",
+                "The 'stride' and 'reduce' options are exclusive.");
+        }
+        if (options.native) {
+            mexErrMsgIdAndTxt("OpenEXR:argument",
+                "Reduced reads are always in single precision.");
+        }
+    }
+
+    // Parts are given by name or by their 1-based index
+    const mxArray * part = mxGetField(pa, 0, "part");
+    if (part != NULL && mxIsChar(part)) {
+        getOption(pa, "part", options.partName);
+    }
+    else if (getNumericOption(pa, "part", 1, 1, values, count)) {
+        if (values[0] < 1) {
+            mexErrMsgIdAndTxt("OpenEXR:argument",
+                "The part index must be a positive integer.");
+        }
+        options.partIndex = static_cast<int>(values[0]) - 1;
+    }
+}
+
+
+// Index of the part selected by the options
+int findPart(const MultiPartInputFile & file, const ReadOptions & options)
+{
+    if (!options.partName.empty()) {
+        for (int i = 0; i != file.parts(); ++i) {
+            const Header & header = file.header(i);
+            if (header.hasName() && header.name() == options.partName) {
+                return i;
+            }
+        }
+        throw Iex::ArgExc("Part not in file: " + options.partName);
+    }
+    if (options.partIndex >= file.parts()) {
+        std::ostringstream msg;
+        msg << "Part " << (options.partIndex + 1) << " not in file, which has "
+            << file.parts() << " parts.";
+        throw Iex::ArgExc(msg.str());
+    }
+    return options.partIndex;
+}
+
+
+// Type of a part. Single-part files may not have the type attribute.
+std::string getPartType(const MultiPartInputFile & file, int part)
+{
+    const Header & header = file.header(part);
+    if (header.hasType()) {
+        return header.type();
+    }
+    return isTiled(file.version()) ? TILEDIMAGE : SCANLINEIMAGE;
+}
+
+
+// Fill in the default extents of the region of interest and validate it
+void resolveRegion(ReadOptions & options, const Box2i & dataWindow)
+{
+    const int width  = dataWindow.max.x - dataWindow.min.x + 1;
+    const int height = dataWindow.max.y - dataWindow.min.y + 1;
+
+    if (options.rowMax < 0) {
+        options.rowMin = 0;
+        options.rowMax = height - 1;
+    }
+    if (options.colMax < 0) {
+        options.colMin = 0;
+        options.colMax = width - 1;
+    }
+
+    if (options.rowMax >= height || options.colMax >= width) {
+        std::ostringstream msg;
+        msg << "The region of interest exceeds the image size ["
+            << height << " " << width << "].";
+        throw Iex::ArgExc(msg.str());
+    }
+}
+
+
 // Get the strings of the explicitly requested channel names.
 // The first two arguments are the original inputs to mexFunction(...)
 void getRequestedChannels(int nrhs, const mxArray *prhs[],
@@ -116,18 +346,53 @@ void getRequestedChannels(int nrhs, const mxArray *prhs[],
 
 
 
-// Prepares a framebuffer for the requested channels, allocating also the
-// appropriate Matlab memory
+// Output type of a channel. Unless the native types are requested all the
+// channels are converted to single precision; in native mode the HALF
+// channels keep their bit patterns as uint16 and UINT channels are uint32.
+inline PixelType getOutputType(const ChannelList & channels,
+    const std::string & name, bool native)
+{
+    if (native) {
+        const Channel * c = channels.findChannel(name.c_str());
+        if (c != NULL) {
+            return c->type;
+        }
+    }
+    return FLOAT;
+}
+
+
+inline mxClassID getClassID(PixelType type)
+{
+    switch (type) {
+    case UINT:
+        return mxUINT32_CLASS;
+    case HALF:
+        return mxUINT16_CLASS;
+    default:
+        return mxSINGLE_CLASS;
+    }
+}
+
+
+inline size_t getTypeSize(PixelType type)
+{
+    return type == HALF ? sizeof(uint16_T) : sizeof(float);
+}
+
+
+// Prepares a framebuffer for the requested channels over the given window,
+// on top of the preallocated Matlab memory of each channel
 void prepareFrameBuffer(FrameBuffer & fb, const Box2i & dataWindow,
     const ChannelList & channels,
     const std::vector<std::string> & requestedChannels,
-    std::vector<mxArray *> & outMatlabData)
+    const std::vector<PixelType> & types,
+    const std::vector<char *> & outData)
 {
     assert(!requestedChannels.empty());
-    assert(outMatlabData.size() == requestedChannels.size());
+    assert(outData.size() == requestedChannels.size());
 
     const Box2i & dw = dataWindow;
-    const int width  = dw.max.x - dw.min.x + 1;
     const int height = dw.max.y - dw.min.y + 1;
 
     // The "weird" strides are because Matlab uses column-major order
@@ -138,12 +403,8 @@ void prepareFrameBuffer(FrameBuffer & fb, const Box2i & dataWindow,
     const off_t offset = - (dw.min.x * xStride + dw.min.y * yStride);
 
     for (size_t i = 0; i != requestedChannels.size(); ++i) {
-        // Allocate the memory
-        mxArray * data = 
-            mxCreateNumericMatrix(height, width, mxSINGLE_CLASS, mxREAL);
-        outMatlabData[i] = data;
-
-        float * ptr = static_cast<float*>(mxGetData(data));
+        char * ptr = outData[i];
+        const size_t typeSize = getTypeSize(types[i]);
 
         // Get the appropriate sampling factors
         int xSampling = 1, ySampling = 1;
@@ -154,9 +415,10 @@ void prepareFrameBuffer(FrameBuffer & fb, const Box2i & dataWindow,
         }
         
         // Insert the slice in the framebuffer
-        fb.insert(requestedChannels[i].c_str(), Slice(FLOAT, (char*)(ptr + offset),
-            sizeof(float) * xStride,
-            sizeof(float) * yStride,
+        fb.insert(requestedChannels[i].c_str(), Slice(types[i],
+            ptr + offset * static_cast<off_t>(typeSize),
+            typeSize * xStride,
+            typeSize * yStride,
             xSampling, ySampling));
     }
 }
@@ -174,6 +436,301 @@ inline void getChannelNames(const ChannelList & channels,
 }
 
 
+// Validate that the requested channels are actually on the file, or fill in
+// all the channel names if none were requested
+void resolveChannels(const ChannelList & channels,
+    std::vector<std::string> & channelNames)
+{
+    if (!channelNames.empty()) {
+        for (size_t i = 0; i != channelNames.size(); ++i) {
+            if (channels.find(channelNames[i].c_str()) == channels.end()) {
+                throw Iex::ArgExc("Channel not in file: " + channelNames[i]);
+            }
+        }
+    } else {
+        // If there are no explicitly required channels, read all
+        getChannelNames(channels, channelNames);
+    }
+    assert(!channelNames.empty());
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Region of interest reads
+///////////////////////////////////////////////////////////////////////////////
+
+// Allocate a Matlab matrix for each channel, sized to the region
+void allocateRegion(const ReadOptions & options,
+    const std::vector<PixelType> & types, std::vector<mxArray *> & outMxData,
+    std::vector<char *> & outData)
+{
+    outMxData.resize(types.size());
+    outData.resize(types.size());
+    for (size_t i = 0; i != types.size(); ++i) {
+        outMxData[i] = mxCreateNumericMatrix(options.outHeight(),
+            options.outWidth(), getClassID(types[i]), mxREAL);
+        outData[i] = static_cast<char *>(mxGetData(outMxData[i]));
+    }
+}
+
+
+// Allocate a single HxWxN array, with the channels as consecutive planes
+void allocateCube(const ReadOptions & options,
+    const std::vector<PixelType> & types, std::vector<mxArray *> & outMxData,
+    std::vector<char *> & outData)
+{
+    assert(!types.empty());
+    for (size_t i = 1; i != types.size(); ++i) {
+        if (types[i] != types[0]) {
+            throw Iex::ArgExc("All the channels of a cube must have "
+                "the same pixel type.");
+        }
+    }
+
+    const mwSize dims[3] = {static_cast<mwSize>(options.outHeight()),
+        static_cast<mwSize>(options.outWidth()),
+        static_cast<mwSize>(types.size())};
+    mxArray * cube = mxCreateNumericArray(3, dims, getClassID(types[0]), mxREAL);
+    outMxData.assign(1, cube);
+
+    const size_t planeSize = getTypeSize(types[0]) * dims[0] * dims[1];
+    char * ptr = static_cast<char *>(mxGetData(cube));
+    outData.resize(types.size());
+    for (size_t i = 0; i != types.size(); ++i) {
+        outData[i] = ptr + i * planeSize;
+    }
+}
+
+
+// Subsampled channels would need a different output size per channel
+void checkFullResolution(const ChannelList & channels,
+    const std::vector<std::string> & channelNames)
+{
+    for (size_t i = 0; i != channelNames.size(); ++i) {
+        const Channel * c = channels.findChannel(channelNames[i].c_str());
+        if (c != NULL && (c->xSampling != 1 || c->ySampling != 1)) {
+            throw Iex::ArgExc("Region reads of subsampled channels are "
+                "not supported: " + channelNames[i]);
+        }
+    }
+}
+
+
+// Copy the requested columns of a row-major block of scanlines into the
+// column-major Matlab matrix. The source points to the first requested row.
+template <typename T>
+void copyRegion(T * dest, size_t destHeight, size_t destRow,
+    const T * src, size_t srcWidth, int numRows, int rowStride,
+    int firstCol, int numCols, int colStride)
+{
+    const size_t srcRowStride = srcWidth * rowStride;
+    for (int j = 0; j < numCols; ++j) {
+        const T * srcCol = src + firstCol + static_cast<size_t>(j) * colStride;
+        T * destCol = dest + static_cast<size_t>(j) * destHeight + destRow;
+        for (int i = 0; i < numRows; ++i) {
+            destCol[i] = srcCol[i * srcRowStride];
+        }
+    }
+}
+
+
+// Same as above for any pixel type, copying the raw bits
+void copyRegion(PixelType type, char * dest, size_t destHeight, size_t destRow,
+    const char * src, size_t srcWidth, int numRows, int rowStride,
+    int firstCol, int numCols, int colStride)
+{
+    if (getTypeSize(type) == sizeof(uint16_T)) {
+        copyRegion(reinterpret_cast<uint16_T *>(dest), destHeight, destRow,
+            reinterpret_cast<const uint16_T *>(src), srcWidth, numRows,
+            rowStride, firstCol, numCols, colStride);
+    } else {
+        copyRegion(reinterpret_cast<uint32_T *>(dest), destHeight, destRow,
+            reinterpret_cast<const uint32_T *>(src), srcWidth, numRows,
+            rowStride, firstCol, numCols, colStride);
+    }
+}
+
+
+// Scanline files always decode complete scanlines, so unless the region
+// spans the whole width the rows go through a scratch buffer one block at a
+// time. Decimated rows are read one at a time so that the line buffers in
+// between are never decompressed.
+void readScanlineRegion(InputPart & img, const ReadOptions & options,
+    const std::vector<std::string> & channelNames,
+    const std::vector<PixelType> & types,
+    const std::vector<char *> & outData)
+{
+    const Box2i & dw = img.header().dataWindow();
+    const int width  = dw.max.x - dw.min.x + 1;
+    const int y0 = dw.min.y + options.rowMin;
+
+    const int outHeight = options.outHeight();
+    const int outWidth  = options.outWidth();
+    const int blockRows = options.rowStride == 1 ?
+        std::min(REGION_BLOCK_ROWS, outHeight) : 1;
+
+    std::vector<std::vector<char> > scratch(channelNames.size());
+    for (size_t i = 0; i != channelNames.size(); ++i) {
+        scratch[i].resize(getTypeSize(types[i]) * width * blockRows);
+    }
+
+    for (int outRow = 0; outRow < outHeight; outRow += blockRows) {
+        const int numRows = std::min(blockRows, outHeight - outRow);
+        const int yStart  = y0 + outRow * options.rowStride;
+        const ptrdiff_t offset = - (static_cast<ptrdiff_t>(dw.min.x) +
+            static_cast<ptrdiff_t>(yStart) * width);
+
+        FrameBuffer framebuffer;
+        for (size_t i = 0; i != channelNames.size(); ++i) {
+            const size_t typeSize = getTypeSize(types[i]);
+            framebuffer.insert(channelNames[i].c_str(),
+                Slice(types[i], &scratch[i][0] + offset * static_cast<ptrdiff_t>(typeSize),
+                      typeSize, typeSize * width));
+        }
+        img.setFrameBuffer(framebuffer);
+        img.readPixels(yStart, yStart + numRows - 1);
+
+        for (size_t i = 0; i != channelNames.size(); ++i) {
+            copyRegion(types[i], outData[i], outHeight, outRow, &scratch[i][0],
+                width, numRows, 1, options.colMin, outWidth, options.colStride);
+        }
+    }
+}
+
+
+// Tiled files are read one row of tiles at a time, restricted to the tiles
+// which overlap the region of interest. The region is relative to the
+// selected level of multi-resolution files.
+void readTiledRegion(TiledInputPart & img, const ReadOptions & options,
+    const std::vector<std::string> & channelNames,
+    const std::vector<PixelType> & types,
+    const std::vector<char *> & outData)
+{
+    const int lx = options.levelX;
+    const int ly = options.levelY;
+    const Box2i dw = img.dataWindowForLevel(lx, ly);
+    const int tileWidth  = static_cast<int>(img.tileXSize());
+    const int tileHeight = static_cast<int>(img.tileYSize());
+    const int dx0 = options.colMin / tileWidth;
+    const int dx1 = options.colMax / tileWidth;
+    const int dy0 = options.rowMin / tileHeight;
+    const int dy1 = options.rowMax / tileHeight;
+    const int stripWidth = (dx1 - dx0 + 1) * tileWidth;
+
+    const int outHeight = options.outHeight();
+    const int outWidth  = options.outWidth();
+
+    std::vector<std::vector<char> > scratch(channelNames.size());
+    for (size_t i = 0; i != channelNames.size(); ++i) {
+        scratch[i].resize(getTypeSize(types[i]) * stripWidth * tileHeight);
+    }
+
+    int outRow = 0;
+    for (int dy = dy0; dy <= dy1 && outRow < outHeight; ++dy) {
+        // Skip rows of tiles without any requested row
+        const int tileRow = dy * tileHeight;
+        const int nextRow = options.rowMin + outRow * options.rowStride;
+        if (nextRow >= tileRow + tileHeight) {
+            continue;
+        }
+        const int numRows = std::min(outHeight - outRow,
+            (tileRow + tileHeight - 1 - nextRow) / options.rowStride + 1);
+
+        const ptrdiff_t offset = - (static_cast<ptrdiff_t>(dw.min.x) +
+            dx0 * tileWidth + static_cast<ptrdiff_t>(dw.min.y + tileRow) *
+            stripWidth);
+
+        FrameBuffer framebuffer;
+        for (size_t i = 0; i != channelNames.size(); ++i) {
+            const size_t typeSize = getTypeSize(types[i]);
+            framebuffer.insert(channelNames[i].c_str(),
+                Slice(types[i], &scratch[i][0] + offset * static_cast<ptrdiff_t>(typeSize),
+                      typeSize, typeSize * stripWidth));
+        }
+        img.setFrameBuffer(framebuffer);
+        img.readTiles(dx0, dx1, dy, dy, lx, ly);
+
+        for (size_t i = 0; i != channelNames.size(); ++i) {
+            const char * src = &scratch[i][0] + getTypeSize(types[i]) *
+                static_cast<size_t>(nextRow - tileRow) * stripWidth;
+            copyRegion(types[i], outData[i], outHeight, outRow, src, stripWidth,
+                numRows, options.rowStride,
+                options.colMin - dx0 * tileWidth, outWidth, options.colStride);
+        }
+        outRow += numRows;
+    }
+    assert(outRow == outHeight);
+}
+
+
+// Box filter the region while decoding. Blocks of scanlines which make
+// whole output rows are decoded into a scratch buffer and averaged, so the
+// full resolution image is never held in memory. The last output row and
+// column average only the pixels inside the region.
+void readReducedRegion(InputPart & img, const ReadOptions & options,
+    const std::vector<std::string> & channelNames,
+    const std::vector<PixelType> & types,
+    const std::vector<char *> & outData)
+{
+    const Box2i & dw = img.header().dataWindow();
+    const int width  = dw.max.x - dw.min.x + 1;
+    const int y0 = dw.min.y + options.rowMin;
+    const int numInRows = options.rowMax - options.rowMin + 1;
+    const int numInCols = options.colMax - options.colMin + 1;
+    const int fy = options.reduceY;
+    const int fx = options.reduceX;
+
+    const int outHeight = options.outHeight();
+    const int outWidth  = options.outWidth();
+    const int blockOutRows = std::max(1, REGION_BLOCK_ROWS / fy);
+    const int blockRows = std::min(blockOutRows * fy, numInRows);
+
+    std::vector<std::vector<float> > scratch(channelNames.size(),
+        std::vector<float>(static_cast<size_t>(width) * blockRows));
+    std::vector<float> sums(outWidth);
+
+    for (int inRow = 0; inRow < numInRows; inRow += blockRows) {
+        const int numRows = std::min(blockRows, numInRows - inRow);
+        const int yStart  = y0 + inRow;
+        const ptrdiff_t offset = - (static_cast<ptrdiff_t>(dw.min.x) +
+            static_cast<ptrdiff_t>(yStart) * width);
+
+        FrameBuffer framebuffer;
+        for (size_t i = 0; i != channelNames.size(); ++i) {
+            assert(types[i] == FLOAT);
+            framebuffer.insert(channelNames[i].c_str(),
+                Slice(FLOAT, reinterpret_cast<char *>(&scratch[i][0] + offset),
+                      sizeof(float), sizeof(float) * width));
+        }
+        img.setFrameBuffer(framebuffer);
+        img.readPixels(yStart, yStart + numRows - 1);
+
+        for (size_t i = 0; i != channelNames.size(); ++i) {
+            float * dest = reinterpret_cast<float *>(outData[i]);
+            for (int r = 0; r < numRows; r += fy) {
+                const int rows = std::min(fy, numRows - r);
+                std::fill(sums.begin(), sums.end(), 0.0f);
+                for (int k = 0; k != rows; ++k) {
+                    const float * src = &scratch[i][0] +
+                        static_cast<size_t>(r + k) * width + options.colMin;
+                    for (int c = 0; c != numInCols; ++c) {
+                        sums[c / fx] += src[c];
+                    }
+                }
+
+                const int outRow = (inRow + r) / fy;
+                for (int j = 0; j != outWidth; ++j) {
+                    const int cols = std::min(fx, numInCols - j * fx);
+                    dest[static_cast<size_t>(j) * outHeight + outRow] =
+                        sums[j] / static_cast<float>(rows * cols);
+                }
+            }
+        }
+    }
+}
+
+
 // Create a containers.Map object with the channel names and value
  mxArray * buildMap(const std::vector<std::string> &channelNames,
      const std::vector<mxArray *> & mxData)
@@ -202,6 +759,533 @@ inline void getChannelNames(const ChannelList & channels,
  }
 
 
+
+///////////////////////////////////////////////////////////////////////////////
+// Read jobs
+///////////////////////////////////////////////////////////////////////////////
+
+// Where a file is read from: either a file name, or the bytes of a whole
+// file already in Matlab memory, which must outlive the read
+struct Source
+{
+    std::string name;
+    const char * data;
+    size_t size;
+
+    Source() : data(NULL), size(0) {}
+};
+
+
+// Get the source from a filename or a uint8 array
+void getSource(const mxArray * pa, Source & outSource)
+{
+    if (mxIsUint8(pa) || mxIsInt8(pa)) {
+        outSource.name = "<memory>";
+        outSource.data = static_cast<const char *>(mxGetData(pa));
+        outSource.size = mxGetNumberOfElements(pa);
+    }
+    else if (mxIsChar(pa)) {
+        OpenEXRforMatlab::toNativeCheck(pa, outSource.name);
+    }
+    else {
+        mexErrMsgIdAndTxt("OpenEXR:argument",
+            "Expected a filename or a uint8 array with the file contents.");
+    }
+}
+
+
+
+// A single file to read. The work is split in stages so that batches may
+// open and decode the files on worker threads: open() and decode() never call
+// the Matlab API and keep their failures in error(), whereas prepare() and
+// the result accessors must run in the Matlab thread.
+class ReadJob
+{
+public:
+    ReadJob(const Source & source,
+        const std::vector<std::string> & channelNames,
+        const ReadOptions & options) :
+    m_filename(source.name), m_data(source.data), m_size(source.size),
+    m_channelNames(channelNames), m_options(options),
+    m_stream(NULL), m_multiFile(NULL), m_part(0), m_file(NULL), m_tiledFile(NULL),
+    m_deepFile(NULL), m_deepTiledFile(NULL), m_direct(false), m_y0(0), m_y1(-1),
+    m_sampleCounts(NULL), m_isArgError(false)
+    {}
+
+    ~ReadJob() {
+        close();
+    }
+
+    // Open the file and read its header
+    void open();
+
+    // Resolve the requested channels and region and allocate the outputs
+    void prepare();
+
+    // Read the pixels into the outputs and close the file
+    void decode();
+
+    // Wait until open() has finished in another thread
+    inline void waitOpened() {
+        m_opened.wait();
+    }
+
+    inline void postOpened() {
+        m_opened.post();
+    }
+
+    inline bool failed() const {
+        return !m_error.empty();
+    }
+
+    inline const std::string & error() const {
+        return m_error;
+    }
+
+    inline const char * errorId() const {
+        return m_isArgError ? "OpenEXR:argument" : "OpenEXR:exception";
+    }
+
+    inline const std::string & filename() const {
+        return m_filename;
+    }
+
+    inline const std::vector<std::string> & channelNames() const {
+        return m_channelNames;
+    }
+
+    inline const std::vector<mxArray *> & outputs() const {
+        return m_mxData;
+    }
+
+    // The cube, a map if there are multiple channels, otherwise the data.
+    // Deep parts return a struct with the sample counts and the map.
+    mxArray * result() const;
+
+private:
+    inline const Header & header() const {
+        return m_multiFile->header(m_part);
+    }
+
+    inline bool isDeep() const {
+        return m_deepFile != NULL || m_deepTiledFile != NULL;
+    }
+
+    // Data window of the level being read
+    Box2i dataWindow() const;
+
+    // Read the sample counts and allocate the outputs of a deep part
+    void prepareDeep();
+
+    void close();
+
+    void setError(const std::exception & e);
+
+    const std::string m_filename;
+    const char * m_data;
+    const size_t m_size;
+    std::vector<std::string> m_channelNames;
+    ReadOptions m_options;
+
+    OPENEXR_IMF_INTERNAL_NAMESPACE::IStream * m_stream;
+    MultiPartInputFile * m_multiFile;
+    int m_part;
+    InputPart * m_file;
+    TiledInputPart * m_tiledFile;
+    DeepScanLineInputPart * m_deepFile;
+    DeepTiledInputPart * m_deepTiledFile;
+
+    // Framebuffer over the Matlab memory for the reads without a scratch
+    // buffer, with the range of scanlines to read
+    FrameBuffer m_framebuffer;
+    bool m_direct;
+    int m_y0, m_y1;
+
+    std::vector<PixelType> m_types;
+    std::vector<mxArray *> m_mxData;
+    std::vector<char *> m_outData;
+
+    // Deep parts store the samples of each channel as a vector, with the
+    // samples of each pixel consecutive and the pixels in column-major order
+    mxArray * m_sampleCounts;
+    std::vector<std::vector<char *> > m_samplePointers;
+    DeepFrameBuffer m_deepFramebuffer;
+
+    IlmThread::Semaphore m_opened;
+    std::string m_error;
+    bool m_isArgError;
+};
+
+
+void ReadJob::setError(const std::exception & e)
+{
+    m_error = e.what();
+    m_isArgError = dynamic_cast<const Iex::ArgExc *>(&e) != NULL;
+}
+
+
+Box2i ReadJob::dataWindow() const
+{
+    if (m_tiledFile != NULL && m_options.hasLevel) {
+        if (!m_tiledFile->isValidLevel(m_options.levelX, m_options.levelY)) {
+            std::ostringstream msg;
+            msg << "Level [" << m_options.levelY << " " << m_options.levelX
+                << "] not in file, which has " << m_tiledFile->numYLevels()
+                << "x" << m_tiledFile->numXLevels() << " levels.";
+            throw Iex::ArgExc(msg.str());
+        }
+        return m_tiledFile->dataWindowForLevel(m_options.levelX,
+            m_options.levelY);
+    }
+    return header().dataWindow();
+}
+
+
+void ReadJob::close()
+{
+    delete m_file;
+    m_file = NULL;
+    delete m_tiledFile;
+    m_tiledFile = NULL;
+    delete m_deepFile;
+    m_deepFile = NULL;
+    delete m_deepTiledFile;
+    m_deepTiledFile = NULL;
+    delete m_multiFile;
+    m_multiFile = NULL;
+    delete m_stream;
+    m_stream = NULL;
+}
+
+
+void ReadJob::open()
+{
+    try {
+        // Memory streams hand OpenEXR pointers to the compressed chunks
+        // instead of copying them through buffered reads
+        if (m_data != NULL) {
+            m_stream = new MemoryIStream(m_data, m_size, m_filename.c_str());
+        } else if (m_options.mmap) {
+            m_stream = new MappedFileIStream(m_filename.c_str());
+        }
+
+        // Only the chunks of the selected part are ever decoded
+        const int numThreads = m_options.numThreads < 0 ?
+            globalThreadCount() : m_options.numThreads;
+        if (m_stream != NULL) {
+            m_multiFile = new MultiPartInputFile(*m_stream, numThreads);
+        } else {
+            m_multiFile = new MultiPartInputFile(m_filename.c_str(), numThreads);
+        }
+        m_part = findPart(*m_multiFile, m_options);
+
+        const std::string type = getPartType(*m_multiFile, m_part);
+        if (type == DEEPSCANLINE) {
+            m_deepFile = new DeepScanLineInputPart(*m_multiFile, m_part);
+        }
+        else if (type == DEEPTILE) {
+            m_deepTiledFile = new DeepTiledInputPart(*m_multiFile, m_part);
+        }
+        else {
+            // Parts without lower resolution levels are box filtered instead
+            const Header & h = header();
+            const bool multiResolution = type == TILEDIMAGE &&
+                h.hasTileDescription() && h.tileDescription().mode != ONE_LEVEL;
+            if (m_options.hasLevel && !multiResolution) {
+                m_options.hasLevel = false;
+                m_options.reduceX = 1 << m_options.levelX;
+                m_options.reduceY = 1 << m_options.levelY;
+                m_options.levelX = m_options.levelY = 0;
+                if (m_options.isReduced()) {
+                    if (m_options.native) {
+                        throw Iex::ArgExc("The part has no lower resolution "
+                            "levels and reduced reads are always in single "
+                            "precision.");
+                    }
+                    m_options.hasRoi = true;
+                }
+            }
+
+            if (type == TILEDIMAGE && !m_options.isReduced() &&
+                (m_options.hasRoi || m_options.hasLevel))
+            {
+                // Only the tiles of the level overlapping the region get decoded
+                m_tiledFile = new TiledInputPart(*m_multiFile, m_part);
+            } else {
+                m_file = new InputPart(*m_multiFile, m_part);
+            }
+        }
+    }
+    catch (std::exception & e) {
+        setError(e);
+    }
+}
+
+
+void ReadJob::prepare()
+{
+    assert(!failed());
+    try {
+        resolveChannels(header().channels(), m_channelNames);
+        m_types.resize(m_channelNames.size());
+        for (size_t i = 0; i != m_channelNames.size(); ++i) {
+            m_types[i] = getOutputType(header().channels(), m_channelNames[i],
+                m_options.native);
+        }
+
+        if (isDeep()) {
+            if (m_options.hasRoi || m_options.hasLevel || m_options.cube) {
+                throw Iex::ArgExc("Regions, levels and cubes are not "
+                    "supported for deep parts.");
+            }
+            prepareDeep();
+            return;
+        }
+
+        const Box2i dw = dataWindow();
+        resolveRegion(m_options, dw);
+        if (m_options.hasRoi || m_options.hasLevel || m_options.cube) {
+            checkFullResolution(header().channels(), m_channelNames);
+        }
+
+        if (m_options.cube) {
+            allocateCube(m_options, m_types, m_mxData, m_outData);
+        } else {
+            allocateRegion(m_options, m_types, m_mxData, m_outData);
+        }
+
+        const int width = dw.max.x - dw.min.x + 1;
+        if (m_file != NULL && m_options.colMin == 0 &&
+            m_options.colMax == width - 1 && !m_options.isReduced() &&
+            m_options.rowStride == 1 && m_options.colStride == 1)
+        {
+            // Whole scanlines: decode straight into the Matlab memory
+            m_direct = true;
+            m_y0 = dw.min.y + m_options.rowMin;
+            m_y1 = dw.min.y + m_options.rowMax;
+            const Box2i window(Imath::V2i(dw.min.x, m_y0),
+                               Imath::V2i(dw.max.x, m_y1));
+            prepareFrameBuffer(m_framebuffer, window, header().channels(),
+                m_channelNames, m_types, m_outData);
+        }
+    }
+    catch (std::exception & e) {
+        setError(e);
+    }
+}
+
+
+void ReadJob::prepareDeep()
+{
+    const Box2i & dw = header().dataWindow();
+    const int width  = dw.max.x - dw.min.x + 1;
+    const int height = dw.max.y - dw.min.y + 1;
+    const size_t numPixels = static_cast<size_t>(width) * height;
+
+    // The sample counts decide the size of the outputs, so they are read
+    // here rather than in decode()
+    m_sampleCounts = mxCreateNumericMatrix(height, width, mxUINT32_CLASS, mxREAL);
+    uint32_T * counts = static_cast<uint32_T *>(mxGetData(m_sampleCounts));
+    const ptrdiff_t offset = - (static_cast<ptrdiff_t>(dw.min.x) * height +
+        dw.min.y);
+    m_deepFramebuffer.insertSampleCountSlice(Slice(UINT,
+        reinterpret_cast<char *>(counts + offset),
+        sizeof(uint32_T) * height, sizeof(uint32_T)));
+
+    if (m_deepFile != NULL) {
+        m_deepFile->setFrameBuffer(m_deepFramebuffer);
+        m_deepFile->readPixelSampleCounts(dw.min.y, dw.max.y);
+    } else {
+        m_deepTiledFile->setFrameBuffer(m_deepFramebuffer);
+        m_deepTiledFile->readPixelSampleCounts(0,
+            m_deepTiledFile->numXTiles() - 1, 0, m_deepTiledFile->numYTiles() - 1);
+    }
+
+    size_t numSamples = 0;
+    for (size_t p = 0; p != numPixels; ++p) {
+        numSamples += counts[p];
+    }
+
+    m_mxData.resize(m_channelNames.size());
+    m_samplePointers.resize(m_channelNames.size());
+    for (size_t i = 0; i != m_channelNames.size(); ++i) {
+        m_mxData[i] = mxCreateNumericMatrix(numSamples, 1,
+            getClassID(m_types[i]), mxREAL);
+        char * data = static_cast<char *>(mxGetData(m_mxData[i]));
+        const size_t typeSize = getTypeSize(m_types[i]);
+
+        // Each pixel points to its first sample
+        std::vector<char *> & pointers = m_samplePointers[i];
+        pointers.resize(numPixels);
+        for (size_t p = 0; p != numPixels; ++p) {
+            pointers[p] = data;
+            data += counts[p] * typeSize;
+        }
+
+        m_deepFramebuffer.insert(m_channelNames[i].c_str(), DeepSlice(m_types[i],
+            reinterpret_cast<char *>(&pointers[0] + offset),
+            sizeof(char *) * height, sizeof(char *), typeSize));
+    }
+}
+
+
+void ReadJob::decode()
+{
+    assert(!failed());
+    try {
+        if (m_deepFile != NULL) {
+            const Box2i & dw = header().dataWindow();
+            m_deepFile->setFrameBuffer(m_deepFramebuffer);
+            m_deepFile->readPixels(dw.min.y, dw.max.y);
+        }
+        else if (m_deepTiledFile != NULL) {
+            m_deepTiledFile->setFrameBuffer(m_deepFramebuffer);
+            m_deepTiledFile->readTiles(0, m_deepTiledFile->numXTiles() - 1,
+                0, m_deepTiledFile->numYTiles() - 1);
+        }
+        else if (m_direct) {
+            m_file->setFrameBuffer(m_framebuffer);
+            m_file->readPixels(m_y0, m_y1);
+        }
+        else if (m_tiledFile != NULL) {
+            readTiledRegion(*m_tiledFile, m_options, m_channelNames, m_types,
+                m_outData);
+        }
+        else if (m_options.isReduced()) {
+            readReducedRegion(*m_file, m_options, m_channelNames, m_types,
+                m_outData);
+        }
+        else {
+            readScanlineRegion(*m_file, m_options, m_channelNames, m_types,
+                m_outData);
+        }
+    }
+    catch (std::exception & e) {
+        setError(e);
+    }
+    close();
+}
+
+
+mxArray * ReadJob::result() const
+{
+    if (m_sampleCounts != NULL) {
+        const char * fields[] = {"samplecount", "channels"};
+        mxArray * deep = mxCreateStructMatrix(1, 1, 2, fields);
+        mxSetField(deep, 0, "samplecount", m_sampleCounts);
+        mxSetField(deep, 0, "channels", buildMap(m_channelNames, m_mxData));
+        return deep;
+    }
+    else if (m_options.cube) {
+        return m_mxData[0];
+    }
+    else if (m_channelNames.size() != 1) {
+        return buildMap(m_channelNames, m_mxData);
+    } else {
+        return m_mxData[0];
+    }
+}
+
+
+// Tasks for the batched reads
+class OpenTask : public IlmThread::Task
+{
+public:
+    OpenTask(IlmThread::TaskGroup * group, ReadJob * job) :
+    IlmThread::Task(group), m_job(job) {}
+
+    void execute() {
+        m_job->open();
+        m_job->postOpened();
+    }
+
+private:
+    ReadJob * m_job;
+};
+
+
+class DecodeTask : public IlmThread::Task
+{
+public:
+    DecodeTask(IlmThread::TaskGroup * group, ReadJob * job) :
+    IlmThread::Task(group), m_job(job) {}
+
+    void execute() {
+        m_job->decode();
+    }
+
+private:
+    ReadJob * m_job;
+};
+
+
+// Read all the files on the persistent file pool. The files ahead of the one
+// being prepared are opened in the background, so that the I/O of the next
+// files overlaps the decompression of the previous ones, which in turn runs
+// on OpenEXR's global thread pool. Returns the first failed job, or NULL.
+const ReadJob * readBatch(const std::vector<ReadJob *> & jobs)
+{
+    IlmThread::ThreadPool & pool = OpenEXRforMatlab::getFileThreadPool();
+    const size_t lookahead = static_cast<size_t>(std::max(pool.numThreads(), 1));
+
+    const ReadJob * failedJob = NULL;
+    {
+        // The destructor waits for all the tasks
+        IlmThread::TaskGroup taskGroup;
+        size_t numOpening = 0;
+        for (size_t i = 0; i != jobs.size() && failedJob == NULL; ++i) {
+            for (; numOpening < jobs.size() && numOpening <= i + lookahead;
+                 ++numOpening)
+            {
+                pool.addTask(new OpenTask(&taskGroup, jobs[numOpening]));
+            }
+
+            jobs[i]->waitOpened();
+            if (!jobs[i]->failed()) {
+                jobs[i]->prepare();
+            }
+            if (jobs[i]->failed()) {
+                failedJob = jobs[i];
+            } else {
+                pool.addTask(new DecodeTask(&taskGroup, jobs[i]));
+            }
+        }
+    }
+
+    for (size_t i = 0; i != jobs.size() && failedJob == NULL; ++i) {
+        if (jobs[i]->failed()) {
+            failedJob = jobs[i];
+        }
+    }
+    return failedJob;
+}
+
+
+// Get the channel lists for a batch: either one list for all the files, or a
+// cell vector with a list per file
+void getBatchChannels(int nrhs, const mxArray *prhs[], size_t numFiles,
+    std::vector<std::vector<std::string> > & outChannels)
+{
+    if (nrhs == 2 && mxIsCell(prhs[1]) && mxGetNumberOfElements(prhs[1]) != 0 &&
+        mxIsCell(mxGetCell(prhs[1], 0)))
+    {
+        if (mxGetNumberOfElements(prhs[1]) != numFiles) {
+            mexErrMsgIdAndTxt("OpenEXR:argument",
+                "Expected one channel list per file.");
+        }
+        outChannels.resize(numFiles);
+        for (size_t i = 0; i != numFiles; ++i) {
+            OpenEXRforMatlab::toNativeCheck(mxGetCell(prhs[1], i), outChannels[i]);
+        }
+    }
+    else {
+        std::vector<std::string> channelNames;
+        getRequestedChannels(nrhs, prhs, channelNames);
+        outChannels.assign(numFiles, channelNames);
+    }
+}
+
+
 } // namespace
 
 
@@ -215,73 +1299,111 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
         mexErrMsgIdAndTxt("OpenEXR:argument", "Too few arguments.");
     }
 
-    char *inputfilePtr = mxArrayToString(prhs[0]);
-    if (inputfilePtr == NULL) {
-        mexErrMsgIdAndTxt("OpenEXR:argument", "Invalid filename argument.");
+    // An optional trailing struct holds the read options
+    int nArgs = nrhs;
+    ReadOptions options;
+    if (nArgs > 1 && mxIsStruct(prhs[nArgs-1])) {
+        getReadOptions(prhs[nArgs-1], options);
+        --nArgs;
     }
-    // Copy to a string so that the matlab memory may be freed asap
-    const std::string inputfile(inputfilePtr);
-    mxFree(inputfilePtr); inputfilePtr = static_cast<char*>(0);
+
+    // The decoding threads come from the global pool, so make sure it is
+    // big enough for the requested count during this call
+    OpenEXRforMatlab::ScopedThreadCount threadCount(options.numThreads);
+
+    if (mxIsCell(prhs[0])) {
+        // Batch mode: a cell array of filenames returns a cell of results
+        if (nlhs > 1) {
+            mexErrMsgIdAndTxt("OpenEXR:argument",
+                "Invalid number of output arguments.");
+        }
+        const size_t numFiles = mxGetNumberOfElements(prhs[0]);
+        std::vector<Source> sources(numFiles);
+        for (size_t i = 0; i != numFiles; ++i) {
+            getSource(mxGetCell(prhs[0], i), sources[i]);
+        }
+        std::vector<std::vector<std::string> > channelNames;
+        getBatchChannels(nArgs, prhs, numFiles, channelNames);
+
+        std::vector<ReadJob *> jobs(numFiles);
+        for (size_t i = 0; i != numFiles; ++i) {
+            jobs[i] = new ReadJob(sources[i], channelNames[i], options);
+        }
+
+        const ReadJob * failedJob = readBatch(jobs);
+        if (failedJob != NULL) {
+            const std::string msg = failedJob->filename() + ": " + failedJob->error();
+            const char * id = failedJob->errorId();
+            for (size_t i = 0; i != jobs.size(); ++i) {
+                delete jobs[i];
+            }
+            mexErrMsgIdAndTxt(id, "%s", msg.c_str());
+        }
+
+        mxArray * results = mxCreateCellArray(mxGetNumberOfDimensions(prhs[0]),
+            mxGetDimensions(prhs[0]));
+        for (size_t i = 0; i != jobs.size(); ++i) {
+            mxSetCell(results, i, jobs[i]->result());
+            delete jobs[i];
+        }
+        plhs[0] = results;
+        return;
+    }
+
+    // Either a filename or the contents of a file
+    Source source;
+    getSource(prhs[0], source);
 
     // Get the strings of explicitly requested channels channels
     std::vector<std::string> channelNames;
-    getRequestedChannels(nrhs, prhs, channelNames);
+    getRequestedChannels(nArgs, prhs, channelNames);
 
-    // Validate the output arguments
-    if (nlhs > 1 && nlhs != static_cast<int>(channelNames.size())) {
+    // Validate the output arguments. Cubes may also return the channel names.
+    if (options.cube ? nlhs > 2 :
+        (nlhs > 1 && nlhs != static_cast<int>(channelNames.size())))
+    {
         mexErrMsgIdAndTxt("OpenEXR:argument",
             "Invalid number of output arguments.");
     }
-    
 
-    try {
-        InputFile img(inputfile.c_str());
 
-        if (!channelNames.empty()) {
-            // Validate that the channels are actually on the file
-            const ChannelList & channels = img.header().channels();
-            for (size_t i = 0; i != channelNames.size(); ++i) {
-                if (channels.find(channelNames[i].c_str()) == channels.end()) {
-                    mexErrMsgIdAndTxt("OpenEXR:argument",
-                        "Channel not in file: %s", channelNames[i].c_str());
-                }
-            }
-        } else {
-            // If there are no explicitly required channels, read all
-            getChannelNames(img.header().channels(), channelNames);
+    // The job closes the file when it goes out of scope, before any error
+    std::string errorMsg;
+    const char * errorId = NULL;
+    {
+        ReadJob job(source, channelNames, options);
+        job.open();
+        if (!job.failed()) {
+            job.prepare();
+        }
+        if (!job.failed()) {
+            job.decode();
         }
-        assert(!channelNames.empty());
-
-        // Prepare the framebuffer
-        const Box2i & dw = img.header().dataWindow();
-        const ChannelList & imgChannels = img.header().channels();
-        std::vector<mxArray *> mxData(channelNames.size());
-        FrameBuffer framebuffer;
-        prepareFrameBuffer(framebuffer, dw, imgChannels, channelNames, mxData);
 
-        // Actually read the pixels
-        img.setFrameBuffer(framebuffer);
-        img.readPixels(dw.min.y, dw.max.y);
-
-        // Assemble the result
-        if (nlhs <= 1) {
-            // Return a map if there are multiple channels, otherwise the data
-            if (channelNames.size() != 1) {
-                mxArray * resultMap = buildMap(channelNames, mxData);
-                plhs[0] = resultMap;
-            } else {
-                plhs[0] = mxData[0];
+        if (job.failed()) {
+            errorMsg = job.error();
+            errorId  = job.errorId();
+        }
+        else if (nlhs <= 1 || options.cube) {
+            // Assemble the result
+            plhs[0] = job.result();
+            if (nlhs == 2) {
+                const std::vector<std::string> & names = job.channelNames();
+                plhs[1] = mxCreateCellMatrix(1, names.size());
+                for (size_t i = 0; i != names.size(); ++i) {
+                    mxSetCell(plhs[1], i, mxCreateString(names[i].c_str()));
+                }
             }
         }
         else {
             // Multiple output arguments, assign the data directly
-            assert(nlhs == channelNames.size());
+            assert(nlhs == static_cast<int>(job.outputs().size()));
             for (int i = 0; i < nlhs; ++i) {
-                plhs[i] = mxData[i];
+                plhs[i] = job.outputs()[i];
             }
         }
     }
-    catch( Iex::BaseExc &e ) {
-        mexErrMsgIdAndTxt("OpenEXR:exception", e.what());
+    if (errorId != NULL) {
+        mexErrMsgIdAndTxt(errorId, "%s", errorMsg.c_str());
     }
 }
@@ -20,13 +20,73 @@ function exrreadchannels( filename )
 %   [M1,...] = EXRREADCHANNELS(FILENAME, CARRAY) behaves as above, but it
 %   receives a cell array with the names of the desired channels.
 %
+%   M = EXRREADCHANNELS(FILENAME,...,OPTS) behaves as above, where OPTS is
+%   a struct with any of these fields:
+%     rows   - [first last] 1-based rows to read, relative to the data
+%              window. Default is all the rows.
+%     cols   - [first last] 1-based columns to read. Default is all.
+%     stride - decimation factor, either a scalar or [rowStride colStride].
+%              Only every stride-th row/column of the region is returned.
+%     native - when true, return the channels in their stored pixel type
+%              instead of converting them to single: HALF channels as
+%              uint16 matrices with the raw half-float bit patterns and
+%              UINT channels as uint32. FLOAT channels are still single.
+%     cube   - when true, return a single HxWxN array whose planes are the
+%              channels in the requested order (all the channels of the
+%              file if none were requested), decoded directly into the
+%              array instead of building a containers.Map. All channels
+%              must have the same output type. [CUBE,NAMES] = ... also
+%              returns a cell array with the names of the planes.
+%     part   - name or 1-based index of the part to read from a multi-part
+%              file. Default is the first part. Only the selected part is
+%              decoded.
+%     mmap   - when true, the file is memory mapped instead of read
+%              through buffered I/O.
+%     threads - number of threads used to decompress each file. Zero
+%              decompresses in the calling thread; by default the count
+%              set through EXRTHREADS is used.
+%     level  - resolution level to read from a mipmapped or ripmapped
+%              tiled file, either a scalar or [ylevel xlevel] for ripmaps.
+%              Level 0 is the full resolution; the region is relative to
+%              the level. Files without lower resolution levels are box
+%              filtered instead, as with reduce = 2^level.
+%     reduce - box filter factor, either a scalar or [rowFactor colFactor].
+%              Each output pixel is the average of a block of the region,
+%              computed while decoding so that the full resolution image is
+%              never held in memory. The last row and column average the
+%              remaining pixels when the region is not a multiple of the
+%              factor. The output is always single; exclusive with stride.
+%   The returned matrices are sized to the region of interest. Tiled files
+%   only decode the tiles which overlap the region, and scanline files only
+%   decode the scanlines within it. Region reads of subsampled channels are
+%   not supported.
+%
+%   Deep parts return a struct with the fields 'samplecount', an HxW
+%   uint32 matrix with the number of samples of each pixel, and 'channels',
+%   a containers.Map with a column vector per channel holding all the
+%   samples: those of each pixel are consecutive, and the pixels are in
+%   column-major order. Regions, levels and cubes are not supported for
+%   deep parts.
+%
+%   M = EXRREADCHANNELS(BYTES,...) behaves as above, but decodes a file
+%   whose whole contents are in the uint8 array BYTES, for example a file
+%   stored inside an archive, without writing it to disk first.
+%
+%   R = EXRREADCHANNELS(FILENAMES,...) reads a batch of files, where
+%   FILENAMES is a cell array of strings or uint8 arrays, and returns a cell array R of the
+%   same size with the result for each file, as above. The channels are
+%   given as above and apply to every file, or as a single cell vector
+%   with one channel list per file. The files are opened and decoded on a
+%   persistent pool of threads, so that reading the next files overlaps
+%   the decompression of the previous ones.
+%
 %   For all these methods it is an error to request a channel which does
-%   not exist. Use EXRINFO to get a list of the channels available for
-%   a given file.
+%   not exist. Use EXRHEADER to get a list of the parts and channels
+%   available for a given file.
 %
 %   Note: this implementation uses the ILM IlmImf library version 1.7.
 %
-%   See also CONTAINERS.MAP,EXRINFO,EXRREAD,TONEMAP
+%   See also CONTAINERS.MAP,EXRHEADER,EXRTHREADS,EXRINFO,EXRREAD,TONEMAP
 
 % Edgar Velazquez-Armendariz (eva5@cs.cornell.edu)
 %
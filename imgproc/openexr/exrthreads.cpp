@@ -0,0 +1,85 @@
+/*============================================================================
+ 
+ OpenEXR for Matlab
+ 
+ Distributed under the MIT License (the "License");
+ see accompanying file LICENSE for details
+ or copy at http://opensource.org/licenses/MIT
+ 
+ Originated from HDRITools - High Dynamic Range Image Tools
+ Copyright 2011 Program of Computer Graphics, Cornell University
+ 
+ This software is distributed WITHOUT ANY WARRANTY; without even the
+ implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ See the License for more information.
+ -----------------------------------------------------------------------------
+ Authors:
+ Jinwei Gu <jwgu AT cs DOT cornell DOT edu>
+ Edgar Velazquez-Armendariz <eva5 AT cs DOT cornell DOT edu>
+ Manuel Leonhardt <leom AT hs-furtwangen DOT de>
+ 
+ ============================================================================*/
+
+
+#include <cstring>
+
+#include <mex.h>
+
+#ifdef __clang__
+  #pragma clang diagnostic push
+  #pragma clang diagnostic ignored "-Wlong-long"
+  #pragma clang diagnostic ignored "-Wdeprecated-register"
+  #pragma clang diagnostic ignored "-Wextra"
+#endif
+
+#include <ImfThreading.h>
+
+#ifdef __clang__
+  #pragma clang diagnostic pop
+#endif
+
+#include "utilities.h"
+
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+    // Picks up changes to maxNumCompThreads for the default count
+    OpenEXRforMatlab::mexEXRInit(true);
+
+    if (nrhs > 1) {
+        mexErrMsgIdAndTxt("OpenEXR:argument", "Too many arguments.");
+    } else if (nlhs > 2) {
+        mexErrMsgIdAndTxt("OpenEXR:argument", "Too many output arguments.");
+    }
+
+    const int previous = OPENEXR_IMF_INTERNAL_NAMESPACE::globalThreadCount();
+
+    if (nrhs == 1) {
+        const mxArray * arg = prhs[0];
+        int numThreads = -1;
+        if (mxIsChar(arg)) {
+            char * str = mxArrayToString(arg);
+            const bool isDefault = str != NULL && strcmp(str, "default") == 0;
+            mxFree(str);
+            if (!isDefault) {
+                mexErrMsgIdAndTxt("OpenEXR:argument",
+                    "The only valid string argument is 'default'.");
+            }
+        }
+        else if (mxIsNumeric(arg) && mxGetNumberOfElements(arg) == 1 &&
+                 mxGetScalar(arg) >= 0)
+        {
+            numThreads = static_cast<int>(mxGetScalar(arg));
+        }
+        else {
+            mexErrMsgIdAndTxt("OpenEXR:argument",
+                "The number of threads must be a non-negative scalar.");
+        }
+        OpenEXRforMatlab::setThreadCount(numThreads);
+    }
+
+    plhs[0] = mxCreateDoubleScalar(previous);
+    if (nlhs > 1) {
+        plhs[1] = mxCreateDoubleScalar(OpenEXRforMatlab::getNumCPUs());
+    }
+}
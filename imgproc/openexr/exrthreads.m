@@ -0,0 +1,29 @@
+function exrthreads( n )
+%EXRTHREADS    Query or set the number of threads used by OpenEXR.
+%   N = EXRTHREADS returns the number of threads which OpenEXR uses to
+%   compress and decompress pixels in the OpenEXR MEX functions.
+%
+%   [N, NCPUS] = EXRTHREADS also returns the number of CPUs available to
+%   this Matlab process. This takes into account the CPU affinity of the
+%   process and, on Linux, the CPU quota of its cgroup (e.g. containers or
+%   batch schedulers).
+%
+%   OLD = EXRTHREADS(N) sets the number of threads to N for the rest of the
+%   Matlab session, and returns the previous count. Zero means that all the
+%   work happens in the calling thread.
+%
+%   OLD = EXRTHREADS('default') restores the default number of threads,
+%   which is the number of available CPUs but no more than
+%   MAXNUMCOMPTHREADS. Within parallel pools, where MAXNUMCOMPTHREADS is
+%   usually 1, each worker then decodes in its own thread instead of
+%   competing for the cores with the other workers. The default is
+%   computed when the OpenEXR functions are first used; call EXRTHREADS
+%   after changing MAXNUMCOMPTHREADS to apply the new value.
+%
+%   The number of threads for a single call is set through the 'threads'
+%   option of EXRREADCHANNELS and EXRWRITECHANNELS.
+%
+%   See also EXRREADCHANNELS,EXRWRITECHANNELS,MAXNUMCOMPTHREADS
+
+% (The help system uses this file, but actually doing something with it
+% will employ the mex file).
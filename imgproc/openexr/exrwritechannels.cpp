@@ -24,7 +24,9 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <algorithm>
 #include <cassert>
+#include <cstdio>
 
 #include <mex.h>
 
@@ -40,11 +42,20 @@
 #include <ImfPixelType.h>
 #include <ImfCompression.h>
 #include <ImfOutputFile.h>
+#include <ImfTiledOutputFile.h>
+#include <ImfMultiPartOutputFile.h>
+#include <ImfOutputPart.h>
+#include <ImfTiledOutputPart.h>
+#include <ImfPartType.h>
+#include <ImfTileDescription.h>
 #include <ImfHeader.h>
 #include <ImfChannelList.h>
+#include <ImfStringVectorAttribute.h>
+#include <ImfVecAttribute.h>
 #include <ImfNamespace.h>
 #include <ImathMath.h>
 #include <ImfFrameBuffer.h>
+#include <ImfThreading.h>
 
 #ifdef __clang__
   #pragma clang diagnostic pop
@@ -66,10 +77,6 @@ struct MatricesVec
     std::vector<std::pair<const mxArray *, mxClassID> > data;
 };
 
-// To hold a vector of attributes
-typedef std::pair<std::string, OPENEXR_IMF_INTERNAL_NAMESPACE::Attribute *> AttributePair;
-typedef std::vector<AttributePair> AttributeVector;
-
 
 template<>
 bool toNative(const mxArray * pa, MatricesVec & outData)
@@ -138,63 +145,6 @@ bool toNative(const mxArray * pa, MatricesVec & outData)
 
 
 
-// Convert from a containters.Map object into a set of attributes. The caller
-// is responsible to delete the attribute pointers returned.
-template <>
-bool toNative(const mxArray * pa, AttributeVector &outAttributes)
-{
-    if (!mxIsClass(pa, "containers.Map")) {
-        mexErrMsgIdAndTxt("OpenEXR:argument", "Not a containers.Map object.");
-    }
-
-    // Extract the cell arrays with the names and values for the attributes
-    mxArray * map = const_cast<mxArray *>(pa);
-    mxArray * isempty    = NULL;
-    mxArray * namesCell  = NULL;
-    mxArray * valuesCell = NULL;
-    if (mexCallMATLAB(1, &isempty, 1, &map, "isempty") != 0) {
-        mexErrMsgIdAndTxt("OpenEXR:argument", "Could not query the map.");
-    }
-    else if (mxIsLogicalScalarTrue(isempty)) {
-        mxDestroyArray (isempty);
-        return true;
-    }
-
-    if (mexCallMATLAB(1, &namesCell, 1, &map, "keys") != 0) {
-        mexErrMsgIdAndTxt("OpenEXR:argument", "Could not get the map keys.");
-    }
-
-    std::vector<std::string> names;
-    if (!toNative(namesCell, names)) {
-        mexWarnMsgIdAndTxt("OpenEXR:unsupported",
-            "The attribute map contains non-string keys.");
-        mxDestroyArray(namesCell);
-        return false;
-    } else {
-        mxDestroyArray(namesCell);
-        namesCell = NULL;
-    }
-
-    if (mexCallMATLAB(1, &valuesCell, 1, &map, "values") != 0) {
-        mxDestroyArray(namesCell);
-        mexErrMsgIdAndTxt("OpenEXR:argument", "Could not get the map values.");
-    }
-
-    assert(names.size() == mxGetNumberOfElements(valuesCell));
-    for (size_t i = 0; i != names.size(); ++i) {
-        OPENEXR_IMF_INTERNAL_NAMESPACE::Attribute* attr = toAttribute(mxGetCell(valuesCell, i));
-        if (attr != NULL) {
-            AttributePair pair(names[i], attr);
-            outAttributes.push_back(pair);
-        }
-    }
-
-    mxDestroyArray(valuesCell);
-    return true;
-}
-
-
-
 // Convert from a containters.Map object. This is very memory intensive since
 // it will create cell arrays using dynamic Matlab memory.
 bool toNative(const mxArray * pa,
@@ -246,6 +196,129 @@ using namespace OpenEXRforMatlab;
 namespace
 {
 
+// Minimum number of scanlines converted and written at a time
+const int MIN_BLOCK_ROWS = 64;
+
+// Maximum size of the converted pixels of a block, in bytes
+const size_t MAX_BLOCK_BYTES = 16 << 20;
+
+
+// Optional arguments given as a trailing struct. Files are tiled when either
+// a tile size or a level mode is given; a negative thread count means the
+// global OpenEXR thread count. Multi-part files are written when the part
+// names are given. A color filter array pattern, stored column-major as
+// 1-based color indices, writes the data as a sensor mosaic.
+struct WriteOptions
+{
+    bool tiled;
+    OPENEXR_IMF_INTERNAL_NAMESPACE::TileDescription tiles;
+    int numThreads;
+    std::vector<std::string> parts;
+    std::vector<int> cfa;
+    size_t cfaRows;
+    size_t cfaCols;
+
+    WriteOptions() : tiled(false), tiles(64, 64), numThreads(-1),
+    cfaRows(0), cfaCols(0) {}
+};
+
+
+// Parse the options struct
+void getWriteOptions(const mxArray * pa, WriteOptions & options)
+{
+    static const char * knownFields[] =
+        {"tilesize", "levels", "rounding", "threads", "parts", "cfa"};
+    const int numKnown = sizeof(knownFields) / sizeof(const char *);
+
+    checkOptionFields(pa, knownFields, numKnown);
+
+    double values[2];
+    size_t count = 0;
+    // Tile sizes are given as [rows cols], like the strides of exrreadchannels
+    if (getNumericOption(pa, "tilesize", 1, 2, values, count)) {
+        if (values[0] < 1 || values[count-1] < 1) {
+            mexErrMsgIdAndTxt("OpenEXR:argument",
+                "The tile size must be a positive integer.");
+        }
+        options.tiles.ySize = static_cast<unsigned int>(values[0]);
+        options.tiles.xSize = static_cast<unsigned int>(values[count-1]);
+        options.tiled = true;
+    }
+    if (getOption(pa, "levels", options.tiles.mode)) {
+        options.tiled = true;
+    }
+    getOption(pa, "rounding", options.tiles.roundingMode);
+
+    if (getNumericOption(pa, "threads", 1, 1, values, count)) {
+        if (values[0] < 0) {
+            mexErrMsgIdAndTxt("OpenEXR:argument",
+                "The number of threads must be non-negative.");
+        }
+        options.numThreads = static_cast<int>(values[0]);
+    }
+
+    if (getOption(pa, "parts", options.parts) && options.parts.empty()) {
+        mexErrMsgIdAndTxt("OpenEXR:argument", "Empty list of part names.");
+    }
+
+    const mxArray * cfa = mxGetField(pa, 0, "cfa");
+    if (cfa != NULL && !mxIsEmpty(cfa)) {
+        if (!mxIsNumeric(cfa) || mxIsComplex(cfa) ||
+            mxGetNumberOfDimensions(cfa) != 2)
+        {
+            mexErrMsgIdAndTxt("OpenEXR:argument",
+                "The 'cfa' option must be a matrix of color indices.");
+        }
+        options.cfaRows = mxGetM(cfa);
+        options.cfaCols = mxGetN(cfa);
+        std::vector<double> pattern(options.cfaRows * options.cfaCols);
+        convertData(&pattern[0], cfa, mxGetClassID(cfa), pattern.size());
+        for (size_t i = 0; i != pattern.size(); ++i) {
+            if (pattern[i] < 1 || pattern[i] != static_cast<int>(pattern[i])) {
+                mexErrMsgIdAndTxt("OpenEXR:argument",
+                    "The 'cfa' color indices must be positive integers.");
+            }
+            options.cfa.push_back(static_cast<int>(pattern[i]));
+        }
+    }
+}
+
+
+// Box filter a row-major image by half along the dimensions in which the
+// next level is smaller. Odd sizes replicate the last row or column, which
+// is what the ROUND_UP level sizes require.
+void reduceLevel(const std::vector<float> & src, int srcWidth, int srcHeight,
+                 std::vector<float> & dest, int destWidth, int destHeight)
+{
+    const int dx = destWidth  < srcWidth  ? 1 : 0;
+    const int dy = destHeight < srcHeight ? 1 : 0;
+    const float scale = 1.0f / ((1 << dx) * (1 << dy));
+
+    dest.resize(static_cast<size_t>(destWidth) * destHeight);
+    for (int y = 0; y < destHeight; ++y) {
+        const float * row0 = &src[static_cast<size_t>(y << dy) * srcWidth];
+        const float * row1 = &src[static_cast<size_t>(
+            std::min((y << dy) + dy, srcHeight - 1)) * srcWidth];
+        float * out = &dest[static_cast<size_t>(y) * destWidth];
+        for (int x = 0; x < destWidth; ++x) {
+            const int x0 = x << dx;
+            const int x1 = std::min(x0 + dx, srcWidth - 1);
+            float sum = row0[x0];
+            if (dx) {
+                sum += row0[x1];
+            }
+            if (dy) {
+                sum += row1[x0];
+                if (dx) {
+                    sum += row1[x1];
+                }
+            }
+            out[x] = sum * scale;
+        }
+    }
+}
+
+
 // Class to be queried for actual data during the OpenEXR file creation
 class WriteData {
 
@@ -253,20 +326,31 @@ public:
     WriteData(const std::string & filename,
          OPENEXR_IMF_INTERNAL_NAMESPACE::Compression compression, OPENEXR_IMF_INTERNAL_NAMESPACE::PixelType targetPixelType,
          const AttributeVector & attributes,
-         const std::vector<std::string> & channelNames,
-         const MatricesVec channelData);
+         const WriteOptions & options);
 
     ~WriteData();
 
-    typedef std::pair<std::string, char *> DataPair;
+    typedef std::pair<const mxArray *, mxClassID> MatrixPair;
+    typedef std::pair<std::string, MatrixPair> DataPair;
+
+    // Add a part with the given channels. Files with a single part are
+    // written as regular single-part files, for which the name is optional.
+    void addPart(const std::string & name,
+         const std::vector<std::string> & channelNames,
+         const MatricesVec & channelData);
+
+    // Add a part with one channel for each site of a color filter array
+    // pattern over a sensor mosaic. The channels are subsampled by the size
+    // of the pattern and named after the color of their site, numbered when
+    // a color appears more than once in the pattern.
+    void addMosaicPart(const std::string & name,
+         const std::vector<std::string> & colorNames,
+         const MatricesVec & mosaic, const std::vector<int> & pattern,
+         size_t patternRows, size_t patternCols);
 
     // Write the OpenEXR file. Note that this method may throw exceptions
     void writeEXR() const;
 
-    inline size_t size() const {
-        return m_channels.size();
-    }
-
     inline size_t typeSize() const {
         switch(type()) {
         case OPENEXR_IMF_INTERNAL_NAMESPACE::HALF:
@@ -281,22 +365,6 @@ public:
         }
     }
 
-    inline size_t xStride() const {
-        return m_height;
-    }
-
-    inline size_t yStride() const {
-        return 1;
-    }
-
-    inline size_t width() const {
-        return m_width;
-    }
-
-    inline size_t height() const {
-        return m_height;
-    }
-
     inline const std::string & filename() const {
         return m_filename;
     }
@@ -309,36 +377,94 @@ public:
         return m_type;
     }
 
+    inline int numThreads() const {
+        return m_numThreads;
+    }
+
 
 private:
 
-    // Helper function to create local copies of the data if necessary
-    template <typename TargetType>
-    char* prepareChannel(const std::pair<const mxArray *, mxClassID> & pair);
+    // Pairs of channels and the Matlab matrix with the data, all of the
+    // same size. The channels of mosaic parts are sampled every xSampling
+    // columns and ySampling rows, starting at the offset of their site.
+    struct Part
+    {
+        std::string name;
+        size_t width;
+        size_t height;
+        std::vector<DataPair> channels;
+        size_t xSampling;
+        size_t ySampling;
+        std::vector<std::pair<size_t, size_t> > sites;
+
+        Part() : width(0), height(0), xSampling(1), ySampling(1) {}
+
+        inline size_t size() const {
+            return channels.size();
+        }
 
-    inline const std::string & channelName (size_t index) const {
-        return m_channels[index].first;
-    }
+        // Size of the channels, accounting for the subsampling
+        inline size_t channelWidth() const {
+            return width / xSampling;
+        }
 
-    inline char * channelData (size_t index) const {
-        return m_channels[index].second;
-    }
+        inline RowSource channelSource (size_t index) const {
+            const RowSource source(channels[index].second.first);
+            if (sites.empty()) {
+                return source;
+            }
+            return source.sample(sites[index].first, sites[index].second,
+                xSampling, ySampling);
+        }
+
+        inline const std::string & channelName (size_t index) const {
+            return channels[index].first;
+        }
+
+        inline const MatrixPair & channelData (size_t index) const {
+            return channels[index].second;
+        }
+    };
+
+    // Create the header with the attributes and channels of a part
+    OPENEXR_IMF_INTERNAL_NAMESPACE::Header createHeader(const Part & part) const;
+
+    // Write the data as scanlines, or as tiles of a single level
+    template <class OutputType>
+    void writeScanlines(OutputType & file, const Part & part) const;
+    template <class TiledOutputType>
+    void writeTiles(TiledOutputType & file, const Part & part) const;
+
+    // Write all the levels of a mipmapped or ripmapped part
+    template <class TiledOutputType>
+    void writeLevels(TiledOutputType & file, const Part & part) const;
+
+    // Write one level of a tiled part from single precision channels
+    template <class TiledOutputType>
+    void writeLevel(TiledOutputType & file, const Part & part,
+        std::vector<std::vector<float> > & level, int lx, int ly) const;
+
+    // Convert a block of scanlines of all the channels into row-major
+    // order, in parallel across the channels and blocks of rows
+    void convertChannels(const Part & part,
+        std::vector<std::vector<char> > & buffers,
+        size_t firstRow, size_t numRows) const;
+
+    // Number of scanlines converted and written at a time
+    int blockRows(const Part & part) const;
 
     
     const std::string m_filename;
     const OPENEXR_IMF_INTERNAL_NAMESPACE::Compression m_compression;
     const OPENEXR_IMF_INTERNAL_NAMESPACE::PixelType m_type;
-    const size_t m_width;
-    const size_t m_height;
+    const bool m_tiled;
+    const OPENEXR_IMF_INTERNAL_NAMESPACE::TileDescription m_tiles;
+    const int m_numThreads;
 
     // Attributes of which we take ownership
     AttributeVector m_attributes;
     
-    // Pairs of channels and a pointer to the data
-    std::vector<DataPair> m_channels;
-
-    // Data created through mxMalloc
-    std::vector<void*> m_allocated;
+    std::vector<Part> m_parts;
 };
 
 
@@ -346,67 +472,142 @@ WriteData::WriteData(const std::string & filename,
                     OPENEXR_IMF_INTERNAL_NAMESPACE::Compression compression,
                     OPENEXR_IMF_INTERNAL_NAMESPACE::PixelType targetPixelType,
                     const AttributeVector & attributes,
-                    const std::vector<std::string> & channelNames,
-                    const MatricesVec channelData) :
+                    const WriteOptions & options) :
 m_filename(filename), m_compression(compression), m_type(targetPixelType),
-m_width(channelData.N), m_height(channelData.M),
+m_tiled(options.tiled), m_tiles(options.tiles),
+m_numThreads(options.numThreads < 0 ?
+    OPENEXR_IMF_INTERNAL_NAMESPACE::globalThreadCount() : options.numThreads),
 m_attributes(attributes)
+{
+    if (type() != OPENEXR_IMF_INTERNAL_NAMESPACE::FLOAT &&
+        type() != OPENEXR_IMF_INTERNAL_NAMESPACE::HALF)
+    {
+        assert("Unsupported Pixel Type" == 0);
+        mexErrMsgIdAndTxt("OpenEXR:unsupported",
+            "Unsupported pixel type: %d", static_cast<int>(type()));
+    }
+}
+
+
+void WriteData::addPart(const std::string & name,
+                        const std::vector<std::string> & channelNames,
+                        const MatricesVec & channelData)
 {
     assert(!channelNames.empty());
     assert(channelNames.size() == channelData.data.size());
 
+    Part part;
+    part.name = name;
+    part.width = channelData.N;
+    part.height = channelData.M;
     for (size_t i = 0; i < channelNames.size(); ++i) {
-        char * data;
-        switch (type()) {
-        case OPENEXR_IMF_INTERNAL_NAMESPACE::FLOAT:
-            data = prepareChannel<float>(channelData.data[i]);
-            break;
-        case OPENEXR_IMF_INTERNAL_NAMESPACE::HALF:
-            data = prepareChannel<half>(channelData.data[i]);
-            break;
-        default:
-            assert("Unsupported Pixel Type" == 0);
-            mexErrMsgIdAndTxt("OpenEXR:unsupported",
-                "Unsupported pixel type: %d", static_cast<int>(type()));
-            data = NULL; // Keep compiler happy
+        DataPair pair(channelNames[i], channelData.data[i]);
+        part.channels.push_back(pair);
+    }
+    m_parts.push_back(part);
+}
 
-        }
 
-        DataPair pair(channelNames[i], data);
-        m_channels.push_back(pair);
+void WriteData::addMosaicPart(const std::string & name,
+                              const std::vector<std::string> & colorNames,
+                              const MatricesVec & mosaic,
+                              const std::vector<int> & pattern,
+                              size_t patternRows, size_t patternCols)
+{
+    assert(mosaic.data.size() == 1);
+    assert(pattern.size() == patternRows * patternCols);
+    assert(mosaic.M % patternRows == 0 && mosaic.N % patternCols == 0);
+
+    std::vector<int> count(colorNames.size(), 0);
+    for (size_t i = 0; i != pattern.size(); ++i) {
+        assert(pattern[i] >= 1 && pattern[i] <= static_cast<int>(colorNames.size()));
+        ++count[pattern[i] - 1];
+    }
+
+    Part part;
+    part.name = name;
+    part.width = mosaic.N;
+    part.height = mosaic.M;
+    part.xSampling = patternCols;
+    part.ySampling = patternRows;
+
+    // Sites in row-major order, so that G1 precedes G2 in a Bayer pattern
+    std::vector<int> ordinal(colorNames.size(), 0);
+    for (size_t y = 0; y != patternRows; ++y) {
+        for (size_t x = 0; x != patternCols; ++x) {
+            const int color = pattern[x * patternRows + y] - 1;
+            std::string channelName = colorNames[color];
+            if (count[color] > 1) {
+                char suffix[16];
+                snprintf(suffix, sizeof(suffix), "%d", ++ordinal[color]);
+                channelName += suffix;
+            }
+            part.channels.push_back(DataPair(channelName, mosaic.data[0]));
+            part.sites.push_back(std::make_pair(x, y));
+        }
     }
+    m_parts.push_back(part);
 }
 
 
-template <typename TargetType>
-char * WriteData::prepareChannel(const std::pair<const mxArray *,
-                                 mxClassID> & pair)
+void WriteData::convertChannels(const Part & part,
+                                std::vector<std::vector<char> > & buffers,
+                                size_t firstRow, size_t numRows) const
 {
-    const mxArray* pa       = pair.first;
-    const mxClassID srcType = pair.second;
-
-    if (srcType == OpenEXRforMatlab::mex_traits<TargetType>::classID) {
-        // If the type is compatible, just return a pointer to the Matlab data
-        return static_cast<char*>(mxGetData(pa));
+    assert(buffers.size() == part.size());
+    std::vector<RowSource> sources;
+    for (size_t i = 0; i != part.size(); ++i) {
+        sources.push_back(part.channelSource(i));
     }
-    else {
-        // Allocate enough space and convert in place
-        const size_t numPixels = width() * height();
-        void * rawData = mxMalloc(sizeof(TargetType) * numPixels);
-        m_allocated.push_back(rawData);
-        TargetType * dest = static_cast<TargetType*> (rawData);
-        convertData(dest, pa, srcType, numPixels);
-        return reinterpret_cast<char*>(dest);
+
+    switch (type()) {
+    case OPENEXR_IMF_INTERNAL_NAMESPACE::FLOAT:
+        {
+            std::vector<float *> dests;
+            for (size_t i = 0; i != buffers.size(); ++i) {
+                dests.push_back(reinterpret_cast<float *>(&buffers[i][0]));
+            }
+            convertRowsParallel(dests, sources, firstRow, numRows, numThreads());
+        }
+        break;
+    case OPENEXR_IMF_INTERNAL_NAMESPACE::HALF:
+        {
+            std::vector<half *> dests;
+            for (size_t i = 0; i != buffers.size(); ++i) {
+                dests.push_back(reinterpret_cast<half *>(&buffers[i][0]));
+            }
+            convertRowsParallel(dests, sources, firstRow, numRows, numThreads());
+        }
+        break;
+    default:
+        assert("Unsupported Pixel Type" == 0);
     }
 }
 
 
-WriteData::~WriteData()
+int WriteData::blockRows(const Part & part) const
 {
-    for (size_t i = 0; i != m_allocated.size(); ++i) {
-        mxFree(m_allocated[i]);
+    // Enough compressed blocks to keep all the encoding threads busy, in
+    // whole rows of the subsampled channels. The block is capped at
+    // MAX_BLOCK_BYTES (but at least one compressed block), otherwise large
+    // blocks such as DWAB's with many threads would span the whole image.
+    const int ySampling = static_cast<int>(part.ySampling);
+    const int linesPerBlock = getLinesPerBlock(compression());
+    int rows = std::max(MIN_BLOCK_ROWS,
+        linesPerBlock * std::max(numThreads(), 1));
+    const size_t rowBytes = std::max(static_cast<size_t>(1),
+        typeSize() * part.channelWidth() * part.size());
+    const size_t maxRows = MAX_BLOCK_BYTES / rowBytes * part.ySampling;
+    if (maxRows < static_cast<size_t>(rows)) {
+        rows = std::max(linesPerBlock, static_cast<int>(maxRows));
     }
+    rows = (rows + ySampling - 1) / ySampling * ySampling;
+    return std::min(rows, static_cast<int>(part.height));
+}
+
 
+WriteData::~WriteData()
+{
     for (size_t i = 0; i != m_attributes.size(); ++i) {
         if (m_attributes[i].second != NULL) {
             delete m_attributes[i].second;
@@ -415,12 +616,12 @@ WriteData::~WriteData()
 }
 
 
-void WriteData::writeEXR() const
+OPENEXR_IMF_INTERNAL_NAMESPACE::Header WriteData::createHeader(const Part & part) const
 {
     using namespace OPENEXR_IMF_INTERNAL_NAMESPACE;
     using namespace Imath;
 
-    Header header(static_cast<int>(width()), static_cast<int>(height()),
+    Header header(static_cast<int>(part.width), static_cast<int>(part.height),
         1.0f,            // aspect ratio
         V2f(0.0f, 0.0f), // screen window center,
         1.0f,            // screen window width,
@@ -435,32 +636,248 @@ void WriteData::writeEXR() const
     }
 
     // Insert channels in the header
-    for (size_t i = 0; i != size(); ++i) {
-        header.channels().insert(channelName(i).c_str(), Channel(type()));
+    for (size_t i = 0; i != part.size(); ++i) {
+        header.channels().insert(part.channelName(i).c_str(),
+            Channel(type(), static_cast<int>(part.xSampling),
+                    static_cast<int>(part.ySampling)));
+    }
+
+    // The channel list is sorted by name, so record the layout of the sites
+    if (!part.sites.empty()) {
+        StringVector pattern;
+        for (size_t i = 0; i != part.size(); ++i) {
+            pattern.push_back(part.channelName(i));
+        }
+        header.insert("cfaPattern", StringVectorAttribute(pattern));
+        header.insert("cfaSize", V2iAttribute(V2i(
+            static_cast<int>(part.xSampling), static_cast<int>(part.ySampling))));
+    }
+
+    if (m_tiled) {
+        header.setTileDescription(m_tiles);
+    }
+    if (!part.name.empty()) {
+        header.setName(part.name);
+    }
+    if (m_parts.size() > 1) {
+        header.setType(m_tiled ? TILEDIMAGE : SCANLINEIMAGE);
+    }
+    return header;
+}
+
+
+void WriteData::writeEXR() const
+{
+    using namespace OPENEXR_IMF_INTERNAL_NAMESPACE;
+    assert(!m_parts.empty());
+
+    std::vector<Header> headers;
+    for (size_t i = 0; i != m_parts.size(); ++i) {
+        headers.push_back(createHeader(m_parts[i]));
+    }
+
+    // The encoding threads come from the global pool, so make sure it is
+    // big enough for the requested count while the file is written
+    ScopedThreadCount threadCount(numThreads());
+    const bool levels = m_tiled && m_tiles.mode != ONE_LEVEL;
+
+    if (m_parts.size() == 1) {
+        if (!m_tiled) {
+            OutputFile file(filename().c_str(), headers[0], numThreads());
+            writeScanlines(file, m_parts[0]);
+        } else {
+            TiledOutputFile file(filename().c_str(), headers[0], numThreads());
+            if (levels) {
+                writeLevels(file, m_parts[0]);
+            } else {
+                writeTiles(file, m_parts[0]);
+            }
+        }
+        return;
+    }
+
+    MultiPartOutputFile file(filename().c_str(), &headers[0],
+        static_cast<int>(headers.size()), false, numThreads());
+    for (size_t i = 0; i != m_parts.size(); ++i) {
+        const int partIndex = static_cast<int>(i);
+        if (!m_tiled) {
+            OutputPart part(file, partIndex);
+            writeScanlines(part, m_parts[i]);
+        } else {
+            TiledOutputPart part(file, partIndex);
+            if (levels) {
+                writeLevels(part, m_parts[i]);
+            } else {
+                writeTiles(part, m_parts[i]);
+            }
+        }
+    }
+}
+
+
+template <class OutputType>
+void WriteData::writeScanlines(OutputType & file, const Part & part) const
+{
+    using namespace OPENEXR_IMF_INTERNAL_NAMESPACE;
+
+    // Matlab matrices are column-major, so rather than handing OpenEXR a
+    // framebuffer which strides across the whole image for every scanline,
+    // each block of scanlines is converted and transposed into a small
+    // row-major buffer which is then written.
+    // Subsampled channels hold one row for every ySampling scanlines.
+    const size_t numBlockRows = static_cast<size_t>(blockRows(part));
+    const size_t ySampling = part.ySampling;
+    const size_t rowSize = typeSize() * part.channelWidth();
+    std::vector<std::vector<char> > buffers(part.size(),
+        std::vector<char>(rowSize * (numBlockRows / ySampling)));
+
+    for (size_t y = 0; y < part.height; y += numBlockRows) {
+        const size_t numRows = std::min(numBlockRows, part.height - y);
+
+        // Create and populate the frame buffer for this block
+        convertChannels(part, buffers, y / ySampling, numRows / ySampling);
+        FrameBuffer frameBuffer;
+        for (size_t i = 0; i != part.size(); ++i) {
+            char * data = &buffers[i][0];
+            frameBuffer.insert(part.channelName(i).c_str(),  // name
+                Slice(type(),                                // type
+                      data - (y / ySampling) * rowSize,      // base
+                      typeSize(),                            // xStride
+                      rowSize,                               // yStride
+                      static_cast<int>(part.xSampling),      // xSampling
+                      static_cast<int>(ySampling)));         // ySampling
+        }
+
+        file.setFrameBuffer(frameBuffer);
+        file.writePixels(static_cast<int>(numRows));
+    }
+}
+
+
+template <class TiledOutputType>
+void WriteData::writeTiles(TiledOutputType & file, const Part & part) const
+{
+    using namespace OPENEXR_IMF_INTERNAL_NAMESPACE;
+
+    // Same as with scanlines, but converting whole rows of tiles at a time
+    const size_t tileRows = m_tiles.ySize;
+    const size_t numTileRows = std::max(static_cast<size_t>(1),
+        static_cast<size_t>(blockRows(part)) / tileRows);
+    const size_t numBlockRows = std::min(numTileRows * tileRows, part.height);
+    const size_t rowSize = typeSize() * part.width;
+    std::vector<std::vector<char> > buffers(part.size(),
+        std::vector<char>(rowSize * numBlockRows));
+
+    const int lastTileX = file.numXTiles() - 1;
+    for (size_t y = 0; y < part.height; y += numBlockRows) {
+        const size_t numRows = std::min(numBlockRows, part.height - y);
+
+        convertChannels(part, buffers, y, numRows);
+        FrameBuffer frameBuffer;
+        for (size_t i = 0; i != part.size(); ++i) {
+            char * data = &buffers[i][0];
+            frameBuffer.insert(part.channelName(i).c_str(),
+                Slice(type(), data - y * rowSize, typeSize(), rowSize));
+        }
+
+        file.setFrameBuffer(frameBuffer);
+        file.writeTiles(0, lastTileX, static_cast<int>(y / tileRows),
+            static_cast<int>((y + numRows - 1) / tileRows));
     }
+}
+
+
+template <class TiledOutputType>
+void WriteData::writeLevels(TiledOutputType & file, const Part & part) const
+{
+    using namespace OPENEXR_IMF_INTERNAL_NAMESPACE;
 
-    OutputFile file(filename().c_str(), header);
+    // The reduced levels are computed in single precision from the full
+    // resolution level; OpenEXR converts them to half while writing if needed.
+    // Each level is box filtered from the previous one into a second buffer
+    // and the two are swapped, so that only two full size copies exist.
+    typedef std::vector<float> Level;
+    std::vector<Level> base(part.size()), current(part.size());
+    std::vector<float *> dests;
+    std::vector<RowSource> sources;
+    for (size_t i = 0; i != part.size(); ++i) {
+        base[i].resize(part.width * part.height);
+        dests.push_back(&base[i][0]);
+        sources.push_back(part.channelSource(i));
+    }
+    convertRowsParallel(dests, sources, 0, part.height, numThreads());
 
-    // Create and populate the frame buffer
+    const bool ripmap = m_tiles.mode == RIPMAP_LEVELS;
+    std::vector<Level> row, previous;
+    if (ripmap) {
+        row.resize(part.size());
+        previous.resize(part.size());
+    }
+    for (int ly = 0; ly < file.numYLevels(); ++ly) {
+
+        // Reduce the first level of this row of levels from the previous one:
+        // vertically for ripmaps, in both directions for mipmaps
+        const int firstX = ripmap ? 0 : ly;
+        if (ly > 0) {
+            const int srcLevel = ripmap ? 0 : ly - 1;
+            for (size_t i = 0; i != part.size(); ++i) {
+                reduceLevel(base[i],
+                    file.levelWidth(srcLevel), file.levelHeight(ly - 1),
+                    current[i], file.levelWidth(firstX), file.levelHeight(ly));
+            }
+            base.swap(current);
+        }
+        writeLevel(file, part, base, firstX, ly);
+
+        // The other levels of a ripmap row are reduced horizontally, leaving
+        // the first one for the next row
+        const int numXLevels = ripmap ? file.numXLevels() : 1;
+        for (int lx = 1; lx < numXLevels; ++lx) {
+            const std::vector<Level> & src = lx == 1 ? base : row;
+            for (size_t i = 0; i != part.size(); ++i) {
+                reduceLevel(src[i],
+                    file.levelWidth(lx - 1), file.levelHeight(ly),
+                    previous[i], file.levelWidth(lx), file.levelHeight(ly));
+            }
+            row.swap(previous);
+            writeLevel(file, part, row, lx, ly);
+        }
+    }
+}
+
+
+template <class TiledOutputType>
+void WriteData::writeLevel(TiledOutputType & file, const Part & part,
+    std::vector<std::vector<float> > & level, int lx, int ly) const
+{
+    using namespace OPENEXR_IMF_INTERNAL_NAMESPACE;
+
+    const size_t rowSize = sizeof(float) * file.levelWidth(lx);
     FrameBuffer frameBuffer;
-    for (size_t i = 0; i != size(); ++i) {
-        frameBuffer.insert(channelName(i).c_str(),  // name
-            Slice(type(),                           // type
-                  channelData(i),                   // base
-                  typeSize() * xStride(),           // xStride
-                  typeSize() * yStride()));         // yStride
+    for (size_t i = 0; i != part.size(); ++i) {
+        frameBuffer.insert(part.channelName(i).c_str(),
+            Slice(FLOAT, reinterpret_cast<char *>(&level[i][0]),
+                  sizeof(float), rowSize));
     }
 
     file.setFrameBuffer(frameBuffer);
-    file.writePixels(static_cast<int>(height()));
+    file.writeTiles(0, file.numXTiles(lx) - 1,
+        0, file.numYTiles(ly) - 1, lx, ly);
 }
 
 
 
 // Unify the different ways to call the function
-WriteData * prepareArguments(const int nrhs, const mxArray * prhs[])
+WriteData * prepareArguments(int nrhs, const mxArray * prhs[])
 {
     int currArg = 0;
+    WriteOptions options;
+
+    // Peel off the trailing options struct
+    if (nrhs > 2 && mxIsStruct(prhs[nrhs - 1])) {
+        getWriteOptions(prhs[nrhs - 1], options);
+        --nrhs;
+    }
 
     std::string filename;
     OPENEXR_IMF_INTERNAL_NAMESPACE::Compression compression = OPENEXR_IMF_INTERNAL_NAMESPACE::ZIP_COMPRESSION;
@@ -470,6 +887,8 @@ WriteData * prepareArguments(const int nrhs, const mxArray * prhs[])
     AttributeVector attributesVector;
     std::vector<std::string> channelNames;
     MatricesVec channelData;
+    std::vector<std::vector<std::string> > partChannels;
+    std::vector<MatricesVec> partData;
 
 
     /////////// Filename, compression and pixel type //////////////////////////
@@ -544,6 +963,10 @@ WriteData * prepareArguments(const int nrhs, const mxArray * prhs[])
     switch(dType) {
     case MAP:
         assert(currArg == nrhs - 1);
+        if (!options.parts.empty()) {
+            mexErrMsgIdAndTxt("OpenEXR:argument",
+                "Multi-part files require cell vectors of channel names and data.");
+        }
         if (!mxIsClass(prhs[currArg], "containers.Map")) {
             mexErrMsgIdAndTxt("OpenEXR:argument",
                 "Expected a containers.Map handle as last argument.");
@@ -556,7 +979,24 @@ WriteData * prepareArguments(const int nrhs, const mxArray * prhs[])
         break;
     case NAMES_DATA:
         assert(currArg == nrhs - 2);
-        if (mxIsChar(prhs[currArg])) {
+        if (!options.parts.empty()) {
+            // Multi-part mode: one set of channel names and data per part
+            const size_t numParts = options.parts.size();
+            if (!mxIsCell(prhs[currArg]) || !mxIsCell(prhs[currArg+1]) ||
+                mxGetNumberOfElements(prhs[currArg])   != numParts ||
+                mxGetNumberOfElements(prhs[currArg+1]) != numParts)
+            {
+                mexErrMsgIdAndTxt("OpenEXR:argument", "Expected a cell "
+                    "vector of channel names and of data for each part.");
+            }
+            partChannels.resize(numParts);
+            partData.resize(numParts);
+            for (size_t i = 0; i != numParts; ++i) {
+                toNativeCheck(mxGetCell(prhs[currArg], i),   partChannels[i]);
+                toNativeCheck(mxGetCell(prhs[currArg+1], i), partData[i]);
+            }
+        }
+        else if (mxIsChar(prhs[currArg])) {
             // Single channel mode
             toNativeCheck(prhs[currArg],   channelNames);
             toNativeCheck(prhs[currArg+1], channelData);
@@ -579,19 +1019,55 @@ WriteData * prepareArguments(const int nrhs, const mxArray * prhs[])
         mexErrMsgIdAndTxt("OpenEXR:IllegalState", "Unknown channel data format");
     }
 
-    if (channelNames.empty()) {
-        mexErrMsgIdAndTxt("OpenEXR:argument", "Empty list of channel names.");
-    }
-    if (channelData.data.empty()) {
-        mexErrMsgIdAndTxt("OpenEXR:argument", "Empty list of channel data.");
+    if (!options.cfa.empty()) {
+        // Mosaic mode: the channel names are those of the colors
+        if (!options.parts.empty() || options.tiled) {
+            mexErrMsgIdAndTxt("OpenEXR:argument", "Mosaics can only be "
+                "written as single-part scanline files.");
+        }
+        if (channelData.data.size() != 1) {
+            mexErrMsgIdAndTxt("OpenEXR:argument",
+                "Expected a single mosaic matrix with the 'cfa' option.");
+        }
+        if (channelData.M % options.cfaRows != 0 ||
+            channelData.N % options.cfaCols != 0)
+        {
+            mexErrMsgIdAndTxt("OpenEXR:argument", "The mosaic size [%d %d] "
+                "is not a multiple of the CFA pattern size [%d %d].",
+                static_cast<int>(channelData.M), static_cast<int>(channelData.N),
+                static_cast<int>(options.cfaRows),
+                static_cast<int>(options.cfaCols));
+        }
+        for (size_t i = 0; i != options.cfa.size(); ++i) {
+            if (options.cfa[i] > static_cast<int>(channelNames.size())) {
+                mexErrMsgIdAndTxt("OpenEXR:argument", "The CFA pattern uses "
+                    "color %d but only %d channel names were given.",
+                    options.cfa[i], static_cast<int>(channelNames.size()));
+            }
+        }
     }
-    if (channelData.M < 1 || channelData.N < 1) {
-        mexErrMsgIdAndTxt("OpenEXR:argument", "Invalid data size: [%d %d].",
-            static_cast<int>(channelData.M), static_cast<int>(channelData.N));
+
+    if (options.parts.empty()) {
+        partChannels.assign(1, channelNames);
+        partData.assign(1, channelData);
     }
-    if (channelNames.size() != channelData.data.size()) {
-        mexErrMsgIdAndTxt("OpenEXR:argument", "Missmatch between number of "
-            "provided channel names and channel data matrices.");
+    for (size_t i = 0; i != partChannels.size(); ++i) {
+        if (partChannels[i].empty()) {
+            mexErrMsgIdAndTxt("OpenEXR:argument", "Empty list of channel names.");
+        }
+        if (partData[i].data.empty()) {
+            mexErrMsgIdAndTxt("OpenEXR:argument", "Empty list of channel data.");
+        }
+        if (partData[i].M < 1 || partData[i].N < 1) {
+            mexErrMsgIdAndTxt("OpenEXR:argument", "Invalid data size: [%d %d].",
+                static_cast<int>(partData[i].M), static_cast<int>(partData[i].N));
+        }
+        if (options.cfa.empty() &&
+            partChannels[i].size() != partData[i].data.size())
+        {
+            mexErrMsgIdAndTxt("OpenEXR:argument", "Missmatch between number of "
+                "provided channel names and channel data matrices.");
+        }
     }
 
     if (attribs != NULL) {
@@ -613,7 +1089,16 @@ WriteData * prepareArguments(const int nrhs, const mxArray * prhs[])
 
 
     WriteData * writeData = new WriteData(filename, compression, pixelType,
-        attributesVector, channelNames, channelData);
+        attributesVector, options);
+    if (!options.cfa.empty()) {
+        writeData->addMosaicPart(std::string(), partChannels[0], partData[0],
+            options.cfa, options.cfaRows, options.cfaCols);
+        return writeData;
+    }
+    for (size_t i = 0; i != partChannels.size(); ++i) {
+        writeData->addPart(options.parts.empty() ? std::string() : options.parts[i],
+            partChannels[i], partData[i]);
+    }
     return writeData;
 }
 
@@ -13,6 +13,8 @@ function exrwritechannels( filename )
 %     pxr24 - lossy 24-bit float compression.
 %     b44   - lossy 4-by-4 pixel block compression, fixed compression rate.
 %     b44a  - lossy 4-by-4 pixel block compression, improved flat fields rate.
+%     dwaa  - lossy DCT based compression, in blocks of 32 scan lines.
+%     dwab  - lossy DCT based compression, in blocks of 256 scan lines.
 %
 %   PIXELTYPE is a case sensitive string. It is one of:
 %     half   - use half precision (16-bit) floating point numbers.
@@ -24,7 +26,8 @@ function exrwritechannels( filename )
 %   254 characters long or less, and names longer than 31 characters are
 %   only compatible with OpenEXR 1.7 or newer. Using standard OpenEXR
 %   attribute names with unexpected values has undefined results.
-%   The types for values are limited to string, double, single or int32.
+%   The types for values are limited to string, cell vector of strings,
+%   double, single or int32 scalars, and vectors of 2 or 3 of those numbers.
 %
 %   CHANNELS is either a string (when saving a single-channel image) or a
 %   cell vector with the name of each channel. Channel names have to be
@@ -55,9 +58,37 @@ function exrwritechannels( filename )
 %   are less efficient than those which take directly cell arrays for the
 %   channel names and data.
 %
+%   EXRWRITECHANNELS(..., OPTS) takes a trailing struct with any of the
+%   following fields:
+%     tilesize - scalar or [rows cols] tile size, in the same order as the
+%                stride and reduce options of EXRREADCHANNELS. When present,
+%                the file is written as a tiled image (64x64 tiles by default).
+%     levels   - 'one', 'mipmap' or 'ripmap'. Also writes a tiled image;
+%                the lower resolution levels are computed by averaging
+%                2x2 pixel blocks of the previous level.
+%     rounding - 'down' (default) or 'up', how the level sizes are rounded.
+%     threads  - number of threads used to compress this file. Zero
+%                compresses in the calling thread; by default the count
+%                set through EXRTHREADS is used.
+%     parts    - cell vector with the names of the parts of a multi-part
+%                file. CHANNELS and DATA are then cell vectors with the
+%                channel names and the data of each part; the data of
+%                different parts may have different sizes. The attributes,
+%                compression, pixel type and tiling apply to every part.
+%     cfa      - matrix with the color filter array pattern of a sensor
+%                mosaic, as indices into CHANNELS (e.g. [2 1; 3 2] with
+%                {'r','g','b'} for a GRBG Bayer pattern). DATA is then the
+%                single mosaic matrix, whose size must be a multiple of the
+%                pattern size. Each site of the pattern is written as a
+%                channel subsampled by the pattern size and named after its
+%                color, numbered when the color is repeated ('g1', 'g2').
+%                The 'cfaPattern' attribute lists these channel names in
+%                row-major order of the pattern and 'cfaSize' its size as
+%                [columns rows]. Mosaics are written as scanline files.
+%
 %   Note: this implementation uses the ILM IlmImf library version 1.7
 %
-%   See also EXRREADCHANNELS,EXRINFO,CONTAINERS.MAP
+%   See also EXRREADCHANNELS,EXRTHREADS,EXRINFO,CONTAINERS.MAP
 
 % Edgar Velazquez-Armendariz (eva5@cs.cornell.edu)
 %
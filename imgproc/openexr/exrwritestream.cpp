@@ -0,0 +1,615 @@
+/*============================================================================
+
+ OpenEXR for Matlab
+
+ Distributed under the MIT License (the "License");
+ see accompanying file LICENSE for details
+ or copy at http://opensource.org/licenses/MIT
+
+ Originated from HDRITools - High Dynamic Range Image Tools
+ Copyright 2011 Program of Computer Graphics, Cornell University
+
+ This software is distributed WITHOUT ANY WARRANTY; without even the
+ implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ See the License for more information.
+ -----------------------------------------------------------------------------
+ Authors:
+ Jinwei Gu <jwgu AT cs DOT cornell DOT edu>
+ Edgar Velazquez-Armendariz <eva5 AT cs DOT cornell DOT edu>
+ Manuel Leonhardt <leom AT hs-furtwangen DOT de>
+
+ ============================================================================*/
+
+
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include <mex.h>
+
+#ifdef __clang__
+  #pragma clang diagnostic push
+  #pragma clang diagnostic ignored "-Wlong-long"
+  #pragma clang diagnostic ignored "-Wdeprecated-register"
+  #pragma clang diagnostic ignored "-Wextra"
+#endif
+
+#include <half.h>
+#include <ImfAttribute.h>
+#include <ImfPixelType.h>
+#include <ImfCompression.h>
+#include <ImfOutputFile.h>
+#include <ImfMultiPartOutputFile.h>
+#include <ImfOutputPart.h>
+#include <ImfPartType.h>
+#include <ImfHeader.h>
+#include <ImfChannelList.h>
+#include <ImfNamespace.h>
+#include <ImfFrameBuffer.h>
+#include <ImfThreading.h>
+#include <Iex.h>
+
+#ifdef __clang__
+  #pragma clang diagnostic pop
+#endif
+
+#include "utilities.h"
+#include "MatlabToImf.h"
+
+
+using namespace OPENEXR_IMF_INTERNAL_NAMESPACE;
+using namespace OpenEXRforMatlab;
+
+
+namespace
+{
+
+// Minimum number of scanlines converted and written at a time
+const int MIN_BLOCK_ROWS = 64;
+
+// Maximum size of the converted pixels of a block, in bytes
+const size_t MAX_BLOCK_BYTES = 16 << 20;
+
+
+// Description of a part of the file to be written
+struct PartInfo
+{
+    std::string name;
+    std::vector<std::string> channels;
+    size_t width;
+    size_t height;
+};
+
+
+// File open for writing blocks of scanlines as they are appended. Files with
+// a single part are regular single-part files; otherwise each part is written
+// independently, so that the parts may be appended in any order.
+class StreamWriter
+{
+public:
+    StreamWriter(const std::string & filename, Compression compression,
+        PixelType type, const AttributeVector & attributes,
+        const std::vector<PartInfo> & parts, int numThreads);
+
+    ~StreamWriter();
+
+    // Index of a part given by name or 1-based index
+    size_t findPart(const mxArray * pa) const;
+
+    // Append the next rows of a part: either an HxWxN array with the
+    // channels as planes, a single matrix or a cell vector of matrices
+    void append(size_t part, const mxArray * data);
+
+    inline size_t rowsWritten(size_t part) const {
+        return m_rowsWritten[part];
+    }
+
+    inline bool isComplete() const {
+        for (size_t i = 0; i != m_parts.size(); ++i) {
+            if (m_rowsWritten[i] != m_parts[i].height) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    inline const std::string & filename() const {
+        return m_filename;
+    }
+
+    inline int numThreads() const {
+        return m_numThreads;
+    }
+
+private:
+    StreamWriter(const StreamWriter &);
+    StreamWriter & operator=(const StreamWriter &);
+
+    template <class OutputType>
+    void writeRows(OutputType & out, size_t part,
+        const std::vector<std::pair<const mxArray *, size_t> > & planes,
+        size_t numRows);
+
+    inline size_t typeSize() const {
+        return m_type == HALF ? sizeof(half) : sizeof(float);
+    }
+
+    const std::string m_filename;
+    const Compression m_compression;
+    const PixelType m_type;
+    const int m_numThreads;
+    const std::vector<PartInfo> m_parts;
+    std::vector<size_t> m_rowsWritten;
+
+    OutputFile * m_file;
+    MultiPartOutputFile * m_multiFile;
+    std::vector<OutputPart *> m_outputParts;
+
+    // Row-major scratch buffer for each channel
+    std::vector<std::vector<char> > m_buffers;
+};
+
+
+StreamWriter::StreamWriter(const std::string & filename,
+    Compression compression, PixelType type,
+    const AttributeVector & attributes, const std::vector<PartInfo> & parts,
+    int numThreads) :
+m_filename(filename), m_compression(compression), m_type(type),
+m_numThreads(numThreads), m_parts(parts), m_rowsWritten(parts.size(), 0),
+m_file(NULL), m_multiFile(NULL)
+{
+    assert(!parts.empty());
+
+    std::vector<Header> headers;
+    for (size_t i = 0; i != parts.size(); ++i) {
+        const PartInfo & part = parts[i];
+        Header header(static_cast<int>(part.width),
+            static_cast<int>(part.height),
+            1.0f,                   // aspect ratio
+            Imath::V2f(0.0f, 0.0f), // screen window center,
+            1.0f,                   // screen window width,
+            INCREASING_Y,           // line order
+            compression);
+
+        for (AttributeVector::const_iterator it = attributes.begin();
+            it != attributes.end(); ++it)
+        {
+            header.insert(it->first.c_str(), *(it->second));
+        }
+        for (size_t c = 0; c != part.channels.size(); ++c) {
+            header.channels().insert(part.channels[c].c_str(), Channel(type));
+        }
+        if (!part.name.empty()) {
+            header.setName(part.name);
+        }
+        if (parts.size() > 1) {
+            header.setType(SCANLINEIMAGE);
+        }
+        headers.push_back(header);
+    }
+
+    if (parts.size() == 1) {
+        m_file = new OutputFile(filename.c_str(), headers[0], numThreads);
+    } else {
+        m_multiFile = new MultiPartOutputFile(filename.c_str(), &headers[0],
+            static_cast<int>(headers.size()), false, numThreads);
+        for (size_t i = 0; i != parts.size(); ++i) {
+            m_outputParts.push_back(
+                new OutputPart(*m_multiFile, static_cast<int>(i)));
+        }
+    }
+}
+
+
+StreamWriter::~StreamWriter()
+{
+    // Missing scanlines are left out of the file, which OpenEXR then fails
+    // to read; closeWriter reports it
+    for (size_t i = 0; i != m_outputParts.size(); ++i) {
+        delete m_outputParts[i];
+    }
+    delete m_multiFile;
+    delete m_file;
+}
+
+
+size_t StreamWriter::findPart(const mxArray * pa) const
+{
+    if (mxIsChar(pa)) {
+        std::string name;
+        toNativeCheck(pa, name);
+        for (size_t i = 0; i != m_parts.size(); ++i) {
+            if (m_parts[i].name == name) {
+                return i;
+            }
+        }
+        mexErrMsgIdAndTxt("OpenEXR:argument", "Unknown part: %s", name.c_str());
+    }
+    else if (isScalar(pa) && mxGetScalar(pa) >= 1 &&
+             mxGetScalar(pa) <= static_cast<double>(m_parts.size()))
+    {
+        return static_cast<size_t>(mxGetScalar(pa)) - 1;
+    }
+    mexErrMsgIdAndTxt("OpenEXR:argument", "Invalid part.");
+    return 0;
+}
+
+
+void StreamWriter::append(size_t part, const mxArray * data)
+{
+    assert(part < m_parts.size());
+    const PartInfo & info = m_parts[part];
+
+    // Each channel is a plane of a matrix or of an HxWxN array
+    std::vector<std::pair<const mxArray *, size_t> > planes;
+    if (mxIsCell(data)) {
+        for (size_t i = 0; i != mxGetNumberOfElements(data); ++i) {
+            planes.push_back(std::make_pair(mxGetCell(data, i), size_t(0)));
+        }
+    } else {
+        const size_t numPlanes = mxGetNumberOfDimensions(data) > 2 ?
+            mxGetDimensions(data)[2] : 1;
+        for (size_t i = 0; i != numPlanes; ++i) {
+            planes.push_back(std::make_pair(data, i));
+        }
+    }
+    if (planes.size() != info.channels.size()) {
+        mexErrMsgIdAndTxt("OpenEXR:argument",
+            "Expected data for %d channels, got %d.",
+            static_cast<int>(info.channels.size()),
+            static_cast<int>(planes.size()));
+    }
+
+    const size_t numRows = mxGetM(planes[0].first);
+    for (size_t i = 0; i != planes.size(); ++i) {
+        const mxArray * pa = planes[i].first;
+        if (pa == NULL || !mxIsNumeric(pa) || mxIsComplex(pa) ||
+            mxIsSparse(pa) || mxGetNumberOfDimensions(pa) > 3)
+        {
+            mexErrMsgIdAndTxt("OpenEXR:argument",
+                "The data must be real numeric matrices.");
+        }
+        if (mxGetM(pa) != numRows || mxGetDimensions(pa)[1] != info.width) {
+            mexErrMsgIdAndTxt("OpenEXR:argument",
+                "Expected blocks of %d columns with the same number of rows.",
+                static_cast<int>(info.width));
+        }
+    }
+    if (m_rowsWritten[part] + numRows > info.height) {
+        mexErrMsgIdAndTxt("OpenEXR:argument",
+            "The rows exceed the image height: %d rows left.",
+            static_cast<int>(info.height - m_rowsWritten[part]));
+    }
+
+    if (m_file != NULL) {
+        writeRows(*m_file, part, planes, numRows);
+    } else {
+        writeRows(*m_outputParts[part], part, planes, numRows);
+    }
+}
+
+
+template <class OutputType>
+void StreamWriter::writeRows(OutputType & out, size_t part,
+    const std::vector<std::pair<const mxArray *, size_t> > & planes,
+    size_t numRows)
+{
+    const PartInfo & info = m_parts[part];
+    const size_t rowSize = typeSize() * info.width;
+
+    // Convert the rows in blocks which keep the encoding threads busy, but
+    // no larger than MAX_BLOCK_BYTES unless a compressed block needs more
+    const size_t linesPerBlock =
+        static_cast<size_t>(getLinesPerBlock(m_compression));
+    const size_t blockRows = std::min(
+        static_cast<size_t>(std::max(MIN_BLOCK_ROWS,
+            getLinesPerBlock(m_compression) * std::max(m_numThreads, 1))),
+        std::max(linesPerBlock, MAX_BLOCK_BYTES /
+            std::max(rowSize * planes.size(), static_cast<size_t>(1))));
+    m_buffers.resize(planes.size());
+    for (size_t i = 0; i != planes.size(); ++i) {
+        m_buffers[i].resize(rowSize * std::min(blockRows, numRows));
+    }
+
+    std::vector<RowSource> sources;
+    for (size_t i = 0; i != planes.size(); ++i) {
+        sources.push_back(RowSource(planes[i].first, planes[i].second));
+    }
+
+    for (size_t r = 0; r < numRows; r += blockRows) {
+        const size_t blockSize = std::min(blockRows, numRows - r);
+        const size_t y = m_rowsWritten[part];
+
+        if (m_type == HALF) {
+            std::vector<half *> dests;
+            for (size_t i = 0; i != planes.size(); ++i) {
+                dests.push_back(reinterpret_cast<half *>(&m_buffers[i][0]));
+            }
+            convertRowsParallel(dests, sources, r, blockSize, m_numThreads);
+        } else {
+            std::vector<float *> dests;
+            for (size_t i = 0; i != planes.size(); ++i) {
+                dests.push_back(reinterpret_cast<float *>(&m_buffers[i][0]));
+            }
+            convertRowsParallel(dests, sources, r, blockSize, m_numThreads);
+        }
+
+        FrameBuffer frameBuffer;
+        for (size_t i = 0; i != planes.size(); ++i) {
+            char * data = &m_buffers[i][0];
+            frameBuffer.insert(info.channels[i].c_str(),
+                Slice(m_type, data - y * rowSize, typeSize(), rowSize));
+        }
+
+        out.setFrameBuffer(frameBuffer);
+        out.writePixels(static_cast<int>(blockSize));
+        m_rowsWritten[part] += blockSize;
+    }
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Handles
+///////////////////////////////////////////////////////////////////////////////
+
+typedef std::map<int, StreamWriter *> WriterMap;
+WriterMap writers;
+int nextHandle = 1;
+
+
+// Close all the files when Matlab exits
+extern "C" void exrWriteStreamExitCallback(void)
+{
+    for (WriterMap::iterator it = writers.begin(); it != writers.end(); ++it) {
+        delete it->second;
+    }
+    writers.clear();
+    mexEXRExit();
+}
+
+
+WriterMap::iterator getWriter(const mxArray * pa)
+{
+    if (!isScalar(pa)) {
+        mexErrMsgIdAndTxt("OpenEXR:argument", "Invalid handle.");
+    }
+    WriterMap::iterator it = writers.find(static_cast<int>(mxGetScalar(pa)));
+    if (it == writers.end()) {
+        mexErrMsgIdAndTxt("OpenEXR:argument", "Invalid or closed handle.");
+    }
+    return it;
+}
+
+
+// Close the file, returning false if some of its scanlines were never written
+bool closeWriter(WriterMap::iterator it)
+{
+    StreamWriter * writer = it->second;
+    writers.erase(it);
+    if (writers.empty()) {
+        mexUnlock();
+    }
+
+    const bool complete = writer->isComplete();
+    delete writer;
+    return complete;
+}
+
+
+// Parse the arguments of 'open' and create the writer:
+// FILENAME, [COMPRESSION, [PIXELTYPE]], [ATTRIBS], CHANNELS, SIZE, [OPTS]
+StreamWriter * openWriter(int nrhs, const mxArray * prhs[])
+{
+    std::string filename;
+    Compression compression = ZIP_COMPRESSION;
+    PixelType pixelType = HALF;
+    int numThreads = globalThreadCount();
+    std::vector<std::string> partNames;
+
+    // Peel off the trailing options struct
+    if (nrhs > 0 && mxIsStruct(prhs[nrhs - 1])) {
+        static const char * knownFields[] = {"threads", "parts"};
+        const int numKnown = sizeof(knownFields) / sizeof(const char *);
+        const mxArray * opts = prhs[nrhs - 1];
+        checkOptionFields(opts, knownFields, numKnown);
+
+        double value = 0.0;
+        size_t count = 0;
+        if (getNumericOption(opts, "threads", 1, 1, &value, count)) {
+            if (value < 0) {
+                mexErrMsgIdAndTxt("OpenEXR:argument",
+                    "The number of threads must be non-negative.");
+            }
+            numThreads = static_cast<int>(value);
+        }
+        getOption(opts, "parts", partNames);
+        --nrhs;
+    }
+
+    if (nrhs < 3 || nrhs > 6) {
+        mexErrMsgIdAndTxt("OpenEXR:argument", "Invalid number of arguments.");
+    }
+    if (!mxIsChar(prhs[0])) {
+        mexErrMsgIdAndTxt("OpenEXR:argument", "Expected a filename.");
+    }
+    toNativeCheck(prhs[0], filename);
+
+    // The optional arguments between the filename and the channels
+    const mxArray * attribs = NULL;
+    int currArg = 1;
+    if (currArg < nrhs - 2 && mxIsChar(prhs[currArg])) {
+        toNativeCheck(prhs[currArg++], compression);
+        if (currArg < nrhs - 2 && mxIsChar(prhs[currArg])) {
+            toNativeCheck(prhs[currArg++], pixelType);
+        }
+    }
+    if (currArg < nrhs - 2) {
+        if (!mxIsClass(prhs[currArg], "containers.Map")) {
+            mexErrMsgIdAndTxt("OpenEXR:argument",
+                "Expected a containers.Map handle as argument %d.", currArg + 2);
+        }
+        attribs = prhs[currArg++];
+    }
+    if (currArg != nrhs - 2) {
+        mexErrMsgIdAndTxt("OpenEXR:argument", "Invalid arguments.");
+    }
+
+    // Channel names and [height width] of each part
+    const mxArray * channelsArg = prhs[nrhs - 2];
+    const mxArray * sizeArg = prhs[nrhs - 1];
+    const size_t numParts = partNames.empty() ? 1 : partNames.size();
+    std::vector<PartInfo> parts(numParts);
+    if (partNames.empty()) {
+        toNativeCheck(channelsArg, parts[0].channels);
+    } else {
+        if (!mxIsCell(channelsArg) ||
+            mxGetNumberOfElements(channelsArg) != numParts)
+        {
+            mexErrMsgIdAndTxt("OpenEXR:argument",
+                "Expected a cell vector with the channel names of each part.");
+        }
+        for (size_t i = 0; i != numParts; ++i) {
+            parts[i].name = partNames[i];
+            toNativeCheck(mxGetCell(channelsArg, i), parts[i].channels);
+        }
+    }
+
+    // Either one [height width] for all the parts or one row per part
+    const size_t numSizes = mxGetM(sizeArg);
+    if (!mxIsNumeric(sizeArg) || mxGetN(sizeArg) != 2 ||
+        (numSizes != 1 && numSizes != numParts))
+    {
+        mexErrMsgIdAndTxt("OpenEXR:argument",
+            "Expected the image size as [height width].");
+    }
+    std::vector<double> sizes(numSizes * 2);
+    convertData(&sizes[0], sizeArg, mxGetClassID(sizeArg), sizes.size());
+    for (size_t i = 0; i != numParts; ++i) {
+        const size_t row = numSizes == 1 ? 0 : i;
+        if (sizes[row] < 1 || sizes[row + numSizes] < 1) {
+            mexErrMsgIdAndTxt("OpenEXR:argument", "Invalid image size.");
+        }
+        if (parts[i].channels.empty()) {
+            mexErrMsgIdAndTxt("OpenEXR:argument", "Empty list of channel names.");
+        }
+        parts[i].height = static_cast<size_t>(sizes[row]);
+        parts[i].width  = static_cast<size_t>(sizes[row + numSizes]);
+    }
+
+    AttributeVector attributes;
+    if (attribs != NULL && !toNative(attribs, attributes)) {
+        mexWarnMsgIdAndTxt("OpenEXR:unsupported",
+            "Attribute generation failed.");
+    }
+
+    StreamWriter * writer = NULL;
+    std::string errorMsg;
+    try {
+        ScopedThreadCount threadCount(numThreads);
+        writer = new StreamWriter(filename, compression, pixelType,
+            attributes, parts, numThreads);
+    }
+    catch (std::exception & e) {
+        errorMsg = e.what();
+    }
+    for (size_t i = 0; i != attributes.size(); ++i) {
+        delete attributes[i].second;
+    }
+    if (writer == NULL) {
+        mexErrMsgIdAndTxt("OpenEXR:exception", "%s", errorMsg.c_str());
+    }
+    return writer;
+}
+
+} // namespace
+
+
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+    OpenEXRforMatlab::mexEXRInit();
+
+    // Chain the exit callback so that open files get closed
+    static bool registered = false;
+    if (!registered) {
+        mexAtExit(exrWriteStreamExitCallback);
+        registered = true;
+    }
+
+    std::string command;
+    if (nrhs < 1 || !mxIsChar(prhs[0])) {
+        mexErrMsgIdAndTxt("OpenEXR:argument",
+            "Expected a command: 'open', 'append' or 'close'.");
+    }
+    toNativeCheck(prhs[0], command);
+
+    if (command == "open") {
+        if (nlhs > 1) {
+            mexErrMsgIdAndTxt("OpenEXR:argument", "Too many output arguments.");
+        }
+        StreamWriter * writer = openWriter(nrhs - 1, prhs + 1);
+        if (writers.empty()) {
+            mexLock();
+        }
+        const int handle = nextHandle++;
+        writers[handle] = writer;
+        plhs[0] = mxCreateDoubleScalar(handle);
+    }
+    else if (command == "append") {
+        if (nrhs != 3 && nrhs != 4) {
+            mexErrMsgIdAndTxt("OpenEXR:argument", "Invalid number of arguments.");
+        } else if (nlhs > 1) {
+            mexErrMsgIdAndTxt("OpenEXR:argument", "Too many output arguments.");
+        }
+        StreamWriter * writer = getWriter(prhs[1])->second;
+        const size_t part = nrhs == 4 ? writer->findPart(prhs[3]) : 0;
+
+        // A per-file count above the global one needs a bigger pool,
+        // as in exrwritechannels
+        std::string errorMsg;
+        try {
+            ScopedThreadCount threadCount(writer->numThreads());
+            writer->append(part, prhs[2]);
+        }
+        catch (std::exception & e) {
+            errorMsg = e.what();
+        }
+        if (!errorMsg.empty()) {
+            mexErrMsgIdAndTxt("OpenEXR:exception", "%s", errorMsg.c_str());
+        }
+        plhs[0] = mxCreateDoubleScalar(static_cast<double>(writer->rowsWritten(part)));
+    }
+    else if (command == "close") {
+        if (nrhs != 2) {
+            mexErrMsgIdAndTxt("OpenEXR:argument", "Invalid number of arguments.");
+        } else if (nlhs > 0) {
+            mexErrMsgIdAndTxt("OpenEXR:argument", "Too many output arguments.");
+        }
+        WriterMap::iterator it = getWriter(prhs[1]);
+        const std::string filename = it->second->filename();
+
+        std::string errorMsg;
+        bool complete = true;
+        try {
+            complete = closeWriter(it);
+        }
+        catch (std::exception & e) {
+            errorMsg = e.what();
+        }
+        if (!errorMsg.empty()) {
+            mexErrMsgIdAndTxt("OpenEXR:exception", "%s", errorMsg.c_str());
+        } else if (!complete) {
+            mexErrMsgIdAndTxt("OpenEXR:incomplete",
+                "Closed %s before writing all its scanlines; "
+                "the file cannot be read.", filename.c_str());
+        }
+    }
+    else {
+        mexErrMsgIdAndTxt("OpenEXR:argument", "Unknown command: %s",
+            command.c_str());
+    }
+}
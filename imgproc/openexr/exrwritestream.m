@@ -0,0 +1,51 @@
+function exrwritestream( command )
+%EXRWRITESTREAM    Write an OpenEXR image one block of scanlines at a time.
+%   H = EXRWRITESTREAM('open', FILENAME, COMPRESSION, PIXELTYPE, ATTRIBS,
+%   CHANNELS, SIZE) creates a scanline OpenEXR file of SIZE = [height width]
+%   pixels with the given channels, and returns a handle H for appending
+%   its rows. COMPRESSION, PIXELTYPE, ATTRIBS and CHANNELS are as in
+%   EXRWRITECHANNELS; COMPRESSION, PIXELTYPE and ATTRIBS may be omitted as
+%   well, defaulting to 'zip', 'half' and no attributes.
+%
+%   ROWS = EXRWRITESTREAM('append', H, DATA) writes the next rows of the
+%   image, top to bottom, and returns the number of rows written so far.
+%   DATA is either a cell vector with one matrix per channel, a single
+%   matrix for single-channel images, or an array of size [rows width N]
+%   whose N planes are the channels in the order given when opening the
+%   file. Every call may append a different number of rows, so that large
+%   simulated captures can be written strip by strip without holding the
+%   whole image in memory.
+%
+%   EXRWRITESTREAM('close', H) finishes the file and frees the handle. It
+%   is an error to close the file before all of its rows have been
+%   appended: the handle is still freed, but OpenEXR cannot read a file
+%   with missing scanlines.
+%
+%   H = EXRWRITESTREAM('open', ..., OPTS) takes a trailing struct with any
+%   of the following fields:
+%     threads - number of threads used to compress this file. Zero
+%               compresses in the calling thread; by default the count set
+%               through EXRTHREADS is used.
+%     parts   - cell vector with the names of the parts of a multi-part
+%               file. CHANNELS is then a cell vector with the channel names
+%               of each part, and SIZE either a single [height width] or a
+%               matrix with one row per part. Use one part per band to write
+%               the bands of an image independently of each other.
+%
+%   ROWS = EXRWRITESTREAM('append', H, DATA, PART) appends the next rows of
+%   the part given by name or by its 1-based index.
+%
+%   Tiled files are not supported; use EXRWRITECHANNELS for those.
+%
+%   Example:
+%     h = exrwritestream('open', 'big.exr', 'piz', 'half', {'R','G','B'}, ...
+%                        [height width]);
+%     for r = 1:256:height
+%         exrwritestream('append', h, computeStrip(r, min(r+255, height)));
+%     end
+%     exrwritestream('close', h);
+%
+%   See also EXRWRITECHANNELS,EXRREADCHANNELS,EXRTHREADS
+
+% (The help system uses this file, but actually doing something with it
+% will employ the mex file).
@@ -3,15 +3,17 @@ verbose = false;
 
 
 % -----------------------------------------------
-build_files = { 'exrinfo.cpp', ...
-    'exrread.cpp', ...
+build_files = { 'exrheader.cpp', ...
     'exrreadchannels.cpp', ...
-    'exrwrite.cpp', ...
-    'exrwritechannels.cpp'};
+    'exrthreads.cpp', ...
+    'exrwritechannels.cpp', ...
+    'exrwritestream.cpp'};
 
 companion_files = { 'utilities.cpp', ...
     'ImfToMatlab.cpp', ...
-    'MatlabToImf.cpp'};
+    'MatlabToImf.cpp', ...
+    'MemoryStreams.cpp', ...
+    'HalfConversion.cpp'};
 
 additionals = {};
 if(verbose == true)
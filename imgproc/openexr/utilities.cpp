@@ -24,13 +24,20 @@
 #if defined(_WIN32)
   #define WINDOWS_LEAN_AND_MEAN
   #include <windows.h>
-#elif USE_SYSCONF
+#else
   #include <unistd.h>
 #endif
+#if defined(__linux__)
+  #include <sched.h>
+#endif
+
+#include <cstdio>
+#include <algorithm>
 
 #include <mex.h>
 
 #include <ImfThreading.h>
+#include <IlmThreadPool.h>
 
 #include "utilities.h"
 
@@ -38,23 +45,123 @@
 namespace
 {
 
-// Actual function to get the number of CPUs
+// Name of the root application data which holds the thread count set
+// through exrthreads. It is kept in Matlab because each MEX file has its own
+// copy of this code, whereas the OpenEXR thread pool is shared by all.
+const char * THREAD_COUNT_APPDATA = "OpenEXRforMatlabThreads";
+
+
+#if defined(__linux__)
+// Number of CPUs allowed by the CFS quota of the cgroup, or 0 if unlimited.
+// Containers and batch schedulers limit the CPUs this way rather than
+// through the affinity mask.
+int get_cgroup_cpus()
+{
+    long long quota = -1, period = 0;
+
+    // cgroup v2: "max 100000" or "<quota> <period>"
+    if (FILE * f = fopen("/sys/fs/cgroup/cpu.max", "r")) {
+        char buf[32];
+        if (fscanf(f, "%31s %lld", buf, &period) == 2 && buf[0] != 'm') {
+            sscanf(buf, "%lld", &quota);
+        }
+        fclose(f);
+    }
+    // cgroup v1
+    else if (FILE * fq = fopen("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", "r")) {
+        if (fscanf(fq, "%lld", &quota) != 1) {
+            quota = -1;
+        }
+        fclose(fq);
+        if (FILE * fp = fopen("/sys/fs/cgroup/cpu/cpu.cfs_period_us", "r")) {
+            if (fscanf(fp, "%lld", &period) != 1) {
+                period = 0;
+            }
+            fclose(fp);
+        }
+    }
+
+    if (quota <= 0 || period <= 0) {
+        return 0;
+    }
+    return static_cast<int>((quota + period - 1) / period);
+}
+#endif
+
+
+// Actual function to get the number of CPUs this process may run on
 inline int get_num_cpus()
 {
 #if defined(_WIN32)
-    SYSTEM_INFO info;
-    GetSystemInfo(&info);
-    const int n = (int)info.dwNumberOfProcessors;
-    return n > 0 ? n : 1;
-#elif USE_SYSCONF
-    const int n = sysconf(_SC_NPROCESSORS_ONLN);
+    DWORD_PTR processMask = 0, systemMask = 0;
+    int n = 0;
+    if (GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask)) {
+        for (; processMask != 0; processMask &= processMask - 1) {
+            ++n;
+        }
+    }
+    if (n <= 0) {
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        n = (int)info.dwNumberOfProcessors;
+    }
     return n > 0 ? n : 1;
 #else
-    // Nothing better
-    return 1;
+    int n = static_cast<int>(sysconf(_SC_NPROCESSORS_ONLN));
+  #if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        n = CPU_COUNT(&set);
+    }
+    const int quota = get_cgroup_cpus();
+    if (quota > 0 && quota < n) {
+        n = quota;
+    }
+  #endif
+    return n > 0 ? n : 1;
 #endif
 }
 
+
+// Get a scalar value by calling a Matlab function, or -1 if not available
+int callMatlabScalar(const char * function, int nrhs, mxArray * prhs[])
+{
+    mxArray * result = NULL;
+    if (mexCallMATLAB(1, &result, nrhs, prhs, function) != 0 ||
+        result == NULL || mxIsEmpty(result) || !mxIsNumeric(result))
+    {
+        if (result != NULL) {
+            mxDestroyArray(result);
+        }
+        return -1;
+    }
+    const int value = static_cast<int>(mxGetScalar(result));
+    mxDestroyArray(result);
+    return value;
+}
+
+
+// Thread count set through setThreadCount, or -1 if there is none
+int getStoredThreadCount()
+{
+    mxArray * args[2];
+    args[0] = mxCreateDoubleScalar(0.0);
+    args[1] = mxCreateString(THREAD_COUNT_APPDATA);
+    const int numThreads = callMatlabScalar("getappdata", 2, args);
+    mxDestroyArray(args[0]);
+    mxDestroyArray(args[1]);
+    return numThreads;
+}
+
+// Thread count which this MEX file last gave to OpenEXR, or -1 if it has
+// not done so yet. The pool is shared, so a different global count means
+// that exrthreads changed it or that another MEX file stopped the pool.
+int syncedThreadCount = -1;
+
+// Pool for the whole-file tasks, created on first use
+IlmThread::ThreadPool * fileThreadPool = NULL;
+
 } // namespace
 
 
@@ -65,21 +172,104 @@ int OpenEXRforMatlab::getNumCPUs()
 }
 
 
+void OpenEXRforMatlab::mexEXRExit()
+{
+    delete fileThreadPool;
+    fileThreadPool = NULL;
+    syncedThreadCount = -1;
+    OPENEXR_IMF_INTERNAL_NAMESPACE::setGlobalThreadCount(0);
+}
+
+
 // Exit callback
 extern "C" void mexEXRExitCallback(void)
 {
-    OPENEXR_IMF_INTERNAL_NAMESPACE::setGlobalThreadCount(0);
+    OpenEXRforMatlab::mexEXRExit();
+}
+
+
+int OpenEXRforMatlab::getDefaultThreadCount()
+{
+    // Within parallel pools each worker gets maxNumCompThreads == 1
+    const int matlabThreads = callMatlabScalar("maxNumCompThreads", 0, NULL);
+    const int numCPUs = getNumCPUs();
+    return matlabThreads > 0 ? std::min(numCPUs, matlabThreads) : numCPUs;
+}
+
+
+int OpenEXRforMatlab::getThreadCount()
+{
+    const int numThreads = getStoredThreadCount();
+    return numThreads >= 0 ? numThreads : getDefaultThreadCount();
+}
+
+
+void OpenEXRforMatlab::setThreadCount(int numThreads)
+{
+    mxArray * args[3];
+    args[0] = mxCreateDoubleScalar(0.0);
+    args[1] = mxCreateString(THREAD_COUNT_APPDATA);
+    // An empty value means the default
+    args[2] = numThreads >= 0 ? mxCreateDoubleScalar(numThreads) :
+        mxCreateDoubleMatrix(0, 0, mxREAL);
+    mexCallMATLAB(0, NULL, 3, args, "setappdata");
+    for (int i = 0; i != 3; ++i) {
+        mxDestroyArray(args[i]);
+    }
+
+    mexEXRInit(true);
 }
 
 
-void OpenEXRforMatlab::mexEXRInit()
+void OpenEXRforMatlab::mexEXRInit(bool resync)
 {
     static bool initialized = false;
     if (!initialized) {
-        // Use up to 75% of CPUs to avoid oversubscription
-        const int numCPUs = (3*getNumCPUs() + 3) / 4;
-        OPENEXR_IMF_INTERNAL_NAMESPACE::setGlobalThreadCount(numCPUs);
         mexAtExit(mexEXRExitCallback);
         initialized = true;
     }
+
+    // Querying Matlab for the count costs two calls into the interpreter,
+    // so it is only done when the shared count is no longer the one this
+    // MEX file set: it was changed through exrthreads from another MEX file,
+    // or the pool stopped when one of them was cleared.
+    const int current = OPENEXR_IMF_INTERNAL_NAMESPACE::globalThreadCount();
+    if (resync || syncedThreadCount < 0 || current != syncedThreadCount) {
+        const int numThreads = getThreadCount();
+        if (current != numThreads) {
+            OPENEXR_IMF_INTERNAL_NAMESPACE::setGlobalThreadCount(numThreads);
+        }
+        syncedThreadCount = numThreads;
+    }
+}
+
+
+IlmThread::ThreadPool & OpenEXRforMatlab::getFileThreadPool()
+{
+    // The file tasks mostly wait on I/O and on the global pool
+    const int numThreads = std::max(
+        OPENEXR_IMF_INTERNAL_NAMESPACE::globalThreadCount(), 1);
+    if (fileThreadPool == NULL) {
+        fileThreadPool = new IlmThread::ThreadPool(numThreads);
+    } else if (fileThreadPool->numThreads() != numThreads) {
+        fileThreadPool->setNumThreads(numThreads);
+    }
+    return *fileThreadPool;
+}
+
+
+OpenEXRforMatlab::ScopedThreadCount::ScopedThreadCount(int numThreads) :
+m_previous(OPENEXR_IMF_INTERNAL_NAMESPACE::globalThreadCount())
+{
+    if (numThreads > m_previous) {
+        OPENEXR_IMF_INTERNAL_NAMESPACE::setGlobalThreadCount(numThreads);
+    }
+}
+
+
+OpenEXRforMatlab::ScopedThreadCount::~ScopedThreadCount()
+{
+    if (OPENEXR_IMF_INTERNAL_NAMESPACE::globalThreadCount() != m_previous) {
+        OPENEXR_IMF_INTERNAL_NAMESPACE::setGlobalThreadCount(m_previous);
+    }
 }
@@ -23,14 +23,76 @@
 
 #pragma once
 
+#include <IlmThreadPool.h>
+#include <ImfCompression.h>
+
 namespace OpenEXRforMatlab
 {
 
-// Get the number of CPUs in the system
+// Get the number of CPUs this process may use, taking into account its
+// affinity mask and, on Linux, the CPU quota of its cgroup
 int getNumCPUs();
 
+// Default number of OpenEXR threads: the usable CPUs, but no more than
+// Matlab's maxNumCompThreads
+int getDefaultThreadCount();
+
+// Number of OpenEXR threads: the one set through setThreadCount, which
+// persists across MEX files for the Matlab session, or else the default
+int getThreadCount();
+
+// Set the number of OpenEXR threads. A negative count restores the default.
+void setThreadCount(int numThreads);
+
 // Generic initialization for Matlab: sets up the number of threads to
-// use in OpenEXR and registers the exit callback.
-void mexEXRInit();
+// use in OpenEXR and registers the exit callback. Called by every gateway.
+// The count is read from Matlab on the first call, when another MEX file
+// changed the shared count, or when resync is true.
+void mexEXRInit(bool resync = false);
+
+// Exit callback registered by mexEXRInit, for gateways which need to
+// register their own and chain to it.
+void mexEXRExit();
+
+// Persistent pool for whole-file tasks, such as the batched reads. It is
+// separate from OpenEXR's global pool, which the files themselves use to
+// decompress their pixels, so that waiting on a file never starves it.
+// It has as many threads as the global pool.
+IlmThread::ThreadPool & getFileThreadPool();
+
+
+// Raises OpenEXR's global thread count for the lifetime of the object, so
+// that an explicit per-call thread count is not capped by the global pool.
+class ScopedThreadCount
+{
+public:
+    explicit ScopedThreadCount(int numThreads);
+    ~ScopedThreadCount();
+
+private:
+    ScopedThreadCount(const ScopedThreadCount &);
+    ScopedThreadCount & operator=(const ScopedThreadCount &);
+
+    int m_previous;
+};
+
+// Number of scanlines in each compressed block, as used by OpenEXR
+inline int getLinesPerBlock(OPENEXR_IMF_INTERNAL_NAMESPACE::Compression compression)
+{
+    switch (compression) {
+    case OPENEXR_IMF_INTERNAL_NAMESPACE::ZIP_COMPRESSION:
+    case OPENEXR_IMF_INTERNAL_NAMESPACE::PXR24_COMPRESSION:
+        return 16;
+    case OPENEXR_IMF_INTERNAL_NAMESPACE::PIZ_COMPRESSION:
+    case OPENEXR_IMF_INTERNAL_NAMESPACE::B44_COMPRESSION:
+    case OPENEXR_IMF_INTERNAL_NAMESPACE::B44A_COMPRESSION:
+    case OPENEXR_IMF_INTERNAL_NAMESPACE::DWAA_COMPRESSION:
+        return 32;
+    case OPENEXR_IMF_INTERNAL_NAMESPACE::DWAB_COMPRESSION:
+        return 256;
+    default:
+        return 1;
+    }
+}
 
 } // namespace OpenEXRforMatlab
\ No newline at end of file
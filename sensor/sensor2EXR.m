@@ -19,6 +19,11 @@ function [filename, rgb, data_max] = sensor2EXR(sensor,filename,varargin)
 %  rgb        - Sensor data in RGB format for display
 %
 % Description
+%   The 'mosaic' format writes the sensor data with exrwritechannels, one
+%   channel per site of the color filter array, subsampled by the size of
+%   the CFA pattern. The site layout is stored in the cfaPattern
+%   attribute, and the exposure and pixel noise parameters are stored as
+%   attributes as well.
 %
 % TODO:
 %   The 'noisy rgb' is used for the Restormer network.
@@ -87,7 +92,36 @@ data = 0.9*data/data_max;
 
 switch dataformat
     case 'mosaic'
-        % Leave data in mosaic form
+        % Write the mosaic natively, without the RGB planes. This needs
+        % the compiled exrwritechannels, not only its help file.
+        if exist('exrwritechannels','file') ~= 3
+            error(['The ''mosaic'' format needs the exrwritechannels MEX ' ...
+                'file. Compile it with make in imgproc/openexr, or use ' ...
+                'the ''noisy rgb'' format.']);
+        end
+        if isempty(filename), filename = [fullfile(tempname),'.exr']; end
+        if isempty(comment), comment = sensorComment(sensor); end
+
+        attribs = containers.Map('UniformValues',false);
+        attribs('comments')       = comment;
+        attribs('expTime')        = single(sensorGet(sensor,'exp time'));
+        attribs('sensorName')     = char(sensorGet(sensor,'name'));
+        attribs('dataType')       = datatype;
+        attribs('dataMax')        = double(data_max);
+        attribs('pixelSize')      = double(sensorGet(sensor,'pixel size'));
+        attribs('analogGain')     = double(sensorGet(sensor,'analog gain'));
+        attribs('analogOffset')   = double(sensorGet(sensor,'analog offset'));
+        attribs('voltageSwing')   = double(sensorGet(sensor,'pixel voltage swing'));
+        attribs('conversionGain') = double(sensorGet(sensor,'pixel conversion gain'));
+        attribs('readNoise')      = double(sensorGet(sensor,'pixel read noise volts'));
+        attribs('darkVoltage')    = double(sensorGet(sensor,'pixel dark voltage'));
+        attribs('noiseFlag')      = int32(sensorGet(sensor,'noise flag'));
+
+        colors = sensorGet(sensor,'filter color letters cell');
+        exrwritechannels(filename,'zip','half',attribs,colors(:)',data, ...
+            struct('cfa',sensorGet(sensor,'pattern')));
+        if nargout > 1, rgb = plane2rgb(data,sensor,0); end
+        return;
     case 'noisyrgb'
         % Convert to separate planes with zero in the empty positions. This
         % behavior is used by Zhenyi for the RGBW demosaicking experiments.
@@ -130,17 +164,22 @@ exrwrite(data,filename,"Channels",Channels);
 info = exrinfo(filename);
 % system(sprintf('open %s',filename));
 
-if isempty(comment)
-    pSize = sensorGet(sensor,'pixel size','um');
-    comment = sprintf('Name: %s | Exposure %.2f ms | Pixel-Size: %.2f um | N-Channels: %d |  Noise-flag: %d',...
-        sensorGet(sensor,'name'),...
-        sensorGet(sensor,'exp time','ms'), ...
-        pSize(1), ...
-        sensorGet(sensor,'nfilters'), ...
-        sensorGet(sensor,'noise flag'));
-end
+if isempty(comment), comment = sensorComment(sensor); end
 
 info.AttributeInfo.Comments = comment;
 exrwrite(data, filename, 'Attributes', info.AttributeInfo,'Channels',Channels);
 
 end
+
+%% Default comment with the sensor parameters
+function comment = sensorComment(sensor)
+
+pSize = sensorGet(sensor,'pixel size','um');
+comment = sprintf('Name: %s | Exposure %.2f ms | Pixel-Size: %.2f um | N-Channels: %d |  Noise-flag: %d',...
+    sensorGet(sensor,'name'),...
+    sensorGet(sensor,'exp time','ms'), ...
+    pSize(1), ...
+    sensorGet(sensor,'nfilters'), ...
+    sensorGet(sensor,'noise flag'));
+
+end
@@ -74,15 +74,16 @@ crop     = p.Results.crop;
 if isa(crop,'images.roi.Rectangle'), crop = crop.Position; end
 
 %% Metadata
-[img, info] = ieDNGRead(fname);
+if fullInfo
+    [img, info] = ieDNGRead(fname);
 
-% We simplify and standardized the parameter names here
-ieInfo      = ieDNGSimpleInfo(info);
-
-if ~fullInfo
+    % We simplify and standardized the parameter names here
+    ieInfo      = ieDNGSimpleInfo(info);
+else
     % The user wants just the simpler, standardized version of the full DNG
-    % header
-    info = ieInfo;
+    % header, which ieDNGRead reads without imfinfo when it can
+    [img, info] = ieDNGRead(fname,'simple info',true);
+    ieInfo      = info;
 end
 
 %% Fix up the data
@@ -36,11 +36,28 @@
 #include <limits.h>
 #include <math.h>
 #include <setjmp.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 #include <time.h>
+#ifdef __cplusplus
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#endif
+#ifndef NO_SIMD
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h> /* Vectorized scale_colors() and convert_to_rgb() */
+#define DCRAW_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define DCRAW_NEON
+#endif
+#endif
 
 #if defined(DJGPP) || defined(__MINGW32__)
 #define fseeko fseek
@@ -62,11 +79,20 @@ typedef __int64 INT64;
 typedef unsigned __int64 UINT64;
 #else
 #include <netinet/in.h>
+#include <sys/mman.h> /* map_file() */
 #include <unistd.h>
 #include <utime.h>
 typedef long long INT64;
 typedef unsigned long long UINT64;
 #endif
+#if defined(DCRAW_LIBRARY) && !defined(LOCALTIME)
+/* Camera clocks are read as UTC, as main() does by setting TZ=UTC */
+#ifdef WIN32
+#define mktime _mkgmtime
+#else
+#define mktime timegm
+#endif
+#endif
 
 #ifdef NODEPS
 #define NO_JASPER
@@ -96,11 +122,37 @@ typedef unsigned long long UINT64;
 #define ushort unsigned short
 #endif
 
+const double xyz_rgb[3][3] = {/* XYZ from RGB */
+                              {0.412453, 0.357580, 0.180423},
+                              {0.212671, 0.715160, 0.072169},
+                              {0.019334, 0.119193, 0.950227}};
+const float d65_white[3] = {0.950456, 1, 1.088754};
+
+struct jhead;
+struct tiff_hdr;
+struct ljpeg_tile;
+
 /*
    All global variables are defined here, and all functions that
    access them are prefixed with "CLASS".  Note that a thread-safe
    C++ class cannot have non-const static local variables.
+
+   Compiled as C++, the variables and functions are the members of
+   class DCRaw, and each object decodes independently of the others,
+   so several files can be decoded at once in different threads.
+   Allocate them with "new DCRaw()", which zeroes the variables like
+   those of the C program.  For the same reason, the functions below
+   keep their state here instead of in static local variables.
  */
+#ifdef __cplusplus
+#define CLASS DCRaw::
+#define CALL(fp) (this->*fp)
+class DCRaw {
+ public:
+#else
+#define CLASS
+#define CALL(fp) (*fp)
+#endif
 FILE *ifp, *ofp;
 short order;
 const char *ifname;
@@ -121,6 +173,8 @@ unsigned flip, tiff_flip, filters, colors;
 ushort raw_height, raw_width, height, width, top_margin, left_margin;
 ushort shrink, iheight, iwidth, fuji_width, thumb_width, thumb_height;
 ushort *raw_image, (*image)[4], cblack[4102];
+uchar *mem_image, *map_data;
+INT64 map_length;
 ushort white[8][8], curve[0x10000], cr2_slice[3], sraw_mul[4];
 double pixel_aspect, aber[4] = {1, 1, 1, 1}, gamm[6] = {0.45, 4.5, 0, 0, 0, 0};
 float bright = 1, user_mul[4] = {0, 0, 0, 0}, threshold = 0;
@@ -128,18 +182,30 @@ int mask[8][4];
 int half_size = 0, four_color_rgb = 0, document_mode = 0, highlight = 0;
 int verbose = 0, use_auto_wb = 0, use_camera_wb = 0, use_camera_matrix = 1;
 int output_color = 1, output_bps = 8, output_tiff = 0, med_passes = 0;
-int no_auto_bright = 0;
+int no_auto_bright = 0, write_to_memory = 0, nthreads = 1;
 unsigned greybox[4] = {0, 0, UINT_MAX, UINT_MAX};
 float cam_mul[4], pre_mul[4], cmatrix[3][4], rgb_cam[3][4];
-const double xyz_rgb[3][3] = {/* XYZ from RGB */
-                              {0.412453, 0.357580, 0.180423},
-                              {0.212671, 0.715160, 0.072169},
-                              {0.019334, 0.119193, 0.950227}};
-const float d65_white[3] = {0.950456, 1, 1.088754};
 int histogram[4][0x2000];
-void (*write_thumb)(), (*write_fun)();
-void (*load_raw)(), (*thumb_load_raw)();
+void (CLASS *write_thumb)(), (CLASS *write_fun)();
+void (CLASS *load_raw)(), (CLASS *thumb_load_raw)();
+void (*tiff_tag_hook)(void *data, int ifd, unsigned tag, unsigned type,
+                      unsigned len) = 0; /* parse_tiff_ifd() */
+void *tiff_tag_data = 0;
 jmp_buf failure;
+char error_text[256]; /* error_msg() */
+int error_fatal;
+#ifdef __cplusplus
+struct tile_pool { /* run_tiles() */
+  std::vector<std::thread> threads;
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::vector<char> done;
+  void (CLASS *tile)(void *arg, int thread, int row, int col);
+  void *arg;
+  int count, ncols, ordered, next, finished, nthreads, quit;
+  unsigned job;
+} pool;
+#endif
 
 struct decode {
   struct decode *branch[2];
@@ -158,7 +224,255 @@ struct ph1 {
   float tag_210;
 } ph1;
 
-#define CLASS
+unsigned gbh_bitbuf;             /* getbithuff() */
+int gbh_vbits, gbh_reset;
+float idct_cs[106];              /* ljpeg_idct() */
+UINT64 ph1_bitbuf;               /* ph1_bithuff() */
+int ph1_vbits;
+uchar pana_buf[0x4000];          /* pana_bits() */
+int pana_vbits;
+uchar jpeg_buffer[4096];         /* fill_input_buffer() */
+unsigned sony_pad[128], sony_p;  /* sony_decrypt() */
+unsigned foveon_table[1024];     /* foveon_decoder() */
+float cielab_cbrt[0x10000], cielab_xyz_cam[3][4]; /* cielab() */
+
+struct vng_bands {               /* vng_interpolate() */
+  int *code[16][16], prow, pcol, nbands;
+  ushort (*brow)[4], (*hold)[4];
+};
+
+struct wavelet_bands {           /* wavelet_denoise() */
+  float *fimg, thold;
+  int size, c, scale, sc, hpass, lpass, step, nbands;
+};
+
+struct median_bands {            /* median_filter() */
+  float *diff;
+  int c, step, nbands;
+};
+
+struct xtrans_tiles {            /* xtrans_interpolate() */
+  short allhex[3][3][2][8];
+  ushort sgrow, sgcol;
+  int passes, ndir;
+  char *buffer;
+};
+
+int fcol(int row, int col);
+void error_msg(int fatal, const char *fmt, ...);
+void merror(void *ptr, const char *where);
+void derror();
+ushort sget2(uchar *s);
+ushort get2();
+unsigned sget4(uchar *s);
+unsigned get4();
+unsigned getint(int type);
+float int_to_float(int i);
+double getreal(int type);
+void read_shorts(ushort *pixel, int count);
+void cubic_spline(const int *x_, const int *y_, const int len);
+void canon_600_fixed_wb(int temp);
+int canon_600_color(int ratio[2], int mar);
+void canon_600_auto_wb();
+void canon_600_coeff();
+void canon_600_load_raw();
+void canon_600_correct();
+int canon_s2is();
+unsigned getbithuff(int nbits, ushort *huff);
+ushort *make_decoder_ref(const uchar **source);
+ushort *make_decoder(const uchar *source);
+void crw_init_tables(unsigned table, ushort *huff[2]);
+int canon_has_lowbits();
+void canon_load_raw();
+void map_file();
+void unmap_file();
+int ljpeg_start(struct jhead *jh, int info_only);
+void ljpeg_end(struct jhead *jh);
+int ljpeg_diff(ushort *huff);
+int *make_ljpeg_lut(ushort *huff);
+void ljpeg_fill(struct jhead *jh);
+unsigned ljpeg_bithuff(struct jhead *jh, int nbits, ushort *huff);
+int ljpeg_diff_mem(struct jhead *jh, ushort *huff, int *lut);
+ushort *ljpeg_row(int jrow, struct jhead *jh);
+void ljpeg_rows(struct jhead *jh, int jrow, int jend);
+void ljpeg_errors(struct jhead *jh);
+int ljpeg_share(struct jhead *jh, struct jhead *set);
+void ljpeg_interval(void *arg, int thread, int index, int unused);
+void lossless_jpeg_load_raw();
+void canon_sraw_load_raw();
+void adobe_copy_pixel(unsigned row, unsigned col, ushort **rp);
+void ljpeg_idct(struct jhead *jh);
+void dng_tile(struct ljpeg_tile *tile);
+void dng_tile_rows(void *arg, int thread, int index, int unused);
+void lossless_dng_load_raw();
+void packed_dng_load_raw();
+void pentax_load_raw();
+void nikon_load_raw();
+void nikon_yuv_load_raw();
+int nikon_e995();
+int nikon_e2100();
+void nikon_3700();
+int minolta_z2();
+void jpeg_thumb();
+void ppm_thumb();
+void ppm16_thumb();
+void layer_thumb();
+void rollei_thumb();
+void rollei_load_raw();
+int raw(unsigned row, unsigned col);
+void phase_one_flat_field(int is_float, int nc);
+void phase_one_correct();
+void phase_one_load_raw();
+unsigned ph1_bithuff(int nbits, ushort *huff);
+void phase_one_load_raw_c();
+void hasselblad_load_raw();
+void leaf_hdr_load_raw();
+void unpacked_load_raw();
+void sinar_4shot_load_raw();
+void imacon_full_load_raw();
+void packed_load_raw();
+void nokia_load_raw();
+void canon_rmf_load_raw();
+unsigned pana_bits(int nbits);
+void panasonic_load_raw();
+void olympus_load_raw();
+void minolta_rd175_load_raw();
+void quicktake_100_load_raw();
+void kodak_radc_load_raw();
+void kodak_jpeg_load_raw();
+void lossy_dng_load_raw();
+void gamma_curve(double pwr, double ts, int mode, int imax);
+void kodak_dc120_load_raw();
+void eight_bit_load_raw();
+void kodak_c330_load_raw();
+void kodak_c603_load_raw();
+void kodak_262_load_raw();
+int kodak_65000_decode(short *out, int bsize);
+void kodak_65000_load_raw();
+void kodak_ycbcr_load_raw();
+void kodak_rgb_load_raw();
+void kodak_thumb_load_raw();
+void sony_decrypt(unsigned *data, int len, int start, int key);
+void sony_load_raw();
+void sony_arw_load_raw();
+void sony_arw2_load_raw();
+void samsung_load_raw();
+void samsung2_load_raw();
+void samsung3_load_raw();
+void smal_decode_segment(unsigned seg[2][2], int holes);
+void smal_v6_load_raw();
+int median4(int *p);
+void fill_holes(int holes);
+void smal_v9_load_raw();
+void redcine_load_raw();
+void foveon_decoder(unsigned size, unsigned code);
+void foveon_thumb();
+void foveon_sd_load_raw();
+void foveon_huff(ushort *huff);
+void foveon_dp_load_raw();
+void foveon_load_camf();
+const char *foveon_camf_param(const char *block, const char *param);
+void *foveon_camf_matrix(unsigned dim[3], const char *name);
+int foveon_fixed(void *ptr, int size, const char *name);
+float foveon_avg(short *pix, int range[2], float cfilt);
+short *foveon_make_curve(double max, double mul, double filt);
+void foveon_make_curves(short **curvep, float dq[3], float div[3], float filt);
+int foveon_apply_curve(short *curve, int i);
+void foveon_interpolate();
+void crop_masked_pixels();
+void remove_zeroes();
+void bad_pixels(const char *cfname);
+void subtract(const char *fname);
+void pseudoinverse(double (*in)[3], double (*out)[3], int size);
+void cam_xyz_coeff(float rgb_cam[3][4], double cam_xyz[4][3]);
+void colorcheck();
+void hat_row(float *out, const float *mid, const float *a, const float *b,
+             int count, float mul);
+void hat_transform(float *temp, float *base, int st, int size, int sc);
+void wavelet_band(void *arg, int thread, int band, int unused);
+void wavelet_denoise();
+void scale_pixels(ushort (*pix)[4], int count, const float mul[4]);
+void scale_colors();
+void pre_interpolate();
+void border_interpolate(int border);
+int tile_threads(int count);
+void run_tiles(void (CLASS *tile)(void *arg, int thread, int row, int col),
+               void *arg, int nrows, int ncols, int ordered);
+#ifdef __cplusplus
+void pool_tiles(int thread, std::unique_lock<std::mutex> &lock);
+void pool_thread(int thread);
+~DCRaw();
+#endif
+void lin_interpolate();
+void vng_band(void *arg, int thread, int band, int unused);
+void vng_interpolate();
+void ppg_row(void *arg, int thread, int row, int unused);
+void ppg_interpolate();
+void cielab(ushort rgb[3], short lab[3]);
+void xtrans_tile(void *arg, int thread, int row, int col);
+void xtrans_interpolate(int passes);
+void ahd_tile(void *arg, int thread, int ti, int tj);
+void ahd_interpolate();
+void median_row(float *out, const float *d0, const float *d1,
+                const float *d2, int count);
+void median_band(void *arg, int thread, int band, int unused);
+void median_filter();
+void blend_highlights();
+void recover_highlights();
+void tiff_get(unsigned base, unsigned *tag, unsigned *type, unsigned *len,
+              unsigned *save);
+void parse_thumb_note(int base, unsigned toff, unsigned tlen);
+int parse_tiff_ifd(int base);
+void parse_makernote(int base, int uptag);
+void get_timestamp(int reversed);
+void parse_exif(int base);
+void parse_gps(int base);
+void romm_coeff(float romm_cam[3][3]);
+void parse_mos(int offset);
+void linear_table(unsigned len);
+void parse_kodak_ifd(int base);
+void parse_minolta(int base);
+int parse_tiff(int base);
+void apply_tiff();
+void parse_external_jpeg();
+void ciff_block_1030();
+void parse_ciff(int offset, int length, int depth);
+void parse_rollei();
+void parse_sinar_ia();
+void parse_phase_one(int base);
+void parse_fuji(int offset);
+int parse_jpeg(int offset);
+void parse_riff();
+void parse_qt(int end);
+void parse_smal(int offset, int fsize);
+void parse_cine();
+void parse_redcine();
+char *foveon_gets(int offset, char *str, int len);
+void parse_foveon();
+void adobe_coeff(const char *make, const char *model);
+void simple_coeff(int index);
+short guess_byte_order(int words);
+float find_green(int bps, int bite, int off0, int off1);
+void identify();
+void apply_profile(const char *input, const char *output);
+void rgb_pixels(ushort (*pix)[4], int count, float out_cam[3][4]);
+void convert_to_rgb();
+void fuji_rotate();
+void stretch();
+int flip_index(int row, int col);
+void tiff_set(struct tiff_hdr *th, ushort *ntag, ushort tag, ushort type,
+              int count, int val);
+void tiff_head(struct tiff_hdr *th, int full);
+void write_ppm_tiff();
+int identify_file(const char *fname);
+INT64 load_raw_memory();
+void fold_black();
+int load_mosaic(const char *fname);
+int load_identified();
+int main(int argc, const char **argv);
+#ifdef __cplusplus
+};
+#endif
 
 #define FORC(cnt) for (c = 0; c < cnt; c++)
 #define FORC3 FORC(3)
@@ -271,19 +585,39 @@ char *my_strcasestr(char *haystack, const char *needle) {
 #define strcasestr my_strcasestr
 #endif
 
+/*
+   Print an error message, and keep it in error_text for the callers
+   of main() that do not see stderr.  The first fatal message wins over
+   the others, and a data error is only kept until there is one.
+ */
+void CLASS error_msg(int fatal, const char *fmt, ...) {
+  va_list ap;
+  char *cp;
+
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+  if (error_fatal || (error_text[0] && !fatal)) return;
+  va_start(ap, fmt);
+  vsnprintf(error_text, sizeof error_text, fmt, ap);
+  va_end(ap);
+  if ((cp = strchr(error_text, '\n'))) *cp = 0;
+  error_fatal = fatal;
+}
+
 void CLASS merror(void *ptr, const char *where) {
   if (ptr) return;
-  fprintf(stderr, _("%s: Out of memory in %s\n"), ifname, where);
+  error_msg(1, _("%s: Out of memory in %s\n"), ifname, where);
   longjmp(failure, 1);
 }
 
 void CLASS derror() {
   if (!data_error) {
-    fprintf(stderr, "%s: ", ifname);
     if (feof(ifp))
-      fprintf(stderr, _("Unexpected end of file\n"));
+      error_msg(0, _("%s: Unexpected end of file\n"), ifname);
     else
-      fprintf(stderr, _("Corrupt data near 0x%llx\n"), (INT64)ftello(ifp));
+      error_msg(0, _("%s: Corrupt data near 0x%llx\n"), ifname,
+                (INT64)ftello(ifp));
   }
   data_error++;
 }
@@ -594,25 +928,23 @@ int CLASS canon_s2is() {
 }
 
 unsigned CLASS getbithuff(int nbits, ushort *huff) {
-  static unsigned bitbuf = 0;
-  static int vbits = 0, reset = 0;
   unsigned c;
 
   if (nbits > 25) return 0;
-  if (nbits < 0) return bitbuf = vbits = reset = 0;
-  if (nbits == 0 || vbits < 0) return 0;
-  while (!reset && vbits < nbits && (c = fgetc(ifp)) != EOF &&
-         !(reset = zero_after_ff && c == 0xff && fgetc(ifp))) {
-    bitbuf = (bitbuf << 8) + (uchar)c;
-    vbits += 8;
-  }
-  c = bitbuf << (32 - vbits) >> (32 - nbits);
+  if (nbits < 0) return gbh_bitbuf = gbh_vbits = gbh_reset = 0;
+  if (nbits == 0 || gbh_vbits < 0) return 0;
+  while (!gbh_reset && gbh_vbits < nbits && (c = fgetc(ifp)) != EOF &&
+         !(gbh_reset = zero_after_ff && c == 0xff && fgetc(ifp))) {
+    gbh_bitbuf = (gbh_bitbuf << 8) + (uchar)c;
+    gbh_vbits += 8;
+  }
+  c = gbh_bitbuf << (32 - gbh_vbits) >> (32 - nbits);
   if (huff) {
-    vbits -= huff[c] >> 8;
+    gbh_vbits -= huff[c] >> 8;
     c = (uchar)huff[c];
   } else
-    vbits -= nbits;
-  if (vbits < 0) derror();
+    gbh_vbits -= nbits;
+  if (gbh_vbits < 0) derror();
   return c;
 }
 
@@ -805,10 +1137,67 @@ void CLASS canon_load_raw() {
 struct jhead {
   int algo, bits, high, wide, clrs, sraw, psv, restart, vpred[6];
   ushort quant[64], idct[64], *huff[20], *free[20], *row;
+  int *lut[20], *lut_free[4];
+  const uchar *bptr, *bend; /* ljpeg_bithuff() */
+  UINT64 bitbuf;
+  int vbits, breset;
+  int threaded, errors; /* in run_tiles(): no ifp, no derror() */
 };
 
+struct ljpeg_tile { /* lossless_dng_load_raw(), lossless_jpeg_load_raw() */
+  struct jhead jh;  /* shares its tables, no row buffer */
+  unsigned trow, tcol, jwide;
+  int jrow, jend;
+};
+
+struct ljpeg_work { /* the tiles of run_tiles() and a row for each thread */
+  struct ljpeg_tile *tile;
+  ushort *row;
+  int rowsize;
+};
+
+/*
+   Map the whole input file into memory for the bit reader of
+   ljpeg_row().  map_data stays null when that is not possible, e.g.
+   for a pipe, and ljpeg_row() then reads ifp with getbits().
+ */
+void CLASS map_file() {
+  INT64 save = ftello(ifp);
+
+  fseeko(ifp, 0, SEEK_END);
+  map_length = ftello(ifp);
+  if (save >= 0 && map_length > 0 &&
+      map_length == (INT64)(size_t)map_length) {
+#ifdef WIN32
+    fseeko(ifp, 0, SEEK_SET);
+    map_data = (uchar *)malloc(map_length);
+    if (map_data &&
+        fread(map_data, 1, map_length, ifp) < (size_t)map_length) {
+      free(map_data);
+      map_data = 0;
+    }
+#else
+    map_data = (uchar *)mmap(0, map_length, PROT_READ, MAP_PRIVATE,
+                             fileno(ifp), 0);
+    if (map_data == (uchar *)MAP_FAILED) map_data = 0;
+#endif
+  }
+  fseeko(ifp, save, SEEK_SET);
+}
+
+void CLASS unmap_file() {
+  if (!map_data) return;
+#ifdef WIN32
+  free(map_data);
+#else
+  munmap(map_data, map_length);
+#endif
+  map_data = 0;
+}
+
 int CLASS ljpeg_start(struct jhead *jh, int info_only) {
   ushort c, tag, len;
+  int i;
   uchar data[0x10000];
   const uchar *dp;
 
@@ -856,6 +1245,15 @@ int CLASS ljpeg_start(struct jhead *jh, int info_only) {
     FORC(4) jh->huff[2 + c] = jh->huff[1];
     FORC(jh->sraw) jh->huff[1 + c] = jh->huff[0];
   }
+  if (!map_data) map_file();
+  if (map_data) {
+    FORC4 if (jh->free[c]) jh->lut_free[c] = make_ljpeg_lut(jh->free[c]);
+    for (i = 0; i < 20; i++)
+      FORC4 if (jh->free[c] && jh->huff[i] == jh->free[c])
+        jh->lut[i] = jh->lut_free[c];
+    jh->bptr = map_data + MIN(ftello(ifp), map_length);
+    jh->bend = map_data + map_length;
+  }
   jh->row = (ushort *)calloc(jh->wide * jh->clrs, 4);
   merror(jh->row, "ljpeg_start()");
   return zero_after_ff = 1;
@@ -864,6 +1262,7 @@ int CLASS ljpeg_start(struct jhead *jh, int info_only) {
 void CLASS ljpeg_end(struct jhead *jh) {
   int c;
   FORC4 if (jh->free[c]) free(jh->free[c]);
+  FORC4 if (jh->lut_free[c]) free(jh->lut_free[c]);
   free(jh->row);
 }
 
@@ -877,22 +1276,137 @@ int CLASS ljpeg_diff(ushort *huff) {
   return diff;
 }
 
+#define LJPEG_LUT_BITS 12
+
+/*
+   Lookahead table for ljpeg_diff_mem().  For every LJPEG_LUT_BITS bits
+   that begin with a whole Huffman code and its difference bits, holds
+   the difference times 256 plus the number of bits they take, or zero
+   if they do not fit and the code must go through huff[].
+ */
+int *CLASS make_ljpeg_lut(ushort *huff) {
+  int *lut, max = huff[0], bits, code, len, leaf, diff;
+
+  lut = (int *)calloc(1 << LJPEG_LUT_BITS, sizeof *lut);
+  merror(lut, "make_ljpeg_lut()");
+  for (bits = 0; bits < 1 << LJPEG_LUT_BITS; bits++) {
+    code = max > LJPEG_LUT_BITS ? bits << (max - LJPEG_LUT_BITS)
+                                : bits >> (LJPEG_LUT_BITS - max);
+    len = huff[1 + code] >> 8;
+    leaf = (uchar)huff[1 + code];
+    if (!len || len + leaf > LJPEG_LUT_BITS) continue;
+    diff = bits >> (LJPEG_LUT_BITS - len - leaf) & ((1 << leaf) - 1);
+    if (leaf && (diff & (1 << (leaf - 1))) == 0) diff -= (1 << leaf) - 1;
+    lut[bits] = diff * 256 + len + leaf;
+  }
+  return lut;
+}
+
+/*
+   The bit reader of ljpeg_row() when the file is in memory: the same
+   bits as getbithuff(), but up to 64 of them are buffered, eight bytes
+   at a time when none of them is a 0xff to unstuff.
+ */
+void CLASS ljpeg_fill(struct jhead *jh) {
+  UINT64 word;
+  int c, n;
+
+  while (!jh->breset && jh->vbits >= 0 && jh->vbits <= 56) {
+    if (jh->bend - jh->bptr >= 8) {
+      for (word = n = 0; n < 8; n++) word = word << 8 | jh->bptr[n];
+      if (!zero_after_ff || !((~word - 0x0101010101010101ULL) & word &
+                              0x8080808080808080ULL)) {
+        n = (64 - jh->vbits) >> 3;
+        jh->bitbuf =
+            n == 8 ? word : jh->bitbuf << n * 8 | word >> (64 - n * 8);
+        jh->bptr += n;
+        jh->vbits += n * 8;
+        continue;
+      }
+    }
+    if (jh->bptr == jh->bend) break;
+    c = *jh->bptr++;
+    if (zero_after_ff && c == 0xff &&
+        (jh->bptr == jh->bend || *jh->bptr++)) {
+      jh->breset = 1;
+      break;
+    }
+    jh->bitbuf = jh->bitbuf << 8 | c;
+    jh->vbits += 8;
+  }
+}
+
+unsigned CLASS ljpeg_bithuff(struct jhead *jh, int nbits, ushort *huff) {
+  unsigned c;
+
+  if (nbits > 25 || nbits == 0 || jh->vbits < 0) return 0;
+  if (jh->vbits < nbits) ljpeg_fill(jh);
+  c = (jh->vbits >= nbits ? jh->bitbuf >> (jh->vbits - nbits)
+                          : jh->bitbuf << (nbits - jh->vbits)) &
+      ((1 << nbits) - 1);
+  if (huff) {
+    jh->vbits -= huff[c] >> 8;
+    c = (uchar)huff[c];
+  } else
+    jh->vbits -= nbits;
+  if (jh->vbits < 0) {
+    if (jh->threaded)
+      jh->errors++;
+    else
+      derror();
+  }
+  return c;
+}
+
+/*
+   ljpeg_diff() on the bit reader of ljpeg_row(), decoding a code and
+   its difference bits with one lookup when they fit in lut[].
+ */
+int CLASS ljpeg_diff_mem(struct jhead *jh, ushort *huff, int *lut) {
+  int len, diff;
+
+  if (jh->vbits < 32) ljpeg_fill(jh);
+  if (lut && jh->vbits >= LJPEG_LUT_BITS &&
+      (diff = lut[jh->bitbuf >> (jh->vbits - LJPEG_LUT_BITS) &
+                  ((1 << LJPEG_LUT_BITS) - 1)])) {
+    jh->vbits -= diff & 0xff;
+    return diff >> 8;
+  }
+  len = ljpeg_bithuff(jh, *huff, huff + 1);
+  if (len == 16 && (!dng_version || dng_version >= 0x1010000)) return -32768;
+  diff = ljpeg_bithuff(jh, len, 0);
+  if ((diff & (1 << (len - 1))) == 0) diff -= (1 << len) - 1;
+  return diff;
+}
+
 ushort *CLASS ljpeg_row(int jrow, struct jhead *jh) {
   int col, c, diff, pred, spred = 0;
   ushort mark = 0, *row[3];
+  const uchar *bp;
 
   if (jrow * jh->wide % jh->restart == 0) {
     FORC(6) jh->vpred[c] = 1 << (jh->bits - 1);
-    if (jrow) {
-      fseek(ifp, -2, SEEK_CUR);
-      do mark = (mark << 8) + (c = fgetc(ifp));
-      while (c != EOF && mark >> 4 != 0xffd);
+    if (jh->bptr) {
+      if (jrow) {
+        bp = jh->bptr - 2;
+        do mark = (mark << 8) + (c = bp < jh->bend ? *bp++ : EOF);
+        while (c != EOF && mark >> 4 != 0xffd);
+        jh->bptr = bp;
+      }
+      jh->bitbuf = jh->vbits = jh->breset = 0;
+    } else {
+      if (jrow) {
+        fseek(ifp, -2, SEEK_CUR);
+        do mark = (mark << 8) + (c = fgetc(ifp));
+        while (c != EOF && mark >> 4 != 0xffd);
+      }
+      getbits(-1);
     }
-    getbits(-1);
   }
   FORC3 row[c] = jh->row + jh->wide * jh->clrs * ((jrow + c) & 1);
   for (col = 0; col < jh->wide; col++) FORC(jh->clrs) {
-      diff = ljpeg_diff(jh->huff[c]);
+      diff = jh->bptr ? ljpeg_diff_mem(jh, jh->huff[c], jh->lut[c])
+                      : ljpeg_diff(jh->huff[c]);
       if (jh->sraw && c <= jh->sraw && (col | c))
         pred = spred;
       else if (col)
@@ -923,24 +1437,32 @@ ushort *CLASS ljpeg_row(int jrow, struct jhead *jh) {
           default:
             pred = 0;
         }
-      if ((**row = pred + diff) >> jh->bits) derror();
+      if ((**row = pred + diff) >> jh->bits) {
+        if (jh->threaded)
+          jh->errors++;
+        else
+          derror();
+      }
       if (c <= jh->sraw) spred = **row;
       row[0]++;
       row[1]++;
     }
+  if (jh->bptr && !jh->threaded) fseeko(ifp, jh->bptr - map_data, SEEK_SET);
   return row[2];
 }
 
-void CLASS lossless_jpeg_load_raw() {
-  int jwide, jrow, jcol, val, jidx, i, j, row = 0, col = 0;
-  struct jhead jh;
+/*
+   Rows jrow to jend - 1 of lossless_jpeg_load_raw(), which start at
+   a restart marker unless jrow is 0.  Unscrambles the CR2 slices.
+ */
+void CLASS ljpeg_rows(struct jhead *jh, int jrow, int jend) {
+  int jwide = jh->wide * jh->clrs, jcol, val, jidx, i, j, row, col;
   ushort *rp;
 
-  if (!ljpeg_start(&jh, 0)) return;
-  jwide = jh.wide * jh.clrs;
-
-  for (jrow = 0; jrow < jh.high; jrow++) {
-    rp = ljpeg_row(jrow, &jh);
+  row = jrow * jwide / raw_width;
+  col = jrow * jwide % raw_width;
+  for (; jrow < jend; jrow++) {
+    rp = ljpeg_row(jrow, jh);
     if (load_flags & 1) row = jrow & 1 ? height - 1 - jrow / 2 : jrow / 2;
     for (jcol = 0; jcol < jwide; jcol++) {
       val = curve[*rp++];
@@ -957,6 +1479,105 @@ void CLASS lossless_jpeg_load_raw() {
       if (++col >= raw_width) col = (row++, 0);
     }
   }
+}
+
+/*
+   Report the data errors counted by a tile decoded in run_tiles(), as
+   the serial decoder would have, at the position where it stopped.
+ */
+void CLASS ljpeg_errors(struct jhead *jh) {
+  if (!jh->errors) return;
+  fseeko(ifp, jh->bptr - map_data, SEEK_SET);
+  derror();
+}
+
+/*
+   If jh has the same Huffman tables as set, free them and make jh
+   use those of set, so that tiles with equal tables share one copy.
+ */
+int CLASS ljpeg_share(struct jhead *jh, struct jhead *set) {
+  int i, c;
+
+  FORC4 {
+    if (!jh->free[c] != !set->free[c]) return 0;
+    if (jh->free[c] && (jh->free[c][0] != set->free[c][0] ||
+                        memcmp(jh->free[c], set->free[c],
+                               (1 + (1 << jh->free[c][0])) * sizeof(ushort))))
+      return 0;
+  }
+  for (i = 0; i < 20; i++) FORC4 {
+      if (jh->free[c] && jh->huff[i] == jh->free[c])
+        jh->huff[i] = set->free[c];
+      if (jh->lut_free[c] && jh->lut[i] == jh->lut_free[c])
+        jh->lut[i] = set->lut_free[c];
+    }
+  FORC4 {
+    free(jh->free[c]);
+    free(jh->lut_free[c]);
+    jh->free[c] = 0;
+    jh->lut_free[c] = 0;
+  }
+  return 1;
+}
+
+void CLASS ljpeg_interval(void *arg, int thread, int index, int unused) {
+  struct ljpeg_work *work = (struct ljpeg_work *)arg;
+  struct ljpeg_tile *tile = work->tile + index;
+
+  tile->jh.row = work->row + (size_t)thread * work->rowsize;
+  ljpeg_rows(&tile->jh, tile->jrow, tile->jend);
+  tile->jh.row = 0;
+}
+
+/*
+   The CR2 slices are not separate streams, only an order of the
+   decoded pixels, so the image is one serial Huffman stream.  If it
+   has restart markers at the start of rows, and every row is
+   predicted from the left only, the intervals between them are
+   decoded in parallel, each from the marker that the serial decoder
+   would find.
+ */
+void CLASS lossless_jpeg_load_raw() {
+  int rows, count = 0, i, c;
+  struct jhead jh;
+  struct ljpeg_tile *tiles;
+  struct ljpeg_work work;
+  const uchar *bp;
+
+  if (!ljpeg_start(&jh, 0)) return;
+  rows = jh.restart / jh.wide;
+  if (jh.bptr && jh.psv == 1 && jh.restart < INT_MAX && rows > 0 &&
+      jh.restart % jh.wide == 0 && (cr2_slice[0] || raw_width != 3984))
+    count = (jh.high + rows - 1) / rows;
+  if (tile_threads(count) > 1) {
+    tiles = (struct ljpeg_tile *)calloc(count, sizeof *tiles);
+    merror(tiles, "lossless_jpeg_load_raw()");
+    for (bp = jh.bptr, i = 0; i < count; i++) {
+      if (i) {
+        while (bp + 1 < jh.bend && (bp[0] != 0xff || bp[1] >> 4 != 0xd)) bp++;
+        if (bp + 1 >= jh.bend) break;
+        bp += 2;
+      }
+      tiles[i].jh = jh;
+      tiles[i].jh.bptr = bp;
+      tiles[i].jh.threaded = 1;
+      tiles[i].jh.row = 0;
+      tiles[i].jrow = i * rows;
+      tiles[i].jend = MIN(jh.high, (i + 1) * rows);
+    }
+    if (i == count) {
+      work.tile = tiles;
+      work.rowsize = jh.wide * jh.clrs * 2;
+      work.row = (ushort *)calloc(tile_threads(count), work.rowsize * 2);
+      merror(work.row, "lossless_jpeg_load_raw()");
+      run_tiles(&CLASS ljpeg_interval, &work, count, 1, 0);
+      FORC(count) ljpeg_errors(&tiles[c].jh);
+      free(work.row);
+    } else
+      ljpeg_rows(&jh, 0, jh.high);
+    free(tiles);
+  } else
+    ljpeg_rows(&jh, 0, jh.high);
   ljpeg_end(&jh);
 }
 
@@ -1049,7 +1670,6 @@ void CLASS adobe_copy_pixel(unsigned row, unsigned col, ushort **rp) {
 void CLASS ljpeg_idct(struct jhead *jh) {
   int c, i, j, len, skip, coef;
   float work[3][8][8];
-  static float cs[106] = {0};
   static const uchar zigzag[80] = {
       0,  1,  8,  16, 9,  2,  3,  10, 17, 24, 32, 25, 18, 11, 4,  5,
       12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6,  7,  14, 21, 28,
@@ -1057,7 +1677,7 @@ void CLASS ljpeg_idct(struct jhead *jh) {
       58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
       63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63};
 
-  if (!cs[0]) FORC(106) cs[c] = cos((c & 31) * M_PI / 16) / 2;
+  if (!idct_cs[0]) FORC(106) idct_cs[c] = cos((c & 31) * M_PI / 16) / 2;
   memset(work, 0, sizeof work);
   work[0][0][0] = jh->vpred[0] += ljpeg_diff(jh->huff[0]) * jh->quant[0];
   for (i = 1; i < 64; i++) {
@@ -1072,19 +1692,59 @@ void CLASS ljpeg_idct(struct jhead *jh) {
   FORC(8) work[0][c][0] *= M_SQRT1_2;
   for (i = 0; i < 8; i++)
     for (j = 0; j < 8; j++)
-      FORC(8) work[1][i][j] += work[0][i][c] * cs[(j * 2 + 1) * c];
+      FORC(8) work[1][i][j] += work[0][i][c] * idct_cs[(j * 2 + 1) * c];
   for (i = 0; i < 8; i++)
     for (j = 0; j < 8; j++)
-      FORC(8) work[2][i][j] += work[1][c][j] * cs[(i * 2 + 1) * c];
+      FORC(8) work[2][i][j] += work[1][c][j] * idct_cs[(i * 2 + 1) * c];
 
   FORC(64) jh->idct[c] = CLIP(((float *)work[2])[c] + 0.5);
 }
 
+void CLASS dng_tile(struct ljpeg_tile *tile) {
+  unsigned jrow, jcol, row, col;
+  ushort *rp;
+
+  for (row = col = jrow = 0; jrow < tile->jh.high; jrow++) {
+    rp = ljpeg_row(jrow, &tile->jh);
+    for (jcol = 0; jcol < tile->jwide; jcol++) {
+      adobe_copy_pixel(tile->trow + row, tile->tcol + col, &rp);
+      if (++col >= tile_width || col >= raw_width) row += 1 + (col = 0);
+    }
+  }
+}
+
+void CLASS dng_tile_rows(void *arg, int thread, int index, int unused) {
+  struct ljpeg_work *work = (struct ljpeg_work *)arg;
+  struct ljpeg_tile *tile = work->tile + index;
+
+  tile->jh.row = work->row + (size_t)thread * work->rowsize;
+  dng_tile(tile);
+  tile->jh.row = 0;
+}
+
+/*
+   Lossless tiles are independent streams.  With several threads,
+   their headers are read here and the tiles decoded afterwards.
+   Tiles with the same Huffman tables share them, and each thread
+   has one row buffer, so only the headers are kept for every tile.
+ */
 void CLASS lossless_dng_load_raw() {
   unsigned save, trow = 0, tcol = 0, jwide, jrow, jcol, row, col, i, j;
-  struct jhead jh;
+  struct jhead jh, sets[4];
+  struct ljpeg_tile tile, *tiles = 0;
+  struct ljpeg_work work;
+  int ntiles = 0, queued = 0, nsets = 0, defer, c;
   ushort *rp;
 
+  if (tile_length < INT_MAX) {
+    ntiles = (raw_width + tile_width - 1) / tile_width *
+             ((raw_height + tile_length - 1) / tile_length);
+    if (tile_threads(ntiles) > 1) {
+      tiles = (struct ljpeg_tile *)calloc(ntiles, sizeof *tiles);
+      merror(tiles, "lossless_dng_load_raw()");
+    }
+  }
+  work.rowsize = 0;
   while (trow < raw_height) {
     save = ftell(ifp);
     if (tile_length < INT_MAX) fseek(ifp, get4(), SEEK_SET);
@@ -1092,6 +1752,7 @@ void CLASS lossless_dng_load_raw() {
     jwide = jh.wide;
     if (filters) jwide *= jh.clrs;
     jwide /= MIN(is_raw, tiff_samples);
+    defer = 0;
     switch (jh.algo) {
       case 0xc1:
         jh.vpred[0] = 16384;
@@ -1108,27 +1769,57 @@ void CLASS lossless_dng_load_raw() {
         }
         break;
       case 0xc3:
-        for (row = col = jrow = 0; jrow < jh.high; jrow++) {
-          rp = ljpeg_row(jrow, &jh);
-          for (jcol = 0; jcol < jwide; jcol++) {
-            adobe_copy_pixel(trow + row, tcol + col, &rp);
-            if (++col >= tile_width || col >= raw_width) row += 1 + (col = 0);
-          }
+        tile.jh = jh;
+        tile.trow = trow;
+        tile.tcol = tcol;
+        tile.jwide = jwide;
+        if (tiles && jh.bptr && queued < ntiles) {
+          for (c = 0; c < nsets && !ljpeg_share(&tile.jh, &sets[c]); c++)
+            ;
+          if (c == nsets && nsets < 4) sets[nsets++] = tile.jh;
+          defer = c < nsets;
         }
+        if (defer) {
+          free(tile.jh.row);
+          tile.jh.row = sets[c].row = 0;
+          tile.jh.threaded = 1;
+          tiles[queued++] = tile;
+          work.rowsize = MAX(work.rowsize, jh.wide * jh.clrs * 2);
+        } else
+          dng_tile(&tile);
     }
     fseek(ifp, save + 4, SEEK_SET);
     if ((tcol += tile_width) >= raw_width) trow += tile_length + (tcol = 0);
-    ljpeg_end(&jh);
+    if (!defer) ljpeg_end(&jh);
+  }
+  if (queued) {
+    work.tile = tiles;
+    work.row = (ushort *)calloc(tile_threads(queued), work.rowsize * 2);
+    merror(work.row, "lossless_dng_load_raw()");
+    run_tiles(&CLASS dng_tile_rows, &work, queued, 1, 0);
+    FORC(queued) ljpeg_errors(&tiles[c].jh);
+    free(work.row);
   }
+  FORC(nsets) ljpeg_end(&sets[c]);
+  free(tiles);
 }
 
 void CLASS packed_dng_load_raw() {
   ushort *pixel, *rp;
-  int row, col;
+  int row, col, linear;
 
+  for (col = 0; col < 0x10000 && curve[col] == col; col++);
+  linear = col == 0x10000;
   pixel = (ushort *)calloc(raw_width, tiff_samples * sizeof *pixel);
   merror(pixel, "packed_dng_load_raw()");
   for (row = 0; row < raw_height; row++) {
+    if (tiff_bps == 16 && tiff_samples == 1 && raw_image) {
+      rp = raw_image + row * raw_width; /* as adobe_copy_pixel() would */
+      read_shorts(rp, raw_width);
+      if (!linear)
+        for (col = 0; col < raw_width; col++) rp[col] = curve[rp[col]];
+      continue;
+    }
     if (tiff_bps == 16)
       read_shorts(pixel, raw_width * tiff_samples);
     else {
@@ -1321,8 +2012,6 @@ int CLASS minolta_z2() {
   return nz > 20;
 }
 
-void CLASS jpeg_thumb();
-
 void CLASS ppm_thumb() {
   char *thumb;
   thumb_length = thumb_width * thumb_height * 3;
@@ -1682,22 +2371,20 @@ void CLASS phase_one_load_raw() {
 }
 
 unsigned CLASS ph1_bithuff(int nbits, ushort *huff) {
-  static UINT64 bitbuf = 0;
-  static int vbits = 0;
   unsigned c;
 
-  if (nbits == -1) return bitbuf = vbits = 0;
+  if (nbits == -1) return ph1_bitbuf = ph1_vbits = 0;
   if (nbits == 0) return 0;
-  if (vbits < nbits) {
-    bitbuf = bitbuf << 32 | get4();
-    vbits += 32;
+  if (ph1_vbits < nbits) {
+    ph1_bitbuf = ph1_bitbuf << 32 | get4();
+    ph1_vbits += 32;
   }
-  c = bitbuf << (64 - vbits) >> (64 - nbits);
+  c = ph1_bitbuf << (64 - ph1_vbits) >> (64 - nbits);
   if (huff) {
-    vbits -= huff[c] >> 8;
+    ph1_vbits -= huff[c] >> 8;
     return (uchar)huff[c];
   }
-  vbits -= nbits;
+  ph1_vbits -= nbits;
   return c;
 }
 #define ph1_bits(n) ph1_bithuff(n, 0)
@@ -1967,18 +2654,17 @@ void CLASS canon_rmf_load_raw() {
 }
 
 unsigned CLASS pana_bits(int nbits) {
-  static uchar buf[0x4000];
-  static int vbits;
   int byte;
 
-  if (!nbits) return vbits = 0;
-  if (!vbits) {
-    fread(buf + load_flags, 1, 0x4000 - load_flags, ifp);
-    fread(buf, 1, load_flags, ifp);
+  if (!nbits) return pana_vbits = 0;
+  if (!pana_vbits) {
+    fread(pana_buf + load_flags, 1, 0x4000 - load_flags, ifp);
+    fread(pana_buf, 1, load_flags, ifp);
   }
-  vbits = (vbits - nbits) & 0x1ffff;
-  byte = vbits >> 3 ^ 0x3ff0;
-  return (buf[byte] | buf[byte + 1] << 8) >> (vbits & 7) & ~(-1 << nbits);
+  pana_vbits = (pana_vbits - nbits) & 0x1ffff;
+  byte = pana_vbits >> 3 ^ 0x3ff0;
+  return (pana_buf[byte] | pana_buf[byte + 1] << 8) >> (pana_vbits & 7) &
+         ~(-1 << nbits);
 }
 
 void CLASS panasonic_load_raw() {
@@ -2274,14 +2960,20 @@ void CLASS kodak_jpeg_load_raw() {}
 void CLASS lossy_dng_load_raw() {}
 #else
 
+#ifdef __cplusplus
+#define JPEG_CLIENT(cinfo) ((DCRaw *)(cinfo)->client_data)->
+#else
+#define JPEG_CLIENT(cinfo)
+#endif
+
 METHODDEF(boolean)
 fill_input_buffer(j_decompress_ptr cinfo) {
-  static uchar jpeg_buffer[4096];
+  uchar *buf = JPEG_CLIENT(cinfo) jpeg_buffer;
   size_t nbytes;
 
-  nbytes = fread(jpeg_buffer, 1, 4096, ifp);
-  swab(jpeg_buffer, jpeg_buffer, nbytes);
-  cinfo->src->next_input_byte = jpeg_buffer;
+  nbytes = fread(buf, 1, 4096, JPEG_CLIENT(cinfo) ifp);
+  swab(buf, buf, nbytes);
+  cinfo->src->next_input_byte = buf;
   cinfo->src->bytes_in_buffer = nbytes;
   return TRUE;
 }
@@ -2295,13 +2987,16 @@ void CLASS kodak_jpeg_load_raw() {
 
   cinfo.err = jpeg_std_error(&jerr);
   jpeg_create_decompress(&cinfo);
+#ifdef __cplusplus
+  cinfo.client_data = this;
+#endif
   jpeg_stdio_src(&cinfo, ifp);
   cinfo.src->fill_input_buffer = fill_input_buffer;
   jpeg_read_header(&cinfo, TRUE);
   jpeg_start_decompress(&cinfo);
   if ((cinfo.output_width != width) || (cinfo.output_height * 2 != height) ||
       (cinfo.output_components != 3)) {
-    fprintf(stderr, _("%s: incorrect JPEG dimensions\n"), ifname);
+    error_msg(1, _("%s: incorrect JPEG dimensions\n"), ifname);
     jpeg_destroy_decompress(&cinfo);
     longjmp(failure, 3);
   }
@@ -2324,8 +3019,6 @@ void CLASS kodak_jpeg_load_raw() {
   maximum = 0xff << 1;
 }
 
-void CLASS gamma_curve(double pwr, double ts, int mode, int imax);
-
 void CLASS lossy_dng_load_raw() {
   struct jpeg_decompress_struct cinfo;
   struct jpeg_error_mgr jerr;
@@ -2617,17 +3310,19 @@ void CLASS kodak_thumb_load_raw() {
 }
 
 void CLASS sony_decrypt(unsigned *data, int len, int start, int key) {
-  static unsigned pad[128], p;
-
   if (start) {
-    for (p = 0; p < 4; p++) pad[p] = key = key * 48828125 + 1;
-    pad[3] = pad[3] << 1 | (pad[0] ^ pad[2]) >> 31;
-    for (p = 4; p < 127; p++)
-      pad[p] = (pad[p - 4] ^ pad[p - 2]) << 1 | (pad[p - 3] ^ pad[p - 1]) >> 31;
-    for (p = 0; p < 127; p++) pad[p] = htonl(pad[p]);
+    for (sony_p = 0; sony_p < 4; sony_p++)
+      sony_pad[sony_p] = key = key * 48828125 + 1;
+    sony_pad[3] = sony_pad[3] << 1 | (sony_pad[0] ^ sony_pad[2]) >> 31;
+    for (sony_p = 4; sony_p < 127; sony_p++)
+      sony_pad[sony_p] = (sony_pad[sony_p - 4] ^ sony_pad[sony_p - 2]) << 1 |
+                         (sony_pad[sony_p - 3] ^ sony_pad[sony_p - 1]) >> 31;
+    for (sony_p = 0; sony_p < 127; sony_p++)
+      sony_pad[sony_p] = htonl(sony_pad[sony_p]);
   }
-  while (len-- && p++)
-    *data++ ^= pad[(p - 1) & 127] = pad[p & 127] ^ pad[(p + 64) & 127];
+  while (len-- && sony_p++)
+    *data++ ^= sony_pad[(sony_p - 1) & 127] =
+        sony_pad[sony_p & 127] ^ sony_pad[(sony_p + 64) & 127];
 }
 
 void CLASS sony_load_raw() {
@@ -2999,23 +3694,22 @@ void CLASS redcine_load_raw() {
 /* RESTRICTED code starts here */
 
 void CLASS foveon_decoder(unsigned size, unsigned code) {
-  static unsigned huff[1024];
   struct decode *cur;
   int i, len;
 
   if (!code) {
-    for (i = 0; i < size; i++) huff[i] = get4();
+    for (i = 0; i < size; i++) foveon_table[i] = get4();
     memset(first_decode, 0, sizeof first_decode);
     free_decode = first_decode;
   }
   cur = free_decode++;
   if (free_decode > first_decode + 2048) {
-    fprintf(stderr, _("%s: decoder table overflow\n"), ifname);
+    error_msg(1, _("%s: decoder table overflow\n"), ifname);
     longjmp(failure, 2);
   }
   if (code)
     for (i = 0; i < size; i++)
-      if (huff[i] == code) {
+      if (foveon_table[i] == code) {
         cur->leaf = i;
         return;
       }
@@ -3700,7 +4394,9 @@ void CLASS crop_masked_pixels() {
   if (load_raw == &CLASS phase_one_load_raw ||
       load_raw == &CLASS phase_one_load_raw_c)
     phase_one_correct();
-  if (fuji_width) {
+  if (!image) /* load_mosaic() keeps the mosaic in raw_image */
+    ;
+  else if (fuji_width) {
     for (row = 0; row < raw_height - top_margin * 2; row++) {
       for (col = 0; col < fuji_width << !fuji_layout; col++) {
         if (fuji_layout) {
@@ -3756,27 +4452,33 @@ mask_set:
     black = (mblack[0] + mblack[1] + mblack[2] + mblack[3]) /
                 (mblack[4] + mblack[5] + mblack[6] + mblack[7]) -
             4;
-    canon_600_correct();
+    if (image) canon_600_correct();
   } else if (zero < mblack[4] && mblack[5] && mblack[6] && mblack[7]) {
     FORC4 cblack[c] = mblack[c] / mblack[4 + c];
     cblack[4] = cblack[5] = cblack[6] = 0;
   }
 }
 
+/*
+   Without image, work on the mosaic that load_mosaic() left in raw_image.
+ */
 void CLASS remove_zeroes() {
   unsigned row, col, tot, n, r, c;
 
+#define PIX(row, col) \
+  (*(image ? &BAYER(row, col) : &RAW((row) + top_margin, (col) + left_margin)))
   for (row = 0; row < height; row++)
     for (col = 0; col < width; col++)
-      if (BAYER(row, col) == 0) {
+      if (PIX(row, col) == 0) {
         tot = n = 0;
         for (r = row - 2; r <= row + 2; r++)
           for (c = col - 2; c <= col + 2; c++)
             if (r < height && c < width && FC(r, c) == FC(row, col) &&
-                BAYER(r, c))
-              tot += (n++, BAYER(r, c));
-        if (n) BAYER(row, col) = tot / n;
+                PIX(r, c))
+              tot += (n++, PIX(r, c));
+        if (n) PIX(row, col) = tot / n;
       }
+#undef PIX
 }
 
 /*
@@ -4050,10 +4752,45 @@ void CLASS colorcheck() {
 }
 #endif
 
+/*
+   out[i] = (2 * mid[i] + a[i] + b[i]) * mul, four floats at a time
+   with SSE2 or NEON.  The sums are done in the same order as in the
+   scalar loop, so the result is the same.
+ */
+void CLASS hat_row(float *out, const float *mid, const float *a,
+                   const float *b, int count, float mul) {
+  int i = 0;
+#if defined(DCRAW_SSE2)
+  const __m128 two = _mm_set1_ps(2), scale = _mm_set1_ps(mul);
+
+  for (; i + 4 <= count; i += 4)
+    _mm_storeu_ps(
+        out + i,
+        _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(two, _mm_loadu_ps(mid + i)),
+                                         _mm_loadu_ps(a + i)),
+                              _mm_loadu_ps(b + i)),
+                   scale));
+#elif defined(DCRAW_NEON)
+  const float32x4_t two = vdupq_n_f32(2), scale = vdupq_n_f32(mul);
+
+  for (; i + 4 <= count; i += 4)
+    vst1q_f32(out + i,
+              vmulq_f32(vaddq_f32(vaddq_f32(vmulq_f32(two, vld1q_f32(mid + i)),
+                                            vld1q_f32(a + i)),
+                                  vld1q_f32(b + i)),
+                        scale));
+#endif
+  for (; i < count; i++) out[i] = (2 * mid[i] + a[i] + b[i]) * mul;
+}
+
 void CLASS hat_transform(float *temp, float *base, int st, int size, int sc) {
   int i;
   for (i = 0; i < sc; i++)
     temp[i] = 2 * base[st * i] + base[st * (sc - i)] + base[st * (i + sc)];
+  if (st == 1 && i + sc < size) {
+    hat_row(temp + i, base + i, base + i - sc, base + i + sc, size - sc - i, 1);
+    i = size - sc;
+  }
   for (; i + sc < size; i++)
     temp[i] = 2 * base[st * i] + base[st * (i - sc)] + base[st * (i + sc)];
   for (; i < size; i++)
@@ -4061,10 +4798,58 @@ void CLASS hat_transform(float *temp, float *base, int st, int size, int sc) {
               base[st * (2 * size - 2 - (i + sc))];
 }
 
+/*
+   One step of wavelet_denoise() on a band of rows.  The transform
+   along the columns is done a row at a time, from the rows of the
+   transform along the rows, which is kept in a plane of its own.
+ */
+void CLASS wavelet_band(void *arg, int thread, int band, int unused) {
+  struct wavelet_bands *wb = (struct wavelet_bands *)arg;
+  float *fimg = wb->fimg, *rows = fimg + wb->size * 3, *out;
+  int top = iheight * band / wb->nbands, sc = wb->sc, c = wb->c;
+  int bottom = iheight * (band + 1) / wb->nbands, row, col, i, lo, hi;
+
+  for (row = top; row < bottom; row++) {
+    i = row * iwidth;
+    switch (wb->step) {
+      case 0:
+        for (col = 0; col < iwidth; col++, i++)
+          fimg[i] = 256 * sqrt(image[i][c] << wb->scale);
+        break;
+      case 1:
+        out = rows + i;
+        hat_transform(out, fimg + wb->hpass + i, 1, iwidth, sc);
+        for (col = 0; col < iwidth; col++) out[col] *= 0.25;
+        break;
+      case 2:
+        lo = row < sc ? sc - row : row - sc;
+        hi = row + sc < iheight ? row + sc : 2 * iheight - 2 - (row + sc);
+        hat_row(fimg + wb->lpass + i, rows + i,
+                rows + LIM(lo, 0, iheight - 1) * iwidth,
+                rows + LIM(hi, 0, iheight - 1) * iwidth, iwidth, 0.25);
+        for (col = 0; col < iwidth; col++, i++) {
+          fimg[wb->hpass + i] -= fimg[wb->lpass + i];
+          if (fimg[wb->hpass + i] < -wb->thold)
+            fimg[wb->hpass + i] += wb->thold;
+          else if (fimg[wb->hpass + i] > wb->thold)
+            fimg[wb->hpass + i] -= wb->thold;
+          else
+            fimg[wb->hpass + i] = 0;
+          if (wb->hpass) fimg[i] += fimg[wb->hpass + i];
+        }
+        break;
+      case 3:
+        for (col = 0; col < iwidth; col++, i++)
+          image[i][c] = CLIP(SQR(fimg[i] + fimg[wb->lpass + i]) / 0x10000);
+    }
+  }
+}
+
 void CLASS wavelet_denoise() {
-  float *fimg = 0, *temp, thold, mul[2], avg, diff;
-  int scale = 1, size, lev, hpass, lpass, row, col, nc, c, i, wlast, blk[2];
+  float *fimg = 0, thold, mul[2], avg, diff;
+  int scale = 1, size, lev, row, col, nc, c, i, wlast, blk[2], nt;
   ushort *window[4];
+  struct wavelet_bands wb;
   static const float noise[] = {0.8002, 0.2735, 0.1202, 0.0585,
                                 0.0291, 0.0152, 0.0080, 0.0044};
 
@@ -4074,40 +4859,29 @@ void CLASS wavelet_denoise() {
   maximum <<= --scale;
   black <<= scale;
   FORC4 cblack[c] <<= scale;
-  if ((size = iheight * iwidth) < 0x15550000)
-    fimg = (float *)malloc((size * 3 + iheight + iwidth) * sizeof *fimg);
+  if ((size = iheight * iwidth) < 0x10000000)
+    fimg = (float *)malloc(size * 4 * sizeof *fimg);
   merror(fimg, "wavelet_denoise()");
-  temp = fimg + size * 3;
+  nt = tile_threads(iheight / 32);
+  wb.fimg = fimg;
+  wb.size = size;
+  wb.scale = scale;
+  wb.nbands = nt > 1 ? nt * 4 : 1;
   if ((nc = colors) == 3 && filters) nc++;
   FORC(nc) { /* denoise R,G1,B,G3 individually */
-    for (i = 0; i < size; i++) fimg[i] = 256 * sqrt(image[i][c] << scale);
-    for (hpass = lev = 0; lev < 5; lev++) {
-      lpass = size * ((lev & 1) + 1);
-      for (row = 0; row < iheight; row++) {
-        hat_transform(temp, fimg + hpass + row * iwidth, 1, iwidth, 1 << lev);
-        for (col = 0; col < iwidth; col++)
-          fimg[lpass + row * iwidth + col] = temp[col] * 0.25;
-      }
-      for (col = 0; col < iwidth; col++) {
-        hat_transform(temp, fimg + lpass + col, iwidth, iheight, 1 << lev);
-        for (row = 0; row < iheight; row++)
-          fimg[lpass + row * iwidth + col] = temp[row] * 0.25;
-      }
-      thold = threshold * noise[lev];
-      for (i = 0; i < size; i++) {
-        fimg[hpass + i] -= fimg[lpass + i];
-        if (fimg[hpass + i] < -thold)
-          fimg[hpass + i] += thold;
-        else if (fimg[hpass + i] > thold)
-          fimg[hpass + i] -= thold;
-        else
-          fimg[hpass + i] = 0;
-        if (hpass) fimg[i] += fimg[hpass + i];
-      }
-      hpass = lpass;
-    }
-    for (i = 0; i < size; i++)
-      image[i][c] = CLIP(SQR(fimg[i] + fimg[lpass + i]) / 0x10000);
+    wb.c = c;
+    wb.step = 0;
+    run_tiles(&CLASS wavelet_band, &wb, wb.nbands, 1, 0);
+    for (wb.hpass = lev = 0; lev < 5; lev++) {
+      wb.lpass = size * ((lev & 1) + 1);
+      wb.sc = 1 << lev;
+      wb.thold = threshold * noise[lev];
+      for (wb.step = 1; wb.step < 3; wb.step++)
+        run_tiles(&CLASS wavelet_band, &wb, wb.nbands, 1, 0);
+      wb.hpass = wb.lpass;
+    }
+    wb.step = 3;
+    run_tiles(&CLASS wavelet_band, &wb, wb.nbands, 1, 0);
   }
   if (filters && colors == 3) { /* pull G1 and G3 closer together */
     for (row = 0; row < 2; row++) {
@@ -4142,6 +4916,61 @@ void CLASS wavelet_denoise() {
   free(fimg);
 }
 
+/*
+   pix[i][c] = CLIP((pix[i][c] - cblack[c]) * mul[c]), two pixels at a
+   time with SSE2 or NEON.  The float arithmetic is the same as in the
+   scalar loop, so is the result.
+ */
+void CLASS scale_pixels(ushort (*pix)[4], int count, const float mul[4]) {
+  int i = 0, val, c;
+#if defined(DCRAW_SSE2)
+  const __m128i zero = _mm_setzero_si128(), bias = _mm_set1_epi32(0x8000);
+  const __m128i dark =
+      _mm_setr_epi32(cblack[0], cblack[1], cblack[2], cblack[3]);
+  const __m128 scale = _mm_loadu_ps(mul), lo = _mm_setzero_ps(),
+               hi = _mm_set1_ps(65535);
+  __m128i v, a, b;
+
+  for (; i + 2 <= count; i += 2) {
+    v = _mm_loadu_si128((__m128i *)pix[i]);
+    a = _mm_sub_epi32(_mm_unpacklo_epi16(v, zero), dark);
+    b = _mm_sub_epi32(_mm_unpackhi_epi16(v, zero), dark);
+    a = _mm_cvttps_epi32(_mm_min_ps(
+        _mm_max_ps(_mm_mul_ps(_mm_cvtepi32_ps(a), scale), lo), hi));
+    b = _mm_cvttps_epi32(_mm_min_ps(
+        _mm_max_ps(_mm_mul_ps(_mm_cvtepi32_ps(b), scale), lo), hi));
+    v = _mm_packs_epi32(_mm_sub_epi32(a, bias), _mm_sub_epi32(b, bias));
+    _mm_storeu_si128((__m128i *)pix[i],
+                     _mm_xor_si128(v, _mm_set1_epi16((short)0x8000)));
+  }
+#elif defined(DCRAW_NEON)
+  const int32_t black4[4] = {(int32_t)cblack[0], (int32_t)cblack[1],
+                             (int32_t)cblack[2], (int32_t)cblack[3]};
+  const int32x4_t dark = vld1q_s32(black4);
+  const float32x4_t scale = vld1q_f32(mul), lo = vdupq_n_f32(0),
+                    hi = vdupq_n_f32(65535);
+  uint16x8_t v;
+  int32x4_t a, b;
+
+  for (; i + 2 <= count; i += 2) {
+    v = vld1q_u16(pix[i]);
+    a = vsubq_s32(vreinterpretq_s32_u32(vmovl_u16(vget_low_u16(v))), dark);
+    b = vsubq_s32(vreinterpretq_s32_u32(vmovl_u16(vget_high_u16(v))), dark);
+    a = vcvtq_s32_f32(
+        vminq_f32(vmaxq_f32(vmulq_f32(vcvtq_f32_s32(a), scale), lo), hi));
+    b = vcvtq_s32_f32(
+        vminq_f32(vmaxq_f32(vmulq_f32(vcvtq_f32_s32(b), scale), lo), hi));
+    vst1q_u16(pix[i], vcombine_u16(vqmovun_s32(a), vqmovun_s32(b)));
+  }
+#endif
+  for (; i < count; i++) FORC4 {
+      if (!(val = pix[i][c])) continue;
+      val -= cblack[c];
+      val *= mul[c];
+      pix[i][c] = CLIP(val);
+    }
+}
+
 void CLASS scale_colors() {
   unsigned bottom, right, size, row, col, ur, uc, i, x, y, c, sum[8];
   int val, dark, sat;
@@ -4215,15 +5044,17 @@ void CLASS scale_colors() {
     cblack[4] = cblack[5] = 0;
   }
   size = iheight * iwidth;
-  for (i = 0; i < size * 4; i++) {
-    if (!(val = ((ushort *)image)[i])) continue;
-    if (cblack[4] && cblack[5])
+  if (cblack[4] && cblack[5])
+    for (i = 0; i < size * 4; i++) {
+      if (!(val = ((ushort *)image)[i])) continue;
       val -= cblack[6 + i / 4 / iwidth % cblack[4] * cblack[5] +
                     i / 4 % iwidth % cblack[5]];
-    val -= cblack[i & 3];
-    val *= scale_mul[i & 3];
-    ((ushort *)image)[i] = CLIP(val);
-  }
+      val -= cblack[i & 3];
+      val *= scale_mul[i & 3];
+      ((ushort *)image)[i] = CLIP(val);
+    }
+  else
+    scale_pixels(image, size, scale_mul);
   if ((aber[0] != 1 || aber[2] != 1) && colors == 3) {
     if (verbose) fprintf(stderr, _("Correcting chromatic aberration...\n"));
     for (c = 0; c < 4; c += 2) {
@@ -4320,6 +5151,108 @@ void CLASS border_interpolate(int border) {
     }
 }
 
+/*
+   The interpolations below split the image into a grid of tiles
+   (or bands of rows) and call tile(arg, thread, row, col) for each,
+   on up to nthreads threads when compiled as C++, and so do the
+   lossless JPEG loaders with their tiles and restart intervals.
+   "thread" is less than tile_threads(), to pick per-thread buffers
+   allocated by the caller.  If "ordered", a tile waits for the one
+   on its left and the one above and to the right of it, so that the
+   tiles which overlap are done in the same order as by the serial
+   loop, and the output is identical.  The tiles must not call
+   merror() or derror().
+ */
+int CLASS tile_threads(int count) {
+#ifdef __cplusplus
+  return LIM(nthreads, 1, count);
+#else
+  return 1;
+#endif
+}
+
+#ifdef __cplusplus
+/*
+   The threads of run_tiles() are started when first needed and then
+   kept, waiting for the next call, until the DCRaw is deleted.  The
+   calling thread does the tiles of thread 0.
+ */
+void CLASS pool_tiles(int thread, std::unique_lock<std::mutex> &lock) {
+  int t, row, col;
+
+  while ((t = pool.next) < pool.count) {
+    pool.next++;
+    row = t / pool.ncols;
+    col = t % pool.ncols;
+    if (pool.ordered)
+      pool.cond.wait(lock, [&] {
+        return (col == 0 || pool.done[t - 1]) &&
+               (row == 0 || pool.done[t - pool.ncols + (col + 1 < pool.ncols)]);
+      });
+    lock.unlock();
+    CALL(pool.tile)(pool.arg, thread, row, col);
+    lock.lock();
+    pool.done[t] = 1;
+    pool.finished++;
+    pool.cond.notify_all();
+  }
+}
+
+void CLASS pool_thread(int thread) {
+  std::unique_lock<std::mutex> lock(pool.mutex);
+  unsigned job = 0; /* joins the call that started it */
+
+  for (;;) {
+    pool.cond.wait(lock, [&] {
+      return pool.quit || (pool.job != job && thread < pool.nthreads);
+    });
+    if (pool.quit) return;
+    job = pool.job;
+    pool_tiles(thread, lock);
+  }
+}
+
+DCRaw::~DCRaw() {
+  int i;
+
+  {
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    pool.quit = 1;
+  }
+  pool.cond.notify_all();
+  for (i = 0; i < (int)pool.threads.size(); i++) pool.threads[i].join();
+}
+#endif
+
+void CLASS run_tiles(void (CLASS *tile)(void *arg, int thread, int row,
+                                         int col),
+                     void *arg, int nrows, int ncols, int ordered) {
+  int count = nrows * ncols, i;
+
+#ifdef __cplusplus
+  if (tile_threads(count) > 1) {
+    std::unique_lock<std::mutex> lock(pool.mutex);
+
+    pool.done.assign(count, 0);
+    pool.tile = tile;
+    pool.arg = arg;
+    pool.count = count;
+    pool.ncols = ncols;
+    pool.ordered = ordered;
+    pool.next = pool.finished = 0;
+    pool.nthreads = tile_threads(count);
+    pool.job++;
+    for (i = pool.threads.size() + 1; i < pool.nthreads; i++)
+      pool.threads.push_back(std::thread(&CLASS pool_thread, this, i));
+    pool.cond.notify_all();
+    pool_tiles(0, lock);
+    pool.cond.wait(lock, [&] { return pool.finished == count; });
+    return;
+  }
+#endif
+  for (i = 0; i < count; i++) CALL(tile)(arg, 0, i / ncols, i % ncols);
+}
+
 void CLASS lin_interpolate() {
   int code[16][16][32], size = 16, *ip, sum[4];
   int f, c, i, x, y, row, col, shift, color;
@@ -4370,8 +5303,78 @@ void CLASS lin_interpolate() {
    I've extended the basic idea to work with non-Bayer filter arrays.
    Gradients are numbered clockwise from NW=0 to W=7.
  */
+/*
+   VNG reads two rows above and below each pixel from the image that
+   it writes to, so each band of rows keeps its first two and last two
+   rows aside until all the bands are done.
+ */
+void CLASS vng_band(void *arg, int thread, int band, int unused) {
+  struct vng_bands *vb = (struct vng_bands *)arg;
+  ushort(*brow[5])[4], (*out)[4], *pix;
+  int *ip, gval[8], gmin, gmax, sum[4];
+  int row, col, top, bottom, t, g, diff, thold, num, color, c;
+
+  top = 2 + (height - 4) * band / vb->nbands;
+  bottom = 2 + (height - 4) * (band + 1) / vb->nbands;
+  brow[4] = vb->brow + thread * 3 * width;
+  for (row = 0; row < 3; row++) brow[row] = brow[4] + row * width;
+  for (row = top; row < bottom; row++) { /* Do VNG interpolation */
+    for (col = 2; col < width - 2; col++) {
+      pix = image[row * width + col];
+      ip = vb->code[row % vb->prow][col % vb->pcol];
+      memset(gval, 0, sizeof gval);
+      while ((g = ip[0]) != INT_MAX) { /* Calculate gradients */
+        diff = ABS(pix[g] - pix[ip[1]]) << ip[2];
+        gval[ip[3]] += diff;
+        ip += 5;
+        if ((g = ip[-1]) == -1) continue;
+        gval[g] += diff;
+        while ((g = *ip++) != -1) gval[g] += diff;
+      }
+      ip++;
+      gmin = gmax = gval[0]; /* Choose a threshold */
+      for (g = 1; g < 8; g++) {
+        if (gmin > gval[g]) gmin = gval[g];
+        if (gmax < gval[g]) gmax = gval[g];
+      }
+      if (gmax == 0) {
+        memcpy(brow[2][col], pix, sizeof *image);
+        continue;
+      }
+      thold = gmin + (gmax >> 1);
+      memset(sum, 0, sizeof sum);
+      color = fcol(row, col);
+      for (num = g = 0; g < 8; g++, ip += 2) { /* Average the neighbors */
+        if (gval[g] <= thold) {
+          FORCC
+          if (c == color && ip[1])
+            sum[c] += (pix[c] + pix[ip[1]]) >> 1;
+          else
+            sum[c] += pix[ip[0] + c];
+          num++;
+        }
+      }
+      FORCC { /* Save to buffer */
+        t = pix[color];
+        if (c != color) t += (sum[c] - sum[color]) / num;
+        brow[2][col][c] = CLIP(t);
+      }
+    }
+    if (row > top + 1) { /* Write buffer to image */
+      out = row < top + 4 ? vb->hold + (band * 4 + row - top - 2) * width
+                          : image + (row - 2) * width;
+      memcpy(out + 2, brow[0] + 2, (width - 4) * sizeof *image);
+    }
+    for (g = 0; g < 4; g++) brow[(g - 1) & 3] = brow[g];
+  }
+  memcpy(vb->hold[(band * 4 + 2) * width + 2], brow[0] + 2,
+         (width - 4) * sizeof *image);
+  memcpy(vb->hold[(band * 4 + 3) * width + 2], brow[1] + 2,
+         (width - 4) * sizeof *image);
+}
+
 void CLASS vng_interpolate() {
-  static const signed char *cp,
+  static const short
       terms[] =
           {-2, -2, +0,   -1, 0,  0x01, -2, -2, +0,   +0, 1,  0x01, -2, -1, -1,
            +0, 0,  0x01, -2, -1, +0,   -1, 0,  0x02, -2, -1, +0,   +0, 0,  0x03,
@@ -4400,10 +5403,10 @@ void CLASS vng_interpolate() {
            +1, -1, +1,   +1, 0,  0x88, +1, +0, +1,   +2, 0,  0x08, +1, +0, +2,
            -1, 0,  0x40, +1, +0, +2,   +1, 0,  0x10},
       chood[] = {-1, -1, -1, 0, -1, +1, 0, +1, +1, +1, +1, 0, +1, -1, 0, -1};
-  ushort(*brow[5])[4], *pix;
-  int prow = 8, pcol = 2, *ip, *code[16][16], gval[8], gmin, gmax, sum[4];
-  int row, col, x, y, x1, x2, y1, y2, t, weight, grads, color, diag;
-  int g, diff, thold, num, c;
+  const short *cp;
+  struct vng_bands vb;
+  int prow = 8, pcol = 2, *ip, nt, band;
+  int row, col, x, y, x1, x2, y1, y2, t, weight, grads, color, diag, g;
 
   lin_interpolate();
   if (verbose) fprintf(stderr, _("VNG interpolation...\n"));
@@ -4414,7 +5417,7 @@ void CLASS vng_interpolate() {
   merror(ip, "vng_interpolate()");
   for (row = 0; row < prow; row++) /* Precalculate for VNG */
     for (col = 0; col < pcol; col++) {
-      code[row][col] = ip;
+      vb.code[row][col] = ip;
       for (cp = terms, t = 0; t < 64; t++) {
         y1 = *cp++;
         x1 = *cp++;
@@ -4432,92 +5435,56 @@ void CLASS vng_interpolate() {
         *ip++ = weight;
         for (g = 0; g < 8; g++)
           if (grads & 1 << g) *ip++ = g;
-        *ip++ = -1;
-      }
-      *ip++ = INT_MAX;
-      for (cp = chood, g = 0; g < 8; g++) {
-        y = *cp++;
-        x = *cp++;
-        *ip++ = (y * width + x) * 4;
-        color = fcol(row, col);
-        if (fcol(row + y, col + x) != color &&
-            fcol(row + y * 2, col + x * 2) == color)
-          *ip++ = (y * width + x) * 8 + color;
-        else
-          *ip++ = 0;
-      }
-    }
-  brow[4] = (ushort(*)[4])calloc(width * 3, sizeof **brow);
-  merror(brow[4], "vng_interpolate()");
-  for (row = 0; row < 3; row++) brow[row] = brow[4] + row * width;
-  for (row = 2; row < height - 2; row++) { /* Do VNG interpolation */
-    for (col = 2; col < width - 2; col++) {
-      pix = image[row * width + col];
-      ip = code[row % prow][col % pcol];
-      memset(gval, 0, sizeof gval);
-      while ((g = ip[0]) != INT_MAX) { /* Calculate gradients */
-        diff = ABS(pix[g] - pix[ip[1]]) << ip[2];
-        gval[ip[3]] += diff;
-        ip += 5;
-        if ((g = ip[-1]) == -1) continue;
-        gval[g] += diff;
-        while ((g = *ip++) != -1) gval[g] += diff;
-      }
-      ip++;
-      gmin = gmax = gval[0]; /* Choose a threshold */
-      for (g = 1; g < 8; g++) {
-        if (gmin > gval[g]) gmin = gval[g];
-        if (gmax < gval[g]) gmax = gval[g];
-      }
-      if (gmax == 0) {
-        memcpy(brow[2][col], pix, sizeof *image);
-        continue;
-      }
-      thold = gmin + (gmax >> 1);
-      memset(sum, 0, sizeof sum);
-      color = fcol(row, col);
-      for (num = g = 0; g < 8; g++, ip += 2) { /* Average the neighbors */
-        if (gval[g] <= thold) {
-          FORCC
-          if (c == color && ip[1])
-            sum[c] += (pix[c] + pix[ip[1]]) >> 1;
-          else
-            sum[c] += pix[ip[0] + c];
-          num++;
-        }
+        *ip++ = -1;
       }
-      FORCC { /* Save to buffer */
-        t = pix[color];
-        if (c != color) t += (sum[c] - sum[color]) / num;
-        brow[2][col][c] = CLIP(t);
+      *ip++ = INT_MAX;
+      for (cp = chood, g = 0; g < 8; g++) {
+        y = *cp++;
+        x = *cp++;
+        *ip++ = (y * width + x) * 4;
+        color = fcol(row, col);
+        if (fcol(row + y, col + x) != color &&
+            fcol(row + y * 2, col + x * 2) == color)
+          *ip++ = (y * width + x) * 8 + color;
+        else
+          *ip++ = 0;
       }
     }
-    if (row > 3) /* Write buffer to image */
-      memcpy(image[(row - 2) * width + 2], brow[0] + 2,
+  vb.prow = prow;
+  vb.pcol = pcol;
+  nt = tile_threads((height - 4) / 32);
+  vb.nbands = nt > 1 ? nt * 4 : 1;
+  nt = tile_threads(vb.nbands); /* run_tiles() may start more */
+  vb.brow = (ushort(*)[4])calloc(width * 3 * nt, sizeof *vb.brow);
+  merror(vb.brow, "vng_interpolate()");
+  vb.hold = (ushort(*)[4])calloc(width * 4 * vb.nbands, sizeof *vb.hold);
+  merror(vb.hold, "vng_interpolate()");
+  run_tiles(&CLASS vng_band, &vb, vb.nbands, 1, 0);
+  for (band = 0; band < vb.nbands; band++) /* Write the rows held back */
+    for (row = 0; row < 4; row++) {
+      t = row < 2 ? 2 + (height - 4) * band / vb.nbands + row
+                  : 2 + (height - 4) * (band + 1) / vb.nbands + row - 4;
+      memcpy(image[t * width + 2], vb.hold[(band * 4 + row) * width + 2],
              (width - 4) * sizeof *image);
-    for (g = 0; g < 4; g++) brow[(g - 1) & 3] = brow[g];
-  }
-  memcpy(image[(row - 2) * width + 2], brow[0] + 2,
-         (width - 4) * sizeof *image);
-  memcpy(image[(row - 1) * width + 2], brow[1] + 2,
-         (width - 4) * sizeof *image);
-  free(brow[4]);
-  free(code[0][0]);
+    }
+  free(vb.hold);
+  free(vb.brow);
+  free(vb.code[0][0]);
 }
 
 /*
    Patterned Pixel Grouping Interpolation by Alain Desbiolles
+
+   Each pass reads only colors which it does not write, so the rows
+   of a pass are independent of each other.
 */
-void CLASS ppg_interpolate() {
+void CLASS ppg_row(void *arg, int thread, int row, int unused) {
   int dir[5] = {1, width, -1, -width, 1};
-  int row, col, diff[2], guess[2], c, d, i;
+  int pass = *(int *)arg, col, diff[2], guess[2], c, d, i;
   ushort(*pix)[4];
 
-  border_interpolate(3);
-  if (verbose) fprintf(stderr, _("PPG interpolation...\n"));
-
   /*  Fill in the green layer with gradients and pattern recognition: */
-  for (row = 3; row < height - 3; row++)
+  if (pass == 0 && row >= 3 && row < height - 3)
     for (col = 3 + (FC(row, 3) & 1), c = FC(row, col); col < width - 3;
          col += 2) {
       pix = image + row * width + col;
@@ -4536,7 +5503,7 @@ void CLASS ppg_interpolate() {
       pix[0][1] = ULIM(guess[i] >> 2, pix[d][1], pix[-d][1]);
     }
   /*  Calculate red and blue for each green pixel:		*/
-  for (row = 1; row < height - 1; row++)
+  if (pass == 1 && row >= 1 && row < height - 1)
     for (col = 1 + (FC(row, 2) & 1), c = FC(row, col + 1); col < width - 1;
          col += 2) {
       pix = image + row * width + col;
@@ -4546,7 +5513,7 @@ void CLASS ppg_interpolate() {
             1);
     }
   /*  Calculate blue for red pixels and vice versa:		*/
-  for (row = 1; row < height - 1; row++)
+  if (pass == 2 && row >= 1 && row < height - 1)
     for (col = 1 + (FC(row, 1) & 1), c = 2 - FC(row, col); col < width - 1;
          col += 2) {
       pix = image + row * width + col;
@@ -4563,31 +5530,40 @@ void CLASS ppg_interpolate() {
     }
 }
 
+void CLASS ppg_interpolate() {
+  int pass;
+
+  border_interpolate(3);
+  if (verbose) fprintf(stderr, _("PPG interpolation...\n"));
+
+  for (pass = 0; pass < 3; pass++)
+    run_tiles(&CLASS ppg_row, &pass, height, 1, 0);
+}
+
 void CLASS cielab(ushort rgb[3], short lab[3]) {
   int c, i, j, k;
   float r, xyz[3];
-  static float cbrt[0x10000], xyz_cam[3][4];
 
   if (!rgb) {
     for (i = 0; i < 0x10000; i++) {
       r = i / 65535.0;
-      cbrt[i] = r > 0.008856 ? pow(r, 1 / 3.0) : 7.787 * r + 16 / 116.0;
+      cielab_cbrt[i] = r > 0.008856 ? pow(r, 1 / 3.0) : 7.787 * r + 16 / 116.0;
     }
     for (i = 0; i < 3; i++)
       for (j = 0; j < colors; j++)
-        for (xyz_cam[i][j] = k = 0; k < 3; k++)
-          xyz_cam[i][j] += xyz_rgb[i][k] * rgb_cam[k][j] / d65_white[i];
+        for (cielab_xyz_cam[i][j] = k = 0; k < 3; k++)
+          cielab_xyz_cam[i][j] += xyz_rgb[i][k] * rgb_cam[k][j] / d65_white[i];
     return;
   }
   xyz[0] = xyz[1] = xyz[2] = 0.5;
   FORCC {
-    xyz[0] += xyz_cam[0][c] * rgb[c];
-    xyz[1] += xyz_cam[1][c] * rgb[c];
-    xyz[2] += xyz_cam[2][c] * rgb[c];
+    xyz[0] += cielab_xyz_cam[0][c] * rgb[c];
+    xyz[1] += cielab_xyz_cam[1][c] * rgb[c];
+    xyz[2] += cielab_xyz_cam[2][c] * rgb[c];
   }
-  xyz[0] = cbrt[CLIP((int)xyz[0])];
-  xyz[1] = cbrt[CLIP((int)xyz[1])];
-  xyz[2] = cbrt[CLIP((int)xyz[2])];
+  xyz[0] = cielab_cbrt[CLIP((int)xyz[0])];
+  xyz[1] = cielab_cbrt[CLIP((int)xyz[1])];
+  xyz[2] = cielab_cbrt[CLIP((int)xyz[2])];
   lab[0] = 64 * (116 * xyz[1] - 16);
   lab[1] = 64 * 500 * (xyz[0] - xyz[1]);
   lab[2] = 64 * 200 * (xyz[1] - xyz[2]);
@@ -4598,33 +5574,223 @@ void CLASS cielab(ushort rgb[3], short lab[3]) {
 
 /*
    Frank Markesteijn's algorithm for Fuji X-Trans sensors
+
+   A tile reads the pixels which the tiles above it and on its left
+   have written, so the tiles are run in the same order as the serial
+   loop over them.
  */
-void CLASS xtrans_interpolate(int passes) {
-  int c, d, f, g, h, i, v, ng, row, col, top, left, mrow, mcol;
-  int val, ndir, pass, hm[8], avg[4], color[3][8];
-  static const short orth[12] = {1, 0, 0, 1, -1, 0, 0, -1, 1, 0, 0, 1},
-                     patt[2][16] = {{0, 1, 0, -1, 2, 0, -1, 0, 1, 1, 1, -1, 0,
-                                     0, 0, 0},
-                                    {0, 1, 0, -2, 1, 0, -2, 0, 1, 1, -2, -2, 1,
-                                     -1, -1, 1}},
-                     dir[4] = {1, TS, TS + 1, TS - 1};
-  short allhex[3][3][2][8], *hex;
-  ushort min, max, sgrow, sgcol;
+void CLASS xtrans_tile(void *arg, int thread, int ti, int tj) {
+  struct xtrans_tiles *xt = (struct xtrans_tiles *)arg;
+  int c, d, f, g, h, i, v, row, col, top, left, mrow, mcol;
+  int val, pass, hm[8], avg[4], color[3][8];
+  int passes = xt->passes, ndir = xt->ndir;
+  static const short dir[4] = {1, TS, TS + 1, TS - 1};
+  short(*allhex)[3][2][8] = xt->allhex, *hex;
+  ushort max, sgrow = xt->sgrow, sgcol = xt->sgcol;
   ushort(*rgb)[TS][TS][3], (*rix)[3], (*pix)[4];
   short(*lab)[TS][3], (*lix)[3];
   float(*drv)[TS][TS], diff[6], tr;
   char(*homo)[TS][TS], *buffer;
 
-  if (verbose) fprintf(stderr, _("%d-pass X-Trans interpolation...\n"), passes);
-
-  cielab(0, 0);
-  ndir = 4 << (passes > 1);
-  buffer = (char *)malloc(TS * TS * (ndir * 11 + 6));
-  merror(buffer, "xtrans_interpolate()");
+  buffer = xt->buffer + (size_t)thread * TS * TS * (ndir * 11 + 6);
   rgb = (ushort(*)[TS][TS][3])buffer;
   lab = (short(*)[TS][3])(buffer + TS * TS * (ndir * 6));
   drv = (float(*)[TS][TS])(buffer + TS * TS * (ndir * 6 + 6));
   homo = (char(*)[TS][TS])(buffer + TS * TS * (ndir * 10 + 6));
+  top = 3 + ti * (TS - 16);
+  left = 3 + tj * (TS - 16);
+
+  mrow = MIN(top + TS, height - 3);
+  mcol = MIN(left + TS, width - 3);
+  for (row = top; row < mrow; row++)
+    for (col = left; col < mcol; col++)
+      memcpy(rgb[0][row - top][col - left], image[row * width + col], 6);
+  FORC3 memcpy(rgb[c + 1], rgb[0], sizeof *rgb);
+
+  /* Interpolate green horizontally, vertically, and along both diagonals:
+   */
+  for (row = top; row < mrow; row++)
+    for (col = left; col < mcol; col++) {
+      if ((f = fcol(row, col)) == 1) continue;
+      pix = image + row * width + col;
+      hex = allhex[row % 3][col % 3][0];
+      color[1][0] = 174 * (pix[hex[1]][1] + pix[hex[0]][1]) -
+                    46 * (pix[2 * hex[1]][1] + pix[2 * hex[0]][1]);
+      color[1][1] = 223 * pix[hex[3]][1] + pix[hex[2]][1] * 33 +
+                    92 * (pix[0][f] - pix[-hex[2]][f]);
+      FORC(2)
+      color[1][2 + c] =
+          164 * pix[hex[4 + c]][1] + 92 * pix[-2 * hex[4 + c]][1] +
+          33 * (2 * pix[0][f] - pix[3 * hex[4 + c]][f] -
+                pix[-3 * hex[4 + c]][f]);
+      FORC4 rgb[c ^ !((row - sgrow) % 3)][row - top][col - left][1] =
+          LIM(color[1][c] >> 8, pix[0][1], pix[0][3]);
+    }
+
+  for (pass = 0; pass < passes; pass++) {
+    if (pass == 1) memcpy(rgb += 4, buffer, 4 * sizeof *rgb);
+
+    /* Recalculate green from interpolated values of closer pixels:	*/
+    if (pass) {
+      for (row = top + 2; row < mrow - 2; row++)
+        for (col = left + 2; col < mcol - 2; col++) {
+          if ((f = fcol(row, col)) == 1) continue;
+          pix = image + row * width + col;
+          hex = allhex[row % 3][col % 3][1];
+          for (d = 3; d < 6; d++) {
+            rix =
+                &rgb[(d - 2) ^ !((row - sgrow) % 3)][row - top][col - left];
+            val = rix[-2 * hex[d]][1] + 2 * rix[hex[d]][1] -
+                  rix[-2 * hex[d]][f] - 2 * rix[hex[d]][f] + 3 * rix[0][f];
+            rix[0][1] = LIM(val / 3, pix[0][1], pix[0][3]);
+          }
+        }
+    }
+
+    /* Interpolate red and blue values for solitary green pixels:	*/
+    for (row = (top - sgrow + 4) / 3 * 3 + sgrow; row < mrow - 2; row += 3)
+      for (col = (left - sgcol + 4) / 3 * 3 + sgcol; col < mcol - 2;
+           col += 3) {
+        rix = &rgb[0][row - top][col - left];
+        h = fcol(row, col + 1);
+        memset(diff, 0, sizeof diff);
+        for (i = 1, d = 0; d < 6; d++, i ^= TS ^ 1, h ^= 2) {
+          for (c = 0; c < 2; c++, h ^= 2) {
+            g = 2 * rix[0][1] - rix[i << c][1] - rix[-i << c][1];
+            color[h][d] = g + rix[i << c][h] + rix[-i << c][h];
+            if (d > 1)
+              diff[d] += SQR(rix[i << c][1] - rix[-i << c][1] -
+                             rix[i << c][h] + rix[-i << c][h]) +
+                         SQR(g);
+          }
+          if (d > 1 && (d & 1))
+            if (diff[d - 1] < diff[d])
+              FORC(2) color[c * 2][d] = color[c * 2][d - 1];
+          if (d < 2 || (d & 1)) {
+            FORC(2) rix[0][c * 2] = CLIP(color[c * 2][d] / 2);
+            rix += TS * TS;
+          }
+        }
+      }
+
+    /* Interpolate red for blue pixels and vice versa:		*/
+    for (row = top + 3; row < mrow - 3; row++)
+      for (col = left + 3; col < mcol - 3; col++) {
+        if ((f = 2 - fcol(row, col)) == 1) continue;
+        rix = &rgb[0][row - top][col - left];
+        c = (row - sgrow) % 3 ? TS : 1;
+        h = 3 * (c ^ TS ^ 1);
+        for (d = 0; d < 4; d++, rix += TS * TS) {
+          i = d > 1 || ((d ^ c) & 1) ||
+                      ((ABS(rix[0][1] - rix[c][1]) +
+                        ABS(rix[0][1] - rix[-c][1])) <
+                       2 * (ABS(rix[0][1] - rix[h][1]) +
+                            ABS(rix[0][1] - rix[-h][1])))
+                  ? c
+                  : h;
+          rix[0][f] = CLIP((rix[i][f] + rix[-i][f] + 2 * rix[0][1] -
+                            rix[i][1] - rix[-i][1]) /
+                           2);
+        }
+      }
+
+    /* Fill in red and blue for 2x2 blocks of green:		*/
+    for (row = top + 2; row < mrow - 2; row++)
+      if ((row - sgrow) % 3)
+        for (col = left + 2; col < mcol - 2; col++)
+          if ((col - sgcol) % 3) {
+            rix = &rgb[0][row - top][col - left];
+            hex = allhex[row % 3][col % 3][1];
+            for (d = 0; d < ndir; d += 2, rix += TS * TS)
+              if (hex[d] + hex[d + 1]) {
+                g = 3 * rix[0][1] - 2 * rix[hex[d]][1] - rix[hex[d + 1]][1];
+                for (c = 0; c < 4; c += 2)
+                  rix[0][c] = CLIP(
+                      (g + 2 * rix[hex[d]][c] + rix[hex[d + 1]][c]) / 3);
+              } else {
+                g = 2 * rix[0][1] - rix[hex[d]][1] - rix[hex[d + 1]][1];
+                for (c = 0; c < 4; c += 2)
+                  rix[0][c] =
+                      CLIP((g + rix[hex[d]][c] + rix[hex[d + 1]][c]) / 2);
+              }
+          }
+  }
+  rgb = (ushort(*)[TS][TS][3])buffer;
+  mrow -= top;
+  mcol -= left;
+
+  /* Convert to CIELab and differentiate in all directions:	*/
+  for (d = 0; d < ndir; d++) {
+    for (row = 2; row < mrow - 2; row++)
+      for (col = 2; col < mcol - 2; col++)
+        cielab(rgb[d][row][col], lab[row][col]);
+    for (f = dir[d & 3], row = 3; row < mrow - 3; row++)
+      for (col = 3; col < mcol - 3; col++) {
+        lix = &lab[row][col];
+        g = 2 * lix[0][0] - lix[f][0] - lix[-f][0];
+        drv[d][row][col] =
+            SQR(g) +
+            SQR((2 * lix[0][1] - lix[f][1] - lix[-f][1] + g * 500 / 232)) +
+            SQR((2 * lix[0][2] - lix[f][2] - lix[-f][2] - g * 500 / 580));
+      }
+  }
+
+  /* Build homogeneity maps from the derivatives:			*/
+  memset(homo, 0, ndir * TS * TS);
+  for (row = 4; row < mrow - 4; row++)
+    for (col = 4; col < mcol - 4; col++) {
+      for (tr = FLT_MAX, d = 0; d < ndir; d++)
+        if (tr > drv[d][row][col]) tr = drv[d][row][col];
+      tr *= 8;
+      for (d = 0; d < ndir; d++)
+        for (v = -1; v <= 1; v++)
+          for (h = -1; h <= 1; h++)
+            if (drv[d][row + v][col + h] <= tr) homo[d][row][col]++;
+    }
+
+  /* Average the most homogenous pixels for the final result:	*/
+  if (height - top < TS + 4) mrow = height - top + 2;
+  if (width - left < TS + 4) mcol = width - left + 2;
+  for (row = MIN(top, 8); row < mrow - 8; row++)
+    for (col = MIN(left, 8); col < mcol - 8; col++) {
+      for (d = 0; d < ndir; d++)
+        for (hm[d] = 0, v = -2; v <= 2; v++)
+          for (h = -2; h <= 2; h++) hm[d] += homo[d][row + v][col + h];
+      for (d = 0; d < ndir - 4; d++)
+        if (hm[d] < hm[d + 4])
+          hm[d] = 0;
+        else if (hm[d] > hm[d + 4])
+          hm[d + 4] = 0;
+      for (max = hm[0], d = 1; d < ndir; d++)
+        if (max < hm[d]) max = hm[d];
+      max -= max >> 3;
+      memset(avg, 0, sizeof avg);
+      for (d = 0; d < ndir; d++)
+        if (hm[d] >= max) {
+          FORC3 avg[c] += rgb[d][row][col][c];
+          avg[3]++;
+        }
+      FORC3 image[(row + top) * width + col + left][c] = avg[c] / avg[3];
+    }
+}
+
+void CLASS xtrans_interpolate(int passes) {
+  struct xtrans_tiles xt;
+  int c, d, g, h, v, ng, row, col, top, left, ntop = 0, nleft = 0, val;
+  static const short orth[12] = {1, 0, 0, 1, -1, 0, 0, -1, 1, 0, 0, 1},
+                     patt[2][16] = {{0, 1, 0, -1, 2, 0, -1, 0, 1, 1, 1, -1, 0,
+                                     0, 0, 0},
+                                    {0, 1, 0, -2, 1, 0, -2, 0, 1, 1, -2, -2, 1,
+                                     -1, -1, 1}};
+  short(*allhex)[3][2][8] = xt.allhex, *hex;
+  ushort min, max, sgrow = 0, sgcol = 0;
+  ushort(*pix)[4];
+
+  if (verbose) fprintf(stderr, _("%d-pass X-Trans interpolation...\n"), passes);
+
+  cielab(0, 0);
+  xt.passes = passes;
+  xt.ndir = 4 << (passes > 1);
 
   /* Map a green hexagon around each non-green pixel and vice versa:	*/
   for (row = 0; row < 3; row++)
@@ -4672,182 +5838,16 @@ void CLASS xtrans_interpolate(int passes) {
       }
     }
 
-  for (top = 3; top < height - 19; top += TS - 16)
-    for (left = 3; left < width - 19; left += TS - 16) {
-      mrow = MIN(top + TS, height - 3);
-      mcol = MIN(left + TS, width - 3);
-      for (row = top; row < mrow; row++)
-        for (col = left; col < mcol; col++)
-          memcpy(rgb[0][row - top][col - left], image[row * width + col], 6);
-      FORC3 memcpy(rgb[c + 1], rgb[0], sizeof *rgb);
-
-      /* Interpolate green horizontally, vertically, and along both diagonals:
-       */
-      for (row = top; row < mrow; row++)
-        for (col = left; col < mcol; col++) {
-          if ((f = fcol(row, col)) == 1) continue;
-          pix = image + row * width + col;
-          hex = allhex[row % 3][col % 3][0];
-          color[1][0] = 174 * (pix[hex[1]][1] + pix[hex[0]][1]) -
-                        46 * (pix[2 * hex[1]][1] + pix[2 * hex[0]][1]);
-          color[1][1] = 223 * pix[hex[3]][1] + pix[hex[2]][1] * 33 +
-                        92 * (pix[0][f] - pix[-hex[2]][f]);
-          FORC(2)
-          color[1][2 + c] =
-              164 * pix[hex[4 + c]][1] + 92 * pix[-2 * hex[4 + c]][1] +
-              33 * (2 * pix[0][f] - pix[3 * hex[4 + c]][f] -
-                    pix[-3 * hex[4 + c]][f]);
-          FORC4 rgb[c ^ !((row - sgrow) % 3)][row - top][col - left][1] =
-              LIM(color[1][c] >> 8, pix[0][1], pix[0][3]);
-        }
-
-      for (pass = 0; pass < passes; pass++) {
-        if (pass == 1) memcpy(rgb += 4, buffer, 4 * sizeof *rgb);
-
-        /* Recalculate green from interpolated values of closer pixels:	*/
-        if (pass) {
-          for (row = top + 2; row < mrow - 2; row++)
-            for (col = left + 2; col < mcol - 2; col++) {
-              if ((f = fcol(row, col)) == 1) continue;
-              pix = image + row * width + col;
-              hex = allhex[row % 3][col % 3][1];
-              for (d = 3; d < 6; d++) {
-                rix =
-                    &rgb[(d - 2) ^ !((row - sgrow) % 3)][row - top][col - left];
-                val = rix[-2 * hex[d]][1] + 2 * rix[hex[d]][1] -
-                      rix[-2 * hex[d]][f] - 2 * rix[hex[d]][f] + 3 * rix[0][f];
-                rix[0][1] = LIM(val / 3, pix[0][1], pix[0][3]);
-              }
-            }
-        }
-
-        /* Interpolate red and blue values for solitary green pixels:	*/
-        for (row = (top - sgrow + 4) / 3 * 3 + sgrow; row < mrow - 2; row += 3)
-          for (col = (left - sgcol + 4) / 3 * 3 + sgcol; col < mcol - 2;
-               col += 3) {
-            rix = &rgb[0][row - top][col - left];
-            h = fcol(row, col + 1);
-            memset(diff, 0, sizeof diff);
-            for (i = 1, d = 0; d < 6; d++, i ^= TS ^ 1, h ^= 2) {
-              for (c = 0; c < 2; c++, h ^= 2) {
-                g = 2 * rix[0][1] - rix[i << c][1] - rix[-i << c][1];
-                color[h][d] = g + rix[i << c][h] + rix[-i << c][h];
-                if (d > 1)
-                  diff[d] += SQR(rix[i << c][1] - rix[-i << c][1] -
-                                 rix[i << c][h] + rix[-i << c][h]) +
-                             SQR(g);
-              }
-              if (d > 1 && (d & 1))
-                if (diff[d - 1] < diff[d])
-                  FORC(2) color[c * 2][d] = color[c * 2][d - 1];
-              if (d < 2 || (d & 1)) {
-                FORC(2) rix[0][c * 2] = CLIP(color[c * 2][d] / 2);
-                rix += TS * TS;
-              }
-            }
-          }
-
-        /* Interpolate red for blue pixels and vice versa:		*/
-        for (row = top + 3; row < mrow - 3; row++)
-          for (col = left + 3; col < mcol - 3; col++) {
-            if ((f = 2 - fcol(row, col)) == 1) continue;
-            rix = &rgb[0][row - top][col - left];
-            c = (row - sgrow) % 3 ? TS : 1;
-            h = 3 * (c ^ TS ^ 1);
-            for (d = 0; d < 4; d++, rix += TS * TS) {
-              i = d > 1 || ((d ^ c) & 1) ||
-                          ((ABS(rix[0][1] - rix[c][1]) +
-                            ABS(rix[0][1] - rix[-c][1])) <
-                           2 * (ABS(rix[0][1] - rix[h][1]) +
-                                ABS(rix[0][1] - rix[-h][1])))
-                      ? c
-                      : h;
-              rix[0][f] = CLIP((rix[i][f] + rix[-i][f] + 2 * rix[0][1] -
-                                rix[i][1] - rix[-i][1]) /
-                               2);
-            }
-          }
-
-        /* Fill in red and blue for 2x2 blocks of green:		*/
-        for (row = top + 2; row < mrow - 2; row++)
-          if ((row - sgrow) % 3)
-            for (col = left + 2; col < mcol - 2; col++)
-              if ((col - sgcol) % 3) {
-                rix = &rgb[0][row - top][col - left];
-                hex = allhex[row % 3][col % 3][1];
-                for (d = 0; d < ndir; d += 2, rix += TS * TS)
-                  if (hex[d] + hex[d + 1]) {
-                    g = 3 * rix[0][1] - 2 * rix[hex[d]][1] - rix[hex[d + 1]][1];
-                    for (c = 0; c < 4; c += 2)
-                      rix[0][c] = CLIP(
-                          (g + 2 * rix[hex[d]][c] + rix[hex[d + 1]][c]) / 3);
-                  } else {
-                    g = 2 * rix[0][1] - rix[hex[d]][1] - rix[hex[d + 1]][1];
-                    for (c = 0; c < 4; c += 2)
-                      rix[0][c] =
-                          CLIP((g + rix[hex[d]][c] + rix[hex[d + 1]][c]) / 2);
-                  }
-              }
-      }
-      rgb = (ushort(*)[TS][TS][3])buffer;
-      mrow -= top;
-      mcol -= left;
-
-      /* Convert to CIELab and differentiate in all directions:	*/
-      for (d = 0; d < ndir; d++) {
-        for (row = 2; row < mrow - 2; row++)
-          for (col = 2; col < mcol - 2; col++)
-            cielab(rgb[d][row][col], lab[row][col]);
-        for (f = dir[d & 3], row = 3; row < mrow - 3; row++)
-          for (col = 3; col < mcol - 3; col++) {
-            lix = &lab[row][col];
-            g = 2 * lix[0][0] - lix[f][0] - lix[-f][0];
-            drv[d][row][col] =
-                SQR(g) +
-                SQR((2 * lix[0][1] - lix[f][1] - lix[-f][1] + g * 500 / 232)) +
-                SQR((2 * lix[0][2] - lix[f][2] - lix[-f][2] - g * 500 / 580));
-          }
-      }
+  xt.sgrow = sgrow;
+  xt.sgcol = sgcol;
 
-      /* Build homogeneity maps from the derivatives:			*/
-      memset(homo, 0, ndir * TS * TS);
-      for (row = 4; row < mrow - 4; row++)
-        for (col = 4; col < mcol - 4; col++) {
-          for (tr = FLT_MAX, d = 0; d < ndir; d++)
-            if (tr > drv[d][row][col]) tr = drv[d][row][col];
-          tr *= 8;
-          for (d = 0; d < ndir; d++)
-            for (v = -1; v <= 1; v++)
-              for (h = -1; h <= 1; h++)
-                if (drv[d][row + v][col + h] <= tr) homo[d][row][col]++;
-        }
-
-      /* Average the most homogenous pixels for the final result:	*/
-      if (height - top < TS + 4) mrow = height - top + 2;
-      if (width - left < TS + 4) mcol = width - left + 2;
-      for (row = MIN(top, 8); row < mrow - 8; row++)
-        for (col = MIN(left, 8); col < mcol - 8; col++) {
-          for (d = 0; d < ndir; d++)
-            for (hm[d] = 0, v = -2; v <= 2; v++)
-              for (h = -2; h <= 2; h++) hm[d] += homo[d][row + v][col + h];
-          for (d = 0; d < ndir - 4; d++)
-            if (hm[d] < hm[d + 4])
-              hm[d] = 0;
-            else if (hm[d] > hm[d + 4])
-              hm[d + 4] = 0;
-          for (max = hm[0], d = 1; d < ndir; d++)
-            if (max < hm[d]) max = hm[d];
-          max -= max >> 3;
-          memset(avg, 0, sizeof avg);
-          for (d = 0; d < ndir; d++)
-            if (hm[d] >= max) {
-              FORC3 avg[c] += rgb[d][row][col][c];
-              avg[3]++;
-            }
-          FORC3 image[(row + top) * width + col + left][c] = avg[c] / avg[3];
-        }
-    }
-  free(buffer);
+  for (top = 3; top < height - 19; top += TS - 16) ntop++;
+  for (left = 3; left < width - 19; left += TS - 16) nleft++;
+  xt.buffer = (char *)malloc((size_t)TS * TS * (xt.ndir * 11 + 6) *
+                             tile_threads(ntop * nleft));
+  merror(xt.buffer, "xtrans_interpolate()");
+  run_tiles(&CLASS xtrans_tile, &xt, ntop, nleft, 1);
+  free(xt.buffer);
   border_interpolate(8);
 }
 #undef fcol
@@ -4855,137 +5855,223 @@ void CLASS xtrans_interpolate(int passes) {
 /*
    Adaptive Homogeneity-Directed interpolation is based on
    the work of Keigo Hirakawa, Thomas Parks, and Paul Lee.
+
+   The tiles overlap, but they read only the pixels' own colors,
+   which they leave alone, so they are independent of each other.
  */
-void CLASS ahd_interpolate() {
-  int i, j, top, left, row, col, tr, tc, c, d, val, hm[2];
+void CLASS ahd_tile(void *arg, int thread, int ti, int tj) {
+  int i, j, top, left, row, col, tr, tc, c, d, f, val, hm[2];
   static const int dir[4] = {-1, 1, -TS, TS};
   unsigned ldiff[2][4], abdiff[2][4], leps, abeps;
   ushort(*rgb)[TS][TS][3], (*rix)[3], (*pix)[4];
   short(*lab)[TS][TS][3], (*lix)[3];
   char(*homo)[TS][TS], *buffer;
 
-  if (verbose) fprintf(stderr, _("AHD interpolation...\n"));
-
-  cielab(0, 0);
-  border_interpolate(5);
-  buffer = (char *)malloc(26 * TS * TS);
-  merror(buffer, "ahd_interpolate()");
+  buffer = (char *)arg + thread * 26 * TS * TS;
   rgb = (ushort(*)[TS][TS][3])buffer;
   lab = (short(*)[TS][TS][3])(buffer + 12 * TS * TS);
   homo = (char(*)[TS][TS])(buffer + 24 * TS * TS);
+  top = 2 + ti * (TS - 6);
+  left = 2 + tj * (TS - 6);
 
-  for (top = 2; top < height - 5; top += TS - 6)
-    for (left = 2; left < width - 5; left += TS - 6) {
-      /*  Interpolate green horizontally and vertically:		*/
-      for (row = top; row < top + TS && row < height - 2; row++) {
-        col = left + (FC(row, left) & 1);
-        for (c = FC(row, col); col < left + TS && col < width - 2; col += 2) {
-          pix = image + row * width + col;
-          val = ((pix[-1][1] + pix[0][c] + pix[1][1]) * 2 - pix[-2][c] -
-                 pix[2][c]) >>
-                2;
-          rgb[0][row - top][col - left][1] = ULIM(val, pix[-1][1], pix[1][1]);
-          val = ((pix[-width][1] + pix[0][c] + pix[width][1]) * 2 -
-                 pix[-2 * width][c] - pix[2 * width][c]) >>
-                2;
-          rgb[1][row - top][col - left][1] =
-              ULIM(val, pix[-width][1], pix[width][1]);
-        }
-      }
-      /*  Interpolate red and blue, and convert to CIELab:		*/
-      for (d = 0; d < 2; d++)
-        for (row = top + 1; row < top + TS - 1 && row < height - 3; row++)
-          for (col = left + 1; col < left + TS - 1 && col < width - 3; col++) {
-            pix = image + row * width + col;
-            rix = &rgb[d][row - top][col - left];
-            lix = &lab[d][row - top][col - left];
-            if ((c = 2 - FC(row, col)) == 1) {
-              c = FC(row + 1, col);
-              val =
-                  pix[0][1] +
-                  ((pix[-1][2 - c] + pix[1][2 - c] - rix[-1][1] - rix[1][1]) >>
-                   1);
-              rix[0][2 - c] = CLIP(val);
-              val = pix[0][1] + ((pix[-width][c] + pix[width][c] - rix[-TS][1] -
-                                  rix[TS][1]) >>
-                                 1);
-            } else
-              val = rix[0][1] + ((pix[-width - 1][c] + pix[-width + 1][c] +
-                                  pix[+width - 1][c] + pix[+width + 1][c] -
-                                  rix[-TS - 1][1] - rix[-TS + 1][1] -
-                                  rix[+TS - 1][1] - rix[+TS + 1][1] + 1) >>
-                                 2);
-            rix[0][c] = CLIP(val);
-            c = FC(row, col);
-            rix[0][c] = pix[0][c];
-            cielab(rix[0], lix[0]);
-          }
-      /*  Build homogeneity maps from the CIELab images:		*/
-      memset(homo, 0, 2 * TS * TS);
-      for (row = top + 2; row < top + TS - 2 && row < height - 4; row++) {
-        tr = row - top;
-        for (col = left + 2; col < left + TS - 2 && col < width - 4; col++) {
-          tc = col - left;
-          for (d = 0; d < 2; d++) {
-            lix = &lab[d][tr][tc];
-            for (i = 0; i < 4; i++) {
-              ldiff[d][i] = ABS(lix[0][0] - lix[dir[i]][0]);
-              abdiff[d][i] = SQR(lix[0][1] - lix[dir[i]][1]) +
-                             SQR(lix[0][2] - lix[dir[i]][2]);
-            }
-          }
-          leps =
-              MIN(MAX(ldiff[0][0], ldiff[0][1]), MAX(ldiff[1][2], ldiff[1][3]));
-          abeps = MIN(MAX(abdiff[0][0], abdiff[0][1]),
-                      MAX(abdiff[1][2], abdiff[1][3]));
-          for (d = 0; d < 2; d++)
-            for (i = 0; i < 4; i++)
-              if (ldiff[d][i] <= leps && abdiff[d][i] <= abeps)
-                homo[d][tr][tc]++;
-        }
+  /*  Interpolate green horizontally and vertically:		*/
+  for (row = top; row < top + TS && row < height - 2; row++) {
+    col = left + (FC(row, left) & 1);
+    for (c = FC(row, col); col < left + TS && col < width - 2; col += 2) {
+      pix = image + row * width + col;
+      val = ((pix[-1][1] + pix[0][c] + pix[1][1]) * 2 - pix[-2][c] -
+             pix[2][c]) >>
+            2;
+      rgb[0][row - top][col - left][1] = ULIM(val, pix[-1][1], pix[1][1]);
+      val = ((pix[-width][1] + pix[0][c] + pix[width][1]) * 2 -
+             pix[-2 * width][c] - pix[2 * width][c]) >>
+            2;
+      rgb[1][row - top][col - left][1] =
+          ULIM(val, pix[-width][1], pix[width][1]);
+    }
+  }
+  /*  Interpolate red and blue, and convert to CIELab:		*/
+  for (d = 0; d < 2; d++)
+    for (row = top + 1; row < top + TS - 1 && row < height - 3; row++)
+      for (col = left + 1; col < left + TS - 1 && col < width - 3; col++) {
+        pix = image + row * width + col;
+        rix = &rgb[d][row - top][col - left];
+        lix = &lab[d][row - top][col - left];
+        if ((c = 2 - FC(row, col)) == 1) {
+          c = FC(row + 1, col);
+          val =
+              pix[0][1] +
+              ((pix[-1][2 - c] + pix[1][2 - c] - rix[-1][1] - rix[1][1]) >>
+               1);
+          rix[0][2 - c] = CLIP(val);
+          val = pix[0][1] + ((pix[-width][c] + pix[width][c] - rix[-TS][1] -
+                              rix[TS][1]) >>
+                             1);
+        } else
+          val = rix[0][1] + ((pix[-width - 1][c] + pix[-width + 1][c] +
+                              pix[+width - 1][c] + pix[+width + 1][c] -
+                              rix[-TS - 1][1] - rix[-TS + 1][1] -
+                              rix[+TS - 1][1] - rix[+TS + 1][1] + 1) >>
+                             2);
+        rix[0][c] = CLIP(val);
+        c = FC(row, col);
+        rix[0][c] = pix[0][c];
+        cielab(rix[0], lix[0]);
       }
-      /*  Combine the most homogenous pixels for the final result:	*/
-      for (row = top + 3; row < top + TS - 3 && row < height - 5; row++) {
-        tr = row - top;
-        for (col = left + 3; col < left + TS - 3 && col < width - 5; col++) {
-          tc = col - left;
-          for (d = 0; d < 2; d++)
-            for (hm[d] = 0, i = tr - 1; i <= tr + 1; i++)
-              for (j = tc - 1; j <= tc + 1; j++) hm[d] += homo[d][i][j];
-          if (hm[0] != hm[1])
-            FORC3 image[row * width + col][c] = rgb[hm[1] > hm[0]][tr][tc][c];
-          else
-            FORC3 image[row * width + col][c] =
-                (rgb[0][tr][tc][c] + rgb[1][tr][tc][c]) >> 1;
+  /*  Build homogeneity maps from the CIELab images:		*/
+  memset(homo, 0, 2 * TS * TS);
+  for (row = top + 2; row < top + TS - 2 && row < height - 4; row++) {
+    tr = row - top;
+    for (col = left + 2; col < left + TS - 2 && col < width - 4; col++) {
+      tc = col - left;
+      for (d = 0; d < 2; d++) {
+        lix = &lab[d][tr][tc];
+        for (i = 0; i < 4; i++) {
+          ldiff[d][i] = ABS(lix[0][0] - lix[dir[i]][0]);
+          abdiff[d][i] = SQR(lix[0][1] - lix[dir[i]][1]) +
+                         SQR(lix[0][2] - lix[dir[i]][2]);
         }
       }
+      leps =
+          MIN(MAX(ldiff[0][0], ldiff[0][1]), MAX(ldiff[1][2], ldiff[1][3]));
+      abeps = MIN(MAX(abdiff[0][0], abdiff[0][1]),
+                  MAX(abdiff[1][2], abdiff[1][3]));
+      for (d = 0; d < 2; d++)
+        for (i = 0; i < 4; i++)
+          if (ldiff[d][i] <= leps && abdiff[d][i] <= abeps)
+            homo[d][tr][tc]++;
+    }
+  }
+  /*  Combine the most homogenous pixels for the final result:	*/
+  for (row = top + 3; row < top + TS - 3 && row < height - 5; row++) {
+    tr = row - top;
+    for (col = left + 3; col < left + TS - 3 && col < width - 5; col++) {
+      tc = col - left;
+      for (d = 0; d < 2; d++)
+        for (hm[d] = 0, i = tr - 1; i <= tr + 1; i++)
+          for (j = tc - 1; j <= tc + 1; j++) hm[d] += homo[d][i][j];
+      f = FC(row, col);
+      FORC3 if (c != f) image[row * width + col][c] =
+          hm[0] != hm[1] ? rgb[hm[1] > hm[0]][tr][tc][c]
+                         : (rgb[0][tr][tc][c] + rgb[1][tr][tc][c]) >> 1;
     }
+  }
+}
+
+void CLASS ahd_interpolate() {
+  int top, left, ntop = 0, nleft = 0;
+  char *buffer;
+
+  if (verbose) fprintf(stderr, _("AHD interpolation...\n"));
+
+  cielab(0, 0);
+  border_interpolate(5);
+  for (top = 2; top < height - 5; top += TS - 6) ntop++;
+  for (left = 2; left < width - 5; left += TS - 6) nleft++;
+  buffer = (char *)malloc(26 * TS * TS * tile_threads(ntop * nleft));
+  merror(buffer, "ahd_interpolate()");
+  run_tiles(&CLASS ahd_tile, buffer, ntop, nleft, 0);
   free(buffer);
 }
 #undef TS
 
-void CLASS median_filter() {
-  ushort(*pix)[4];
-  int pass, c, i, j, k, med[9];
+/*
+   out[i] is the median of d0, d1 and d2 at i - 1, i and i + 1, by
+   the optimal 9-element median search, four at a time with SSE2 or
+   NEON, where each exchange is a min() and a max().
+ */
+void CLASS median_row(float *out, const float *d0, const float *d1,
+                      const float *d2, int count) {
   static const uchar opt[] = /* Optimal 9-element median search */
       {1, 2, 4, 5, 7, 8, 0, 1, 3, 4, 6, 7, 1, 2, 4, 5, 7, 8, 0,
        3, 5, 8, 4, 7, 3, 6, 1, 4, 2, 5, 4, 7, 4, 2, 6, 4, 4, 2};
+  const float *d[3] = {d0, d1, d2};
+  float med[9];
+  int col = 0, i, j;
+#if defined(DCRAW_SSE2)
+  __m128 v[9], t;
+
+  for (; col + 4 <= count; col += 4) {
+    for (i = 0; i < 9; i++) v[i] = _mm_loadu_ps(d[i / 3] + col + i % 3 - 1);
+    for (i = 0; i < sizeof opt; i += 2) {
+      t = v[opt[i]];
+      v[opt[i]] = _mm_min_ps(t, v[opt[i + 1]]);
+      v[opt[i + 1]] = _mm_max_ps(t, v[opt[i + 1]]);
+    }
+    _mm_storeu_ps(out + col, v[4]);
+  }
+#elif defined(DCRAW_NEON)
+  float32x4_t v[9], t;
+
+  for (; col + 4 <= count; col += 4) {
+    for (i = 0; i < 9; i++) v[i] = vld1q_f32(d[i / 3] + col + i % 3 - 1);
+    for (i = 0; i < sizeof opt; i += 2) {
+      t = v[opt[i]];
+      v[opt[i]] = vminq_f32(t, v[opt[i + 1]]);
+      v[opt[i + 1]] = vmaxq_f32(t, v[opt[i + 1]]);
+    }
+    vst1q_f32(out + col, v[4]);
+  }
+#endif
+  for (; col < count; col++) {
+    for (i = 0; i < 9; i++) med[i] = d[i / 3][col + i % 3 - 1];
+    for (j = 0; j < sizeof opt; j += 2)
+      if (med[opt[j]] > med[opt[j + 1]]) SWAP(med[opt[j]], med[opt[j + 1]]);
+    out[col] = med[4];
+  }
+}
+
+/*
+   One step of median_filter() on a band of rows: copy color c to the
+   fourth channel, or replace c - G by its median.  Each thread keeps
+   the differences of three rows, and one row of medians.
+ */
+void CLASS median_band(void *arg, int thread, int band, int unused) {
+  struct median_bands *mb = (struct median_bands *)arg;
+  float *d[4], *tmp;
+  int c = mb->c, row, col, i, top, bottom;
+  ushort(*pix)[4];
 
+  if (mb->step == 0) {
+    for (row = height * band / mb->nbands;
+         row < height * (band + 1) / mb->nbands; row++)
+      for (pix = image + row * width, col = 0; col < width; col++)
+        pix[col][3] = pix[col][c];
+    return;
+  }
+  top = 1 + (height - 2) * band / mb->nbands;
+  bottom = 1 + (height - 2) * (band + 1) / mb->nbands;
+  for (i = 0; i < 4; i++) d[i] = mb->diff + (thread * 4 + i) * width;
+  for (row = top - 1; row <= bottom; row++) {
+    tmp = d[0];
+    d[0] = d[1];
+    d[1] = d[2];
+    d[2] = tmp;
+    for (pix = image + row * width, col = 0; col < width; col++)
+      d[2][col] = pix[col][3] - pix[col][1];
+    if (row < top + 1) continue;
+    median_row(d[3] + 1, d[0] + 1, d[1] + 1, d[2] + 1, width - 2);
+    for (pix = image + (row - 1) * width, col = 1; col < width - 1; col++)
+      pix[col][c] = CLIP((int)d[3][col] + pix[col][1]);
+  }
+}
+
+void CLASS median_filter() {
+  struct median_bands mb;
+  int pass, nt;
+
+  nt = tile_threads(height / 32);
+  mb.nbands = nt > 1 ? nt * 4 : 1;
+  nt = tile_threads(mb.nbands);
+  mb.diff = (float *)malloc(width * 4 * nt * sizeof *mb.diff);
+  merror(mb.diff, "median_filter()");
   for (pass = 1; pass <= med_passes; pass++) {
     if (verbose) fprintf(stderr, _("Median filter pass %d...\n"), pass);
-    for (c = 0; c < 3; c += 2) {
-      for (pix = image; pix < image + width * height; pix++)
-        pix[0][3] = pix[0][c];
-      for (pix = image + width; pix < image + width * (height - 1); pix++) {
-        if ((pix - image + 1) % width < 2) continue;
-        for (k = 0, i = -width; i <= width; i += width)
-          for (j = i - 1; j <= i + 1; j++) med[k++] = pix[j][3] - pix[j][1];
-        for (i = 0; i < sizeof opt; i += 2)
-          if (med[opt[i]] > med[opt[i + 1]]) SWAP(med[opt[i]], med[opt[i + 1]]);
-        pix[0][c] = CLIP(med[4] + pix[0][1]);
-      }
-    }
+    for (mb.c = 0; mb.c < 3; mb.c += 2)
+      for (mb.step = 0; mb.step < 2; mb.step++)
+        run_tiles(&CLASS median_band, &mb, mb.nbands, 1, 0);
   }
+  free(mb.diff);
 }
 
 void CLASS blend_highlights() {
@@ -5120,8 +6206,6 @@ void CLASS parse_thumb_note(int base, unsigned toff, unsigned tlen) {
   }
 }
 
-int CLASS parse_tiff_ifd(int base);
-
 void CLASS parse_makernote(int base, int uptag) {
   static const uchar xlat[2][256] = {
       {0xc1, 0xbf, 0x6d, 0x0d, 0x59, 0xc5, 0x13, 0x9d, 0x83, 0x61, 0x6b, 0x4f,
@@ -5681,12 +6765,10 @@ void CLASS parse_kodak_ifd(int base) {
   }
 }
 
-void CLASS parse_minolta(int base);
-int CLASS parse_tiff(int base);
-
 int CLASS parse_tiff_ifd(int base) {
   unsigned entries, tag, type, len, plen = 16, save;
   int ifd, use_cm = 0, cfa, i, j, c, ima_len = 0;
+  long value;
   char software[64], *cbuf, *cp;
   uchar cfa_pat[16], cfa_pc[] = {0, 1, 2, 3}, tab[256];
   double cc[4][4], cm[4][3], cam_xyz[4][3], num;
@@ -5704,6 +6786,11 @@ int CLASS parse_tiff_ifd(int base) {
   if (entries > 512) return 1;
   while (entries--) {
     tiff_get(base, &tag, &type, &len, &save);
+    if (tiff_tag_hook) { /* the caller may read the value at ifp */
+      value = ftell(ifp);
+      tiff_tag_hook(tiff_tag_data, ifd, tag, type, len);
+      fseek(ifp, value, SEEK_SET);
+    }
     switch (tag) {
       case 5:
         width = get2();
@@ -7101,7 +8188,9 @@ void CLASS parse_foveon() {
 void CLASS adobe_coeff(const char *make, const char *model) {
   static const struct {
     const char *prefix;
-    short black, maximum, trans[12];
+    short black;
+    ushort maximum;
+    short trans[12];
   } table[] = {
       {"AgfaPhoto DC-833m",
        0,
@@ -10328,7 +11417,7 @@ dng_skip:
     is_raw = 0;
 #ifdef NO_JASPER
   if (load_raw == &CLASS redcine_load_raw) {
-    fprintf(stderr, _("%s: You must link dcraw with %s!!\n"), ifname,
+    error_msg(1, _("%s: You must link dcraw with %s!!\n"), ifname,
             "libjasper");
     is_raw = 0;
   }
@@ -10336,7 +11425,7 @@ dng_skip:
 #ifdef NO_JPEG
   if (load_raw == &CLASS kodak_jpeg_load_raw ||
       load_raw == &CLASS lossy_dng_load_raw) {
-    fprintf(stderr, _("%s: You must link dcraw with %s!!\n"), ifname,
+    error_msg(1, _("%s: You must link dcraw with %s!!\n"), ifname,
             "libjpeg");
     is_raw = 0;
   }
@@ -10400,10 +11489,62 @@ quit:
 }
 #endif
 
+/*
+   Multiply each pixel by out_cam and add it to the histogram, in the
+   same pass.  The vector code sums the products in the same order as
+   the scalar code, without fused multiply-adds, so it gives the same
+   result.
+ */
+void CLASS rgb_pixels(ushort (*pix)[4], int count, float out_cam[3][4]) {
+  int i, c;
+#if defined(DCRAW_SSE2)
+  int rgb[4];
+  __m128 col[4], sum;
+  const __m128 lo = _mm_setzero_ps(), hi = _mm_set1_ps(65535);
+
+  FORC4 col[c] = _mm_setr_ps(out_cam[0][c], out_cam[1][c], out_cam[2][c], 0);
+#elif defined(DCRAW_NEON)
+  int rgb[4];
+  float32x4_t col[4], sum;
+  const float32x4_t lo = vdupq_n_f32(0), hi = vdupq_n_f32(65535);
+
+  FORC4 {
+    const float column[4] = {out_cam[0][c], out_cam[1][c], out_cam[2][c], 0};
+    col[c] = vld1q_f32(column);
+  }
+#else
+  float out[3];
+#endif
+
+  for (i = 0; i < count; i++) {
+#if defined(DCRAW_SSE2)
+    sum = _mm_setzero_ps();
+    FORCC sum = _mm_add_ps(sum, _mm_mul_ps(col[c], _mm_set1_ps(pix[i][c])));
+    _mm_storeu_si128((__m128i *)rgb,
+                     _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(sum, lo), hi)));
+    FORC3 pix[i][c] = rgb[c];
+#elif defined(DCRAW_NEON)
+    sum = vdupq_n_f32(0);
+    FORCC sum = vaddq_f32(sum, vmulq_f32(col[c], vdupq_n_f32(pix[i][c])));
+    vst1q_s32((int32_t *)rgb, vcvtq_s32_f32(vminq_f32(vmaxq_f32(sum, lo), hi)));
+    FORC3 pix[i][c] = rgb[c];
+#else
+    out[0] = out[1] = out[2] = 0;
+    FORCC {
+      out[0] += out_cam[0][c] * pix[i][c];
+      out[1] += out_cam[1][c] * pix[i][c];
+      out[2] += out_cam[2][c] * pix[i][c];
+    }
+    FORC3 pix[i][c] = CLIP((int)out[c]);
+#endif
+    FORCC histogram[c][pix[i][c] >> 3]++;
+  }
+}
+
 void CLASS convert_to_rgb() {
   int row, col, c, i, j, k;
   ushort *img;
-  float out[3], out_cam[3][4];
+  float out_cam[3][4];
   double num, inverse[3][3];
   static const double xyzd50_srgb[3][3] = {{0.436083, 0.385083, 0.143055},
                                            {0.222507, 0.716888, 0.060608},
@@ -10481,20 +11622,14 @@ void CLASS convert_to_rgb() {
             name[output_color - 1]);
 
   memset(histogram, 0, sizeof histogram);
-  for (img = image[0], row = 0; row < height; row++)
-    for (col = 0; col < width; col++, img += 4) {
-      if (!raw_color) {
-        out[0] = out[1] = out[2] = 0;
-        FORCC {
-          out[0] += out_cam[0][c] * img[c];
-          out[1] += out_cam[1][c] * img[c];
-          out[2] += out_cam[2][c] * img[c];
-        }
-        FORC3 img[c] = CLIP((int)out[c]);
-      } else if (document_mode)
-        img[0] = img[fcol(row, col)];
-      FORCC histogram[c][img[c] >> 3]++;
-    }
+  if (!raw_color)
+    rgb_pixels(image, height * width, out_cam);
+  else
+    for (img = image[0], row = 0; row < height; row++)
+      for (col = 0; col < width; col++, img += 4) {
+        if (document_mode) img[0] = img[fcol(row, col)];
+        FORCC histogram[c][img[c] >> 3]++;
+      }
   if (colors == 4 && output_color) colors = 3;
   if (document_mode && filters) colors = 1;
 }
@@ -10740,35 +11875,179 @@ void CLASS write_ppm_tiff() {
   iheight = height;
   iwidth = width;
   if (flip & 4) SWAP(height, width);
-  ppm = (uchar *)calloc(width, colors * output_bps / 8);
-  ppm2 = (ushort *)ppm;
-  merror(ppm, "write_ppm_tiff()");
-  if (output_tiff) {
-    tiff_head(&th, 1);
-    fwrite(&th, sizeof th, 1, ofp);
-    if (oprof) fwrite(oprof, ntohl(oprof[0]), 1, ofp);
-  } else if (colors > 3)
-    fprintf(
-        ofp,
-        "P7\nWIDTH %d\nHEIGHT %d\nDEPTH %d\nMAXVAL %d\nTUPLTYPE %s\nENDHDR\n",
-        width, height, colors, (1 << output_bps) - 1, cdesc);
-  else
-    fprintf(ofp, "P%d\n%d %d\n%d\n", colors / 2 + 5, width, height,
-            (1 << output_bps) - 1);
+  if (write_to_memory) {
+    mem_image =
+        (uchar *)malloc((size_t)height * width * colors * output_bps / 8);
+    merror(mem_image, "write_ppm_tiff()");
+  } else {
+    ppm = (uchar *)calloc(width, colors * output_bps / 8);
+    ppm2 = (ushort *)ppm;
+    merror(ppm, "write_ppm_tiff()");
+    if (output_tiff) {
+      tiff_head(&th, 1);
+      fwrite(&th, sizeof th, 1, ofp);
+      if (oprof) fwrite(oprof, ntohl(oprof[0]), 1, ofp);
+    } else if (colors > 3)
+      fprintf(
+          ofp,
+          "P7\nWIDTH %d\nHEIGHT %d\nDEPTH %d\nMAXVAL %d\nTUPLTYPE %s\nENDHDR\n",
+          width, height, colors, (1 << output_bps) - 1, cdesc);
+    else
+      fprintf(ofp, "P%d\n%d %d\n%d\n", colors / 2 + 5, width, height,
+              (1 << output_bps) - 1);
+  }
   soff = flip_index(0, 0);
   cstep = flip_index(0, 1) - soff;
   rstep = flip_index(1, 0) - flip_index(0, width);
   for (row = 0; row < height; row++, soff += rstep) {
+    if (write_to_memory) {
+      ppm = mem_image + (size_t)row * width * colors * output_bps / 8;
+      ppm2 = (ushort *)ppm;
+    }
     for (col = 0; col < width; col++, soff += cstep)
       if (output_bps == 8)
         FORCC ppm[col * colors + c] = curve[image[soff][c]] >> 8;
       else
         FORCC ppm2[col * colors + c] = curve[image[soff][c]];
+    if (write_to_memory) continue;
     if (output_bps == 16 && !output_tiff && htons(0x55aa) != 0x55aa)
       swab(ppm2, ppm2, width * colors * 2);
     fwrite(ppm, colors * output_bps / 8, width, ofp);
   }
-  free(ppm);
+  if (!write_to_memory) free(ppm);
+}
+
+/*
+   Identify fname without decoding it, e.g. to size the buffers for
+   the decode.  Returns the number of raw images, which is zero if
+   dcraw cannot decode the file, or -1 if it cannot be opened.
+ */
+int CLASS identify_file(const char *fname) {
+  ifname = fname;
+  if (!(ifp = fopen(ifname, "rb"))) return -1;
+  if (setjmp(failure))
+    is_raw = 0;
+  else
+    identify();
+  fclose(ifp);
+  return is_raw;
+}
+
+/*
+   Upper bound of the memory that load_raw() allocates besides
+   raw_image, after identify(): the Huffman and lookahead tables of
+   the lossless JPEG loaders and, when they decode on several
+   threads, the tile headers, the shared tables and a row buffer for
+   each thread.  On Windows, map_file() also reads the whole file.
+ */
+INT64 CLASS load_raw_memory() {
+  INT64 tables, bytes = 0;
+  int ntiles;
+#ifdef WIN32
+  FILE *fp;
+#endif
+
+  if (load_raw == &CLASS lossless_dng_load_raw)
+    ntiles = tile_length < INT_MAX
+                 ? (raw_width + tile_width - 1) / tile_width *
+                       ((raw_height + tile_length - 1) / tile_length)
+                 : 1;
+  else if (load_raw == &CLASS lossless_jpeg_load_raw)
+    ntiles = raw_height; /* at most one restart interval per row */
+  else
+    return 0;
+  tables = 4 * ((1 + (1 << 16)) * sizeof(ushort) +
+                (1 << LJPEG_LUT_BITS) * sizeof(int));
+  if (tile_threads(ntiles) > 1)
+    bytes = ntiles * (INT64)sizeof(struct ljpeg_tile) + 5 * tables +
+            tile_threads(ntiles) * (INT64)raw_width * 4 * 4;
+  else
+    bytes = tables + raw_width * 4 * 4;
+#ifdef WIN32
+  if ((fp = fopen(ifname, "rb"))) {
+    fseeko(fp, 0, SEEK_END);
+    bytes += ftello(fp);
+    fclose(fp);
+  }
+#endif
+  return bytes;
+}
+
+/*
+   Move the part of the black level that is common to all the colors,
+   and to all the cells of the black pattern, from cblack[] into black.
+ */
+void CLASS fold_black() {
+  int i, c;
+
+  i = cblack[3];
+  FORC3 if (i > cblack[c]) i = cblack[c];
+  FORC4 cblack[c] -= i;
+  black += i;
+  i = cblack[6];
+  FORC(cblack[4] * cblack[5])
+  if (i > cblack[6 + c]) i = cblack[6 + c];
+  FORC(cblack[4] * cblack[5])
+  cblack[6 + c] -= i;
+  black += i;
+}
+
+/*
+   Load the color filter mosaic of fname and nothing else: no scaling,
+   interpolation, color conversion or output.  raw_image is left for
+   the caller to free, with the visible height x width mosaic at
+   top_margin, left_margin, and unrotated (see flip).  cblack[0..3] are
+   the total black level of each color, as in main(), plus the
+   cblack[4] x cblack[5] pattern at cblack[6].  Zero pixels are filled
+   in as in main(), but bad_pixels() and the canon_600_correct() gains
+   are not applied: there is no .badpixels search or dark frame, and the
+   Canon PowerShot 600 mosaic keeps its raw values.  Returns 1 on success,
+   -1 if fname cannot be opened, or 0 if dcraw cannot decode it or if
+   the image is not a plain mosaic (is_raw is then nonzero).
+ */
+int CLASS load_mosaic(const char *fname) {
+  int status = identify_file(fname);
+
+  if (status <= 0) return status;
+  if (!(filters || colors == 1) || fuji_width) return 0;
+  return load_identified();
+}
+
+/*
+   The second half of load_mosaic(), after identify_file() has parsed
+   the file: ifname is opened again and only load_raw() and what
+   follows it are run.  Returns as load_mosaic() does.
+ */
+int CLASS load_identified() {
+  int c;
+
+  if (!(ifp = fopen(ifname, "rb"))) return -1;
+  if (setjmp(failure)) {
+    free(raw_image);
+    free(meta_data);
+    raw_image = 0;
+    meta_data = 0;
+    unmap_file();
+    fclose(ifp);
+    return is_raw = 0;
+  }
+  if (meta_length) {
+    meta_data = (char *)malloc(meta_length);
+    merror(meta_data, "load_identified()");
+  }
+  raw_image = (ushort *)calloc((raw_height + 7), raw_width * 2);
+  merror(raw_image, "load_identified()");
+  fseeko(ifp, data_offset, SEEK_SET);
+  CALL(load_raw)();
+  crop_masked_pixels();
+  if (zero_is_bad) remove_zeroes();
+  fold_black();
+  FORC4 cblack[c] += black;
+  free(meta_data);
+  meta_data = 0;
+  unmap_file();
+  fclose(ifp);
+  return 1;
 }
 
 int CLASS main(int argc, const char **argv) {
@@ -10783,7 +12062,7 @@ int CLASS main(int argc, const char **argv) {
   const char *cam_profile = 0, *out_profile = 0;
 #endif
 
-#ifndef LOCALTIME
+#if !defined(LOCALTIME) && !defined(DCRAW_LIBRARY)
   putenv((char *)"TZ=UTC");
 #endif
 #ifdef LOCALEDIR
@@ -10844,7 +12123,7 @@ int CLASS main(int argc, const char **argv) {
     if ((cp = (char *)strchr(sp = "nbrkStqmHACg", opt)))
       for (i = 0; i < "114111111422"[cp - sp] - '0'; i++)
         if (!isdigit(argv[arg + i][0])) {
-          fprintf(stderr, _("Non-numeric argument to \"-%c\"\n"), opt);
+          error_msg(1, _("Non-numeric argument to \"-%c\"\n"), opt);
           return 1;
         }
     switch (opt) {
@@ -10961,15 +12240,20 @@ int CLASS main(int argc, const char **argv) {
         output_bps = 16;
         break;
       default:
-        fprintf(stderr, _("Unknown option \"-%c\".\n"), opt);
+        error_msg(1, _("Unknown option \"-%c\".\n"), opt);
         return 1;
     }
   }
   if (arg == argc) {
-    fprintf(stderr, _("No files to process.\n"));
+    error_msg(1, _("No files to process.\n"));
+    return 1;
+  }
+  if (write_to_memory && (timestamp_only || identify_only || thumbnail_only ||
+                          read_from_stdin || multi_out)) {
+    error_msg(1, _("Cannot use -z, -i, -e, -I or \"-s all\" in memory.\n"));
     return 1;
   }
-  if (write_to_stdout) {
+  if (write_to_stdout && !write_to_memory) {
     if (isatty(1)) {
       fprintf(stderr, _("Will not write an image to the terminal!\n"));
       return 1;
@@ -10996,7 +12280,7 @@ int CLASS main(int argc, const char **argv) {
     }
     ifname = argv[arg];
     if (!(ifp = fopen(ifname, "rb"))) {
-      perror(ifname);
+      error_msg(1, "%s: %s\n", ifname, strerror(errno));
       continue;
     }
     status = (identify(), !is_raw);
@@ -11071,7 +12355,7 @@ int CLASS main(int argc, const char **argv) {
         printf(_("Thumb size:  %4d x %d\n"), thumb_width, thumb_height);
       printf(_("Full size:   %4d x %d\n"), raw_width, raw_height);
     } else if (!is_raw)
-      fprintf(stderr, _("Cannot decode file %s\n"), ifname);
+      error_msg(1, _("Cannot decode file %s\n"), ifname);
     if (!is_raw) goto next;
     shrink = filters &&
              (half_size ||
@@ -11146,7 +12430,7 @@ int CLASS main(int argc, const char **argv) {
     if (raw_image && read_from_stdin)
       fread(raw_image, 2, raw_height * raw_width, stdin);
     else
-      (*load_raw)();
+      CALL(load_raw)();
     if (document_mode == 3) {
       top_margin = left_margin = fuji_width = 0;
       height = raw_height;
@@ -11159,22 +12443,14 @@ int CLASS main(int argc, const char **argv) {
       merror(image, "main()");
       crop_masked_pixels();
       free(raw_image);
+      raw_image = 0;
     }
     if (zero_is_bad) remove_zeroes();
     bad_pixels(bpfile);
     if (dark_frame) subtract(dark_frame);
     quality = 2 + !fuji_width;
     if (user_qual >= 0) quality = user_qual;
-    i = cblack[3];
-    FORC3 if (i > cblack[c]) i = cblack[c];
-    FORC4 cblack[c] -= i;
-    black += i;
-    i = cblack[6];
-    FORC(cblack[4] * cblack[5])
-    if (i > cblack[6 + c]) i = cblack[6 + c];
-    FORC(cblack[4] * cblack[5])
-    cblack[6 + c] -= i;
-    black += i;
+    fold_black();
     if (user_black >= 0) black = user_black;
     FORC4 cblack[c] += black;
     if (user_sat > 0) maximum = user_sat;
@@ -11215,6 +12491,11 @@ int CLASS main(int argc, const char **argv) {
     convert_to_rgb();
     if (use_fuji_rotate) stretch();
   thumbnail:
+    if (write_to_memory) {
+      CALL(write_fun)();
+      fclose(ifp);
+      goto cleanup;
+    }
     if (write_fun == &CLASS jpeg_thumb)
       write_ext = ".jpg";
     else if (output_tiff && write_fun == &CLASS write_ppm_tiff)
@@ -11241,10 +12522,12 @@ int CLASS main(int argc, const char **argv) {
       }
     }
     if (verbose) fprintf(stderr, _("Writing data to %s ...\n"), ofname);
-    (*write_fun)();
+    CALL(write_fun)();
     fclose(ifp);
     if (ofp != stdout) fclose(ofp);
   cleanup:
+    unmap_file();
+    if (raw_image) free(raw_image); /* after a failure in load_raw() */
     if (meta_data) free(meta_data);
     if (ofname) free(ofname);
     if (oprof) free(oprof);
@@ -11258,3 +12541,16 @@ int CLASS main(int argc, const char **argv) {
   }
   return status;
 }
+
+#if defined(__cplusplus) && !defined(DCRAW_LIBRARY)
+int main(int argc, char **argv) {
+  DCRaw *dcraw = new DCRaw();
+  int status;
+
+  dcraw->nthreads = std::thread::hardware_concurrency();
+  status = dcraw->main(argc, (const char **)argv);
+
+  delete dcraw;
+  return status;
+}
+#endif
@@ -0,0 +1,182 @@
+/*============================================================================
+
+ dcrawBench - throughput of dcraw's per-pixel output stages
+
+ Times the loops of scale_colors(), convert_to_rgb() and write_ppm_tiff()
+ on a synthetic image, and checks the first two against the scalar code
+ that they replace. Compare a build with the SSE2/NEON code to one
+ without it:
+
+     g++ -O2 -DNODEPS dcrawBench.cpp -o dcrawBench -lpthread
+     g++ -O2 -DNODEPS -DNO_SIMD dcrawBench.cpp -o dcrawBenchScalar -lpthread
+
+     ./dcrawBench [width height [repetitions]]
+
+ This is a command line program, it is not built by dcrawCompile.
+
+ ============================================================================*/
+
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#define DCRAW_LIBRARY
+#include "dcraw.c"
+
+
+namespace
+{
+
+typedef std::chrono::steady_clock Clock;
+
+// The loop of scale_colors() before it was vectorized
+void scaleReference(ushort (*pix)[4], int count, const unsigned black[4],
+                    const float mul[4])
+{
+    for (int i = 0; i < count * 4; i++) {
+        int val = reinterpret_cast<ushort *>(pix)[i];
+        if (val == 0) {
+            continue;
+        }
+        val -= black[i & 3];
+        val *= mul[i & 3];
+        reinterpret_cast<ushort *>(pix)[i] = CLIP(val);
+    }
+}
+
+
+// The loop of convert_to_rgb() before it was vectorized
+void rgbReference(ushort (*pix)[4], int count, float out_cam[3][4],
+                  int colors, int histogram[4][0x2000])
+{
+    for (int i = 0; i < count; i++) {
+        float out[3] = { 0, 0, 0 };
+        for (int c = 0; c < colors; c++) {
+            out[0] += out_cam[0][c] * pix[i][c];
+            out[1] += out_cam[1][c] * pix[i][c];
+            out[2] += out_cam[2][c] * pix[i][c];
+        }
+        for (int c = 0; c < 3; c++) {
+            pix[i][c] = CLIP((int)out[c]);
+        }
+        for (int c = 0; c < colors; c++) {
+            histogram[c][pix[i][c] >> 3]++;
+        }
+    }
+}
+
+
+void report(const char * stage, Clock::duration elapsed, int reps,
+            size_t pixels)
+{
+    const double seconds =
+        std::chrono::duration<double>(elapsed).count() / reps;
+    printf("  %-28s %8.2f ms %8.1f Mpixel/s\n", stage, seconds * 1e3,
+           pixels / seconds * 1e-6);
+}
+
+} // namespace
+
+
+int main(int argc, char **argv)
+{
+    const int width = argc > 2 ? atoi(argv[1]) : 6000;
+    const int height = argc > 2 ? atoi(argv[2]) : 4000;
+    const int reps = argc > 3 ? atoi(argv[3]) : 5;
+    const int count = width * height;
+    if (width < 16 || height < 16 || reps < 1) {
+        fprintf(stderr, "Usage: %s [width height [repetitions]]\n", argv[0]);
+        return 1;
+    }
+
+#if defined(DCRAW_SSE2)
+    printf("SSE2, %d x %d pixels\n", width, height);
+#elif defined(DCRAW_NEON)
+    printf("NEON, %d x %d pixels\n", width, height);
+#else
+    printf("Scalar, %d x %d pixels\n", width, height);
+#endif
+
+    DCRaw * dcraw = new DCRaw();
+    dcraw->width = dcraw->iwidth = width;
+    dcraw->height = dcraw->iheight = height;
+    dcraw->colors = 3;
+    dcraw->write_to_memory = 1;
+    const unsigned black[4] = { 128, 130, 127, 131 };
+    for (int c = 0; c < 4; c++) {
+        dcraw->cblack[c] = black[c];
+    }
+    const float mul[4] = { 32.5f, 16.1f, 24.7f, 16.1f };
+    float out_cam[3][4] = { { 1.6f, -0.5f, -0.1f, 0 },
+                            { -0.2f, 1.4f, -0.2f, 0 },
+                            { 0.05f, -0.45f, 1.4f, 0 } };
+
+    std::vector<ushort> source(static_cast<size_t>(count) * 4);
+    srand(1);
+    for (size_t i = 0; i != source.size(); ++i) {
+        source[i] = rand() % 4096;
+    }
+    std::vector<ushort> expected(source);
+    ushort (*reference)[4] = reinterpret_cast<ushort (*)[4]>(&expected[0]);
+    dcraw->image = static_cast<ushort (*)[4]>(malloc(source.size() * 2));
+    const size_t bytes = source.size() * sizeof(ushort);
+    int failures = 0;
+
+    // scale_colors(): black level, white balance and clipping
+    Clock::duration elapsed = Clock::duration::zero();
+    for (int r = 0; r < reps; r++) {
+        memcpy(dcraw->image, &source[0], bytes);
+        const Clock::time_point start = Clock::now();
+        dcraw->scale_pixels(dcraw->image, count, mul);
+        elapsed += Clock::now() - start;
+    }
+    report("scale_colors", elapsed, reps, count);
+    scaleReference(reference, count, black, mul);
+    if (memcmp(dcraw->image, reference, bytes) != 0) {
+        printf("  scale_colors differs from the scalar loop\n");
+        failures++;
+    }
+
+    // convert_to_rgb(): color matrix and histogram
+    std::vector<ushort> scaled(dcraw->image[0], dcraw->image[0] + bytes / 2);
+    elapsed = Clock::duration::zero();
+    for (int r = 0; r < reps; r++) {
+        memcpy(dcraw->image, &scaled[0], bytes);
+        memset(dcraw->histogram, 0, sizeof dcraw->histogram);
+        const Clock::time_point start = Clock::now();
+        dcraw->rgb_pixels(dcraw->image, count, out_cam);
+        elapsed += Clock::now() - start;
+    }
+    report("convert_to_rgb", elapsed, reps, count);
+    static int histogram[4][0x2000];
+    rgbReference(reference, count, out_cam, 3, histogram);
+    if (memcmp(dcraw->image, reference, bytes) != 0 ||
+        memcmp(dcraw->histogram, histogram, sizeof histogram) != 0)
+    {
+        printf("  convert_to_rgb differs from the scalar loop\n");
+        failures++;
+    }
+
+    // write_ppm_tiff(): gamma curve and interleaving, to memory
+    const int bps[2] = { 8, 16 };
+    for (int k = 0; k != 2; ++k) {
+        dcraw->output_bps = bps[k];
+        elapsed = Clock::duration::zero();
+        for (int r = 0; r < reps; r++) {
+            const Clock::time_point start = Clock::now();
+            dcraw->write_ppm_tiff();
+            elapsed += Clock::now() - start;
+            free(dcraw->mem_image);
+            dcraw->mem_image = NULL;
+        }
+        report(bps[k] == 8 ? "write_ppm_tiff, 8 bits" :
+               "write_ppm_tiff, 16 bits", elapsed, reps, count);
+    }
+
+    free(dcraw->image);
+    delete dcraw;
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,153 @@
+function [rawInfo, errs] = dcrawCatalog(fname, varargin)
+% Read the camera and sensor parameters of raw images into a struct
+%
+% Synopsis
+%   rawInfo         = dcrawCatalog(fname)
+%   [rawInfo, errs] = dcrawCatalog(fnames, varargin)
+%
+% Inputs:
+%   fname  - path to the raw file
+%   fnames - cell array of paths
+%
+% Optional key/val pairs
+%   threads - number of threads for a list of files (default: one per
+%             core)
+%
+% Outputs:
+%   rawInfo - struct with the fields of dcrawIdentify: make, model, iso,
+%             shutter, aperture, focalLength, timestamp, the sizes, the
+%             filter pattern, the black and white levels and the camera
+%             to sRGB matrices.  For a cell array of files, a struct array
+%             of the same size.
+%   errs    - cell array of error messages, '' for the files that were
+%             read.  The entries of rawInfo for the others have empty
+%             fields.
+%
+% Description
+%   The headers are parsed in-process by dcrawIdentify, without reading
+%   the pixels, and a list of files is spread over several threads.
+%   Without the MEX file (see dcrawCompile) each file is run through the
+%   dcraw executable with '-i -v', and only the fields that it prints
+%   are filled in.  That text gives the make and the model on one line,
+%   so the make is taken to be its first word, or 'Phase One', the one
+%   make of two words that dcraw writes.
+%
+%   dcrawInfo returns the text of "dcraw -i -v" for one file.
+%
+% Example:
+%   info = dcrawCatalog('DSC01354.ARW');
+%   [info, errs] = dcrawCatalog({'DSC01354.ARW', 'DSC01355.ARW'});
+%
+% See also:
+%   dcrawIdentify, dcrawInfo, dcrawMosaic, dcrawInit
+%
+
+%% Parse inputs
+varargin = ieParamFormat(varargin);
+p = inputParser;
+
+p.addRequired('fname', @(x)(ischar(x) || iscellstr(x)));
+p.addParameter('threads', [], @(x)(isempty(x) || (isscalar(x) && x > 0)));
+
+p.parse(fname, varargin{:});
+
+%% Read the headers in-process when the MEX file is available
+if exist('dcrawIdentify', 'file') == 3
+    if ischar(fname)
+        rawInfo = dcrawIdentify(fname);
+        errs = {''};
+    else
+        params = struct('threads', p.Results.threads);
+        [rawInfo, errs] = dcrawIdentify(fname, params);
+    end
+    return;
+end
+
+%% Otherwise run the dcraw executable on each file
+if ismac
+    fp = fullfile(isetRootPath,'utility', 'external', 'dcraw', 'dcraw_mac');
+elseif isunix
+    fp = fullfile(isetRootPath,'utility', 'external', 'dcraw', 'dcraw_linux');
+elseif ispc
+    fp = fullfile(isetRootPath, 'utility', 'external', 'dcraw', 'dcraw_win64.exe');
+else
+    error('If you are on Win32, use dcraw_win32.');
+end
+
+fnames = cellstr(fname);
+rawInfo = repmat(emptyInfo, size(fnames));
+errs = repmat({''}, size(fnames));
+for ii = 1:numel(fnames)
+    [status, text] = system(sprintf('"%s" -i -v "%s"', fp, fnames{ii}));
+    if status ~= 0 || ~contains(text, 'Camera:')
+        errs{ii} = sprintf('dcraw could not identify "%s".', fnames{ii});
+        if ischar(fname), error('dcraw:decode', '%s', errs{ii}); end
+    else
+        rawInfo(ii) = parseInfo(text);
+    end
+end
+
+end
+
+%% The struct of dcrawIdentify, with every field empty
+function info = emptyInfo
+
+fields = {'make', 'model', 'iso', 'shutter', 'aperture', 'focalLength', ...
+    'timestamp', 'rawSize', 'size', 'colors', 'colorDesc', 'filters', ...
+    'pattern', 'black', 'cblack', 'blackPattern', 'blackLevel', ...
+    'maximum', 'rgbCam', 'cameraMatrix', 'preMul', 'camMul', 'flip'};
+info = cell2struct(cell(numel(fields), 1), fields, 1);
+
+end
+
+%% The fields that "dcraw -i -v" prints
+function info = parseInfo(text)
+
+info = emptyInfo;
+lines = strsplit(text, newline);
+for ii = 1:numel(lines)
+    tokens = regexp(lines{ii}, '^([^:]+):\s*(.*?)\s*$', 'tokens', 'once');
+    if isempty(tokens), continue; end
+    value = tokens{2};
+    switch tokens{1}
+        case 'Camera'
+            % The make is printed before the model, with only a space
+            % between them
+            if startsWith(value, 'Phase One ')
+                info.make = 'Phase One';
+                info.model = value(numel('Phase One ')+1:end);
+            else
+                [info.make, info.model] = strtok(value);
+                info.model = strtrim(info.model);
+            end
+        case 'Timestamp'
+            % dcraw prints the camera clock as UTC
+            try
+                t = datetime(value, 'TimeZone', 'UTC', ...
+                    'InputFormat', 'eee MMM d HH:mm:ss yyyy', ...
+                    'Locale', 'en_US');
+                info.timestamp = posixtime(t);
+            catch
+            end
+        case 'ISO speed'
+            info.iso = str2double(value);
+        case 'Shutter'
+            info.shutter = str2num(strtok(value)); %#ok<ST2NM>
+        case 'Aperture'
+            info.aperture = str2double(strrep(value, 'f/', ''));
+        case 'Focal length'
+            info.focalLength = str2double(strtok(value));
+        case 'Full size'
+            info.rawSize = fliplr(sscanf(value, '%d x %d')');
+        case 'Image size'
+            info.size = fliplr(sscanf(value, '%d x %d')');
+        case 'Raw colors'
+            info.colors = str2double(value);
+        case 'Daylight multipliers'
+            info.preMul = sscanf(value, '%f')';
+        case 'Camera multipliers'
+            info.camMul = sscanf(value, '%f')';
+    end
+end
+
+end
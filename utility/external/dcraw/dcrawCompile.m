@@ -0,0 +1,40 @@
+function dcrawCompile(varargin)
+% Compile the dcraw MEX files
+%
+%   dcrawCompile([mex options])
+%
+% Inputs:
+%   mex options - extra arguments passed to mex, such as '-v' or
+%                 '-DNO_JPEG'
+%
+% Notes:
+%   dcraw.c is compiled into each MEX file as C++.  By default it is built
+%   without its optional libraries (-DNODEPS), so lossy DNG, Kodak DC120,
+%   Red camera movies and ICC profiles are not supported.  To enable them,
+%   install libjpeg, jasper and lcms2 and pass the matching options, e.g.
+%
+%      dcrawCompile('-UNODEPS', '-DNO_JASPER', '-ljpeg', '-llcms2')
+%
+%   The MEX files are written next to this function.
+%
+% Example:
+%   dcrawCompile;
+%
+% See also:
+%   dcrawDecode, dcrawMosaic, dcrawIdentify, dcrawDNGRead, dcrawRead
+%
+
+buildFiles = {'dcrawDecode.cpp', 'dcrawMosaic.cpp', 'dcrawIdentify.cpp', ...
+    'dcrawDNGRead.cpp'};
+
+srcDir = fileparts(mfilename('fullpath'));
+for ii = 1:numel(buildFiles)
+    fprintf('Building %s\n', buildFiles{ii});
+    mex(fullfile(srcDir, buildFiles{ii}), ...
+        '-outdir', srcDir, ...
+        '-DNODEPS', ...
+        '-largeArrayDims', ...
+        varargin{:});
+end
+
+end
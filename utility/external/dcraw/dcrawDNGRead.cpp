@@ -0,0 +1,645 @@
+/*============================================================================
+
+ dcrawDNGRead - read the mosaic and the DNG tags of DNG files
+
+ MEX gateway around DCRaw::identify_file() and DCRaw::load_identified()
+ in dcraw.c.  While parse_tiff_ifd() walks the IFDs, a tag hook keeps the
+ DNG tags that dcraw itself only partly stores (the black and white
+ levels, color matrices, white balance and opcode lists), so that one
+ call returns the pixels and the header.
+
+ The files are read by a pool of worker threads, each file with its own
+ DCRaw object.  A worker parses the header, asks the MATLAB thread for
+ an output array of the right size, and then unpacks the mosaic with the
+ same DCRaw object, so that the header is parsed once and the pixels are
+ copied once.  The MATLAB API is only used from the MATLAB thread.
+
+ Build with dcrawCompile.
+
+ ============================================================================*/
+
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <mex.h>
+
+#define DCRAW_LIBRARY
+#include "dcraw.c"
+#include "dcrawMetadata.h"
+
+
+namespace
+{
+
+enum TagKind { NUMBERS, BYTES, TEXT };
+
+// How a list of numbers is laid out, as in the DNG specification
+enum TagShape {
+    ROW,            // 1 x count
+    COLOR_ROWS,     // colors x 3, e.g. ColorMatrix1
+    COLOR_COLS,     // 3 x colors, e.g. ForwardMatrix1
+    SQUARE,         // colors x colors, e.g. CameraCalibration1
+    BLACK_REPEAT,   // BlackLevelRepeatDim
+    CFA_REPEAT      // CFARepeatPatternDim
+};
+
+struct DngTag
+{
+    unsigned tag;
+    const char * name;
+    TagKind kind;
+    TagShape shape;
+};
+
+// The tags that are returned, under their names in the DNG specification
+const DngTag dngTags[] = {
+    { 50706, "DNGVersion", NUMBERS, ROW },
+    { 50708, "UniqueCameraModel", TEXT, ROW },
+    { 274, "Orientation", NUMBERS, ROW },
+    { 34855, "ISOSpeedRatings", NUMBERS, ROW },
+    { 33434, "ExposureTime", NUMBERS, ROW },
+    { 33437, "FNumber", NUMBERS, ROW },
+    { 33421, "CFARepeatPatternDim", NUMBERS, ROW },
+    { 33422, "CFAPattern", NUMBERS, CFA_REPEAT },
+    { 50710, "CFAPlaneColor", NUMBERS, ROW },
+    { 50713, "BlackLevelRepeatDim", NUMBERS, ROW },
+    { 50714, "BlackLevel", NUMBERS, BLACK_REPEAT },
+    { 50715, "BlackLevelDeltaH", NUMBERS, ROW },
+    { 50716, "BlackLevelDeltaV", NUMBERS, ROW },
+    { 50717, "WhiteLevel", NUMBERS, ROW },
+    { 50829, "ActiveArea", NUMBERS, ROW },
+    { 50719, "DefaultCropOrigin", NUMBERS, ROW },
+    { 50720, "DefaultCropSize", NUMBERS, ROW },
+    { 50778, "CalibrationIlluminant1", NUMBERS, ROW },
+    { 50779, "CalibrationIlluminant2", NUMBERS, ROW },
+    { 50721, "ColorMatrix1", NUMBERS, COLOR_ROWS },
+    { 50722, "ColorMatrix2", NUMBERS, COLOR_ROWS },
+    { 50723, "CameraCalibration1", NUMBERS, SQUARE },
+    { 50724, "CameraCalibration2", NUMBERS, SQUARE },
+    { 50964, "ForwardMatrix1", NUMBERS, COLOR_COLS },
+    { 50965, "ForwardMatrix2", NUMBERS, COLOR_COLS },
+    { 50727, "AnalogBalance", NUMBERS, ROW },
+    { 50728, "AsShotNeutral", NUMBERS, ROW },
+    { 50729, "AsShotWhiteXY", NUMBERS, ROW },
+    { 50730, "BaselineExposure", NUMBERS, ROW },
+    { 51041, "NoiseProfile", NUMBERS, ROW },
+    { 51008, "OpcodeList1", BYTES, ROW },
+    { 51009, "OpcodeList2", BYTES, ROW },
+    { 51022, "OpcodeList3", BYTES, ROW }
+};
+const size_t numTags = sizeof(dngTags) / sizeof(dngTags[0]);
+
+// The fields that come from the DCRaw members, before the tags
+const char * const fileFields[] = { "Make", "Model" };
+const size_t numFileFields = sizeof(fileFields) / sizeof(fileFields[0]);
+
+// Larger values are taken to be a corrupt header
+const unsigned MAX_NUMBERS = 0x10000;
+const unsigned MAX_BYTES = 0x4000000;
+
+struct TagValue
+{
+    size_t index;                   // into dngTags
+    int ifd;
+    std::vector<double> numbers;    // NUMBERS
+    std::string bytes;              // BYTES and TEXT
+};
+
+struct DngFile
+{
+    std::string name;
+    std::vector<TagValue> values;   // of every IFD, in the order parsed
+    int rawIfd;                     // the IFD that dcraw decodes
+    RawInfo info;
+    unsigned short * mosaic;        // the data of the output array
+    std::string error;
+    bool noMosaic;                  // the error is that there is no mosaic
+};
+
+struct TagReader
+{
+    DCRaw * dcraw;
+    std::vector<TagValue> * values;
+};
+
+
+// The index of tag into dngTags, or numTags
+size_t findTag(unsigned tag)
+{
+    size_t index = 0;
+    while (index != numTags && dngTags[index].tag != tag) {
+        ++index;
+    }
+    return index;
+}
+
+
+// DCRaw::tiff_tag_hook, called with ifp at the value of each tag
+void readTag(void * data, int ifd, unsigned tag, unsigned type, unsigned len)
+{
+    const TagReader & reader = *static_cast<TagReader *>(data);
+    const size_t index = findTag(tag);
+    if (index == numTags) {
+        return;
+    }
+
+    TagValue value;
+    value.index = index;
+    value.ifd = ifd;
+    DCRaw & dcraw = *reader.dcraw;
+    if (dngTags[index].kind == NUMBERS) {
+        if (len > MAX_NUMBERS) {
+            return;
+        }
+        value.numbers.resize(len);
+        for (unsigned i = 0; i != len; ++i) {
+            value.numbers[i] = dcraw.getreal(type);
+        }
+    } else if (len != 0) {
+        if (len > MAX_BYTES) {
+            return;
+        }
+        value.bytes.resize(len);
+        value.bytes.resize(fread(&value.bytes[0], 1, len, dcraw.ifp));
+        if (dngTags[index].kind == TEXT) {
+            value.bytes.resize(strnlen(value.bytes.c_str(),
+                                       value.bytes.size()));
+        }
+    }
+    reader.values->push_back(value);
+}
+
+
+// The IFD whose image apply_tiff() chose, or -1
+int findRawIfd(const DCRaw & dcraw)
+{
+    for (unsigned i = 0; i != dcraw.tiff_nifds; ++i) {
+        if (dcraw.tiff_ifd[i].offset == dcraw.data_offset &&
+            dcraw.tiff_ifd[i].width == dcraw.raw_width &&
+            dcraw.tiff_ifd[i].height == dcraw.raw_height)
+        {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+
+// The value of the raw IFD if it has the tag, as the DNG specification
+// puts the per-image tags there, else that of the first IFD.
+const TagValue * findValue(const DngFile & file, size_t index)
+{
+    const TagValue * found = NULL;
+    for (size_t i = 0; i != file.values.size(); ++i) {
+        const TagValue & value = file.values[i];
+        if (value.index != index) {
+            continue;
+        }
+        if (value.ifd == file.rawIfd) {
+            return &value;
+        }
+        if (found == NULL || value.ifd < found->ifd) {
+            found = &value;
+        }
+    }
+    return found;
+}
+
+
+// Parse the header of one file, keeping the tags. Returns the DCRaw
+// object for load_identified(), or NULL after an error. No MATLAB API
+// here, this runs in the workers.
+DCRaw * identifyDng(DngFile & file, bool pixels)
+{
+    DCRaw * dcraw = new DCRaw();
+    TagReader reader = { dcraw, &file.values };
+    dcraw->tiff_tag_hook = readTag;
+    dcraw->tiff_tag_data = &reader;
+    const int status = dcraw->identify_file(file.name.c_str());
+    const int openError = errno;
+    dcraw->tiff_tag_hook = NULL;
+    dcraw->tiff_tag_data = NULL;
+    if (status < 0) {
+        file.error = "Cannot open \"" + file.name + "\": " +
+            strerror(openError) + ".";
+    } else if (status == 0) {
+        file.error = "\"" + file.name +
+            "\" is not a raw file that dcraw can decode.";
+    } else if (!dcraw->dng_version) {
+        file.error = "\"" + file.name + "\" is not a DNG file.";
+    } else if (pixels && (!(dcraw->filters || dcraw->colors == 1) ||
+                          dcraw->fuji_width))
+    {
+        file.error = "\"" + file.name +
+            "\" does not hold a color filter mosaic.";
+        file.noMosaic = true;
+    } else {
+        file.rawIfd = findRawIfd(*dcraw);
+        readInfo(file.info, *dcraw);
+        return dcraw;
+    }
+    delete dcraw;
+    return NULL;
+}
+
+
+// The black levels without the pixels, as load_identified() would leave
+// them. crop_masked_pixels() only measures the MaskedAreas of a DNG file,
+// which parse_tiff_ifd() stores in mask.
+bool needsPixels(const DCRaw & dcraw)
+{
+    return dcraw.mask[0][3] > 0;
+}
+
+
+// Unpack the mosaic of an identified file, into its output array if it
+// has one. No MATLAB API here either.
+void loadDng(DngFile & file, DCRaw & dcraw)
+{
+    const int status = dcraw.load_identified();
+    const int openError = errno;
+    if (status < 0) {
+        file.error = "Cannot open \"" + file.name + "\": " +
+            strerror(openError) + ".";
+    } else if (status == 0) {
+        file.error = "\"" + file.name + "\" could not be decoded.";
+    } else {
+        if (file.mosaic != NULL) {
+            copyMosaic(file.mosaic, dcraw);
+        }
+        readInfo(file.info, dcraw);
+    }
+    free(dcraw.raw_image);
+    dcraw.raw_image = NULL;
+}
+
+
+// Reads a list of files on worker threads. The MATLAB thread creates the
+// output arrays as the workers ask for them, with next() and provide().
+class DngReader
+{
+public:
+    DngReader(std::vector<DngFile> & files, bool pixels, int numThreads) :
+    m_files(files), m_pixels(pixels), m_provided(files.size(), false),
+    m_next(0), m_finished(0), m_cancelled(false)
+    {
+        for (int i = 0; i != numThreads; ++i) {
+            m_threads.push_back(std::thread(&DngReader::worker, this));
+        }
+    }
+
+    // Stops the workers, which give up on the files they wait for
+    ~DngReader() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_next = m_files.size();
+            m_cancelled = true;
+        }
+        m_cond.notify_all();
+        for (size_t i = 0; i != m_threads.size(); ++i) {
+            m_threads[i].join();
+        }
+    }
+
+    // The next file that needs an array, or false once every file is read
+    bool next(size_t & index) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond.wait(lock, [&] {
+            return !m_requests.empty() || m_finished == m_files.size();
+        });
+        if (m_requests.empty()) {
+            return false;
+        }
+        index = m_requests.front();
+        m_requests.pop_front();
+        return true;
+    }
+
+    void provide(size_t index, unsigned short * mosaic) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_files[index].mosaic = mosaic;
+            m_provided[index] = true;
+        }
+        m_cond.notify_all();
+    }
+
+private:
+    void worker() {
+        for (;;) {
+            size_t index;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_next == m_files.size()) {
+                    return;
+                }
+                index = m_next++;
+            }
+
+            DngFile & file = m_files[index];
+            DCRaw * dcraw = identifyDng(file, m_pixels);
+            bool load = dcraw != NULL && (m_pixels || needsPixels(*dcraw));
+            if (dcraw != NULL && m_pixels) {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_requests.push_back(index);
+                m_cond.notify_all();
+                m_cond.wait(lock, [&] {
+                    return m_provided[index] || m_cancelled;
+                });
+                load = !m_cancelled;
+            }
+            if (load) {
+                loadDng(file, *dcraw);
+            } else if (dcraw != NULL) {
+                dcraw->fold_black();
+                for (int c = 0; c != 4; ++c) {
+                    dcraw->cblack[c] += dcraw->black;
+                }
+                readInfo(file.info, *dcraw);
+            }
+            delete dcraw;
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                ++m_finished;
+            }
+            m_cond.notify_all();
+        }
+    }
+
+    std::vector<DngFile> & m_files;
+    const bool m_pixels;
+    std::vector<bool> m_provided;
+    std::deque<size_t> m_requests;
+    size_t m_next;
+    size_t m_finished;
+    bool m_cancelled;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::vector<std::thread> m_threads;
+};
+
+
+// The rows and columns of a tag value, 1 x count unless its shape fits
+void tagSize(const DngFile & file, const TagValue & value, size_t & rows,
+             size_t & cols)
+{
+    const size_t count = value.numbers.size();
+    rows = 1;
+    cols = count;
+    size_t high = 0;
+    switch (dngTags[value.index].shape) {
+        case COLOR_ROWS:
+            high = count / 3;
+            break;
+        case COLOR_COLS:
+            high = 3;
+            break;
+        case SQUARE:
+            high = static_cast<size_t>(std::sqrt(static_cast<double>(count)) +
+                                       0.5);
+            break;
+        case BLACK_REPEAT:
+        case CFA_REPEAT: {
+            // BlackLevelRepeatDim or CFARepeatPatternDim
+            const TagValue * dim = findValue(file,
+                findTag(dngTags[value.index].shape == BLACK_REPEAT ?
+                        50713 : 33421));
+            if (dim != NULL && dim->numbers.size() == 2) {
+                high = static_cast<size_t>(dim->numbers[0]);
+            }
+            break;
+        }
+        case ROW:
+            break;
+    }
+    if (high != 0 && count != 0 && count % high == 0) {
+        rows = high;
+        cols = count / high;
+    }
+}
+
+
+mxArray * createValue(const DngFile & file, const TagValue & value)
+{
+    if (dngTags[value.index].kind == TEXT) {
+        return mxCreateString(value.bytes.c_str());
+    } else if (dngTags[value.index].kind == BYTES) {
+        mxArray * result = mxCreateNumericMatrix(1, value.bytes.size(),
+                                                 mxUINT8_CLASS, mxREAL);
+        std::copy(value.bytes.begin(), value.bytes.end(),
+                  static_cast<char *>(mxGetData(result)));
+        return result;
+    }
+    size_t rows, cols;
+    tagSize(file, value, rows, cols);
+    return value.numbers.empty() ? mxCreateDoubleMatrix(0, 0, mxREAL) :
+        createMatrix(&value.numbers[0], rows, cols, cols);
+}
+
+
+// What dcraw found for the tags that are usually in the EXIF IFD, which
+// parse_tiff_ifd() does not see, and the TIFF default Orientation
+mxArray * createDefault(const DngFile & file, unsigned tag)
+{
+    switch (tag) {
+        case 274:
+            return mxCreateDoubleScalar(1);
+        case 34855:
+            return mxCreateDoubleScalar(file.info.iso);
+        case 33434:
+            return mxCreateDoubleScalar(file.info.shutter);
+        case 33437:
+            return mxCreateDoubleScalar(file.info.aperture);
+        default:
+            return NULL;
+    }
+}
+
+
+// A struct array of the given size, with the file fields and then the
+// tags. The elements whose file is NULL, and the tags that a file does
+// not have, are empty.
+mxArray * createTags(const DngFile * const * files, mwSize numDims,
+                     const mwSize * dims)
+{
+    std::vector<const char *> fields(fileFields, fileFields + numFileFields);
+    for (size_t i = 0; i != numTags; ++i) {
+        fields.push_back(dngTags[i].name);
+    }
+    mxArray * result = mxCreateStructArray(numDims, dims,
+        static_cast<int>(fields.size()), &fields[0]);
+
+    const size_t count = mxGetNumberOfElements(result);
+    for (size_t i = 0; i != count; ++i) {
+        if (files[i] == NULL) {
+            continue;
+        }
+        const DngFile & file = *files[i];
+        mxSetField(result, i, "Make", mxCreateString(file.info.make.c_str()));
+        mxSetField(result, i, "Model",
+            mxCreateString(file.info.model.c_str()));
+        for (size_t t = 0; t != numTags; ++t) {
+            const TagValue * value = findValue(file, t);
+            mxSetField(result, i, dngTags[t].name, value != NULL ?
+                createValue(file, *value) : createDefault(file, dngTags[t].tag));
+        }
+    }
+    return result;
+}
+
+
+int hardwareThreads()
+{
+    return std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+}
+
+
+std::string toString(const mxArray * pa, const char * what)
+{
+    if (!mxIsChar(pa)) {
+        mexErrMsgIdAndTxt("dcraw:argument", "The %s must be a string.", what);
+    }
+    char * str = mxArrayToString(pa);
+    std::string result(str);
+    mxFree(str);
+    return result;
+}
+
+
+// The 'threads' and 'pixels' parameters
+void getParams(const mxArray * params, size_t numFiles, int & numThreads,
+               bool & pixels)
+{
+    double threads = hardwareThreads();
+    pixels = true;
+    if (params != NULL) {
+        if (!mxIsStruct(params) || mxGetNumberOfElements(params) != 1) {
+            mexErrMsgIdAndTxt("dcraw:argument",
+                "The parameters must be a scalar struct.");
+        }
+        const mxArray * field = mxGetField(params, 0, "threads");
+        if (field != NULL && !mxIsEmpty(field)) {
+            if (!mxIsNumeric(field) || mxGetNumberOfElements(field) != 1 ||
+                !(mxGetScalar(field) > 0))
+            {
+                mexErrMsgIdAndTxt("dcraw:argument",
+                    "The 'threads' parameter must be a positive scalar.");
+            }
+            threads = mxGetScalar(field);
+        }
+        field = mxGetField(params, 0, "pixels");
+        if (field != NULL && !mxIsEmpty(field)) {
+            if (!(mxIsNumeric(field) || mxIsLogical(field)) ||
+                mxGetNumberOfElements(field) != 1)
+            {
+                mexErrMsgIdAndTxt("dcraw:argument",
+                    "The 'pixels' parameter must be a logical scalar.");
+            }
+            pixels = mxGetScalar(field) != 0;
+        }
+    }
+    numThreads = static_cast<int>(std::max(1.0,
+        std::min(threads, static_cast<double>(numFiles))));
+}
+
+} // namespace
+
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+    if (nrhs < 1 || nrhs > 2) {
+        mexErrMsgIdAndTxt("dcraw:argument",
+            "Usage: [mosaic, tags, info] = dcrawDNGRead(fname, params) or "
+            "[mosaics, tags, info, err] = dcrawDNGRead(fnames, params)");
+    } else if (nlhs > (mxIsCell(prhs[0]) ? 4 : 3)) {
+        mexErrMsgIdAndTxt("dcraw:argument", "Too many output arguments.");
+    }
+
+    const bool isBatch = mxIsCell(prhs[0]);
+    std::vector<DngFile> files(isBatch ? mxGetNumberOfElements(prhs[0]) : 1);
+    for (size_t i = 0; i != files.size(); ++i) {
+        files[i].name = toString(isBatch ? mxGetCell(prhs[0], i) : prhs[0],
+                                 "file name");
+        files[i].rawIfd = -1;
+        files[i].mosaic = NULL;
+        files[i].noMosaic = false;
+    }
+    int numThreads;
+    bool pixels;
+    getParams(nrhs == 2 ? prhs[1] : NULL, files.size(), numThreads, pixels);
+
+    // The arrays are created here, on the MATLAB thread, and filled in by
+    // the workers
+    std::vector<mxArray *> mosaics(files.size(), NULL);
+    {
+        DngReader reader(files, pixels, numThreads);
+        size_t i;
+        while (reader.next(i)) {
+            mosaics[i] = mxCreateUninitNumericMatrix(files[i].info.height,
+                files[i].info.width, mxUINT16_CLASS, mxREAL);
+            reader.provide(i,
+                static_cast<unsigned short *>(mxGetData(mosaics[i])));
+        }
+    }
+
+    std::vector<const DngFile *> found(files.size());
+    std::vector<const RawInfo *> infos(files.size());
+    for (size_t i = 0; i != files.size(); ++i) {
+        const bool ok = files[i].error.empty();
+        if (mosaics[i] != NULL && !ok) {
+            mxDestroyArray(mosaics[i]);
+            mosaics[i] = NULL;
+        }
+        if (mosaics[i] == NULL) {
+            mosaics[i] = mxCreateNumericMatrix(0, 0, mxUINT16_CLASS, mxREAL);
+        }
+        found[i] = ok ? &files[i] : NULL;
+        infos[i] = ok ? &files[i].info : NULL;
+    }
+
+    if (!isBatch) {
+        if (!files[0].error.empty()) {
+            mexErrMsgIdAndTxt(files[0].noMosaic ? "dcraw:mosaic" :
+                              "dcraw:decode", "%s", files[0].error.c_str());
+        }
+        const mwSize dims[2] = { 1, 1 };
+        plhs[0] = mosaics[0];
+        if (nlhs > 1) {
+            plhs[1] = createTags(&found[0], 2, dims);
+        }
+        if (nlhs > 2) {
+            plhs[2] = createInfo(&infos[0], 2, dims);
+        }
+        return;
+    }
+
+    const mwSize numDims = mxGetNumberOfDimensions(prhs[0]);
+    const mwSize * dims = mxGetDimensions(prhs[0]);
+    plhs[0] = mxCreateCellArray(numDims, dims);
+    for (size_t i = 0; i != files.size(); ++i) {
+        mxSetCell(plhs[0], i, mosaics[i]);
+    }
+    if (nlhs > 1) {
+        plhs[1] = createTags(found.empty() ? NULL : &found[0], numDims, dims);
+    }
+    if (nlhs > 2) {
+        plhs[2] = createInfo(infos.empty() ? NULL : &infos[0], numDims, dims);
+    }
+    if (nlhs > 3) {
+        plhs[3] = mxCreateCellArray(numDims, dims);
+        for (size_t i = 0; i != files.size(); ++i) {
+            mxSetCell(plhs[3], i, mxCreateString(files[i].error.c_str()));
+        }
+    }
+}
@@ -0,0 +1,73 @@
+function [mosaic, tags, info, err] = dcrawDNGRead(fname, params) %#ok<STOUT,INUSD>
+% Read the mosaic and the DNG tags of DNG files with dcraw (MEX)
+%
+%   [mosaic, tags, info]       = dcrawDNGRead(fname, [params])
+%   [mosaics, tags, info, err] = dcrawDNGRead(fnames, [params])
+%
+% Inputs:
+%   fname  - path to the DNG file
+%   fnames - cell array of paths, read in parallel (e.g. a burst)
+%   params - struct with the parameters, all optional
+%      threads - number of threads for a cell array (default: one per
+%                core)
+%      pixels  - false to read only the tags; mosaic is then empty,
+%                and only the files with MaskedAreas are unpacked, to
+%                measure info.black (default: true)
+%
+% Outputs:
+%   mosaic - the color filter mosaic as a uint16 height x width array, as
+%            for dcrawMosaic: the ActiveArea, not rotated to the camera
+%            orientation (see info.flip), without black subtraction.  For
+%            a cell array of files, a cell array of the same size.
+%   tags   - struct with the DNG tags, under their names in the DNG
+%            specification, [] when the file does not have one
+%      Make, Model          - camera, as dcraw names it
+%      DNGVersion, UniqueCameraModel, Orientation (1 if missing)
+%      ISOSpeedRatings, ExposureTime, FNumber - from the EXIF IFD if they
+%                             are not in the TIFF IFDs
+%      CFARepeatPatternDim, CFAPattern, CFAPlaneColor
+%      BlackLevelRepeatDim, BlackLevel (repeat rows x cols),
+%      BlackLevelDeltaH, BlackLevelDeltaV, WhiteLevel
+%      ActiveArea, DefaultCropOrigin, DefaultCropSize
+%      CalibrationIlluminant1/2
+%      ColorMatrix1/2       - colors x 3, XYZ to camera
+%      CameraCalibration1/2 - colors x colors
+%      ForwardMatrix1/2     - 3 x colors, camera to XYZ (D50)
+%      AnalogBalance, AsShotNeutral, AsShotWhiteXY, BaselineExposure,
+%      NoiseProfile
+%      OpcodeList1/2/3      - the opcode lists as uint8 bytes, big-endian
+%                             as stored
+%   info   - struct with what dcraw knows about the mosaic, the fields of
+%            dcrawMosaic
+%   err    - cell array of error messages, '' for the files that were
+%            read.  Unlike a single file, a file that fails does not stop
+%            the batch; its mosaic is empty and its tags and info have
+%            empty fields.
+%
+% Notes:
+%   The tags of the raw IFD are preferred to those of the other IFDs,
+%   such as IFD0 with the preview.  Files that are not DNG, or DNG files
+%   without a mosaic (linear DNG), are rejected; use dcrawRead for those.
+%   The error identifier of a single file without a mosaic is
+%   'dcraw:mosaic'.
+%
+%   Build the MEX file with dcrawCompile.  ieDNGRead uses it when it
+%   exists.
+%
+% Example:
+%   [mosaic, tags, info] = dcrawDNGRead('MCC-centered.dng');
+%   black = repmat(info.blackLevel, ceil(size(mosaic)./size(info.blackLevel)));
+%   mosaic = double(mosaic) - black(1:size(mosaic,1), 1:size(mosaic,2));
+%
+%   files = dir(fullfile(burstDir, '*.dng'));
+%   files = fullfile({files.folder}, {files.name});
+%   [mosaics, tags, ~, err] = dcrawDNGRead(files);
+%
+% See also:
+%   ieDNGRead, dcrawMosaic, dcrawIdentify, dcrawCompile
+
+% (The help system uses this file, but actually doing something with it
+% will employ the mex file).
+error('dcraw:mex', 'dcrawDNGRead has not been compiled.  Run dcrawCompile.');
+
+end
@@ -0,0 +1,489 @@
+/*============================================================================
+
+ dcrawDecode - decode camera raw files in-process with dcraw
+
+ MEX gateway around dcraw.c, which is compiled into this file as the
+ DCRaw class, without its main() program (see DCRAW_LIBRARY in dcraw.c).
+ The image is the same one that "dcraw [opts] fname" writes as a PGM/PPM,
+ but it goes straight into a MATLAB array instead of through a temporary
+ file.
+
+ Given a cell array of files, the files are decoded by a pool of worker
+ threads, each one with its own DCRaw object, while the MATLAB thread
+ hands the images back in order.  The MATLAB API is only used from the
+ MATLAB thread.
+
+ Build with dcrawCompile.
+
+ ============================================================================*/
+
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <mex.h>
+
+#define DCRAW_LIBRARY
+#include "dcraw.c"
+
+
+namespace
+{
+
+// Split the dcraw option string at blanks, like the shell would
+std::vector<std::string> splitOptions(const char * opts)
+{
+    std::vector<std::string> tokens;
+    const char * p = opts;
+    while (*p != '\0') {
+        while (*p != '\0' && isspace(static_cast<unsigned char>(*p))) {
+            ++p;
+        }
+        const char * start = p;
+        while (*p != '\0' && !isspace(static_cast<unsigned char>(*p))) {
+            ++p;
+        }
+        if (p != start) {
+            tokens.push_back(std::string(start, p));
+        }
+    }
+    return tokens;
+}
+
+
+// Transpose the row-major, interleaved dcraw image into column-major planes
+template <typename T>
+void copyToMatlab(T * dest, const T * src, size_t rows, size_t cols,
+                  size_t numColors)
+{
+    const size_t TILE = 64;
+    for (size_t r0 = 0; r0 < rows; r0 += TILE) {
+        const size_t r1 = std::min(rows, r0 + TILE);
+        for (size_t c0 = 0; c0 < cols; c0 += TILE) {
+            const size_t c1 = std::min(cols, c0 + TILE);
+            for (size_t k = 0; k != numColors; ++k) {
+                T * plane = dest + k * rows * cols;
+                for (size_t c = c0; c != c1; ++c) {
+                    const T * in = src + (r0 * cols + c) * numColors + k;
+                    T * out = plane + c * rows;
+                    for (size_t r = r0; r != r1; ++r, in += cols * numColors) {
+                        out[r] = *in;
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+// The output of one decode, or the reason why there is none
+struct DecodedImage
+{
+    DecodedImage() : data(NULL), rows(0), cols(0), numColors(0), bps(0) {}
+
+    size_t bytes() const {
+        return rows * cols * numColors * (bps / 8);
+    }
+
+    void release() {
+        free(data);
+        data = NULL;
+    }
+
+    unsigned char * data;
+    size_t rows;
+    size_t cols;
+    size_t numColors;
+    int bps;
+    std::string error;
+};
+
+
+int hardwareThreads()
+{
+    return std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+}
+
+
+// Run "dcraw [opts] fname" with a fresh decoder, which may interpolate
+// with numThreads threads. On failure the error is the message that dcraw
+// prints, such as an unknown option, a file it cannot decode or running
+// out of memory. No MATLAB API here, this runs in the workers.
+void decodeFile(const std::string & fname,
+                const std::vector<std::string> & tokens, int numThreads,
+                DecodedImage & image)
+{
+    // dcraw writes an empty string at argv[argc]
+    std::vector<const char *> argv;
+    argv.push_back("dcraw");
+    for (size_t i = 0; i != tokens.size(); ++i) {
+        argv.push_back(tokens[i].c_str());
+    }
+    argv.push_back(fname.c_str());
+    argv.push_back(NULL);
+
+    DCRaw * dcraw = new DCRaw();
+    dcraw->write_to_memory = 1;
+    dcraw->nthreads = numThreads;
+    const int status = dcraw->main(static_cast<int>(argv.size() - 1), &argv[0]);
+    if (status != 0 || dcraw->mem_image == NULL) {
+        free(dcraw->mem_image);
+        // dcraw's own reason, as the dcraw executable prints it
+        image.error = dcraw->error_text[0] ? std::string(dcraw->error_text) :
+            "dcraw could not decode \"" + fname + "\".";
+    } else {
+        image.data = dcraw->mem_image;
+        image.rows = dcraw->height;
+        image.cols = dcraw->width;
+        image.numColors = dcraw->colors;
+        image.bps = dcraw->output_bps;
+    }
+    delete dcraw;
+}
+
+
+// Upper bound of the memory for decoding a file with numThreads threads: the
+// raw mosaic, the four-channel working image and the output, all at the raw
+// size, plus the scratch buffers of the loader (see load_raw_memory).
+// Zero with an error message if the file cannot be decoded at all.
+size_t estimateMemory(const std::string & fname, int numThreads,
+                      std::string & error)
+{
+    DCRaw * dcraw = new DCRaw();
+    dcraw->nthreads = numThreads;
+    const int numRaw = dcraw->identify_file(fname.c_str());
+    const int openError = errno;
+    const size_t pixels = static_cast<size_t>(dcraw->raw_height) *
+        std::max(dcraw->raw_width, dcraw->width);
+    const size_t scratch = numRaw > 0 ?
+        static_cast<size_t>(dcraw->load_raw_memory()) : 0;
+    delete dcraw;
+
+    if (numRaw < 0) {
+        error = "Cannot open \"" + fname + "\": " + strerror(openError) + ".";
+        return 0;
+    } else if (numRaw == 0) {
+        error = "\"" + fname + "\" is not a raw file that dcraw can decode.";
+        return 0;
+    }
+    return pixels * (1 + 4 + 4) * sizeof(ushort) + scratch;
+}
+
+
+mxArray * toMatlab(const DecodedImage & image)
+{
+    const mwSize numDims = image.numColors > 1 ? 3 : 2;
+    const mwSize dims[3] = { image.rows, image.cols, image.numColors };
+    mxArray * result = NULL;
+    if (image.bps == 16) {
+        result = mxCreateNumericArray(numDims, dims, mxUINT16_CLASS, mxREAL);
+        copyToMatlab(static_cast<unsigned short *>(mxGetData(result)),
+            reinterpret_cast<const unsigned short *>(image.data),
+            image.rows, image.cols, image.numColors);
+    } else {
+        result = mxCreateNumericArray(numDims, dims, mxUINT8_CLASS, mxREAL);
+        copyToMatlab(static_cast<unsigned char *>(mxGetData(result)),
+            image.data, image.rows, image.cols, image.numColors);
+    }
+    return result;
+}
+
+
+
+// Bytes of memory which the decodes in flight may use. They are granted
+// in the order of the files, so that the file which the MATLAB thread
+// waits for is never starved by the ones after it. A file bigger than
+// the whole budget runs once nothing else holds memory.
+class MemoryBudget
+{
+public:
+    explicit MemoryBudget(size_t limit) :
+    m_limit(limit), m_inUse(0), m_nextTicket(0), m_cancelled(false)
+    {}
+
+    // Returns false if the batch was cancelled while waiting
+    bool acquire(size_t ticket, size_t bytes) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond.wait(lock, [&] {
+            return m_cancelled || (ticket == m_nextTicket &&
+                (m_inUse == 0 || m_inUse + bytes <= m_limit));
+        });
+        if (m_cancelled) {
+            return false;
+        }
+        m_inUse += bytes;
+        ++m_nextTicket;
+        m_cond.notify_all();
+        return true;
+    }
+
+    void release(size_t bytes) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_inUse -= bytes;
+        m_cond.notify_all();
+    }
+
+    void cancel() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_cancelled = true;
+        m_cond.notify_all();
+    }
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    const size_t m_limit;
+    size_t m_inUse;
+    size_t m_nextTicket;
+    bool m_cancelled;
+};
+
+
+
+// Decodes a list of files on worker threads. The results are collected
+// in order with wait() and handed back with consumed().
+class BatchDecoder
+{
+public:
+    BatchDecoder(const std::vector<std::string> & files,
+                 const std::vector<std::string> & tokens,
+                 int numThreads, size_t memoryLimit) :
+    m_files(files), m_tokens(tokens), m_results(files.size()),
+    m_reserved(files.size(), 0), m_done(files.size(), false),
+    m_next(0), m_budget(memoryLimit),
+    m_decodeThreads(std::max(1, hardwareThreads() / numThreads))
+    {
+        for (int i = 0; i != numThreads; ++i) {
+            m_threads.push_back(std::thread(&BatchDecoder::worker, this));
+        }
+    }
+
+    // Stops the workers after their current file and frees what is left
+    ~BatchDecoder() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_next = m_files.size();
+        }
+        m_budget.cancel();
+        for (size_t i = 0; i != m_threads.size(); ++i) {
+            m_threads[i].join();
+        }
+        for (size_t i = 0; i != m_results.size(); ++i) {
+            m_results[i].release();
+        }
+    }
+
+    DecodedImage & wait(size_t index) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond.wait(lock, [&] { return m_done[index]; });
+        return m_results[index];
+    }
+
+    void consumed(size_t index) {
+        m_results[index].release();
+        m_budget.release(m_reserved[index]);
+        m_reserved[index] = 0;
+    }
+
+private:
+    void worker() {
+        for (;;) {
+            size_t index;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_next == m_files.size()) {
+                    return;
+                }
+                index = m_next++;
+            }
+
+            DecodedImage image;
+            const size_t estimate = estimateMemory(m_files[index],
+                m_decodeThreads, image.error);
+            if (!m_budget.acquire(index, estimate)) {
+                return;
+            }
+            if (image.error.empty()) {
+                decodeFile(m_files[index], m_tokens, m_decodeThreads, image);
+            }
+
+            // Only the output stays accounted for until it is consumed
+            const size_t reserved = std::min(estimate, image.bytes());
+            m_budget.release(estimate - reserved);
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_results[index] = image;
+                m_reserved[index] = reserved;
+                m_done[index] = true;
+            }
+            m_cond.notify_all();
+        }
+    }
+
+    const std::vector<std::string> m_files;
+    const std::vector<std::string> m_tokens;
+    std::vector<DecodedImage> m_results;
+    std::vector<size_t> m_reserved;
+    std::vector<bool> m_done;
+    size_t m_next;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    MemoryBudget m_budget;
+    const int m_decodeThreads;
+    std::vector<std::thread> m_threads;
+};
+
+
+
+std::string toString(const mxArray * pa, const char * what)
+{
+    if (!mxIsChar(pa)) {
+        mexErrMsgIdAndTxt("dcraw:argument", "The %s must be a string.", what);
+    }
+    char * str = mxArrayToString(pa);
+    std::string result(str);
+    mxFree(str);
+    return result;
+}
+
+
+double getScalarField(const mxArray * params, const char * name, double value)
+{
+    const mxArray * field = mxGetField(params, 0, name);
+    if (field == NULL || mxIsEmpty(field)) {
+        return value;
+    }
+    if (!mxIsNumeric(field) || mxGetNumberOfElements(field) != 1 ||
+        !(mxGetScalar(field) > 0))
+    {
+        mexErrMsgIdAndTxt("dcraw:argument",
+            "The '%s' parameter must be a positive scalar.", name);
+    }
+    return mxGetScalar(field);
+}
+
+
+// Decodes every file, returning the cell arrays of images and errors, or
+// calling back for each file in order when there is a callback
+void decodeBatch(int nlhs, mxArray *plhs[], const mxArray * filesCell,
+                 const std::vector<std::string> & tokens,
+                 const mxArray * params)
+{
+    std::vector<std::string> files(mxGetNumberOfElements(filesCell));
+    for (size_t i = 0; i != files.size(); ++i) {
+        files[i] = toString(mxGetCell(filesCell, i), "file name");
+    }
+
+    double numThreads = hardwareThreads();
+    double memoryLimit = 4.0 * 1024 * 1024 * 1024;
+    mxArray * callback = NULL;
+    if (params != NULL) {
+        if (!mxIsStruct(params) || mxGetNumberOfElements(params) != 1) {
+            mexErrMsgIdAndTxt("dcraw:argument",
+                "The batch parameters must be a scalar struct.");
+        }
+        numThreads = getScalarField(params, "threads", numThreads);
+        memoryLimit = getScalarField(params, "memory", memoryLimit);
+        callback = mxGetField(params, 0, "callback");
+        if (callback != NULL && mxIsEmpty(callback)) {
+            callback = NULL;
+        } else if (callback != NULL &&
+                   !mxIsClass(callback, "function_handle")) {
+            mexErrMsgIdAndTxt("dcraw:argument",
+                "The 'callback' parameter must be a function handle.");
+        }
+    }
+    numThreads = std::max(1.0,
+        std::min(numThreads, static_cast<double>(files.size())));
+    memoryLimit = std::min(memoryLimit,
+        static_cast<double>(std::numeric_limits<size_t>::max() / 2));
+
+    const mwSize numDims = mxGetNumberOfDimensions(filesCell);
+    const mwSize * dims = mxGetDimensions(filesCell);
+    mxArray * images = mxCreateCellArray(numDims, dims);
+    mxArray * errors = mxCreateCellArray(numDims, dims);
+
+    mxArray * exception = NULL;
+    {
+        BatchDecoder batch(files, tokens, static_cast<int>(numThreads),
+            static_cast<size_t>(memoryLimit));
+        for (size_t i = 0; i != files.size() && exception == NULL; ++i) {
+            DecodedImage & image = batch.wait(i);
+            mxArray * img = image.error.empty() ?
+                toMatlab(image) : mxCreateDoubleMatrix(0, 0, mxREAL);
+            mxArray * err = mxCreateString(image.error.c_str());
+            batch.consumed(i);
+
+            if (callback != NULL) {
+                mxArray * args[4] = { callback,
+                    mxCreateDoubleScalar(static_cast<double>(i + 1)),
+                    img, err };
+                exception = mexCallMATLABWithTrap(0, NULL, 4, args, "feval");
+                mxDestroyArray(args[1]);
+                mxDestroyArray(img);
+                mxDestroyArray(err);
+            } else {
+                mxSetCell(images, i, img);
+                mxSetCell(errors, i, err);
+            }
+        }
+    }
+
+    // Rethrow errors from the callback once the workers are gone
+    if (exception != NULL) {
+        mxDestroyArray(images);
+        mxDestroyArray(errors);
+        mexCallMATLAB(0, NULL, 1, &exception, "throw");
+    }
+
+    plhs[0] = images;
+    if (nlhs > 1) {
+        plhs[1] = errors;
+    } else {
+        mxDestroyArray(errors);
+    }
+}
+
+} // namespace
+
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+    if (nrhs < 1 || nrhs > 3) {
+        mexErrMsgIdAndTxt("dcraw:argument",
+            "Usage: I = dcrawDecode(fname, opts) or "
+            "[I, err] = dcrawDecode(fnames, opts, params)");
+    } else if (nlhs > 2 || (nlhs > 1 && !mxIsCell(prhs[0]))) {
+        mexErrMsgIdAndTxt("dcraw:argument", "Too many output arguments.");
+    } else if (nrhs == 3 && !mxIsCell(prhs[0])) {
+        mexErrMsgIdAndTxt("dcraw:argument",
+            "The batch parameters require a cell array of file names.");
+    }
+
+    const std::string opts = nrhs >= 2 ?
+        toString(prhs[1], "options") : std::string("-o 0 -D -c -4");
+    const std::vector<std::string> tokens = splitOptions(opts.c_str());
+
+    if (mxIsCell(prhs[0])) {
+        decodeBatch(nlhs, plhs, prhs[0], tokens, nrhs == 3 ? prhs[2] : NULL);
+        return;
+    }
+
+    const std::string fname = toString(prhs[0], "file name");
+    DecodedImage image;
+    decodeFile(fname, tokens, hardwareThreads(), image);
+    if (!image.error.empty()) {
+        mexErrMsgIdAndTxt("dcraw:decode", "%s", image.error.c_str());
+    }
+    plhs[0] = toMatlab(image);
+    image.release();
+}
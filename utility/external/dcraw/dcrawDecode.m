@@ -0,0 +1,50 @@
+function [I, err] = dcrawDecode(fname, opts, params) %#ok<STOUT,INUSD>
+% Decode camera raw files in-process with dcraw (MEX)
+%
+%   I        = dcrawDecode(fname, [opts])
+%   [I, err] = dcrawDecode(fnames, [opts], [params])
+%
+% Inputs:
+%   fname  - path to the raw file
+%   fnames - cell array of paths, decoded in parallel
+%   opts   - dcraw options as for the command line, default '-o 0 -D -c -4'
+%   params - struct with the batch parameters, all optional
+%      threads  - number of decoder threads (default: one per core)
+%      memory   - bytes that the decodes in flight may use (default 4 GB).
+%                 A file larger than this is decoded on its own.
+%      callback - function handle called as callback(ii, I, err) for each
+%                 file, in order, instead of returning the images
+%
+% Outputs:
+%   I   - the image that "dcraw opts fname" writes, as a height x width
+%         (x colors) array.  It is uint16 for 16-bit output (-4, -6) and
+%         uint8 otherwise, like imread of the PGM/PPM file.  For a cell
+%         array of files, a cell array of the same size with the images.
+%   err - cell array of error messages, '' for the files that decoded.
+%         The images of the files that failed are [].  Unlike a single
+%         file, a file that fails does not stop the batch.
+%
+% Notes:
+%   The decoder runs inside MATLAB, so there is no process spawn and no
+%   temporary file.  The options that do not produce an image (-i, -e,
+%   -z, -I and "-s all") are rejected; -c and -T make no difference.
+%
+%   Build the MEX file with dcrawCompile.  dcrawRead uses it when it
+%   exists and falls back to the dcraw executables otherwise.
+%
+% Example:
+%   I = dcrawDecode('DSC01354.ARW');
+%   I = dcrawDecode('DSC01354.ARW', '-w -q 3 -6');
+%
+%   files = {'DSC01354.ARW', 'DSC01355.ARW', 'DSC01356.ARW'};
+%   [I, err] = dcrawDecode(files, '-D -4', struct('threads', 4));
+%   dcrawDecode(files, '-D -4', struct('callback', @(ii,I,err) disp(size(I))));
+%
+% See also:
+%   dcrawRead, dcrawReadBatch, dcrawCompile
+
+% (The help system uses this file, but actually doing something with it
+% will employ the mex file).
+error('dcraw:mex', 'dcrawDecode has not been compiled.  Run dcrawCompile.');
+
+end
@@ -0,0 +1,184 @@
+/*============================================================================
+
+ dcrawIdentify - read the metadata of camera raw files, without the pixels
+
+ MEX gateway around DCRaw::identify_file() in dcraw.c, which parses the
+ TIFF/EXIF headers and maker notes as "dcraw -i -v" does, in-process.
+ Given a cell array of files, they are read by a pool of worker
+ threads, each one with its own DCRaw object.  The MATLAB API is only
+ used from the MATLAB thread, once the workers are done.
+
+ Build with dcrawCompile.
+
+ ============================================================================*/
+
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <mex.h>
+
+#define DCRAW_LIBRARY
+#include "dcraw.c"
+#include "dcrawMetadata.h"
+
+
+namespace
+{
+
+int hardwareThreads()
+{
+    return std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+}
+
+
+// Identify one file with a fresh decoder. The black levels are folded as
+// dcrawMosaic reports them. No MATLAB API here, this runs in the workers.
+void identifyFile(const std::string & fname, RawInfo & info,
+                  std::string & error)
+{
+    DCRaw * dcraw = new DCRaw();
+    const int status = dcraw->identify_file(fname.c_str());
+    const int openError = errno;
+    if (status < 0) {
+        error = "Cannot open \"" + fname + "\": " + strerror(openError) + ".";
+    } else if (status == 0) {
+        error = "\"" + fname + "\" is not a raw file that dcraw can decode.";
+    } else {
+        dcraw->fold_black();
+        for (int c = 0; c != 4; ++c) {
+            dcraw->cblack[c] += dcraw->black;
+        }
+        readInfo(info, *dcraw);
+    }
+    delete dcraw;
+}
+
+
+// Takes the next file until there are none left
+void identifyWorker(const std::vector<std::string> & files,
+                    std::vector<RawInfo> & infos,
+                    std::vector<std::string> & errors,
+                    std::atomic<size_t> & next)
+{
+    size_t i = next++;
+    while (i < files.size()) {
+        identifyFile(files[i], infos[i], errors[i]);
+        i = next++;
+    }
+}
+
+
+// Identifies the files on numThreads threads, this one included
+void identifyFiles(const std::vector<std::string> & files, int numThreads,
+                   std::vector<RawInfo> & infos,
+                   std::vector<std::string> & errors)
+{
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> threads;
+    for (int i = 1; i < numThreads; ++i) {
+        threads.push_back(std::thread(identifyWorker, std::cref(files),
+            std::ref(infos), std::ref(errors), std::ref(next)));
+    }
+    identifyWorker(files, infos, errors, next);
+    for (size_t i = 0; i != threads.size(); ++i) {
+        threads[i].join();
+    }
+}
+
+
+std::string toString(const mxArray * pa, const char * what)
+{
+    if (!mxIsChar(pa)) {
+        mexErrMsgIdAndTxt("dcraw:argument", "The %s must be a string.", what);
+    }
+    char * str = mxArrayToString(pa);
+    std::string result(str);
+    mxFree(str);
+    return result;
+}
+
+
+int getThreads(const mxArray * params, size_t numFiles)
+{
+    double numThreads = hardwareThreads();
+    if (params != NULL) {
+        if (!mxIsStruct(params) || mxGetNumberOfElements(params) != 1) {
+            mexErrMsgIdAndTxt("dcraw:argument",
+                "The parameters must be a scalar struct.");
+        }
+        const mxArray * field = mxGetField(params, 0, "threads");
+        if (field != NULL && !mxIsEmpty(field)) {
+            if (!mxIsNumeric(field) || mxGetNumberOfElements(field) != 1 ||
+                !(mxGetScalar(field) > 0))
+            {
+                mexErrMsgIdAndTxt("dcraw:argument",
+                    "The 'threads' parameter must be a positive scalar.");
+            }
+            numThreads = mxGetScalar(field);
+        }
+    }
+    return static_cast<int>(std::max(1.0,
+        std::min(numThreads, static_cast<double>(numFiles))));
+}
+
+} // namespace
+
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+    if (nrhs < 1 || nrhs > 2) {
+        mexErrMsgIdAndTxt("dcraw:argument",
+            "Usage: info = dcrawIdentify(fname) or "
+            "[info, err] = dcrawIdentify(fnames, params)");
+    } else if (nlhs > 2 || (nlhs > 1 && !mxIsCell(prhs[0]))) {
+        mexErrMsgIdAndTxt("dcraw:argument", "Too many output arguments.");
+    } else if (nrhs == 2 && !mxIsCell(prhs[0])) {
+        mexErrMsgIdAndTxt("dcraw:argument",
+            "The parameters require a cell array of file names.");
+    }
+
+    const bool isBatch = mxIsCell(prhs[0]);
+    std::vector<std::string> files(isBatch ?
+        mxGetNumberOfElements(prhs[0]) : 1);
+    for (size_t i = 0; i != files.size(); ++i) {
+        files[i] = toString(isBatch ? mxGetCell(prhs[0], i) : prhs[0],
+                            "file name");
+    }
+    const int numThreads = getThreads(nrhs == 2 ? prhs[1] : NULL,
+                                      files.size());
+
+    std::vector<RawInfo> infos(files.size());
+    std::vector<std::string> errors(files.size());
+    identifyFiles(files, numThreads, infos, errors);
+
+    if (!isBatch) {
+        if (!errors[0].empty()) {
+            mexErrMsgIdAndTxt("dcraw:decode", "%s", errors[0].c_str());
+        }
+        const RawInfo * info = &infos[0];
+        const mwSize dims[2] = { 1, 1 };
+        plhs[0] = createInfo(&info, 2, dims);
+        return;
+    }
+
+    std::vector<const RawInfo *> found(files.size());
+    for (size_t i = 0; i != files.size(); ++i) {
+        found[i] = errors[i].empty() ? &infos[i] : NULL;
+    }
+    const mwSize numDims = mxGetNumberOfDimensions(prhs[0]);
+    const mwSize * dims = mxGetDimensions(prhs[0]);
+    plhs[0] = createInfo(found.empty() ? NULL : &found[0], numDims, dims);
+    if (nlhs > 1) {
+        plhs[1] = mxCreateCellArray(numDims, dims);
+        for (size_t i = 0; i != files.size(); ++i) {
+            mxSetCell(plhs[1], i, mxCreateString(errors[i].c_str()));
+        }
+    }
+}
@@ -0,0 +1,72 @@
+function [info, err] = dcrawIdentify(fname, params) %#ok<STOUT,INUSD>
+% Read the metadata of camera raw files with dcraw, without the pixels (MEX)
+%
+%   info        = dcrawIdentify(fname)
+%   [info, err] = dcrawIdentify(fnames, [params])
+%
+% Inputs:
+%   fname  - path to the raw file
+%   fnames - cell array of paths, read in parallel
+%   params - struct with the batch parameters, all optional
+%      threads - number of threads (default: one per core)
+%
+% Outputs:
+%   info - struct with what dcraw finds in the headers, as for
+%          "dcraw -i -v".  For a cell array of files, a struct array of
+%          the same size, with empty fields for the files that failed.
+%      make, model  - camera
+%      iso          - ISO speed
+%      shutter      - exposure time (s)
+%      aperture     - f-number
+%      focalLength  - focal length (mm)
+%      timestamp    - capture time, seconds since 1970 with the camera
+%                     clock read as UTC, as "dcraw -i -v" prints it
+%      rawSize      - [rows cols] of the raw data, masked border included
+%      size         - [rows cols] of the image
+%      colors       - number of filter colors
+%      colorDesc    - their names, e.g. 'RGB'
+%      filters      - dcraw's code for the filter pattern
+%      pattern      - the repeating filter pattern, indices into colorDesc
+%      black        - black level common to all pixels
+%      cblack       - total black level of each of dcraw's colors (1x4,
+%                     the 4th is the second green of an RGB pattern)
+%      blackPattern - black level added per position of a repeating block
+%      blackLevel   - the whole black level of each site of a block that
+%                     repeats over the image, as for dcrawMosaic
+%      maximum      - white level
+%      rgbCam       - camera to linear sRGB matrix
+%      cameraMatrix - camera to linear sRGB matrix that dcraw builds from
+%                     the file, the one "dcraw +M" uses, [] if none; see
+%                     dcrawMosaic
+%      preMul       - daylight white balance multipliers
+%      camMul       - as shot white balance multipliers, if any
+%      flip         - dcraw's rotation: 1 flips left-right, 2 flips
+%                     up-down and 4 transposes, in that order
+%   err  - cell array of error messages, '' for the files that were read.
+%          Unlike a single file, a file that fails does not stop the batch.
+%
+% Notes:
+%   The fields are those of dcrawMosaic.  Only the headers are parsed, so
+%   the black levels are those stored in the file: for the cameras whose
+%   black level dcraw measures in the masked border, dcrawMosaic returns
+%   the measured values.
+%
+%   Build the MEX file with dcrawCompile.  dcrawCatalog uses it when it
+%   exists.
+%
+% Example:
+%   info = dcrawIdentify('DSC01354.ARW');
+%
+%   files = dir(fullfile(rawDir, '*.NEF'));
+%   files = fullfile({files.folder}, {files.name});
+%   [info, err] = dcrawIdentify(files, struct('threads', 8));
+%   iso = [info(cellfun(@isempty, err)).iso];
+%
+% See also:
+%   dcrawCatalog, dcrawMosaic, dcrawCompile
+
+% (The help system uses this file, but actually doing something with it
+% will employ the mex file).
+error('dcraw:mex', 'dcrawIdentify has not been compiled.  Run dcrawCompile.');
+
+end
@@ -10,7 +10,7 @@ function rawInfo = dcrawInfo(fname)
 %   I = dcrawRead('DSC01354.ARW');
 %
 % See also:
-%   dcrawInit
+%   dcrawInit, dcrawCatalog
 %
 
 % Check inputs
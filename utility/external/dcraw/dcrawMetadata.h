@@ -0,0 +1,288 @@
+/*============================================================================
+
+ dcrawMetadata - what dcraw knows about a raw file, as a MATLAB struct
+
+ Shared by the MEX gateways, after they include dcraw.c.  RawInfo is a
+ plain copy of the DCRaw members, so that worker threads can fill it
+ in; only createInfo() uses the MATLAB API.  copyMosaic() moves the
+ pixels of load_mosaic() into a MATLAB array, also from any thread.
+
+ ============================================================================*/
+
+#ifndef DCRAW_METADATA_H
+#define DCRAW_METADATA_H
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <mex.h>
+
+
+namespace
+{
+
+struct RawInfo
+{
+    std::string make;
+    std::string model;
+    double iso;
+    double shutter;
+    double aperture;
+    double focalLength;
+    double timestamp;
+    size_t rawHeight;
+    size_t rawWidth;
+    size_t height;
+    size_t width;
+    size_t colors;
+    std::string colorDesc;
+    double filters;
+    std::vector<double> pattern;
+    size_t patternRows;
+    size_t patternCols;
+    double black;
+    double cblack[4];
+    std::vector<double> blackPattern;
+    size_t blackRows;
+    size_t blackCols;
+    std::vector<double> blackLevel;
+    size_t blackLevelRows;
+    size_t blackLevelCols;
+    double maximum;
+    double rgbCam[3][4];
+    double cameraMatrix[3][4];
+    double preMul[4];
+    double camMul[4];
+    double flip;
+};
+
+
+// The filter color of each cell of the repeating pattern, 1-based
+// indices into colorDesc, with the pattern sizes that "dcraw -i -v" prints.
+// The second green of an RGB pattern is green, as in pre_interpolate().
+void readPattern(RawInfo & info, DCRaw & dcraw)
+{
+    info.patternRows = info.patternCols = 0;
+    info.pattern.clear();
+    const unsigned filters = dcraw.filters;
+    if (filters == 0) {
+        return;
+    }
+    size_t high = 2, wide = 2;
+    if ((filters ^ (filters >> 8)) & 0xff) high = 4;
+    if ((filters ^ (filters >> 16)) & 0xffff) high = 8;
+    if (filters == 1) high = wide = 16;
+    if (filters == 9) high = wide = 6;
+
+    info.patternRows = high;
+    info.patternCols = wide;
+    info.pattern.resize(high * wide);
+    for (size_t r = 0; r != high; ++r) {
+        for (size_t c = 0; c != wide; ++c) {
+            const int color = dcraw.fcol(static_cast<int>(r),
+                                         static_cast<int>(c));
+            info.pattern[c * high + r] = 1 + (color == 3 && dcraw.colors == 3 ?
+                                              1 : color);
+        }
+    }
+}
+
+
+// The whole black level of each site of the block that repeats both the
+// filter pattern and the black pattern: cblack of the site's color, which
+// includes black, plus the blackPattern entry, as scale_colors() subtracts
+// them. Needs the cblack fields of info.
+void readBlackLevel(RawInfo & info, DCRaw & dcraw)
+{
+    const size_t patternRows = std::max<size_t>(info.patternRows, 1);
+    const size_t patternCols = std::max<size_t>(info.patternCols, 1);
+    const bool hasPattern = info.blackRows != 0 && info.blackCols != 0;
+    size_t high = patternRows, wide = patternCols;
+    while (hasPattern && high % info.blackRows != 0) high += patternRows;
+    while (hasPattern && wide % info.blackCols != 0) wide += patternCols;
+
+    info.blackLevelRows = high;
+    info.blackLevelCols = wide;
+    info.blackLevel.resize(high * wide);
+    for (size_t r = 0; r != high; ++r) {
+        for (size_t c = 0; c != wide; ++c) {
+            const int color = dcraw.filters == 0 ? 0 :
+                dcraw.fcol(static_cast<int>(r), static_cast<int>(c));
+            double black = info.cblack[color];
+            if (hasPattern) {
+                black += info.blackPattern[(c % info.blackCols) *
+                    info.blackRows + r % info.blackRows];
+            }
+            info.blackLevel[c * high + r] = black;
+        }
+    }
+}
+
+
+// Copy what identify() and load_raw() found. No MATLAB API here, this
+// may run in the workers.
+void readInfo(RawInfo & info, DCRaw & dcraw)
+{
+    info.make = dcraw.make;
+    info.model = dcraw.model;
+    info.iso = dcraw.iso_speed;
+    info.shutter = dcraw.shutter;
+    info.aperture = dcraw.aperture;
+    info.focalLength = dcraw.focal_len;
+    info.timestamp = static_cast<double>(dcraw.timestamp);
+    info.rawHeight = dcraw.raw_height;
+    info.rawWidth = dcraw.raw_width;
+    info.height = dcraw.height;
+    info.width = dcraw.width;
+    info.colors = dcraw.colors;
+    info.colorDesc.assign(dcraw.cdesc, info.colors);
+    info.filters = dcraw.filters;
+    readPattern(info, dcraw);
+
+    info.black = dcraw.black;
+    for (int c = 0; c != 4; ++c) {
+        info.cblack[c] = dcraw.cblack[c];
+    }
+    info.blackRows = dcraw.cblack[4];
+    info.blackCols = dcraw.cblack[5];
+    info.blackPattern.resize(info.blackRows * info.blackCols);
+    for (size_t r = 0; r != info.blackRows; ++r) {
+        for (size_t c = 0; c != info.blackCols; ++c) {
+            info.blackPattern[c * info.blackRows + r] =
+                dcraw.cblack[6 + r * info.blackCols + c];
+        }
+    }
+    readBlackLevel(info, dcraw);
+    info.maximum = dcraw.maximum;
+
+    for (int r = 0; r != 3; ++r) {
+        for (int c = 0; c != 4; ++c) {
+            info.rgbCam[r][c] = dcraw.rgb_cam[r][c];
+            info.cameraMatrix[r][c] = dcraw.cmatrix[r][c];
+        }
+    }
+    for (int c = 0; c != 4; ++c) {
+        info.preMul[c] = dcraw.pre_mul[c];
+        info.camMul[c] = dcraw.cam_mul[c];
+    }
+    info.flip = dcraw.flip;
+}
+
+
+// Copy the visible part of the row-major raw_image into a column-major array
+void copyMosaic(unsigned short * dest, const DCRaw & dcraw)
+{
+    const size_t rows = dcraw.height;
+    const size_t cols = dcraw.width;
+    const size_t TILE = 64;
+    for (size_t r0 = 0; r0 < rows; r0 += TILE) {
+        const size_t r1 = std::min(rows, r0 + TILE);
+        for (size_t c = 0; c != cols; ++c) {
+            const ushort * in = dcraw.raw_image +
+                (r0 + dcraw.top_margin) * dcraw.raw_width +
+                c + dcraw.left_margin;
+            unsigned short * out = dest + c * rows;
+            for (size_t r = r0; r != r1; ++r, in += dcraw.raw_width) {
+                out[r] = *in;
+            }
+        }
+    }
+}
+
+
+mxArray * createMatrix(const double * values, size_t rows, size_t cols,
+                       size_t stride)
+{
+    mxArray * result = mxCreateDoubleMatrix(rows, cols, mxREAL);
+    double * out = mxGetPr(result);
+    for (size_t r = 0; r != rows; ++r) {
+        for (size_t c = 0; c != cols; ++c) {
+            out[c * rows + r] = values[r * stride + c];
+        }
+    }
+    return result;
+}
+
+
+mxArray * createColumnMajor(const std::vector<double> & values, size_t rows,
+                            size_t cols)
+{
+    mxArray * result = mxCreateDoubleMatrix(values.empty() ? 0 : rows,
+        values.empty() ? 0 : cols, mxREAL);
+    std::copy(values.begin(), values.end(), mxGetPr(result));
+    return result;
+}
+
+
+const char * const infoFields[] = {
+    "make", "model", "iso", "shutter", "aperture", "focalLength",
+    "timestamp", "rawSize", "size", "colors", "colorDesc", "filters",
+    "pattern", "black", "cblack", "blackPattern", "blackLevel", "maximum",
+    "rgbCam", "cameraMatrix", "preMul", "camMul", "flip"
+};
+
+
+// A struct array of the given size. The elements whose info is NULL, the
+// files that could not be read, have empty fields.
+mxArray * createInfo(const RawInfo * const * infos, mwSize numDims,
+                     const mwSize * dims)
+{
+    const int numFields = sizeof(infoFields) / sizeof(infoFields[0]);
+    mxArray * result = mxCreateStructArray(numDims, dims, numFields,
+        const_cast<const char **>(infoFields));
+
+    const size_t count = mxGetNumberOfElements(result);
+    for (size_t i = 0; i != count; ++i) {
+        if (infos[i] == NULL) {
+            continue;
+        }
+        const RawInfo & info = *infos[i];
+        const double rawSize[2] = { static_cast<double>(info.rawHeight),
+                                    static_cast<double>(info.rawWidth) };
+        const double size[2] = { static_cast<double>(info.height),
+                                 static_cast<double>(info.width) };
+        const bool hasMatrix = info.cameraMatrix[0][0] != 0;
+
+        mxSetField(result, i, "make", mxCreateString(info.make.c_str()));
+        mxSetField(result, i, "model", mxCreateString(info.model.c_str()));
+        mxSetField(result, i, "iso", mxCreateDoubleScalar(info.iso));
+        mxSetField(result, i, "shutter", mxCreateDoubleScalar(info.shutter));
+        mxSetField(result, i, "aperture",
+            mxCreateDoubleScalar(info.aperture));
+        mxSetField(result, i, "focalLength",
+            mxCreateDoubleScalar(info.focalLength));
+        mxSetField(result, i, "timestamp",
+            mxCreateDoubleScalar(info.timestamp));
+        mxSetField(result, i, "rawSize", createMatrix(rawSize, 1, 2, 2));
+        mxSetField(result, i, "size", createMatrix(size, 1, 2, 2));
+        mxSetField(result, i, "colors",
+            mxCreateDoubleScalar(static_cast<double>(info.colors)));
+        mxSetField(result, i, "colorDesc",
+            mxCreateString(info.colorDesc.c_str()));
+        mxSetField(result, i, "filters", mxCreateDoubleScalar(info.filters));
+        mxSetField(result, i, "pattern", createColumnMajor(info.pattern,
+            info.patternRows, info.patternCols));
+        mxSetField(result, i, "black", mxCreateDoubleScalar(info.black));
+        mxSetField(result, i, "cblack", createMatrix(info.cblack, 1, 4, 4));
+        mxSetField(result, i, "blackPattern", createColumnMajor(
+            info.blackPattern, info.blackRows, info.blackCols));
+        mxSetField(result, i, "blackLevel", createColumnMajor(
+            info.blackLevel, info.blackLevelRows, info.blackLevelCols));
+        mxSetField(result, i, "maximum", mxCreateDoubleScalar(info.maximum));
+        mxSetField(result, i, "rgbCam",
+            createMatrix(info.rgbCam[0], 3, info.colors, 4));
+        mxSetField(result, i, "cameraMatrix", hasMatrix ?
+            createMatrix(info.cameraMatrix[0], 3, info.colors, 4) :
+            mxCreateDoubleMatrix(0, 0, mxREAL));
+        mxSetField(result, i, "preMul",
+            createMatrix(info.preMul, 1, info.colors, 4));
+        mxSetField(result, i, "camMul", createMatrix(info.camMul, 1, 4, 4));
+        mxSetField(result, i, "flip", mxCreateDoubleScalar(info.flip));
+    }
+    return result;
+}
+
+} // namespace
+
+#endif // DCRAW_METADATA_H
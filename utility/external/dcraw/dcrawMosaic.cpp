@@ -0,0 +1,72 @@
+/*============================================================================
+
+ dcrawMosaic - read the color filter mosaic of a camera raw file
+
+ MEX gateway around DCRaw::load_mosaic() in dcraw.c.  The file is
+ unpacked and its masked pixels measured, and that is all: there is no
+ scaling, interpolation, color conversion or output formatting.  The
+ black levels, white level, filter pattern and color matrices that
+ dcraw found come back in a struct, so that a sensor can be built from
+ the mosaic without a second pass over the header.
+
+ Build with dcrawCompile.
+
+ ============================================================================*/
+
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+#include <mex.h>
+
+#define DCRAW_LIBRARY
+#include "dcraw.c"
+#include "dcrawMetadata.h"
+
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+    if (nrhs != 1 || !mxIsChar(prhs[0])) {
+        mexErrMsgIdAndTxt("dcraw:argument",
+            "Usage: [mosaic, info] = dcrawMosaic(fname)");
+    } else if (nlhs > 2) {
+        mexErrMsgIdAndTxt("dcraw:argument", "Too many output arguments.");
+    }
+
+    char * str = mxArrayToString(prhs[0]);
+    const std::string fname(str);
+    mxFree(str);
+
+    DCRaw * dcraw = new DCRaw();
+    const int status = dcraw->load_mosaic(fname.c_str());
+    const int openError = errno;
+    std::string error;
+    const bool noMosaic = status == 0 && dcraw->is_raw;
+    if (status < 0) {
+        error = "Cannot open \"" + fname + "\": " + strerror(openError) + ".";
+    } else if (noMosaic) {
+        error = "\"" + fname + "\" does not hold a color filter mosaic.";
+    } else if (status == 0) {
+        error = "\"" + fname + "\" is not a raw file that dcraw can decode.";
+    } else {
+        const mwSize dims[2] = { dcraw->height, dcraw->width };
+        plhs[0] = mxCreateNumericArray(2, dims, mxUINT16_CLASS, mxREAL);
+        copyMosaic(static_cast<unsigned short *>(mxGetData(plhs[0])), *dcraw);
+        if (nlhs > 1) {
+            RawInfo info;
+            readInfo(info, *dcraw);
+            const RawInfo * infos[1] = { &info };
+            const mwSize dims[2] = { 1, 1 };
+            plhs[1] = createInfo(infos, 2, dims);
+        }
+    }
+    free(dcraw->raw_image);
+    delete dcraw;
+
+    if (!error.empty()) {
+        mexErrMsgIdAndTxt(noMosaic ? "dcraw:mosaic" : "dcraw:decode", "%s",
+                          error.c_str());
+    }
+}
@@ -0,0 +1,75 @@
+function [mosaic, info] = dcrawMosaic(fname) %#ok<STOUT,INUSD>
+% Read the color filter mosaic of a camera raw file with dcraw (MEX)
+%
+%   [mosaic, info] = dcrawMosaic(fname)
+%
+% Inputs:
+%   fname - path to the raw file
+%
+% Outputs:
+%   mosaic - the sensor values as a uint16 height x width array, with the
+%            masked border removed.  There is no black subtraction,
+%            scaling or interpolation, and the image is not rotated to
+%            the camera orientation (see info.flip).
+%   info   - struct with what dcraw knows about the mosaic
+%      make, model  - camera
+%      iso, shutter, aperture, focalLength, timestamp - exposure, as
+%                     for dcrawIdentify
+%      rawSize      - [rows cols] of the raw data, masked border included
+%      size         - [rows cols] of the mosaic
+%      colors       - number of filter colors
+%      colorDesc    - their names, e.g. 'RGB'
+%      filters      - dcraw's code for the filter pattern
+%      pattern      - the repeating filter pattern, indices into colorDesc
+%                     ([1 2; 2 3] is RGGB)
+%      black        - black level common to all pixels
+%      cblack       - total black level of each of dcraw's colors (1x4,
+%                     the 4th is the second green of an RGB pattern)
+%      blackPattern - black level added per position of a repeating
+%                     block, [] if there is none
+%      blackLevel   - the whole black level of each site of a block that
+%                     repeats over the mosaic: cblack of its color plus
+%                     its blackPattern entry.  The block is pattern, or a
+%                     multiple of it that blackPattern also repeats in.
+%      maximum      - white level
+%      rgbCam       - camera to linear sRGB matrix
+%      cameraMatrix - camera to linear sRGB matrix that dcraw builds from
+%                     the file, the one "dcraw +M" uses, [] if none.  For
+%                     a DNG it comes from the ColorMatrix, CameraCalibration
+%                     and AnalogBalance tags, for other cameras from the
+%                     maker notes.  It is 3 x colors, and for a DNG its rows
+%                     are normalized so that camera white maps to sRGB
+%                     white.  It is not the XYZ to camera ColorMatrix tag
+%                     (see dcrawDNGRead for that).
+%      preMul       - daylight white balance multipliers
+%      camMul       - as shot white balance multipliers, if any
+%      flip         - dcraw's rotation: 1 flips left-right, 2 flips
+%                     up-down and 4 transposes, in that order
+%
+% Notes:
+%   Only the raw data is unpacked, so this is the fastest way to get a
+%   mosaic out of a raw file.  The values are those of
+%   "dcraw -D -4 -t 0" run where there is no .badpixels file: dead
+%   pixels listed in one are not repaired, and the gain correction of
+%   the Canon PowerShot 600 is not applied.  Zero pixels are filled in
+%   from their neighbours for the cameras where dcraw does so.  Files
+%   without a plain mosaic (linear DNG, Foveon, Fuji SuperCCD) are
+%   rejected with the error identifier 'dcraw:mosaic'; use dcrawRead for
+%   those.
+%
+%   Build the MEX file with dcrawCompile.
+%
+% Example:
+%   [mosaic, info] = dcrawMosaic('DSC01354.ARW');
+%   black = repmat(info.blackLevel, ceil(size(mosaic)./size(info.blackLevel)));
+%   mosaic = double(mosaic) - black(1:size(mosaic,1), 1:size(mosaic,2));
+%
+% See also:
+%   dcrawRead, dcrawDecode, dcrawIdentify, dcrawDNGRead, dcrawCompile,
+%   ieDNGRead
+
+% (The help system uses this file, but actually doing something with it
+% will employ the mex file).
+error('dcraw:mex', 'dcrawMosaic has not been compiled.  Run dcrawCompile.');
+
+end
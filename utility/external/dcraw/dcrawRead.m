@@ -26,9 +26,12 @@ function [I, map] = dcrawRead(fname, opts, varargin)
 %   2) By dcrawInit, this function is called by imread. For loading images
 %      specifying url, the image format field is required. Otherwise
 %      MATLAB will treat ARW file as TIFF and decoding will fail.
+%   3) When the dcrawDecode MEX file has been built (dcrawCompile), the
+%      file is decoded in-process. Otherwise the dcraw executable for this
+%      platform writes a temporary file that is read back.
 %
 % See also:
-%   dcrawInit
+%   dcrawInit, dcrawDecode, dcrawCompile
 %
 % HJ, VISTA TEAM, 2015
 
@@ -36,6 +39,13 @@ function [I, map] = dcrawRead(fname, opts, varargin)
 if notDefined('fname'), error('file name required'); end
 if exist(fname, 'file') ~= 2, error('file not exist'); end
 if notDefined('opts'), opts = '-o 0 -D -c -4'; end
+map = [];
+
+% Decode in-process when the MEX file is available
+if exist('dcrawDecode', 'file') == 3
+    I = dcrawDecode(fname, opts);
+    return;
+end
 
 % Decode file
 if ismac
@@ -55,7 +65,6 @@ if s ~= 0, error(msg); end
 
 % Load file
 I = imread(fout);
-map = [];
 
 % Clean up
 delete(fout);
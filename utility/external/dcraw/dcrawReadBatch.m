@@ -0,0 +1,85 @@
+function [imgs, errs] = dcrawReadBatch(fnames, varargin)
+% Load a list of raw images, decoding them in parallel
+%
+% Synopsis
+%   [imgs, errs] = dcrawReadBatch(fnames, varargin)
+%
+% Inputs
+%   fnames - cell array with the paths of the raw files
+%
+% Optional key/val pairs
+%   opts     - dcraw options, as for dcrawRead (default '-o 0 -D -c -4')
+%   threads  - number of decoder threads (default: one per core)
+%   memory   - bytes that the decodes in flight may use (default 4 GB)
+%   callback - function handle, called as callback(ii, img, err) for each
+%              file in order.  The images are then not returned, so that
+%              a long calibration sweep need not fit in memory.
+%
+% Returns
+%   imgs - cell array with the images, as dcrawRead returns them.  The
+%          entries of the files that could not be read are [].
+%   errs - cell array with the error messages, '' for the files that were
+%          read.  A file that fails does not stop the others.
+%
+% Description
+%   The files are decoded by dcrawDecode with a pool of threads, so the
+%   whole batch costs about as much as its slowest files instead of the
+%   sum of all of them.  Without the MEX file (see dcrawCompile) the files
+%   are read one at a time with dcrawRead.
+%
+% See also
+%   dcrawRead, dcrawDecode, dcrawCompile
+
+% Examples:
+%{
+  fnames = {'DSC01354.ARW', 'DSC01355.ARW', 'DSC01356.ARW'};
+  [imgs, errs] = dcrawReadBatch(fnames, 'threads', 2);
+%}
+%{
+  % Mean level of each exposure, without keeping the images
+  fnames = {'DSC01354.ARW', 'DSC01355.ARW', 'DSC01356.ARW'};
+  dcrawReadBatch(fnames, 'callback', @(ii,img,err) disp(mean(img(:))));
+%}
+
+%% Parse inputs
+varargin = ieParamFormat(varargin);
+p = inputParser;
+
+p.addRequired('fnames', @iscellstr);
+p.addParameter('opts', '-o 0 -D -c -4', @ischar);
+p.addParameter('threads', [], @(x)(isempty(x) || (isscalar(x) && x > 0)));
+p.addParameter('memory', [], @(x)(isempty(x) || (isscalar(x) && x > 0)));
+p.addParameter('callback', [], ...
+    @(x)(isempty(x) || isa(x, 'function_handle')));
+
+p.parse(fnames, varargin{:});
+
+opts     = p.Results.opts;
+callback = p.Results.callback;
+
+%% Decode in-process when the MEX file is available
+if exist('dcrawDecode', 'file') == 3
+    params = struct('threads', p.Results.threads, ...
+        'memory', p.Results.memory, 'callback', callback);
+    [imgs, errs] = dcrawDecode(fnames, opts, params);
+    return;
+end
+
+%% Otherwise one file at a time
+imgs = cell(size(fnames));
+errs = repmat({''}, size(fnames));
+for ii = 1:numel(fnames)
+    img = [];
+    try
+        img = dcrawRead(fnames{ii}, opts);
+    catch err
+        errs{ii} = err.message;
+    end
+    if isempty(callback)
+        imgs{ii} = img;
+    else
+        callback(ii, img, errs{ii});
+    end
+end
+
+end
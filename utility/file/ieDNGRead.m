@@ -16,10 +16,12 @@ function [img,info] = ieDNGRead(fname,varargin)
 % Returns
 %   img:  Image data mosaic, or if rgb flag is set an RGB file
 %   info: The header information.  I am unsure whether exposure time is in
-%         seconds, I think.
+%         seconds, I think.  This is the imfinfo struct.  When
+%         dcrawDNGRead is compiled, the simple info comes from its DNG
+%         tags instead, read in the same pass as the mosaic.
 %
 % See also
-%   sensorDNGRead, dcrawRead
+%   sensorDNGRead, dcrawDNGRead, dcrawRead, dcrawMosaic
 
 % Examples:
 %{
@@ -52,55 +54,71 @@ onlyInfo   = p.Results.onlyinfo;
 simpleInfo = p.Results.simpleinfo;
 rgbflag    = p.Results.rgb;
 
-%% Read the info with imfinfo (Matlab)
+% dcraw needs a full path name, often.
+fullFile = which(fname);
+if isempty(fullFile)
+    error('Cannot find file %s',fname);
+end
 
-% The user may want only the simple info or all the info.  Over time we may
-% expand what is in the simple info struct.
-allInfo = imfinfo(fname);
+%% Read the tags and the mosaic in one pass with dcraw
 
-if simpleInfo
-    % Pull out a few fields. We are aware of two types of info structs at
-    % present.  More may appear over time.
-    if checkfields(allInfo,'DigitalCamera')
-        % For camera app on the Google Pixel 4a
-        infoSimple.isoSpeed     = allInfo.DigitalCamera.ISOSpeedRatings;
-        infoSimple.exposureTime = allInfo.DigitalCamera.ExposureTime;
-        infoSimple.blackLevel   = allInfo.SubIFDs{1}.BlackLevel;
-        infoSimple.orientation  = allInfo.Orientation;
-    else
-        % For openCam files
-        infoSimple.isoSpeed     = allInfo.ISOSpeedRatings;
-        infoSimple.exposureTime = allInfo.ExposureTime;
-        infoSimple.blackLevel   = allInfo.BlackLevel;
-        infoSimple.orientation  = allInfo.Orientation;
+% The DNG tags come back under the same names as in the imfinfo struct of
+% openCam files, so ieDNGSimpleInfo reads either one.  A DNG without a
+% mosaic (linear DNG) goes through dcrawRead, below.
+tags = [];
+if ~rgbflag && (simpleInfo || ~onlyInfo) && exist('dcrawDNGRead', 'file') == 3
+    try
+        [img, tags, mosaicInfo] = dcrawDNGRead(fullFile, ...
+            struct('pixels', ~onlyInfo));
+        % Rotate the mosaic as dcraw -D does
+        if bitand(mosaicInfo.flip, 2), img = flipud(img); end
+        if bitand(mosaicInfo.flip, 1), img = fliplr(img); end
+        if bitand(mosaicInfo.flip, 4), img = img.'; end
+    catch err
+        if ~strcmp(err.identifier, 'dcraw:mosaic'), rethrow(err); end
     end
-    info = infoSimple;
-else
-    info = allInfo;
 end
 
-%%  Return the img data too
-
+%% Otherwise read the image with Matlab or dcraw
 if onlyInfo
     img = [];
-    return;
-else
-    % dcraw needs a full path name, often.
-    fullFile = which(fname); 
-    if isempty(fullFile)
-        error('Cannot find file %s',fname);
-    end
-
-    if rgbflag       
+elseif isempty(tags)
+    if rgbflag
         img = imread(fullFile);
     else
-        % Raw mosaic will be returned.  This is the default.
-        % If the file name has spaces in it, dcrawRead gets unhappy.
-        % Test for that.  Then fix it.
-        img = dcrawRead(fullFile);
+        % Unpack only the mosaic, then rotate it as dcraw -D does.  A DNG
+        % without a mosaic (linear DNG) goes through dcrawRead.
+        haveMosaic = false;
+        if exist('dcrawMosaic', 'file') == 3
+            try
+                [img, mosaicInfo] = dcrawMosaic(fullFile);
+                if bitand(mosaicInfo.flip, 2), img = flipud(img); end
+                if bitand(mosaicInfo.flip, 1), img = fliplr(img); end
+                if bitand(mosaicInfo.flip, 4), img = img.'; end
+                haveMosaic = true;
+            catch err
+                if ~strcmp(err.identifier, 'dcraw:mosaic'), rethrow(err); end
+            end
+        end
+        if ~haveMosaic
+            % Raw mosaic will be returned.  This is the default.
+            % If the file name has spaces in it, dcrawRead gets unhappy.
+            % Test for that.  Then fix it.
+            img = dcrawRead(fullFile);
+        end
     end
 end
 
+% The user may want only the simple info or all the info.  Over time we may
+% expand what is in the simple info struct.
+if ~simpleInfo
+    info = imfinfo(fname);
+elseif ~isempty(tags)
+    info = ieDNGSimpleInfo(tags);
+else
+    info = ieDNGSimpleInfo(imfinfo(fname));
+end
+
 
 % Depending on the orientation, should we rotate the data?
 %{
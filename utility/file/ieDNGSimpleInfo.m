@@ -7,14 +7,14 @@ function infoSimple = ieDNGSimpleInfo(info)
 % Inputs
 %    info:  This is the header info from a DNG file.  It can take
 %           different formats, depending on the app that wrote the DNG
-%           file.
+%           file, or it is the tags struct of dcrawDNGRead.
 %
 % Outputs
 %    infoSimple:  ISETCam formatted info.  Much shorter.  May evolve over
 %                 time.
 %
 % See also
-%  ieDNGRead
+%  ieDNGRead, dcrawDNGRead
 %
 
 % Example:
@@ -33,7 +33,7 @@ if checkfields(info,'DigitalCamera')
     infoSimple.blackLevel   = info.SubIFDs{1}.BlackLevel;
     infoSimple.orientation  = info.Orientation;
 else
-    % For openCam files
+    % For openCam files, and the tags of dcrawDNGRead
     infoSimple.isoSpeed     = info.ISOSpeedRatings;
     infoSimple.exposureTime = info.ExposureTime;
     infoSimple.blackLevel   = info.BlackLevel;